@@ -0,0 +1,729 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <unistd.h>
+
+#include "gen.h"
+
+#include <ncrunch/ncrunch.h>
+#include <ncrunch/stats.h>
+#include <ncrunch/games.h>
+#include <ncrunch/alias.h>
+#include <ncrunch/h2h.h>
+#include <ncrunch/rating.h>
+#include <ncrunch/whatif.h>
+#include <ncrunch/reorder.h>
+
+/* the flatf line and token helpers, timed on their own */
+#include "../src/flatf_internal.h"
+
+
+
+#define BENCH_DEFAULT_TEAMS 10000
+#define BENCH_ROUNDS        5
+#define BENCH_SCENARIOS     1024
+
+
+
+/**
+ * The synthetic flatf and the pieces of it the microbenchmarks work on
+ */
+
+struct bench_data {
+	char path[FILENAME_MAX];
+	char games_path[FILENAME_MAX];
+	size_t num_lines;	/* data rows, not counting the heading */
+	char **lines;
+	size_t num_tokens;
+	char **tokens;
+	char **names;
+	struct ncrunch_ctx *ctx;	/* the flatf, loaded */
+	struct alias alias;		/* ctx's names */
+	struct games games;		/* the game log, read for ctx */
+	struct h2h h2h;
+	struct rating colley;		/* base solve for the what-if benches */
+	const char *reorder;		/* reorder_method name for -O; NULL for none */
+};
+
+
+/**
+ * One microbenchmark; returns the number of items it processed and adds
+ * something derived from its results to *sum so that the work is not
+ * optimized away
+ */
+
+struct bench {
+	const char *name;
+	size_t (*run)(struct bench_data *d, double *sum);
+	int games;	/* needs the game log; only run when named */
+};
+
+
+static double _now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static size_t _run_read_line(struct bench_data *d, double *sum)
+{
+	char buf[FLATF_READBUFSIZE];
+	size_t lines = 0;
+	size_t count;
+	int fd;
+
+	fd = flatf_open_file(d->path);
+	if (fd < 0)
+		return 0;
+
+	while ((count = flatf_read_line(fd, buf))) {
+		*sum += count;
+		lines++;
+	}
+
+	close(fd);
+	return lines;
+}
+
+
+static size_t _run_tokenize_line(struct bench_data *d, double *sum)
+{
+	char buf[FLATF_READBUFSIZE];
+	struct tokenlist list;
+	size_t i;
+
+	for (i = 0; i < d->num_lines; i++) {
+		strcpy(buf, d->lines[i]);
+		*sum += flatf_tokenize_line(buf, &list);
+		flatf_deallocate_tokens(&list);
+	}
+
+	return d->num_lines;
+}
+
+
+static size_t _run_is_alpha(struct bench_data *d, double *sum)
+{
+	size_t i;
+
+	for (i = 0; i < d->num_tokens; i++)
+		*sum += flatf_is_alpha(d->tokens[i]);
+
+	return d->num_tokens;
+}
+
+
+static size_t _run_is_numeric(struct bench_data *d, double *sum)
+{
+	size_t i;
+
+	for (i = 0; i < d->num_tokens; i++)
+		*sum += flatf_is_numeric(d->tokens[i]);
+
+	return d->num_tokens;
+}
+
+
+static size_t _run_atof(struct bench_data *d, double *sum)
+{
+	size_t i;
+
+	for (i = 0; i < d->num_tokens; i++)
+		*sum += atof(d->tokens[i]);
+
+	return d->num_tokens;
+}
+
+
+static size_t _run_hash_stringi(struct bench_data *d, double *sum)
+{
+	struct mdigest digest;
+	size_t i;
+
+	for (i = 0; i < d->num_lines; i++) {
+		hash_stringi(d->names[i], &digest);
+		*sum += digest.md[0];
+	}
+
+	return d->num_lines;
+}
+
+
+static size_t _run_alias_resolve(struct bench_data *d, double *sum)
+{
+	size_t i;
+
+	for (i = 0; i < d->num_lines; i++)
+		*sum += alias_resolve(&d->alias, d->names[i]);
+
+	return d->num_lines;
+}
+
+
+static size_t _run_team_create(struct bench_data *d, double *sum)
+{
+	struct ncrunch_ctx *ctx;
+	size_t i;
+
+	ctx = ncrunch_ctx_create();
+	if (!ctx)
+		return 0;
+
+	tfl_create(ctx, tfl_num_fields(d->ctx));
+
+	for (i = 0; i < d->num_lines; i++)
+		*sum += team_create(ctx);
+
+	ncrunch_ctx_destroy(ctx);
+	return d->num_lines;
+}
+
+
+static size_t _load_flatf(struct bench_data *d, double *sum, struct ncrunch_stats *stats, const char **fields,
+	size_t num_fields)
+{
+	struct ncrunch_ctx *ctx;
+	size_t num_teams;
+
+	ctx = ncrunch_ctx_create();
+	if (!ctx)
+		return 0;
+
+	ncrunch_ctx_set_stats(ctx, stats);
+	flatf_set_fields(ctx, fields, num_fields);
+
+	if (flatf_read(ctx, d->path) < 0) {
+		ncrunch_ctx_destroy(ctx);
+		return 0;
+	}
+
+	num_teams = teams_num_teams(ctx);
+	*sum += num_teams;
+
+	ncrunch_ctx_destroy(ctx);
+	return num_teams;
+}
+
+
+static size_t _run_flatf_read(struct bench_data *d, double *sum)
+{
+	return _load_flatf(d, sum, NULL, NULL, 0);
+}
+
+
+/**
+ * flatf_read() of just the field rank_field ranks by
+ */
+
+static size_t _run_flatf_read_fields(struct bench_data *d, double *sum)
+{
+	static const char *fields[] = { "wins" };
+
+	return _load_flatf(d, sum, NULL, fields, 1);
+}
+
+
+/**
+ * flatf_write() of the loaded flatf, next to it
+ */
+
+static size_t _run_flatf_write(struct bench_data *d, double *sum)
+{
+	char path[FILENAME_MAX + 8];
+
+	snprintf(path, sizeof(path), "%s.out", d->path);
+
+	if (flatf_write(d->ctx, path) < 0)
+		return 0;
+
+	unlink(path);
+	*sum += teams_num_teams(d->ctx);
+	return teams_num_teams(d->ctx);
+}
+
+
+/**
+ * flatf_read() with the -t instrumentation turned on, to show its overhead
+ */
+
+static size_t _run_flatf_read_stats(struct bench_data *d, double *sum)
+{
+	struct ncrunch_stats stats;
+
+	memset(&stats, 0, sizeof(struct ncrunch_stats));
+	return _load_flatf(d, sum, &stats, NULL, 0);
+}
+
+
+/**
+ * Scans a small integer column out into doubles
+ */
+
+static size_t _run_get_column(struct bench_data *d, double *sum)
+{
+	size_t num_teams = teams_num_teams(d->ctx);
+	double *column;
+	size_t field;
+	size_t i;
+
+	if (tfl_find(d->ctx, "wins", &field) < 0)
+		return 0;
+
+	column = malloc(num_teams * sizeof(double));
+	if (!column || teams_get_column(d->ctx, field, column) < 0) {
+		free(column);
+		return 0;
+	}
+
+	for (i = 0; i < num_teams; i++)
+		*sum += column[i];
+
+	free(column);
+	return num_teams;
+}
+
+
+static size_t _run_rank_field(struct bench_data *d, double *sum)
+{
+	size_t num_teams = teams_num_teams(d->ctx);
+	size_t *order;
+	size_t field;
+
+	if (tfl_find(d->ctx, "wins", &field) < 0)
+		return 0;
+
+	order = malloc(num_teams * sizeof(size_t));
+	if (!order || rank_by_field(d->ctx, field, order) < 0) {
+		free(order);
+		return 0;
+	}
+
+	*sum += order[0];
+	free(order);
+	return num_teams;
+}
+
+
+static size_t _run_h2h_build(struct bench_data *d, double *sum)
+{
+	struct h2h h2h;
+	size_t num_teams = teams_num_teams(d->ctx);
+
+	if (h2h_build(&h2h, &d->games, num_teams) < 0)
+		return 0;
+
+	*sum += h2h_common(&h2h, 0, num_teams - 1);
+	h2h_free(&h2h);
+
+	return num_teams;
+}
+
+
+/**
+ * rank_field with ties broken head-to-head; "wins" has plenty of ties
+ */
+
+static size_t _run_rank_h2h(struct bench_data *d, double *sum)
+{
+	size_t num_teams = teams_num_teams(d->ctx);
+	size_t *order;
+	size_t field;
+
+	if (tfl_find(d->ctx, "wins", &field) < 0)
+		return 0;
+
+	if (!d->h2h.num_teams && h2h_build(&d->h2h, &d->games, num_teams) < 0)
+		return 0;
+
+	order = malloc(num_teams * sizeof(size_t));
+	if (!order || rank_by_field_h2h(d->ctx, field, &d->h2h, order) < 0) {
+		free(order);
+		return 0;
+	}
+
+	*sum += order[0];
+	free(order);
+	return num_teams;
+}
+
+
+/**
+ * A conjugate gradient solve, which passes over the game list every
+ * iteration; the bench most sensitive to how team ids are ordered (-O)
+ */
+
+static size_t _run_massey(struct bench_data *d, double *sum)
+{
+	size_t num_teams = teams_num_teams(d->ctx);
+	double *ratings;
+	int iterations;
+
+	ratings = malloc(num_teams * sizeof(double));
+	if (!ratings)
+		return 0;
+
+	iterations = rating_mode_solve(rating_mode_find("massey"), &d->games, num_teams, ratings);
+	if (iterations < 0) {
+		free(ratings);
+		return 0;
+	}
+
+	*sum += ratings[0] + iterations;
+	free(ratings);
+	return num_teams;
+}
+
+
+static size_t _run_colley(struct bench_data *d, double *sum)
+{
+	struct rating rating;
+	size_t num_teams = teams_num_teams(d->ctx);
+
+	if (rating_colley(&rating, &d->games, num_teams) < 0)
+		return 0;
+
+	*sum += rating.ratings[0];
+	rating_free(&rating);
+
+	return num_teams;
+}
+
+
+/**
+ * One extra game per scenario against the base solve; compare the time per
+ * scenario with a whole colley run
+ */
+
+static size_t _run_whatif(struct bench_data *d, double *sum)
+{
+	size_t num_teams = teams_num_teams(d->ctx);
+	struct whatif *scenarios;
+	struct game *games;
+	double *ratings;
+	size_t i;
+
+	if (!d->colley.num_teams && rating_colley(&d->colley, &d->games, num_teams) < 0)
+		return 0;
+
+	scenarios = calloc(BENCH_SCENARIOS, sizeof(struct whatif));
+	games = calloc(BENCH_SCENARIOS, sizeof(struct game));
+	ratings = malloc(BENCH_SCENARIOS * num_teams * sizeof(double));
+
+	if (!scenarios || !games || !ratings) {
+		free(scenarios);
+		free(games);
+		free(ratings);
+		return 0;
+	}
+
+	for (i = 0; i < BENCH_SCENARIOS; i++) {
+		games[i].home = i % num_teams;
+		games[i].away = (i * 7 + 1) % num_teams;
+		games[i].home_score = 1;
+		if (games[i].home == games[i].away)
+			games[i].away = (games[i].away + 1) % num_teams;
+
+		scenarios[i].games = &games[i];
+		scenarios[i].num_games = 1;
+		scenarios[i].ratings = &ratings[i * num_teams];
+	}
+
+	if (whatif_run(&d->colley, scenarios, BENCH_SCENARIOS, 0) != 0)
+		num_teams = 0;
+	else
+		*sum += ratings[(BENCH_SCENARIOS - 1) * num_teams];
+
+	free(scenarios);
+	free(games);
+	free(ratings);
+
+	return num_teams ? BENCH_SCENARIOS : 0;
+}
+
+
+static const struct bench benches[] = {
+	{ "read_line",		_run_read_line },
+	{ "tokenize_line",	_run_tokenize_line },
+	{ "is_alpha",		_run_is_alpha },
+	{ "is_numeric",		_run_is_numeric },
+	{ "atof",		_run_atof },
+	{ "hash_stringi",	_run_hash_stringi },
+	{ "alias_resolve",	_run_alias_resolve },
+	{ "team_create",	_run_team_create },
+	{ "flatf_read",		_run_flatf_read },
+	{ "flatf_read_fields",	_run_flatf_read_fields },
+	{ "flatf_read_stats",	_run_flatf_read_stats },
+	{ "flatf_write",	_run_flatf_write },
+	{ "get_column",		_run_get_column },
+	{ "rank_field",		_run_rank_field },
+	{ "h2h_build",		_run_h2h_build,	1 },
+	{ "rank_h2h",		_run_rank_h2h,	1 },
+	{ "massey",		_run_massey,	1 },
+	{ "colley",		_run_colley,	1 },
+	{ "whatif",		_run_whatif,	1 },
+	{ NULL,			NULL }
+};
+
+
+/**
+ * Times the best of a few rounds of one benchmark and prints the result
+ *
+ * Output is one tab separated line per benchmark:
+ * name, items, ns per item, checksum
+ */
+
+static int _bench(struct bench_data *d, const struct bench *b)
+{
+	double best = 0.0;
+	double start, elapsed;
+	double sum = 0.0;
+	size_t items = 0;
+	int round;
+
+	for (round = 0; round < BENCH_ROUNDS; round++) {
+		sum = 0.0;
+		start = _now();
+		items = b->run(d, &sum);
+		elapsed = _now() - start;
+
+		if (!items) {
+			fprintf(stderr, "%s: %s failed\n", __func__, b->name);
+			return -1;
+		}
+
+		if (round == 0 || elapsed < best)
+			best = elapsed;
+	}
+
+	printf("%s\t%lu\t%.2f\t%.6f\n", b->name, items, best / items, sum);
+	return 0;
+}
+
+
+/**
+ * Reads the generated flatf back into memory as lines, tokens and names
+ */
+
+static int _load(struct bench_data *d)
+{
+	char buf[FLATF_READBUFSIZE];
+	struct tokenlist list;
+	struct token *token;
+	size_t max_lines = 0;
+	size_t max_tokens = 0;
+	int fd;
+
+	fd = flatf_open_file(d->path);
+	if (fd < 0 || !flatf_read_line(fd, buf))
+		return -1;
+
+	while (flatf_read_line(fd, buf)) {
+		if (d->num_lines == max_lines) {
+			max_lines = max_lines ? max_lines * 2 : 1024;
+			d->lines = realloc(d->lines, max_lines * sizeof(char *));
+			d->names = realloc(d->names, max_lines * sizeof(char *));
+		}
+
+		d->lines[d->num_lines] = strdup(buf);
+
+		flatf_tokenize_line(buf, &list);
+		for (token = list.head; token; token = token->next) {
+			if (d->num_tokens == max_tokens) {
+				max_tokens = max_tokens ? max_tokens * 2 : 1024;
+				d->tokens = realloc(d->tokens, max_tokens * sizeof(char *));
+			}
+
+			d->tokens[d->num_tokens++] = strdup(token->str);
+		}
+
+		d->names[d->num_lines] = strdup(list.head->str);
+		flatf_deallocate_tokens(&list);
+		d->num_lines++;
+	}
+
+	close(fd);
+
+	d->ctx = ncrunch_ctx_create();
+	if (!d->ctx || flatf_read(d->ctx, d->path) < 0)
+		return -2;
+
+	if (alias_build(&d->alias, d->ctx) < 0)
+		return -3;
+
+	return 0;
+}
+
+
+/**
+ * Reorders the team ids (-O), reporting how far apart opponents' ids are
+ * before and after
+ */
+
+static int _reorder(struct bench_data *d)
+{
+	enum reorder_method method;
+	size_t *order;
+	size_t before;
+	int err;
+
+	if (reorder_method_find(d->reorder, &method) < 0) {
+		fprintf(stderr, "%s: no reordering method named '%s'\n", __func__, d->reorder);
+		return -1;
+	}
+
+	order = malloc((teams_num_teams(d->ctx) + 1) * sizeof(size_t));
+	if (!order)
+		return -2;
+
+	before = reorder_spread(&d->games);
+	err = reorder_order(d->ctx, &d->games, method, order);
+	if (err >= 0)
+		err = reorder_apply(d->ctx, &d->games, order);
+
+	if (err >= 0)
+		fprintf(stderr, "%s: %s: opponents %lu ids apart on average, was %lu\n", __func__,
+			d->reorder, reorder_spread(&d->games), before);
+
+	free(order);
+	return err;
+}
+
+
+/**
+ * Reads the game log, the first time a bench needs it
+ *
+ * The matrix is O(teams^3 / 64) to build and a Colley solve O(teams^3),
+ * which is why these benches are left out unless asked for; both are
+ * built by the first bench that needs them.
+ */
+
+static int _load_games(struct bench_data *d)
+{
+	if (d->games.list)
+		return 0;
+
+	if (games_read(d->ctx, d->games_path, &d->games) != 0)
+		return -1;
+
+	if (d->reorder && _reorder(d) < 0)
+		return -2;
+
+	return 0;
+}
+
+
+static void _unload(struct bench_data *d)
+{
+	size_t i;
+
+	for (i = 0; i < d->num_lines; i++) {
+		free(d->lines[i]);
+		free(d->names[i]);
+	}
+
+	for (i = 0; i < d->num_tokens; i++)
+		free(d->tokens[i]);
+
+	free(d->lines);
+	free(d->names);
+	free(d->tokens);
+	h2h_free(&d->h2h);
+	rating_free(&d->colley);
+	games_free(&d->games);
+	alias_free(&d->alias);
+	ncrunch_ctx_destroy(d->ctx);
+	unlink(d->path);
+	unlink(d->games_path);
+}
+
+
+static void _usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-t teams] [-f fields] [-S seed] [-O reorder] [bench...]\n", prog);
+}
+
+
+int main(int argc, char **argv)
+{
+	struct bench_data d;
+	struct gen_params params;
+	const struct bench *b;
+	int fd;
+	int opt;
+	int i;
+	int err = 0;
+
+	gen_defaults(&params);
+	params.teams = BENCH_DEFAULT_TEAMS;
+
+	memset(&d, 0, sizeof(struct bench_data));
+
+	while ((opt = getopt(argc, argv, "t:f:S:O:h")) != -1) {
+		switch (opt) {
+		case 't': params.teams = strtoul(optarg, NULL, 10); break;
+		case 'f': params.fields = strtoul(optarg, NULL, 10); break;
+		case 'S': params.seed = strtoull(optarg, NULL, 10); break;
+		case 'O': d.reorder = optarg; break;
+		default:
+			_usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	snprintf(d.path, FILENAME_MAX, "/tmp/ncrunch_bench.XXXXXX");
+
+	snprintf(d.games_path, FILENAME_MAX, "/tmp/ncrunch_bench_games.XXXXXX");
+
+	fd = mkstemp(d.path);
+	if (fd < 0) {
+		fprintf(stderr, "%s: could not create a temp file\n", __func__);
+		return EXIT_FAILURE;
+	}
+	close(fd);
+
+	fd = mkstemp(d.games_path);
+	if (fd < 0) {
+		fprintf(stderr, "%s: could not create a temp file\n", __func__);
+		unlink(d.path);
+		return EXIT_FAILURE;
+	}
+	close(fd);
+
+	if (gen_season(&params, 0, d.path, d.games_path) < 0 || _load(&d) < 0) {
+		fprintf(stderr, "%s: could not set up the synthetic flatf\n", __func__);
+		unlink(d.path);
+		unlink(d.games_path);
+		return EXIT_FAILURE;
+	}
+
+	for (b = benches; b->name; b++) {
+		if (optind < argc) {
+			for (i = optind; i < argc; i++) {
+				if (strcmp(argv[i], b->name) == 0)
+					break;
+			}
+
+			if (i == argc)
+				continue;
+		} else if (b->games) {
+			continue;
+		}
+
+		if (b->games && _load_games(&d) < 0) {
+			fprintf(stderr, "%s: could not set up the synthetic game log\n", __func__);
+			err = 1;
+			continue;
+		}
+
+		err |= _bench(&d, b);
+	}
+
+	_unload(&d);
+	return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,260 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "gen.h"
+
+
+
+#define GEN_DEFAULT_TEAMS     1000
+#define GEN_DEFAULT_FIELDS    8
+#define GEN_DEFAULT_GAMES     12
+#define GEN_DEFAULT_CONFSIZE  12
+#define GEN_DEFAULT_SEED      1
+
+
+
+/**
+ * xorshift64*; used instead of rand() so that output is the same everywhere
+ */
+
+struct gen_rng {
+	uint64_t state;
+};
+
+
+static uint64_t _next(struct gen_rng *rng)
+{
+	rng->state ^= rng->state >> 12;
+	rng->state ^= rng->state << 25;
+	rng->state ^= rng->state >> 27;
+	return rng->state * 2685821657736338717ULL;
+}
+
+
+/**
+ * Returns a random number in [0, n)
+ */
+
+static size_t _below(struct gen_rng *rng, size_t n)
+{
+	return (size_t) (_next(rng) % n);
+}
+
+
+/**
+ * Fills in the default scale
+ */
+
+void gen_defaults(struct gen_params *params)
+{
+	memset(params, 0, sizeof(struct gen_params));
+
+	params->teams = GEN_DEFAULT_TEAMS;
+	params->fields = GEN_DEFAULT_FIELDS;
+	params->games = GEN_DEFAULT_GAMES;
+	params->conf_size = GEN_DEFAULT_CONFSIZE;
+	params->seed = GEN_DEFAULT_SEED;
+}
+
+
+/**
+ * Spells a number with letters only, since the flatf reader treats any
+ * token with a digit in it as numeric
+ */
+
+static void _letters(size_t id, char *buf, size_t len)
+{
+	char tmp[32];
+	size_t n = 0;
+
+	do {
+		tmp[n++] = 'a' + id % 26;
+		id /= 26;
+	} while (id && n < sizeof(tmp));
+
+	while (n < 4 && n < sizeof(tmp))
+		tmp[n++] = 'a';
+
+	if (n >= len)
+		n = len - 1;
+
+	/* most significant letter first */
+	for (len = 0; len < n; len++)
+		buf[len] = tmp[n - len - 1];
+
+	buf[n] = '\0';
+}
+
+
+/**
+ * Builds the name of a generated team
+ *
+ * @param id The team's id in the generator (not its row in the flatf)
+ * @param buf Receives the name
+ * @param len Size of buf
+ */
+
+void gen_team_name(size_t id, char *buf, size_t len)
+{
+	char letters[32];
+
+	_letters(id, letters, sizeof(letters));
+	letters[0] = 'A' + (letters[0] - 'a');
+	snprintf(buf, len, "Team %s", letters);
+}
+
+
+/**
+ * Picks an opponent for a team; two thirds of games are in conference
+ */
+
+static size_t _opponent(struct gen_rng *rng, const struct gen_params *params, size_t team)
+{
+	size_t conf = team / params->conf_size;
+	size_t first = conf * params->conf_size;
+	size_t size = params->conf_size;
+	size_t opp;
+
+	if (first + size > params->teams)
+		size = params->teams - first;
+
+	do {
+		if (size > 1 && _below(rng, 3) < 2)
+			opp = first + _below(rng, size);
+		else
+			opp = _below(rng, params->teams);
+	} while (opp == team);
+
+	return opp;
+}
+
+
+/**
+ * Writes one season's flatf and game log
+ *
+ * Each team is scheduled for params->games games as the home side, so teams
+ * play about twice that many in total. Wins and losses in the flatf agree
+ * with the game log; the stat columns are random.
+ *
+ * @param params The scale of the data
+ * @param season Mixed into the seed so that seasons differ
+ * @param flatf_path Where to write the flatf
+ * @param games_path Where to write the game log; NULL to skip it
+ * @return Negative on error
+ */
+
+int gen_season(const struct gen_params *params, size_t season, const char *flatf_path, const char *games_path)
+{
+	struct gen_rng rng;
+	size_t *wins = NULL;
+	size_t *losses = NULL;
+	size_t *rows = NULL;
+	FILE *flatf = NULL;
+	FILE *games = NULL;
+	char name[64];
+	char opp_name[64];
+	char tag[32];
+	size_t home, away, hs, as;
+	size_t i, j, tmp;
+	int err = 0;
+
+	if (params->teams < 2 || params->conf_size == 0) {
+		fprintf(stderr, "%s: need at least two teams\n", __func__);
+		return -1;
+	}
+
+	rng.state = (params->seed ^ (season * 0x9e3779b97f4a7c15ULL)) | 1;
+
+	wins = calloc(params->teams, sizeof(size_t));
+	losses = calloc(params->teams, sizeof(size_t));
+	rows = malloc(params->teams * sizeof(size_t));
+	if (!wins || !losses || !rows) {
+		err = -2;
+		goto out;
+	}
+
+	if (games_path) {
+		games = fopen(games_path, "w");
+		if (!games) {
+			fprintf(stderr, "%s: could not create '%s'\n", __func__, games_path);
+			err = -3;
+			goto out;
+		}
+
+		fprintf(games, "week\thome\taway\thome_score\taway_score\n");
+	}
+
+	for (i = 0; i < params->games; i++) {
+		for (home = 0; home < params->teams; home++) {
+			away = _opponent(&rng, params, home);
+			hs = _below(&rng, 50);
+			as = _below(&rng, 50);
+			if (hs == as)
+				hs++;
+
+			if (hs > as) {
+				wins[home]++;
+				losses[away]++;
+			} else {
+				wins[away]++;
+				losses[home]++;
+			}
+
+			if (games) {
+				gen_team_name(home, name, sizeof(name));
+				gen_team_name(away, opp_name, sizeof(opp_name));
+				fprintf(games, "%lu\t%s\t%s\t%lu\t%lu\n", i + 1, name, opp_name, hs, as);
+			}
+		}
+	}
+
+	/* shuffle the rows so that conference mates are not adjacent */
+	for (i = 0; i < params->teams; i++)
+		rows[i] = i;
+
+	for (i = params->teams - 1; i > 0; i--) {
+		j = _below(&rng, i + 1);
+		tmp = rows[i];
+		rows[i] = rows[j];
+		rows[j] = tmp;
+	}
+
+	flatf = fopen(flatf_path, "w");
+	if (!flatf) {
+		fprintf(stderr, "%s: could not create '%s'\n", __func__, flatf_path);
+		err = -4;
+		goto out;
+	}
+
+	fprintf(flatf, "name\ttags\twins\tlosses");
+	for (j = 0; j < params->fields; j++) {
+		_letters(j, tag, sizeof(tag));
+		fprintf(flatf, "\tstat%s", tag);
+	}
+	fprintf(flatf, "\n");
+
+	for (i = 0; i < params->teams; i++) {
+		gen_team_name(rows[i], name, sizeof(name));
+		_letters(rows[i] / params->conf_size, tag, sizeof(tag));
+		fprintf(flatf, "%s\tconf%s\t%lu\t%lu", name, tag, wins[rows[i]], losses[rows[i]]);
+
+		for (j = 0; j < params->fields; j++)
+			fprintf(flatf, "\t%lu.%02lu", _below(&rng, 1000), _below(&rng, 100));
+
+		fprintf(flatf, "\n");
+	}
+
+out:
+	if (flatf && fclose(flatf) != 0)
+		err = -5;
+
+	if (games && fclose(games) != 0)
+		err = -5;
+
+	free(wins);
+	free(losses);
+	free(rows);
+	return err;
+}
@@ -0,0 +1,39 @@
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+
+/*
+ * Synthetic dataset generator
+ *
+ * A season is a flatf plus a game log. The flatf has the usual name, tags,
+ * wins and losses columns plus a number of numeric stat columns; rows are
+ * shuffled so conference mates are spread through the file. The game log
+ * is tab separated with a heading line:
+ *
+ *	week	home	away	home_score	away_score
+ *
+ * Team names match the flatf's name column. The same parameters and seed
+ * always produce the same files.
+ */
+
+
+/**
+ * The scale of the data to generate
+ */
+
+struct gen_params {
+	size_t teams;
+	size_t fields;		/* numeric stat columns besides wins/losses */
+	size_t games;		/* games per team per season */
+	size_t conf_size;	/* teams per conference */
+	uint64_t seed;
+};
+
+
+void gen_defaults(struct gen_params *params);
+void gen_team_name(size_t id, char *buf, size_t len);
+int gen_season(const struct gen_params *params, size_t season, const char *flatf_path, const char *games_path);
@@ -0,0 +1,79 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "gen.h"
+
+
+
+#define GEN_DEFAULT_SEASONS    1
+#define GEN_DEFAULT_FIRSTYEAR  2000
+
+
+
+static void _usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-t teams] [-f fields] [-g games] [-c conf_size] "
+		"[-n seasons] [-y first_year] [-S seed] <outdir>\n", prog);
+	fprintf(stderr, "writes <outdir>/season<year>.flatf and <outdir>/season<year>.games\n");
+}
+
+
+/**
+ * Writes synthetic seasons for benchmarking and testing
+ */
+
+int main(int argc, char **argv)
+{
+	struct gen_params params;
+	size_t seasons = GEN_DEFAULT_SEASONS;
+	size_t first_year = GEN_DEFAULT_FIRSTYEAR;
+	char flatf_path[FILENAME_MAX];
+	char games_path[FILENAME_MAX];
+	const char *outdir;
+	size_t i;
+	int opt;
+
+	gen_defaults(&params);
+
+	while ((opt = getopt(argc, argv, "t:f:g:c:n:y:S:h")) != -1) {
+		switch (opt) {
+		case 't': params.teams = strtoul(optarg, NULL, 10); break;
+		case 'f': params.fields = strtoul(optarg, NULL, 10); break;
+		case 'g': params.games = strtoul(optarg, NULL, 10); break;
+		case 'c': params.conf_size = strtoul(optarg, NULL, 10); break;
+		case 'n': seasons = strtoul(optarg, NULL, 10); break;
+		case 'y': first_year = strtoul(optarg, NULL, 10); break;
+		case 'S': params.seed = strtoull(optarg, NULL, 10); break;
+		default:
+			_usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind != argc - 1) {
+		_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	outdir = argv[optind];
+	if (mkdir(outdir, 0755) < 0 && errno != EEXIST) {
+		fprintf(stderr, "%s: could not create '%s'\n", __func__, outdir);
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < seasons; i++) {
+		snprintf(flatf_path, FILENAME_MAX, "%s/season%lu.flatf", outdir, first_year + i);
+		snprintf(games_path, FILENAME_MAX, "%s/season%lu.games", outdir, first_year + i);
+
+		if (gen_season(&params, first_year + i, flatf_path, games_path) < 0)
+			return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,227 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include <ncrunch/script.h>
+
+
+
+#define BENCH_DEFAULT_TEAMS 10000
+#define BENCH_ROUNDS        5
+
+
+
+/**
+ * The same rating formula written three ways:
+ *
+ * rating_team() is called once per team with a table of that team's fields,
+ * rating_loop() gets whole columns but walks them element by element, and
+ * rating() works on whole columns with the column operators.
+ */
+
+static const char bench_script[] =
+	"function rating_team(t)\n"
+	"	return (t.wins - t.losses) / (t.wins + t.losses) + (t.pf - t.pa) * 0.01\n"
+	"end\n"
+	"function rating_loop(teams)\n"
+	"	local w, l, pf, pa = teams.wins, teams.losses, teams.pf, teams.pa\n"
+	"	local out = ncrunch.column(#w)\n"
+	"	for i = 1, #w do\n"
+	"		out[i] = (w[i] - l[i]) / (w[i] + l[i]) + (pf[i] - pa[i]) * 0.01\n"
+	"	end\n"
+	"	return out\n"
+	"end\n"
+	"function rating(teams)\n"
+	"	return (teams.wins - teams.losses) / (teams.wins + teams.losses)\n"
+	"		+ (teams.pf - teams.pa) * 0.01\n"
+	"end\n";
+
+
+/**
+ * Synthetic team data, stored column-wise
+ */
+
+struct bench_data {
+	size_t n;
+	double *wins, *losses, *pf, *pa;
+	double *out;
+};
+
+
+static double _now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+/**
+ * Calls rating_team() once per team
+ */
+
+static int _run_per_team(lua_State *L, struct bench_data *d)
+{
+	size_t i;
+
+	for (i = 0; i < d->n; i++) {
+		lua_getglobal(L, "rating_team");
+		lua_createtable(L, 0, 4);
+
+		lua_pushnumber(L, d->wins[i]);
+		lua_setfield(L, -2, "wins");
+		lua_pushnumber(L, d->losses[i]);
+		lua_setfield(L, -2, "losses");
+		lua_pushnumber(L, d->pf[i]);
+		lua_setfield(L, -2, "pf");
+		lua_pushnumber(L, d->pa[i]);
+		lua_setfield(L, -2, "pa");
+
+		if (lua_pcall(L, 1, 1, 0))
+			return -1;
+
+		d->out[i] = lua_tonumber(L, -1);
+		lua_pop(L, 1);
+	}
+
+	return 0;
+}
+
+
+/**
+ * Pushes a column holding a copy of values
+ */
+
+static void _push_column(lua_State *L, const double *values, size_t n, const char *name)
+{
+	struct script_column *col;
+
+	col = script_new_column(L, n);
+	memcpy(col->data, values, n * sizeof(double));
+	lua_setfield(L, -2, name);
+}
+
+
+/**
+ * Calls a function that takes the teams as columns and returns a column
+ */
+
+static int _run_batched(lua_State *L, struct bench_data *d, const char *func)
+{
+	struct script_column *col;
+
+	lua_getglobal(L, func);
+	lua_newtable(L);
+	_push_column(L, d->wins, d->n, "wins");
+	_push_column(L, d->losses, d->n, "losses");
+	_push_column(L, d->pf, d->n, "pf");
+	_push_column(L, d->pa, d->n, "pa");
+
+	if (lua_pcall(L, 1, 1, 0))
+		return -1;
+
+	col = script_to_column(L, -1);
+	memcpy(d->out, col->data, d->n * sizeof(double));
+	lua_pop(L, 1);
+
+	return 0;
+}
+
+
+/**
+ * Times the best of a few rounds of one approach and prints the result
+ *
+ * Output is one tab separated line per approach:
+ * name, teams, ns per team, checksum
+ */
+
+static int _bench(lua_State *L, struct bench_data *d, const char *name, const char *func)
+{
+	double best = 0.0;
+	double start, elapsed;
+	double sum = 0.0;
+	size_t i;
+	int round;
+	int err;
+
+	for (round = 0; round < BENCH_ROUNDS; round++) {
+		start = _now();
+
+		if (func)
+			err = _run_batched(L, d, func);
+		else
+			err = _run_per_team(L, d);
+
+		elapsed = _now() - start;
+
+		if (err) {
+			fprintf(stderr, "%s: %s: %s\n", __func__, name, lua_tostring(L, -1));
+			return -1;
+		}
+
+		if (round == 0 || elapsed < best)
+			best = elapsed;
+
+		lua_gc(L, LUA_GCCOLLECT, 0);
+	}
+
+	for (i = 0; i < d->n; i++)
+		sum += d->out[i];
+
+	printf("%s\t%lu\t%.2f\t%.6f\n", name, d->n, best / d->n, sum);
+	return 0;
+}
+
+
+int main(int argc, char **argv)
+{
+	struct bench_data d;
+	lua_State *L;
+	size_t i;
+	int err = 0;
+
+	d.n = argc > 1 ? strtoul(argv[1], NULL, 10) : BENCH_DEFAULT_TEAMS;
+	d.wins = malloc(d.n * sizeof(double));
+	d.losses = malloc(d.n * sizeof(double));
+	d.pf = malloc(d.n * sizeof(double));
+	d.pa = malloc(d.n * sizeof(double));
+	d.out = malloc(d.n * sizeof(double));
+
+	srand(1);
+	for (i = 0; i < d.n; i++) {
+		d.wins[i] = rand() % 13;
+		d.losses[i] = 12 - d.wins[i] + 1;
+		d.pf[i] = 100 + rand() % 400;
+		d.pa[i] = 100 + rand() % 400;
+	}
+
+	L = luaL_newstate();
+	luaL_openlibs(L);
+	script_open(L, NULL);
+
+	if (luaL_loadstring(L, bench_script) || lua_pcall(L, 0, 0, 0)) {
+		fprintf(stderr, "%s: %s\n", __func__, lua_tostring(L, -1));
+		return EXIT_FAILURE;
+	}
+
+	err |= _bench(L, &d, "lua_per_team", NULL);
+	err |= _bench(L, &d, "lua_batched_loop", "rating_loop");
+	err |= _bench(L, &d, "lua_batched", "rating");
+
+	lua_close(L);
+	free(d.wins);
+	free(d.losses);
+	free(d.pf);
+	free(d.pa);
+	free(d.out);
+
+	return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}
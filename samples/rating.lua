@@ -0,0 +1,9 @@
+-- Sample ranking formula for ncrunch -s
+--
+-- teams holds one column per numeric field. Column arithmetic runs in C over
+-- the whole column, so avoid looping over teams here when a formula will do.
+
+function rating(teams)
+	local games = teams.wins + teams.losses
+	return teams.wins / games
+end
@@ -0,0 +1,138 @@
+#!/usr/bin/perl
+
+use Term::ANSIColor;
+
+
+if ($#ARGV < 0) {
+	print "usage: call with path to a file written by ncrunch -p\n";
+	exit -1;
+}
+
+$filename = $ARGV[0];
+
+open PGCOPY, '<:raw', $filename or die $!;
+local $/;
+$data = <PGCOPY>;
+close PGCOPY;
+
+$pos = 0;
+
+
+
+
+print "Reading header...\t\t\t\t";
+
+if (&take(11) ne "PGCOPY\n\377\r\n\0") {
+	&printFAILED;
+	print "bad signature\n";
+	exit -2;
+}
+
+$flags = unpack('N', &take(4));
+$ext_len = unpack('N', &take(4));
+
+if ($flags & 0x00010000) {
+	&printFAILED;
+	print "OIDs are not expected\n";
+	exit -2;
+}
+
+&take($ext_len);
+&printOK;
+
+
+
+
+$row = 0;
+while (1) {
+	$num_fields = unpack('n!', &take(2));
+	last if ($num_fields == -1);
+
+	$row++;
+	print "Reading row $row...\t\t\t\t";
+
+	if (defined $row_fields && $num_fields != $row_fields) {
+		&printFAILED;
+		print "row has $num_fields fields, expected $row_fields\n";
+		exit -3;
+	}
+
+	$row_fields = $num_fields;
+	@values = ();
+
+	for ($i = 0; $i < $num_fields; $i++) {
+		$len = unpack('N!', &take(4));
+
+		if ($len == -1) {
+			push @values, 'NULL';
+		}
+
+		elsif ($len == 8) {
+			# float8 values are 8 bytes; so is the odd 8 character string
+			$value = &take(8);
+			push @values, ($value =~ /^[\x20-\x7e]{8}$/) ? $value : unpack('d>', $value);
+		}
+
+		else {
+			push @values, &take($len);
+		}
+	}
+
+	&printOK;
+	print "\t", join("\t", @values), "\n";
+}
+
+if ($pos != length($data)) {
+	&printFAILED;
+	print "trailing data after end marker\n";
+	exit -4;
+}
+
+print "\t\t\t\t\t\t";
+&printDONE;
+
+
+
+sub take {
+	my $len = $_[0];
+
+	if ($pos + $len > length($data)) {
+		&printFAILED;
+		print "unexpected end of file\n";
+		exit -5;
+	}
+
+	my $bytes = substr($data, $pos, $len);
+	$pos += $len;
+	return $bytes;
+}
+
+
+sub printOK {
+	print '[  ';
+	print color 'green';
+	print 'OK';
+	print color 'reset';
+	print '  ]';
+	print "\n";
+}
+
+
+sub printFAILED {
+	print '[';
+	print color 'red';
+	print 'FAILED';
+	print color 'reset';
+	print ']';
+	print "\n";
+}
+
+
+sub printDONE {
+	print '[ ';
+	print color 'green';
+	print 'DONE';
+	print color 'reset';
+	print ' ]';
+	print "\n";
+}
@@ -0,0 +1,848 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <ncrunch/ncrunch.h>
+#include <ncrunch/hash.h>
+#include <ncrunch/alias.h>
+
+
+
+/* seeds to try before giving up on a build */
+#define ALIAS_MAXSEEDS 16
+
+/* displacements to try per bucket before trying another seed */
+#define ALIAS_MAXDISP  (1 << 24)
+
+/* a bucket bigger than this makes a build try another seed */
+#define ALIAS_MAXBUCKET 64
+
+
+/**
+ * The saved file's header; the displacements, slots and keys follow
+ */
+
+struct alias_header {
+	char magic[8];
+	struct mdigest source;
+	uint64_t seed;
+	uint64_t num_keys;
+	uint64_t num_buckets;
+	uint64_t blob_len;
+};
+
+
+/**
+ * A key while the dictionary is being built
+ */
+
+struct alias_key {
+	char *key;
+	size_t len;
+	uint32_t team;
+	int is_name;
+	uint64_t hash;
+};
+
+
+static uint64_t _mix(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+
+/**
+ * Hashes a folded key eight bytes at a time
+ */
+
+static uint64_t _hash(const char *key, size_t len, uint64_t seed)
+{
+	uint64_t h = seed ^ (len * 0x9e3779b97f4a7c15ULL);
+	uint64_t w;
+
+	while (len >= 8) {
+		memcpy(&w, key, 8);
+		h = _mix(h ^ w);
+		key += 8;
+		len -= 8;
+	}
+
+	w = 0;
+	memcpy(&w, key, len);
+	return _mix(h ^ w);
+}
+
+
+static size_t _bucket(uint64_t hash, size_t num_buckets)
+{
+	return (hash >> 32) % num_buckets;
+}
+
+
+static size_t _slot(uint64_t hash, uint32_t disp, size_t num_keys)
+{
+	return _mix(hash + (disp + 1) * 0x9e3779b97f4a7c15ULL) % num_keys;
+}
+
+
+/**
+ * Folds a name into a key; see the top of alias.h
+ *
+ * @param out Room for ALIAS_MAXKEY bytes; not terminated
+ * @return The key's length, or (size_t) -1 if it is too long
+ */
+
+static size_t _fold(const char *name, char *out)
+{
+	size_t len = 0;
+	int space = 0;
+	char c;
+
+	for (; (c = *name); name++) {
+		if (c == ' ' || c == '_' || (c >= '\t' && c <= '\r')) {
+			space = len > 0;
+			continue;
+		}
+
+		if (len + space + 1 > ALIAS_MAXKEY)
+			return (size_t) -1;
+
+		if (space)
+			out[len++] = ' ';
+
+		out[len++] = (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+		space = 0;
+	}
+
+	return len;
+}
+
+
+static void _free_keys(struct alias_key *keys, size_t num_keys)
+{
+	size_t i;
+
+	for (i = 0; i < num_keys; i++)
+		free(keys[i].key);
+
+	free(keys);
+}
+
+
+/**
+ * Folds a name or tag and adds it to the keys
+ */
+
+static int _add_key(struct alias_key **keys, size_t *num_keys, size_t *max_keys, const char *name,
+	size_t team, int is_name)
+{
+	char buf[ALIAS_MAXKEY];
+	struct alias_key *grown;
+	size_t len;
+
+	len = _fold(name, buf);
+	if (len == (size_t) -1 || len == 0)
+		return 0;
+
+	if (*num_keys == *max_keys) {
+		*max_keys = *max_keys ? *max_keys * 2 : 256;
+		grown = realloc(*keys, *max_keys * sizeof(struct alias_key));
+		if (!grown)
+			return -1;
+
+		*keys = grown;
+	}
+
+	(*keys)[*num_keys].key = malloc(len);
+	if (!(*keys)[*num_keys].key)
+		return -1;
+
+	memcpy((*keys)[*num_keys].key, buf, len);
+	(*keys)[*num_keys].len = len;
+	(*keys)[*num_keys].team = team;
+	(*keys)[*num_keys].is_name = is_name;
+	(*num_keys)++;
+	return 0;
+}
+
+
+/**
+ * Adds every word of a string tags field (one that grew past TFL_MAXTAGS)
+ */
+
+static int _add_words(struct alias_key **keys, size_t *num_keys, size_t *max_keys, const char *str, size_t team)
+{
+	char word[ALIAS_MAXKEY];
+	size_t len;
+
+	while (str && *str) {
+		len = strcspn(str, " \t");
+		if (len && len < sizeof(word)) {
+			memcpy(word, str, len);
+			word[len] = '\0';
+
+			if (_add_key(keys, num_keys, max_keys, word, team, 0) < 0)
+				return -1;
+		}
+
+		str += len;
+		str += strspn(str, " \t");
+	}
+
+	return 0;
+}
+
+
+/**
+ * Gathers every team's name and tags as folded keys
+ *
+ * @return Negative on error
+ */
+
+static int _collect(const struct ncrunch_ctx *ctx, struct alias_key **keys, size_t *num_keys)
+{
+	size_t max_keys = 0;
+	size_t nameid, tagsid;
+	size_t bit;
+	size_t t;
+	uint64_t mask;
+	int type = -1;
+	int err = 0;
+
+	*keys = NULL;
+	*num_keys = 0;
+
+	if (tfl_find(ctx, "name", &nameid) < 0) {
+		fprintf(stderr, "%s: could not find required 'name' field\n", __func__);
+		return -1;
+	}
+
+	if (tfl_find(ctx, "tags", &tagsid) == 0)
+		type = tfl_get_type(ctx, tagsid);
+
+	for (t = 0; !err && t < teams_num_teams(ctx); t++) {
+		err = _add_key(keys, num_keys, &max_keys, team_get_string(ctx, t, nameid), t, 1);
+
+		if (!err && type == TEAM_FIELD_TAGS && team_get_tags(ctx, t, tagsid, &mask) == 0) {
+			for (bit = 0; !err && bit < TFL_MAXTAGS; bit++) {
+				if (mask & ((uint64_t) 1 << bit))
+					err = _add_key(keys, num_keys, &max_keys, tfl_get_tag(ctx, tagsid, bit), t, 0);
+			}
+		} else if (!err && type == TEAM_FIELD_STRING) {
+			err = _add_words(keys, num_keys, &max_keys, team_get_string(ctx, t, tagsid), t);
+		}
+	}
+
+	if (err) {
+		_free_keys(*keys, *num_keys);
+		*keys = NULL;
+		return -2;
+	}
+
+	return 0;
+}
+
+
+/**
+ * qsort() callback; by key, names ahead of tags, then by team
+ */
+
+static int _compare_keys(const void *a, const void *b)
+{
+	const struct alias_key *x = a;
+	const struct alias_key *y = b;
+	size_t len = x->len < y->len ? x->len : y->len;
+	int c;
+
+	c = memcmp(x->key, y->key, len);
+	if (c)
+		return c;
+
+	if (x->len != y->len)
+		return x->len < y->len ? -1 : 1;
+
+	if (x->is_name != y->is_name)
+		return y->is_name - x->is_name;
+
+	return (x->team > y->team) - (x->team < y->team);
+}
+
+
+/**
+ * Sorts the keys and keeps one per distinct key: a name if there is one,
+ * otherwise a tag if every team with it is the same team; a tag several
+ * teams share, like a conference, is left out
+ *
+ * @return The number of keys kept
+ */
+
+static size_t _dedupe(struct alias_key *keys, size_t num_keys)
+{
+	struct alias_key swap;
+	size_t kept = 0;
+	size_t i, j;
+	int ambiguous;
+
+	qsort(keys, num_keys, sizeof(struct alias_key), _compare_keys);
+
+	for (i = 0; i < num_keys; i = j) {
+		ambiguous = 0;
+
+		for (j = i + 1; j < num_keys && keys[j].len == keys[i].len &&
+		     memcmp(keys[j].key, keys[i].key, keys[i].len) == 0; j++) {
+			if (!keys[i].is_name && keys[j].team != keys[i].team)
+				ambiguous = 1;
+		}
+
+		if (!ambiguous) {
+			/* swap rather than copy so every key is still freed once */
+			swap = keys[kept];
+			keys[kept++] = keys[i];
+			keys[i] = swap;
+		}
+	}
+
+	return kept;
+}
+
+
+/**
+ * Lays out the saved form in one block: header, displacements, slots, keys
+ */
+
+static int _alloc_layout(struct alias *alias)
+{
+	size_t size = sizeof(struct alias_header) + alias->num_buckets * sizeof(uint32_t) +
+		alias->num_keys * sizeof(struct alias_slot) + alias->blob_len;
+	char *mem;
+
+	mem = calloc(1, size);
+	if (!mem)
+		return -1;
+
+	alias->mem = mem;
+	alias->disp = (uint32_t *) (mem + sizeof(struct alias_header));
+	alias->slots = (struct alias_slot *) ((char *) alias->disp + alias->num_buckets * sizeof(uint32_t));
+	alias->blob = (char *) alias->slots + alias->num_keys * sizeof(struct alias_slot);
+	return 0;
+}
+
+
+/**
+ * Tries to place every key with one seed
+ *
+ * @return Negative if some bucket found no displacement
+ */
+
+static int _place(struct alias *alias, const struct alias_key *keys, size_t *order, size_t *start,
+	uint8_t *taken)
+{
+	size_t pos[ALIAS_MAXBUCKET];
+	size_t n = alias->num_keys;
+	size_t nb = alias->num_buckets;
+	size_t *count = &start[nb + 1];
+	size_t *members = &start[2 * nb + 2];
+	size_t b, i, j, k, x, size;
+	size_t used;
+	uint32_t d;
+	int ok;
+
+	memset(start, 0, (2 * nb + 2) * sizeof(size_t));
+	memset(taken, 0, n);
+
+	for (k = 0; k < n; k++)
+		count[_bucket(_hash(keys[k].key, keys[k].len, alias->seed), nb)]++;
+
+	for (b = 0; b < nb; b++) {
+		if (count[b] > ALIAS_MAXBUCKET)
+			return -1;
+		start[b + 1] = start[b] + count[b];
+	}
+
+	memset(count, 0, nb * sizeof(size_t));
+	for (k = 0; k < n; k++) {
+		b = _bucket(_hash(keys[k].key, keys[k].len, alias->seed), nb);
+		members[start[b] + count[b]++] = k;
+	}
+
+	/* biggest buckets first, while there is the most room; a counting
+	 * sort, since sizes are small */
+	for (size = ALIAS_MAXBUCKET, used = 0; size > 0; size--) {
+		for (b = 0; b < nb; b++) {
+			if (count[b] == size)
+				order[used++] = b;
+		}
+	}
+
+	for (i = 0; i < used; i++) {
+		b = order[i];
+		size = count[b];
+
+		for (d = 0; d < ALIAS_MAXDISP; d++) {
+			ok = 1;
+
+			for (j = 0; ok && j < size; j++) {
+				k = members[start[b] + j];
+				pos[j] = _slot(_hash(keys[k].key, keys[k].len, alias->seed), d, n);
+
+				if (taken[pos[j]])
+					ok = 0;
+
+				for (x = 0; ok && x < j; x++) {
+					if (pos[x] == pos[j])
+						ok = 0;
+				}
+			}
+
+			if (ok)
+				break;
+		}
+
+		if (d == ALIAS_MAXDISP)
+			return -2;
+
+		alias->disp[b] = d;
+		for (j = 0; j < size; j++) {
+			taken[pos[j]] = 1;
+			alias->slots[pos[j]].team = members[start[b] + j];
+		}
+	}
+
+	return 0;
+}
+
+
+/**
+ * Builds the dictionary for a context's teams
+ *
+ * @return Negative on error
+ */
+
+int alias_build(struct alias *alias, const struct ncrunch_ctx *ctx)
+{
+	struct alias_key *keys;
+	struct alias_slot *slot;
+	size_t num_keys;
+	size_t *order = NULL;
+	size_t *start = NULL;
+	uint8_t *taken = NULL;
+	size_t offset;
+	size_t i;
+	int err = -1;
+
+	memset(alias, 0, sizeof(struct alias));
+
+	if (_collect(ctx, &keys, &num_keys) < 0)
+		return -1;
+
+	alias->num_keys = _dedupe(keys, num_keys);
+	alias->num_buckets = alias->num_keys / ALIAS_LOAD + 1;
+
+	for (i = 0; i < alias->num_keys; i++)
+		alias->blob_len += keys[i].len;
+
+	if (alias->blob_len > UINT32_MAX || _alloc_layout(alias) < 0) {
+		_free_keys(keys, num_keys);
+		return -2;
+	}
+
+	order = malloc(alias->num_buckets * sizeof(size_t));
+	start = malloc((3 * alias->num_buckets + 2 + alias->num_keys) * sizeof(size_t));
+	taken = malloc(alias->num_keys + 1);
+
+	for (i = 0; order && start && taken && i < ALIAS_MAXSEEDS; i++) {
+		alias->seed = _mix(0x6e637275636821ULL + i);
+
+		err = _place(alias, keys, order, start, taken);
+		if (err == 0)
+			break;
+	}
+
+	free(order);
+	free(start);
+	free(taken);
+
+	if (err < 0) {
+		fprintf(stderr, "%s: could not build a perfect hash over %lu keys\n", __func__, alias->num_keys);
+		_free_keys(keys, num_keys);
+		alias_free(alias);
+		return -3;
+	}
+
+	/* the slots hold key indices so far; swap in their keys */
+	for (i = 0, offset = 0; i < alias->num_keys; i++) {
+		slot = &alias->slots[i];
+
+		memcpy(&alias->blob[offset], keys[slot->team].key, keys[slot->team].len);
+		slot->offset = offset;
+		slot->len = keys[slot->team].len;
+		slot->team = keys[slot->team].team;
+		offset += slot->len;
+	}
+
+	_free_keys(keys, num_keys);
+	return 0;
+}
+
+
+/**
+ * Checks that every slot of a loaded dictionary has its key inside the
+ * blob and names a team that exists
+ *
+ * @return Negative on the first slot that doesn't
+ */
+
+static int _check_slots(const struct alias *alias, size_t num_teams)
+{
+	const struct alias_slot *slot;
+	size_t i;
+
+	for (i = 0; i < alias->num_keys; i++) {
+		slot = &alias->slots[i];
+
+		if (!slot->len || slot->len > ALIAS_MAXKEY || (size_t) slot->offset + slot->len > alias->blob_len ||
+		    slot->team >= num_teams)
+			return -1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Loads a saved dictionary
+ *
+ * @param source The digest of the flatf it should have been built from
+ * @param num_teams The number of teams in that flatf
+ * @return Negative if it is missing, stale or damaged
+ */
+
+int alias_load(struct alias *alias, const char *path, const struct mdigest *source, size_t num_teams)
+{
+	struct alias_header hdr;
+	struct stat st;
+	size_t size;
+	ssize_t got;
+	int fd;
+
+	memset(alias, 0, sizeof(struct alias));
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0 || read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    memcmp(hdr.magic, ALIAS_MAGIC, sizeof(hdr.magic)) != 0 ||
+	    memcmp(&hdr.source, source, sizeof(struct mdigest)) != 0) {
+		close(fd);
+		return -2;
+	}
+
+	/* each count alone has to fit the file before they are multiplied */
+	if ((off_t) hdr.num_keys > st.st_size || (off_t) hdr.num_buckets > st.st_size ||
+	    (off_t) hdr.blob_len > st.st_size) {
+		close(fd);
+		return -3;
+	}
+
+	alias->seed = hdr.seed;
+	alias->num_keys = hdr.num_keys;
+	alias->num_buckets = hdr.num_buckets;
+	alias->blob_len = hdr.blob_len;
+
+	size = sizeof(hdr) + alias->num_buckets * sizeof(uint32_t) +
+		alias->num_keys * sizeof(struct alias_slot) + alias->blob_len;
+
+	if (!alias->num_buckets || (off_t) size != st.st_size || _alloc_layout(alias) < 0) {
+		close(fd);
+		memset(alias, 0, sizeof(struct alias));
+		return -3;
+	}
+
+	got = pread(fd, (char *) alias->mem + sizeof(hdr), size - sizeof(hdr), sizeof(hdr));
+	close(fd);
+
+	if (got != (ssize_t) (size - sizeof(hdr))) {
+		alias_free(alias);
+		return -4;
+	}
+
+	if (_check_slots(alias, num_teams) < 0) {
+		alias_free(alias);
+		return -5;
+	}
+
+	memcpy(alias->mem, &hdr, sizeof(hdr));
+	return 0;
+}
+
+
+/**
+ * Saves the dictionary, through a temp file renamed into place
+ *
+ * @param source The digest of the flatf it was built from
+ * @return Negative on error
+ */
+
+int alias_save(const struct alias *alias, const char *path, const struct mdigest *source)
+{
+	struct alias_header *hdr = alias->mem;
+	char tmp[FILENAME_MAX];
+	size_t size = sizeof(struct alias_header) + alias->num_buckets * sizeof(uint32_t) +
+		alias->num_keys * sizeof(struct alias_slot) + alias->blob_len;
+	ssize_t n;
+	size_t done = 0;
+	int fd;
+
+	memcpy(hdr->magic, ALIAS_MAGIC, sizeof(hdr->magic));
+	hdr->source = *source;
+	hdr->seed = alias->seed;
+	hdr->num_keys = alias->num_keys;
+	hdr->num_buckets = alias->num_buckets;
+	hdr->blob_len = alias->blob_len;
+
+	snprintf(tmp, FILENAME_MAX, "%s.%d.tmp", path, (int) getpid());
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "%s: could not create '%s'\n", __func__, tmp);
+		return -1;
+	}
+
+	while (done < size) {
+		n = write(fd, (const char *) alias->mem + done, size - done);
+		if (n <= 0)
+			break;
+		done += n;
+	}
+
+	if (close(fd) < 0 || done < size || rename(tmp, path) < 0) {
+		fprintf(stderr, "%s: could not write '%s'\n", __func__, path);
+		unlink(tmp);
+		return -2;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Loads the dictionary saved next to a flatf, or builds and saves it if
+ * there is none or the flatf has changed since
+ *
+ * @return Negative on error; failing to save is only a warning
+ */
+
+int alias_open(struct alias *alias, const struct ncrunch_ctx *ctx, const char *flatf)
+{
+	char path[FILENAME_MAX];
+	struct mdigest source;
+
+	if (hash_file(flatf, &source) < 0)
+		return alias_build(alias, ctx);
+
+	snprintf(path, FILENAME_MAX, "%s%s", flatf, ALIAS_SUFFIX);
+
+	if (alias_load(alias, path, &source, teams_num_teams(ctx)) == 0)
+		return 0;
+
+	if (alias_build(alias, ctx) < 0)
+		return -1;
+
+	alias_save(alias, path, &source);
+	return 0;
+}
+
+
+static size_t _lookup(const struct alias *alias, const char *key, size_t len, uint64_t hash)
+{
+	const struct alias_slot *slot;
+
+	slot = &alias->slots[_slot(hash, alias->disp[_bucket(hash, alias->num_buckets)], alias->num_keys)];
+	if (slot->len != len || memcmp(&alias->blob[slot->offset], key, len) != 0)
+		return TEAMS_INVALID;
+
+	return slot->team;
+}
+
+
+/**
+ * Resolves a name or alias to a team
+ *
+ * Safe to call from any number of threads at once.
+ *
+ * @return The team's id, or TEAMS_INVALID
+ */
+
+size_t alias_resolve(const struct alias *alias, const char *name)
+{
+	char key[ALIAS_MAXKEY];
+	size_t len;
+
+	len = _fold(name, key);
+	if (!alias->num_keys || len == (size_t) -1)
+		return TEAMS_INVALID;
+
+	return _lookup(alias, key, len, _hash(key, len, alias->seed));
+}
+
+
+/**
+ * Counts a name that didn't resolve
+ */
+
+static int _miss(struct alias *alias, const char *name, const char *key, size_t len)
+{
+	struct alias_miss *grown, *old;
+	struct alias_miss *m;
+	uint64_t hash = _hash(key, len, 0);
+	size_t max, i, j;
+
+	if (2 * (alias->num_misses + 1) > alias->max_misses) {
+		max = alias->max_misses ? 2 * alias->max_misses : 64;
+		grown = calloc(max, sizeof(struct alias_miss));
+		if (!grown)
+			return -1;
+
+		old = alias->misses;
+		for (i = 0; i < alias->max_misses; i++) {
+			if (!old[i].name)
+				continue;
+
+			for (j = old[i].hash % max; grown[j].name; j = (j + 1) % max);
+			grown[j] = old[i];
+		}
+
+		free(old);
+		alias->misses = grown;
+		alias->max_misses = max;
+	}
+
+	for (i = hash % alias->max_misses; alias->misses[i].name; i = (i + 1) % alias->max_misses) {
+		m = &alias->misses[i];
+		if (m->hash == hash && strlen(m->key) == len && memcmp(m->key, key, len) == 0) {
+			m->count++;
+			return 0;
+		}
+	}
+
+	m = &alias->misses[i];
+	m->name = strdup(name);
+	m->key = strndup(key, len);
+	if (!m->name || !m->key) {
+		free(m->name);
+		free(m->key);
+		m->name = NULL;
+		return -1;
+	}
+
+	m->hash = hash;
+	m->count = 1;
+	alias->num_misses++;
+	return 0;
+}
+
+
+/**
+ * alias_resolve(), counting the names that don't resolve for
+ * alias_write_misses(); for one thread at a time
+ *
+ * @return The team's id, or TEAMS_INVALID
+ */
+
+size_t alias_resolve_report(struct alias *alias, const char *name)
+{
+	char key[ALIAS_MAXKEY];
+	const char *miss = key;
+	size_t len;
+	size_t id = TEAMS_INVALID;
+
+	len = _fold(name, key);
+	if (len == (size_t) -1) {
+		/* too long to fold (and to be anyone's name); counted as given */
+		miss = name;
+		len = strlen(name);
+	} else if (alias->num_keys) {
+		id = _lookup(alias, key, len, _hash(key, len, alias->seed));
+	}
+
+	if (id == TEAMS_INVALID)
+		_miss(alias, name, miss, len);
+
+	return id;
+}
+
+
+/**
+ * qsort() callback; most frequent first, then by name
+ */
+
+static int _compare_misses(const void *a, const void *b)
+{
+	const struct alias_miss *x = *(const struct alias_miss * const *) a;
+	const struct alias_miss *y = *(const struct alias_miss * const *) b;
+
+	if (x->count != y->count)
+		return x->count > y->count ? -1 : 1;
+
+	return strcmp(x->key, y->key);
+}
+
+
+/**
+ * Writes the names that didn't resolve, one per line: how many times it
+ * came up, then the name as first seen
+ *
+ * @return Negative on error
+ */
+
+int alias_write_misses(const struct alias *alias, FILE *out)
+{
+	const struct alias_miss **list;
+	size_t n = 0;
+	size_t i;
+
+	if (!alias->num_misses)
+		return 0;
+
+	list = malloc(alias->num_misses * sizeof(struct alias_miss *));
+	if (!list)
+		return -1;
+
+	for (i = 0; i < alias->max_misses; i++) {
+		if (alias->misses[i].name)
+			list[n++] = &alias->misses[i];
+	}
+
+	qsort(list, n, sizeof(struct alias_miss *), _compare_misses);
+
+	for (i = 0; i < n; i++)
+		fprintf(out, "%lu\t%s\n", list[i]->count, list[i]->name);
+
+	free(list);
+	return 0;
+}
+
+
+void alias_free(struct alias *alias)
+{
+	size_t i;
+
+	for (i = 0; i < alias->max_misses; i++) {
+		free(alias->misses[i].name);
+		free(alias->misses[i].key);
+	}
+
+	free(alias->misses);
+	free(alias->mem);
+	memset(alias, 0, sizeof(struct alias));
+}
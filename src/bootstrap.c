@@ -0,0 +1,455 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <ncrunch/ncrunch.h>
+#include <ncrunch/games.h>
+#include <ncrunch/rating.h>
+#include <ncrunch/bootstrap.h>
+
+
+
+/**
+ * Shared by the worker threads; each takes the next draw in turn
+ */
+
+struct bootstrap_state {
+	struct bootstrap *bs;
+	const struct rating_mode *mode;
+	const struct games *games;
+	uint64_t seed;
+	size_t next;
+	int err;
+	pthread_mutex_t lock;
+};
+
+
+/**
+ * A rating paired with its team for sorting into ranks
+ */
+
+struct bootstrap_entry {
+	double val;
+	size_t id;
+};
+
+
+/**
+ * A worker's scratch space, allocated once for all of its draws
+ */
+
+struct bootstrap_work {
+	struct games games;	/* the drawn season */
+	uint32_t *picks;	/* times each game was drawn */
+	double *work;		/* the mode's */
+	struct bootstrap_entry *entries;
+	size_t iterations;
+};
+
+
+/**
+ * splitmix64; small, and any seed is a good one
+ */
+
+static uint64_t _next(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+
+/**
+ * qsort() callback; highest rating first, ties by team id
+ */
+
+static int _compare_entries(const void *a, const void *b)
+{
+	const struct bootstrap_entry *x = a;
+	const struct bootstrap_entry *y = b;
+
+	if (x->val != y->val)
+		return x->val > y->val ? -1 : 1;
+
+	return (x->id > y->id) - (x->id < y->id);
+}
+
+
+static int _compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double *) a;
+	double y = *(const double *) b;
+
+	return (x > y) - (x < y);
+}
+
+
+static int _compare_ranks(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *) a;
+	uint32_t y = *(const uint32_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+
+/**
+ * Turns a row of ratings into ranks
+ */
+
+static void _rank(const double *ratings, size_t n, struct bootstrap_entry *entries, uint32_t *ranks)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		entries[i].val = ratings[i];
+		entries[i].id = i;
+	}
+
+	qsort(entries, n, sizeof(struct bootstrap_entry), _compare_entries);
+
+	for (i = 0; i < n; i++)
+		ranks[entries[i].id] = i + 1;
+}
+
+
+static void _free_work(struct bootstrap_work *work)
+{
+	free(work->games.list);
+	free(work->picks);
+	free(work->work);
+	free(work->entries);
+	memset(work, 0, sizeof(struct bootstrap_work));
+}
+
+
+static int _alloc_work(struct bootstrap_work *work, const struct bootstrap_state *state)
+{
+	size_t n = state->bs->num_teams;
+	size_t num_games = state->games->num_games;
+
+	memset(work, 0, sizeof(struct bootstrap_work));
+
+	work->games.list = malloc((num_games ? num_games : 1) * sizeof(struct game));
+	work->games.max_games = num_games;
+	work->picks = malloc((num_games ? num_games : 1) * sizeof(uint32_t));
+	work->work = malloc((state->mode->work_size(n) + 1) * sizeof(double));
+	work->entries = malloc(n * sizeof(struct bootstrap_entry));
+
+	if (!work->games.list || !work->picks || !work->work || !work->entries) {
+		_free_work(work);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Draws and rates one resampled season
+ *
+ * The drawn games are kept in log order, as a season's are; Elo depends on
+ * the order, and Colley and Massey don't mind it.
+ *
+ * @return Negative on error
+ */
+
+static int _draw(struct bootstrap_state *state, struct bootstrap_work *work, size_t draw)
+{
+	const struct games *games = state->games;
+	struct bootstrap *bs = state->bs;
+	double *ratings = &bs->ratings[draw * bs->num_teams];
+	uint64_t rng = state->seed ^ (draw * 0xd1b54a32d192ed03ULL);
+	size_t i, n;
+	uint32_t k;
+	int iter;
+
+	memset(work->picks, 0, games->num_games * sizeof(uint32_t));
+
+	for (i = 0; i < games->num_games; i++)
+		work->picks[_next(&rng) % games->num_games]++;
+
+	for (i = 0, n = 0; i < games->num_games; i++) {
+		for (k = 0; k < work->picks[i]; k++)
+			work->games.list[n++] = games->list[i];
+	}
+
+	work->games.num_games = n;
+
+	/* warm start */
+	memcpy(ratings, bs->base, bs->num_teams * sizeof(double));
+
+	iter = state->mode->solve(&work->games, bs->num_teams, ratings, work->work);
+	if (iter < 0)
+		return -1;
+
+	work->iterations += iter;
+	_rank(ratings, bs->num_teams, work->entries, &bs->ranks[draw * bs->num_teams]);
+
+	return 0;
+}
+
+
+static void *_worker(void *arg)
+{
+	struct bootstrap_state *state = arg;
+	struct bootstrap_work work;
+	size_t draw;
+	int err;
+
+	err = _alloc_work(&work, state);
+
+	for (;;) {
+		pthread_mutex_lock(&state->lock);
+		if (err < 0)
+			state->err = err;
+
+		draw = state->err < 0 ? state->bs->num_draws : state->next++;
+		pthread_mutex_unlock(&state->lock);
+
+		if (draw >= state->bs->num_draws)
+			break;
+
+		err = _draw(state, &work, draw);
+	}
+
+	pthread_mutex_lock(&state->lock);
+	state->bs->iterations += work.iterations;
+	pthread_mutex_unlock(&state->lock);
+
+	_free_work(&work);
+	return NULL;
+}
+
+
+/**
+ * Rates a season and num_draws resamples of it
+ *
+ * @param seed Seeds the draws; the same seed gives the same results
+ * @param threads Worker threads; 0 for one per CPU
+ * @return Negative on error
+ */
+
+int bootstrap_run(struct bootstrap *bs, const struct rating_mode *mode, const struct games *games,
+	size_t num_teams, size_t num_draws, uint64_t seed, size_t threads)
+{
+	struct bootstrap_state state;
+	pthread_t *workers;
+	size_t num_workers = 0;
+	long ncpu;
+	size_t i;
+
+	memset(bs, 0, sizeof(struct bootstrap));
+	bs->num_teams = num_teams;
+	bs->num_draws = num_draws;
+
+	if (!num_teams)
+		return 0;
+
+	bs->base = malloc(num_teams * sizeof(double));
+	bs->ratings = malloc((num_draws ? num_draws : 1) * num_teams * sizeof(double));
+	bs->ranks = malloc((num_draws ? num_draws : 1) * num_teams * sizeof(uint32_t));
+
+	if (!bs->base || !bs->ratings || !bs->ranks) {
+		fprintf(stderr, "%s: not enough memory for %lu draws\n", __func__, num_draws);
+		bootstrap_free(bs);
+		return -1;
+	}
+
+	if (rating_mode_solve(mode, games, num_teams, bs->base) < 0) {
+		bootstrap_free(bs);
+		return -2;
+	}
+
+	if (!num_draws || !games->num_games) {
+		bs->num_draws = 0;
+		return 0;
+	}
+
+	if (!threads) {
+		ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = ncpu > 0 ? ncpu : 1;
+	}
+
+	if (threads > num_draws)
+		threads = num_draws;
+
+	memset(&state, 0, sizeof(struct bootstrap_state));
+	state.bs = bs;
+	state.mode = mode;
+	state.games = games;
+	state.seed = seed;
+
+	workers = malloc(threads * sizeof(pthread_t));
+	if (!workers) {
+		bootstrap_free(bs);
+		return -3;
+	}
+
+	pthread_mutex_init(&state.lock, NULL);
+
+	for (i = 0; i < threads; i++) {
+		if (pthread_create(&workers[num_workers], NULL, _worker, &state) == 0)
+			num_workers++;
+	}
+
+	/* no threads at all; do the work here */
+	if (!num_workers)
+		_worker(&state);
+
+	for (i = 0; i < num_workers; i++)
+		pthread_join(workers[i], NULL);
+
+	pthread_mutex_destroy(&state.lock);
+	free(workers);
+
+	if (state.err < 0) {
+		fprintf(stderr, "%s: %s failed on a draw\n", __func__, mode->name);
+		bootstrap_free(bs);
+		return -4;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Works out every team's intervals from the draws
+ *
+ * @param level The share of draws the intervals cover, such as 0.95
+ * @param teams Receives num_teams entries
+ * @return Negative on error
+ */
+
+int bootstrap_summary(const struct bootstrap *bs, double level, struct bootstrap_team *teams)
+{
+	struct bootstrap_entry *entries;
+	uint32_t *base_ranks;
+	double *ratings;
+	uint32_t *ranks;
+	size_t n = bs->num_teams;
+	size_t draws = bs->num_draws;
+	size_t lo, hi, mid;
+	size_t t, d;
+
+	if (!n)
+		return 0;
+
+	entries = malloc(n * sizeof(struct bootstrap_entry));
+	base_ranks = malloc(n * sizeof(uint32_t));
+	ratings = malloc((draws ? draws : 1) * sizeof(double));
+	ranks = malloc((draws ? draws : 1) * sizeof(uint32_t));
+
+	if (!entries || !base_ranks || !ratings || !ranks) {
+		free(entries);
+		free(base_ranks);
+		free(ratings);
+		free(ranks);
+		return -1;
+	}
+
+	_rank(bs->base, n, entries, base_ranks);
+
+	lo = draws ? (size_t) ((1.0 - level) / 2.0 * (draws - 1) + 0.5) : 0;
+	hi = draws ? draws - 1 - lo : 0;
+	mid = draws ? (draws - 1) / 2 : 0;
+
+	for (t = 0; t < n; t++) {
+		teams[t].rating = bs->base[t];
+		teams[t].rank = base_ranks[t];
+
+		if (!draws) {
+			teams[t].lo = teams[t].hi = bs->base[t];
+			teams[t].rank_best = teams[t].rank_lo = teams[t].rank_median =
+				teams[t].rank_hi = teams[t].rank_worst = base_ranks[t];
+			continue;
+		}
+
+		for (d = 0; d < draws; d++) {
+			ratings[d] = bs->ratings[d * n + t];
+			ranks[d] = bs->ranks[d * n + t];
+		}
+
+		qsort(ratings, draws, sizeof(double), _compare_doubles);
+		qsort(ranks, draws, sizeof(uint32_t), _compare_ranks);
+
+		teams[t].lo = ratings[lo];
+		teams[t].hi = ratings[hi];
+		teams[t].rank_best = ranks[0];
+		teams[t].rank_lo = ranks[lo];
+		teams[t].rank_median = ranks[mid];
+		teams[t].rank_hi = ranks[hi];
+		teams[t].rank_worst = ranks[draws - 1];
+	}
+
+	free(entries);
+	free(base_ranks);
+	free(ratings);
+	free(ranks);
+	return 0;
+}
+
+
+/**
+ * Writes every team's intervals, one per line in order of rank
+ *
+ * Each line is tab separated: rank, team name, rating, its interval (two
+ * columns), then the best rank, rank interval low, median rank, rank
+ * interval high and worst rank over the draws
+ *
+ * @return Negative on error
+ */
+
+int bootstrap_write(const struct ncrunch_ctx *ctx, const struct bootstrap *bs, double level, FILE *out)
+{
+	struct bootstrap_team *teams;
+	const struct bootstrap_team *team;
+	size_t *order;
+	size_t nameid;
+	size_t i;
+
+	if (tfl_find(ctx, "name", &nameid) < 0) {
+		fprintf(stderr, "%s: could not find required 'name' field\n", __func__);
+		return -1;
+	}
+
+	if (!bs->num_teams)
+		return 0;
+
+	teams = malloc(bs->num_teams * sizeof(struct bootstrap_team));
+	order = malloc(bs->num_teams * sizeof(size_t));
+
+	if (!teams || !order || bootstrap_summary(bs, level, teams) < 0) {
+		free(teams);
+		free(order);
+		return -2;
+	}
+
+	for (i = 0; i < bs->num_teams; i++)
+		order[teams[i].rank - 1] = i;
+
+	for (i = 0; i < bs->num_teams; i++) {
+		team = &teams[order[i]];
+		fprintf(out, "%u\t%s\t%g\t%g\t%g\t%u\t%u\t%u\t%u\t%u\n", team->rank,
+			team_get_string(ctx, order[i], nameid), team->rating, team->lo, team->hi,
+			team->rank_best, team->rank_lo, team->rank_median, team->rank_hi, team->rank_worst);
+	}
+
+	free(teams);
+	free(order);
+	return 0;
+}
+
+
+void bootstrap_free(struct bootstrap *bs)
+{
+	free(bs->base);
+	free(bs->ratings);
+	free(bs->ranks);
+	memset(bs, 0, sizeof(struct bootstrap));
+}
@@ -0,0 +1,334 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <dirent.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+
+#include <ncrunch/cache.h>
+
+
+
+/* bump this whenever the format of cached output changes */
+#define CACHE_VERSION "ncrunch-cache-1"
+
+#define CACHE_LOCKNAME ".lock"
+
+
+
+/**
+ * A file in the cache directory, as seen while evicting
+ */
+
+struct cache_file {
+	char name[HASH_HEXSIZE];
+	struct timespec mtime;
+	off_t size;
+};
+
+
+/**
+ * Computes the key for a run from its inputs
+ *
+ * The key covers the contents (not the names) of every input file and the
+ * parameter string, which should name the algorithm and all of its settings.
+ *
+ * @param files The input files; NULL entries stand for an unused input
+ * @param num_files Number of entries in files
+ * @param params The algorithm and its parameters
+ * @param key The resulting key
+ * @return Negative on error
+ */
+
+int cache_key(const char **files, size_t num_files, const char *params, struct mdigest *key)
+{
+	struct mdigest digest;
+	char hex[HASH_HEXSIZE];
+	char *buf = NULL;
+	size_t len = 0;
+	size_t i;
+	FILE *out;
+
+	out = open_memstream(&buf, &len);
+	if (!out)
+		return -1;
+
+	fprintf(out, "%s\n", CACHE_VERSION);
+
+	for (i = 0; i < num_files; i++) {
+		if (!files[i]) {
+			fprintf(out, "-\n");
+			continue;
+		}
+
+		if (hash_file(files[i], &digest) < 0) {
+			fclose(out);
+			free(buf);
+			return -2;
+		}
+
+		hash_hex(&digest, hex);
+		fprintf(out, "%s\n", hex);
+	}
+
+	fprintf(out, "%s\n", params);
+	fclose(out);
+
+	hash_string(buf, len, key);
+	free(buf);
+
+	return 0;
+}
+
+
+/**
+ * Builds the path of a file inside the cache directory
+ */
+
+static void _path(char path[FILENAME_MAX], const char *dir, const char *name)
+{
+	snprintf(path, FILENAME_MAX, "%s/%s", dir, name);
+}
+
+
+/**
+ * Looks a key up in the cache and maps the entry into memory
+ *
+ * @param dir The cache directory
+ * @param key The key from cache_key()
+ * @param entry Set to the mapped entry on a hit
+ * @return 0 on a hit, 1 on a miss, negative on error
+ */
+
+int cache_lookup(const char *dir, const struct mdigest *key, struct cache_entry *entry)
+{
+	char hex[HASH_HEXSIZE];
+	char path[FILENAME_MAX];
+	struct stat st;
+	void *data;
+	int fd;
+
+	memset(entry, 0, sizeof(struct cache_entry));
+
+	hash_hex(key, hex);
+	_path(path, dir, hex);
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return errno == ENOENT ? 1 : -1;
+
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -2;
+	}
+
+	/* touch the entry so that it counts as recently used */
+	futimens(fd, NULL);
+
+	if (st.st_size > 0) {
+		data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			close(fd);
+			return -3;
+		}
+
+		entry->data = data;
+		entry->len = st.st_size;
+	}
+
+	close(fd);
+	return 0;
+}
+
+
+/**
+ * Unmaps an entry returned by cache_lookup()
+ */
+
+void cache_release(struct cache_entry *entry)
+{
+	if (entry->data)
+		munmap((void *) entry->data, entry->len);
+
+	memset(entry, 0, sizeof(struct cache_entry));
+}
+
+
+/**
+ * qsort() callback; oldest first
+ */
+
+static int _compare_mtime(const void *a, const void *b)
+{
+	const struct cache_file *x = a;
+	const struct cache_file *y = b;
+
+	if (x->mtime.tv_sec != y->mtime.tv_sec)
+		return (x->mtime.tv_sec > y->mtime.tv_sec) - (x->mtime.tv_sec < y->mtime.tv_sec);
+
+	return (x->mtime.tv_nsec > y->mtime.tv_nsec) - (x->mtime.tv_nsec < y->mtime.tv_nsec);
+}
+
+
+/**
+ * Removes least recently used entries until the cache fits in max_size
+ *
+ * Must be called with the cache lock held. Readers that already have an
+ * entry mapped are unaffected by its removal.
+ *
+ * @return Negative on error
+ */
+
+static int _evict(const char *dir, size_t max_size)
+{
+	DIR *d;
+	struct dirent *ent;
+	struct cache_file *files = NULL;
+	struct cache_file *grown;
+	size_t num_files = 0;
+	size_t max_files = 0;
+	off_t total = 0;
+	char path[FILENAME_MAX];
+	struct stat st;
+	size_t i;
+
+	d = opendir(dir);
+	if (!d)
+		return -1;
+
+	while ((ent = readdir(d))) {
+		/* entries are named by their hex digest; skip locks and temp files */
+		if (strlen(ent->d_name) != HASH_HEXSIZE - 1)
+			continue;
+
+		_path(path, dir, ent->d_name);
+		if (stat(path, &st) < 0 || !S_ISREG(st.st_mode))
+			continue;
+
+		if (num_files == max_files) {
+			max_files = max_files ? max_files * 2 : 64;
+			grown = realloc(files, max_files * sizeof(struct cache_file));
+			if (!grown)
+				break;
+
+			files = grown;
+		}
+
+		strcpy(files[num_files].name, ent->d_name);
+		files[num_files].mtime = st.st_mtim;
+		files[num_files].size = st.st_size;
+		total += st.st_size;
+		num_files++;
+	}
+
+	closedir(d);
+
+	if (total > (off_t) max_size) {
+		qsort(files, num_files, sizeof(struct cache_file), _compare_mtime);
+
+		for (i = 0; i < num_files && total > (off_t) max_size; i++) {
+			_path(path, dir, files[i].name);
+			if (unlink(path) == 0)
+				total -= files[i].size;
+		}
+	}
+
+	free(files);
+	return 0;
+}
+
+
+/**
+ * Writes all of a buffer to a file descriptor
+ *
+ * @return Negative on error
+ */
+
+static int _write_all(int fd, const char *data, size_t len)
+{
+	ssize_t count;
+
+	while (len) {
+		count = write(fd, data, len);
+		if (count < 0 && errno == EINTR)
+			continue;
+
+		if (count <= 0)
+			return -1;
+
+		data += count;
+		len -= count;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Adds an entry to the cache, then trims the cache to max_size
+ *
+ * Safe to call from several processes at once: the entry is written to a
+ * private temp file and renamed into place, and eviction is serialized with
+ * an flock() on the cache's lock file.
+ *
+ * @param dir The cache directory; created if missing
+ * @param max_size The most bytes of entries to keep
+ * @param key The key from cache_key()
+ * @param data The result to store
+ * @param len Length of data
+ * @return Negative on error
+ */
+
+int cache_store(const char *dir, size_t max_size, const struct mdigest *key, const void *data, size_t len)
+{
+	char hex[HASH_HEXSIZE];
+	char path[FILENAME_MAX];
+	char tmp[FILENAME_MAX];
+	int fd;
+	int lockfd;
+	int err;
+
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+		fprintf(stderr, "%s: could not create cache directory '%s'\n", __func__, dir);
+		return -1;
+	}
+
+	hash_hex(key, hex);
+	_path(path, dir, hex);
+	snprintf(tmp, FILENAME_MAX, "%s/.%s.%d.tmp", dir, hex, (int) getpid());
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "%s: could not create '%s'\n", __func__, tmp);
+		return -2;
+	}
+
+	err = _write_all(fd, data, len);
+	if (close(fd) < 0)
+		err = -1;
+
+	if (err || rename(tmp, path) < 0) {
+		fprintf(stderr, "%s: could not write cache entry '%s'\n", __func__, path);
+		unlink(tmp);
+		return -3;
+	}
+
+	_path(path, dir, CACHE_LOCKNAME);
+	lockfd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (lockfd < 0)
+		return -4;
+
+	flock(lockfd, LOCK_EX);
+	err = _evict(dir, max_size);
+	flock(lockfd, LOCK_UN);
+	close(lockfd);
+
+	return err;
+}
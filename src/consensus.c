@@ -0,0 +1,290 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <ncrunch/ncrunch.h>
+#include <ncrunch/games.h>
+#include <ncrunch/rating.h>
+#include <ncrunch/consensus.h>
+
+
+
+static const char *consensus_methods[] = { "borda", "mean", "kemeny" };
+
+
+/**
+ * One mode's run, on its own thread
+ */
+
+struct consensus_job {
+	const struct rating_mode *mode;
+	const struct games *games;
+	size_t num_teams;
+	double *ratings;
+	int err;
+};
+
+
+/**
+ * A sort key paired with its team; sorted ascending, ties by flatf row
+ */
+
+struct consensus_entry {
+	double key;
+	size_t id;
+	size_t row;
+};
+
+
+static int _compare(const void *a, const void *b)
+{
+	const struct consensus_entry *x = a;
+	const struct consensus_entry *y = b;
+
+	if (x->key != y->key)
+		return x->key < y->key ? -1 : 1;
+
+	return (x->row > y->row) - (x->row < y->row);
+}
+
+
+/**
+ * Sorts the teams by key into order
+ */
+
+static void _sort(struct consensus_entry *entries, size_t n, size_t *order)
+{
+	size_t i;
+
+	qsort(entries, n, sizeof(struct consensus_entry), _compare);
+
+	for (i = 0; i < n; i++)
+		order[i] = entries[i].id;
+}
+
+
+static void *_job(void *arg)
+{
+	struct consensus_job *job = arg;
+
+	job->err = rating_mode_solve(job->mode, job->games, job->num_teams, job->ratings);
+	return NULL;
+}
+
+
+/**
+ * How many modes rank team a above team b
+ */
+
+static size_t _prefer(const struct consensus *cons, size_t a, size_t b)
+{
+	size_t n = cons->num_teams;
+	size_t count = 0;
+	size_t m;
+
+	for (m = 0; m < cons->num_modes; m++)
+		count += cons->ranks[m * n + a] < cons->ranks[m * n + b];
+
+	return count;
+}
+
+
+/**
+ * Swaps neighbours in order while a majority of modes would have them the
+ * other way round; every swap lowers the total pairwise disagreement, so it
+ * ends
+ */
+
+static void _kemeny(struct consensus *cons)
+{
+	size_t *order = cons->order;
+	size_t pass, i, t;
+	int swapped = 1;
+
+	for (pass = 0; swapped && pass < CONSENSUS_MAXPASSES; pass++) {
+		swapped = 0;
+
+		for (i = 0; i + 1 < cons->num_teams; i++) {
+			if (_prefer(cons, order[i + 1], order[i]) > _prefer(cons, order[i], order[i + 1])) {
+				t = order[i];
+				order[i] = order[i + 1];
+				order[i + 1] = t;
+				swapped = 1;
+			}
+		}
+	}
+}
+
+
+/**
+ * Looks up a consensus method by name
+ *
+ * @return Negative if there is none by that name
+ */
+
+int consensus_method_find(const char *name, enum consensus_method *method)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(consensus_methods) / sizeof(consensus_methods[0]); i++) {
+		if (strcmp(consensus_methods[i], name) == 0) {
+			*method = i;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+
+/**
+ * Rates a season with every mode at once and combines their rankings
+ *
+ * @param modes The modes to run; the array must outlive cons
+ * @return Negative on error
+ */
+
+int consensus_run(struct consensus *cons, const struct rating_mode **modes, size_t num_modes,
+	const struct games *games, const struct ncrunch_ctx *ctx, enum consensus_method method)
+{
+	struct consensus_job *jobs;
+	struct consensus_entry *entries;
+	pthread_t *threads;
+	int *started;
+	size_t n = teams_num_teams(ctx);
+	size_t m, i;
+	int err = 0;
+
+	memset(cons, 0, sizeof(struct consensus));
+	cons->num_teams = n;
+	cons->num_modes = num_modes;
+	cons->modes = modes;
+
+	if (!n || !num_modes)
+		return 0;
+
+	cons->ratings = malloc(num_modes * n * sizeof(double));
+	cons->ranks = malloc(num_modes * n * sizeof(uint32_t));
+	cons->score = calloc(n, sizeof(double));
+	cons->order = malloc(n * sizeof(size_t));
+	jobs = calloc(num_modes, sizeof(struct consensus_job));
+	threads = malloc(num_modes * sizeof(pthread_t));
+	started = calloc(num_modes, sizeof(int));
+	entries = malloc(n * sizeof(struct consensus_entry));
+
+	if (!cons->ratings || !cons->ranks || !cons->score || !cons->order ||
+	    !jobs || !threads || !started || !entries) {
+		free(jobs);
+		free(threads);
+		free(started);
+		free(entries);
+		consensus_free(cons);
+		return -1;
+	}
+
+	for (m = 0; m < num_modes; m++) {
+		jobs[m].mode = modes[m];
+		jobs[m].games = games;
+		jobs[m].num_teams = n;
+		jobs[m].ratings = &cons->ratings[m * n];
+
+		started[m] = pthread_create(&threads[m], NULL, _job, &jobs[m]) == 0;
+	}
+
+	for (m = 0; m < num_modes; m++) {
+		if (started[m])
+			pthread_join(threads[m], NULL);
+		else
+			_job(&jobs[m]);
+
+		if (jobs[m].err < 0)
+			err = -2;
+	}
+
+	free(jobs);
+	free(threads);
+	free(started);
+
+	if (err < 0) {
+		free(entries);
+		consensus_free(cons);
+		return err;
+	}
+
+	for (m = 0; m < num_modes; m++) {
+		for (i = 0; i < n; i++) {
+			entries[i].key = -cons->ratings[m * n + i];
+			entries[i].id = i;
+			entries[i].row = team_get_row(ctx, i);
+		}
+
+		_sort(entries, n, cons->order);
+
+		for (i = 0; i < n; i++) {
+			cons->ranks[m * n + cons->order[i]] = i + 1;
+			cons->score[cons->order[i]] += method == CONSENSUS_MEAN ?
+				(double) (i + 1) / num_modes : (double) (n - i - 1);
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		entries[i].key = method == CONSENSUS_MEAN ? cons->score[i] : -cons->score[i];
+		entries[i].id = i;
+		entries[i].row = team_get_row(ctx, i);
+	}
+
+	_sort(entries, n, cons->order);
+	free(entries);
+
+	if (method == CONSENSUS_KEMENY)
+		_kemeny(cons);
+
+	return 0;
+}
+
+
+/**
+ * Writes the consensus ranking, one team per line
+ *
+ * Each line is tab separated: consensus rank, team name, score (borda
+ * points, or mean rank for mean), then the team's rank in each mode in the
+ * order the modes were given
+ *
+ * @return Negative on error
+ */
+
+int consensus_write(const struct ncrunch_ctx *ctx, const struct consensus *cons, FILE *out)
+{
+	size_t n = cons->num_teams;
+	size_t nameid;
+	size_t i, m, t;
+
+	if (tfl_find(ctx, "name", &nameid) < 0) {
+		fprintf(stderr, "%s: could not find required 'name' field\n", __func__);
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		t = cons->order[i];
+		fprintf(out, "%lu\t%s\t%g", i + 1, team_get_string(ctx, t, nameid), cons->score[t]);
+
+		for (m = 0; m < cons->num_modes; m++)
+			fprintf(out, "\t%u", cons->ranks[m * n + t]);
+
+		fputc('\n', out);
+	}
+
+	return 0;
+}
+
+
+void consensus_free(struct consensus *cons)
+{
+	free(cons->ratings);
+	free(cons->ranks);
+	free(cons->score);
+	free(cons->order);
+	memset(cons, 0, sizeof(struct consensus));
+}
@@ -0,0 +1,66 @@
+
+#pragma once
+
+#include <stdint.h>
+
+#include <ncrunch/ncrunch.h>
+#include <ncrunch/hash.h>
+
+
+
+/*
+ * The layout of a context, for the library's own sources only; everything
+ * outside teams.c and flatf.c goes through the functions in ncrunch.h
+ */
+
+
+/**
+ * A field in the team field list, along with its column of values
+ *
+ * The column holds max_teams values laid out as the type's C type
+ * (char *, double, int32_t, uint16_t, uint8_t, uint8_t, uint64_t bitmask).
+ * Tag bits index into tags.
+ */
+
+struct tfl_entry {
+	char *name;
+	enum tfl_type type;
+	void *data;
+
+	char **tags;
+	size_t num_tags;
+};
+
+
+/**
+ * A team; its field values live in the field list's columns
+ *
+ * Ids start out in flatf row order; row keeps that order when
+ * teams_permute() gives the teams new ids.
+ */
+
+struct team {
+	struct mdigest name;
+	uint32_t row;
+};
+
+
+/**
+ * A loaded dataset; see ncrunch.h
+ */
+
+struct ncrunch_ctx {
+	struct tfl_entry *tfl;
+	size_t num_fields;
+	size_t max_fields;	/* allocated size of tfl */
+
+	struct team *teams;
+	size_t num_teams;
+	size_t max_teams;	/* allocated size of teams and of each column */
+
+	struct ncrunch_stats *stats;	/* NULL unless instrumenting (stats.h) */
+
+	const char **load;	/* fields flatf_read() stores (flatf_set_fields()) */
+	size_t num_load;
+	uint8_t *skip;		/* per field, set if the read in progress leaves it out */
+};
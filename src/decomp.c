@@ -0,0 +1,381 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+
+#ifdef NCRUNCH_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef NCRUNCH_ZSTD
+#include <zstd.h>
+#endif
+
+#include <ncrunch/decomp.h>
+
+
+
+/* compressed bytes read from the file at a time */
+#define DECOMP_INSIZE  (128 * 1024)
+
+/* decoded bytes handed to the pipe at a time */
+#define DECOMP_OUTSIZE (64 * 1024)
+
+
+
+static const unsigned char gzip_magic[2] = { 0x1f, 0x8b };
+static const unsigned char zstd_magic[4] = { 0x28, 0xb5, 0x2f, 0xfd };
+
+
+
+#if defined(NCRUNCH_ZLIB) || defined(NCRUNCH_ZSTD)
+/**
+ * Reads up to len bytes, retrying short reads and interrupts
+ *
+ * @return The number of bytes read, 0 at end of file, negative on error
+ */
+
+static ssize_t _read_full(int fd, void *buf, size_t len)
+{
+	size_t done = 0;
+	ssize_t count;
+
+	while (done < len) {
+		count = read(fd, (char *) buf + done, len - done);
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count < 0)
+			return -1;
+		if (count == 0)
+			break;
+
+		done += count;
+	}
+
+	return done;
+}
+
+
+/**
+ * Writes all of buf to the pipe
+ *
+ * @return Negative if the reader has gone away or on error
+ */
+
+static int _write_full(int fd, const void *buf, size_t len)
+{
+	ssize_t count;
+
+	while (len) {
+		count = write(fd, buf, len);
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count < 0)
+			return -1;
+
+		buf = (const char *) buf + count;
+		len -= count;
+	}
+
+	return 0;
+}
+#endif
+
+
+#ifdef NCRUNCH_ZLIB
+/**
+ * Decodes gzip, including files of several concatenated members
+ */
+
+static int _produce_gzip(struct decomp *d, unsigned char *in, unsigned char *out)
+{
+	z_stream zs;
+	ssize_t count;
+	int ret = Z_OK;
+	int err = 0;
+
+	memset(&zs, 0, sizeof(z_stream));
+
+	/* 16 + MAX_WBITS: expect a gzip header and trailer */
+	if (inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK)
+		return -1;
+
+	while (!err) {
+		if (zs.avail_in == 0) {
+			count = _read_full(d->in, in, DECOMP_INSIZE);
+			if (count < 0) {
+				err = -2;
+				break;
+			}
+
+			if (count == 0) {
+				/* a clean end only between members */
+				if (ret != Z_STREAM_END)
+					err = -3;
+				break;
+			}
+
+			zs.next_in = in;
+			zs.avail_in = count;
+		}
+
+		if (ret == Z_STREAM_END)
+			inflateReset(&zs);
+
+		do {
+			zs.next_out = out;
+			zs.avail_out = DECOMP_OUTSIZE;
+
+			ret = inflate(&zs, Z_NO_FLUSH);
+			if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+				err = -3;
+				break;
+			}
+
+			if (_write_full(d->out, out, DECOMP_OUTSIZE - zs.avail_out) < 0) {
+				err = -4;
+				break;
+			}
+		} while (zs.avail_out == 0 && ret != Z_STREAM_END);
+	}
+
+	inflateEnd(&zs);
+	return err;
+}
+#endif
+
+
+#ifdef NCRUNCH_ZSTD
+/**
+ * Decodes zstd, including files of several concatenated frames
+ */
+
+static int _produce_zstd(struct decomp *d, unsigned char *in, unsigned char *out)
+{
+	ZSTD_DStream *zs;
+	ZSTD_inBuffer ib;
+	ZSTD_outBuffer ob;
+	ssize_t count;
+	size_t ret = 0;
+	int err = 0;
+
+	zs = ZSTD_createDStream();
+	if (!zs)
+		return -1;
+
+	ZSTD_initDStream(zs);
+
+	while (!err) {
+		count = _read_full(d->in, in, DECOMP_INSIZE);
+		if (count < 0) {
+			err = -2;
+			break;
+		}
+
+		if (count == 0) {
+			/* ret is 0 only at the end of a frame */
+			if (ret != 0)
+				err = -3;
+			break;
+		}
+
+		ib.src = in;
+		ib.size = count;
+		ib.pos = 0;
+
+		while (ib.pos < ib.size && !err) {
+			ob.dst = out;
+			ob.size = DECOMP_OUTSIZE;
+			ob.pos = 0;
+
+			ret = ZSTD_decompressStream(zs, &ob, &ib);
+			if (ZSTD_isError(ret)) {
+				err = -3;
+				break;
+			}
+
+			if (_write_full(d->out, out, ob.pos) < 0)
+				err = -4;
+		}
+	}
+
+	ZSTD_freeDStream(zs);
+	return err;
+}
+#endif
+
+
+/**
+ * Producer thread entry point
+ */
+
+static void *_produce(void *arg)
+{
+	struct decomp *d = arg;
+	unsigned char *in;
+	unsigned char *out;
+	sigset_t set;
+
+	/* a reader that stops early closes the pipe; take that as EPIPE */
+	sigemptyset(&set);
+	sigaddset(&set, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	in = malloc(DECOMP_INSIZE);
+	out = malloc(DECOMP_OUTSIZE);
+
+	if (!in || !out) {
+		d->err = -1;
+
+	} else {
+		switch (d->format) {
+#ifdef NCRUNCH_ZLIB
+		case DECOMP_GZIP:
+			d->err = _produce_gzip(d, in, out);
+			break;
+#endif
+#ifdef NCRUNCH_ZSTD
+		case DECOMP_ZSTD:
+			d->err = _produce_zstd(d, in, out);
+			break;
+#endif
+		default:
+			d->err = -1;
+			break;
+		}
+	}
+
+	free(in);
+	free(out);
+
+	/* the reader sees end of file */
+	close(d->out);
+	d->out = -1;
+
+	return NULL;
+}
+
+
+/**
+ * Looks at the start of a file for a compression format's magic number
+ *
+ * The file offset is left unchanged.
+ */
+
+enum decomp_format decomp_detect(int fd)
+{
+	unsigned char magic[4];
+	ssize_t count;
+
+	count = pread(fd, magic, sizeof(magic), 0);
+
+	if (count >= 2 && memcmp(magic, gzip_magic, sizeof(gzip_magic)) == 0)
+		return DECOMP_GZIP;
+
+	if (count >= 4 && memcmp(magic, zstd_magic, sizeof(zstd_magic)) == 0)
+		return DECOMP_ZSTD;
+
+	return DECOMP_NONE;
+}
+
+
+const char *decomp_format_name(enum decomp_format format)
+{
+	switch (format) {
+	case DECOMP_NONE: return "plain";
+	case DECOMP_GZIP: return "gzip";
+	case DECOMP_ZSTD: return "zstd";
+	}
+
+	return "invalid";
+}
+
+
+/**
+ * Starts decoding fd on a producer thread
+ *
+ * On success d->fd is the read end of the pipe the plain text comes out of;
+ * the caller reads it and closes it, then calls decomp_finish(). fd itself
+ * belongs to the decoder from here on.
+ *
+ * @return Negative if the format isn't built in or the thread can't start
+ */
+
+int decomp_start(struct decomp *d, int fd, enum decomp_format format)
+{
+	int fds[2];
+
+	memset(d, 0, sizeof(struct decomp));
+	d->format = format;
+	d->in = fd;
+	d->fd = -1;
+	d->out = -1;
+
+#ifndef NCRUNCH_ZLIB
+	if (format == DECOMP_GZIP) {
+		fprintf(stderr, "%s: built without gzip support\n", __func__);
+		return -1;
+	}
+#endif
+#ifndef NCRUNCH_ZSTD
+	if (format == DECOMP_ZSTD) {
+		fprintf(stderr, "%s: built without zstd support\n", __func__);
+		return -1;
+	}
+#endif
+
+	if (pipe2(fds, O_CLOEXEC) < 0) {
+		fprintf(stderr, "%s: could not create pipe: %s\n", __func__, strerror(errno));
+		return -2;
+	}
+
+	/* a larger ring lets the producer run further ahead; best effort */
+	fcntl(fds[1], F_SETPIPE_SZ, DECOMP_RINGSIZE);
+
+	d->fd = fds[0];
+	d->out = fds[1];
+
+	if (pthread_create(&d->thread, NULL, _produce, d) != 0) {
+		fprintf(stderr, "%s: could not start decoder thread\n", __func__);
+		close(fds[0]);
+		close(fds[1]);
+		d->fd = -1;
+		d->out = -1;
+		return -3;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Waits for the producer and closes the compressed file
+ *
+ * The caller must have closed d->fd first, or drained it to end of file.
+ *
+ * @return Negative if the input was corrupt, truncated or unreadable; a
+ * reader that stopped early is not an error
+ */
+
+int decomp_finish(struct decomp *d)
+{
+	pthread_join(d->thread, NULL);
+	close(d->in);
+	d->in = -1;
+
+	if (d->err == -4)
+		return 0;
+
+	if (d->err < 0) {
+		fprintf(stderr, "%s: %s input is corrupt or truncated\n", __func__, decomp_format_name(d->format));
+		return -1;
+	}
+
+	return 0;
+}
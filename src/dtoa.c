@@ -0,0 +1,460 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include <ncrunch/dtoa.h>
+
+
+
+/* the scaled value's binary exponent is kept in this range, so that its
+ * integer part fits in 32 bits and its fraction in 64 */
+#define DTOA_MINEXP  -60
+#define DTOA_MAXEXP  -32
+
+/* 10^k is cached for every eighth k from DTOA_POWERS_MIN */
+#define DTOA_POWERS_MIN  -348
+#define DTOA_POWERS_STEP 8
+
+#define DTOA_1_LOG2_10   0.30102999566398114
+
+
+
+/**
+ * A number f * 2^e, with a 64 bit significand and no hidden bit
+ */
+
+struct dtoa_fp {
+	uint64_t f;
+	int e;
+};
+
+
+/**
+ * A power of ten, 10^k = f * 2^e, its significand rounded to 64 bits
+ */
+
+struct dtoa_power {
+	uint64_t f;
+	int16_t e;
+	int16_t k;
+};
+
+
+static const struct dtoa_power dtoa_powers[] = {
+	{ 0xfa8fd5a0081c0288ULL, -1220, -348 },
+	{ 0xbaaee17fa23ebf76ULL, -1193, -340 },
+	{ 0x8b16fb203055ac76ULL, -1166, -332 },
+	{ 0xcf42894a5dce35eaULL, -1140, -324 },
+	{ 0x9a6bb0aa55653b2dULL, -1113, -316 },
+	{ 0xe61acf033d1a45dfULL, -1087, -308 },
+	{ 0xab70fe17c79ac6caULL, -1060, -300 },
+	{ 0xff77b1fcbebcdc4fULL, -1034, -292 },
+	{ 0xbe5691ef416bd60cULL, -1007, -284 },
+	{ 0x8dd01fad907ffc3cULL, -980, -276 },
+	{ 0xd3515c2831559a83ULL, -954, -268 },
+	{ 0x9d71ac8fada6c9b5ULL, -927, -260 },
+	{ 0xea9c227723ee8bcbULL, -901, -252 },
+	{ 0xaecc49914078536dULL, -874, -244 },
+	{ 0x823c12795db6ce57ULL, -847, -236 },
+	{ 0xc21094364dfb5637ULL, -821, -228 },
+	{ 0x9096ea6f3848984fULL, -794, -220 },
+	{ 0xd77485cb25823ac7ULL, -768, -212 },
+	{ 0xa086cfcd97bf97f4ULL, -741, -204 },
+	{ 0xef340a98172aace5ULL, -715, -196 },
+	{ 0xb23867fb2a35b28eULL, -688, -188 },
+	{ 0x84c8d4dfd2c63f3bULL, -661, -180 },
+	{ 0xc5dd44271ad3cdbaULL, -635, -172 },
+	{ 0x936b9fcebb25c996ULL, -608, -164 },
+	{ 0xdbac6c247d62a584ULL, -582, -156 },
+	{ 0xa3ab66580d5fdaf6ULL, -555, -148 },
+	{ 0xf3e2f893dec3f126ULL, -529, -140 },
+	{ 0xb5b5ada8aaff80b8ULL, -502, -132 },
+	{ 0x87625f056c7c4a8bULL, -475, -124 },
+	{ 0xc9bcff6034c13053ULL, -449, -116 },
+	{ 0x964e858c91ba2655ULL, -422, -108 },
+	{ 0xdff9772470297ebdULL, -396, -100 },
+	{ 0xa6dfbd9fb8e5b88fULL, -369, -92 },
+	{ 0xf8a95fcf88747d94ULL, -343, -84 },
+	{ 0xb94470938fa89bcfULL, -316, -76 },
+	{ 0x8a08f0f8bf0f156bULL, -289, -68 },
+	{ 0xcdb02555653131b6ULL, -263, -60 },
+	{ 0x993fe2c6d07b7facULL, -236, -52 },
+	{ 0xe45c10c42a2b3b06ULL, -210, -44 },
+	{ 0xaa242499697392d3ULL, -183, -36 },
+	{ 0xfd87b5f28300ca0eULL, -157, -28 },
+	{ 0xbce5086492111aebULL, -130, -20 },
+	{ 0x8cbccc096f5088ccULL, -103, -12 },
+	{ 0xd1b71758e219652cULL, -77, -4 },
+	{ 0x9c40000000000000ULL, -50, 4 },
+	{ 0xe8d4a51000000000ULL, -24, 12 },
+	{ 0xad78ebc5ac620000ULL, 3, 20 },
+	{ 0x813f3978f8940984ULL, 30, 28 },
+	{ 0xc097ce7bc90715b3ULL, 56, 36 },
+	{ 0x8f7e32ce7bea5c70ULL, 83, 44 },
+	{ 0xd5d238a4abe98068ULL, 109, 52 },
+	{ 0x9f4f2726179a2245ULL, 136, 60 },
+	{ 0xed63a231d4c4fb27ULL, 162, 68 },
+	{ 0xb0de65388cc8ada8ULL, 189, 76 },
+	{ 0x83c7088e1aab65dbULL, 216, 84 },
+	{ 0xc45d1df942711d9aULL, 242, 92 },
+	{ 0x924d692ca61be758ULL, 269, 100 },
+	{ 0xda01ee641a708deaULL, 295, 108 },
+	{ 0xa26da3999aef774aULL, 322, 116 },
+	{ 0xf209787bb47d6b85ULL, 348, 124 },
+	{ 0xb454e4a179dd1877ULL, 375, 132 },
+	{ 0x865b86925b9bc5c2ULL, 402, 140 },
+	{ 0xc83553c5c8965d3dULL, 428, 148 },
+	{ 0x952ab45cfa97a0b3ULL, 455, 156 },
+	{ 0xde469fbd99a05fe3ULL, 481, 164 },
+	{ 0xa59bc234db398c25ULL, 508, 172 },
+	{ 0xf6c69a72a3989f5cULL, 534, 180 },
+	{ 0xb7dcbf5354e9beceULL, 561, 188 },
+	{ 0x88fcf317f22241e2ULL, 588, 196 },
+	{ 0xcc20ce9bd35c78a5ULL, 614, 204 },
+	{ 0x98165af37b2153dfULL, 641, 212 },
+	{ 0xe2a0b5dc971f303aULL, 667, 220 },
+	{ 0xa8d9d1535ce3b396ULL, 694, 228 },
+	{ 0xfb9b7cd9a4a7443cULL, 720, 236 },
+	{ 0xbb764c4ca7a44410ULL, 747, 244 },
+	{ 0x8bab8eefb6409c1aULL, 774, 252 },
+	{ 0xd01fef10a657842cULL, 800, 260 },
+	{ 0x9b10a4e5e9913129ULL, 827, 268 },
+	{ 0xe7109bfba19c0c9dULL, 853, 276 },
+	{ 0xac2820d9623bf429ULL, 880, 284 },
+	{ 0x80444b5e7aa7cf85ULL, 907, 292 },
+	{ 0xbf21e44003acdd2dULL, 933, 300 },
+	{ 0x8e679c2f5e44ff8fULL, 960, 308 },
+	{ 0xd433179d9c8cb841ULL, 986, 316 },
+	{ 0x9e19db92b4e31ba9ULL, 1013, 324 },
+	{ 0xeb96bf6ebadf77d9ULL, 1039, 332 },
+	{ 0xaf87023b9bf0ee6bULL, 1066, 340 },
+};
+
+
+static const uint32_t dtoa_pow10[] = {
+	1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+
+/**
+ * The product of two numbers, its significand rounded to the upper 64 bits
+ */
+
+static struct dtoa_fp _multiply(struct dtoa_fp x, struct dtoa_fp y)
+{
+	const uint64_t mask = 0xffffffffu;
+	uint64_t a = x.f >> 32, b = x.f & mask;
+	uint64_t c = y.f >> 32, d = y.f & mask;
+	uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+	uint64_t mid;
+	struct dtoa_fp r;
+
+	mid = (bd >> 32) + (ad & mask) + (bc & mask) + ((uint64_t) 1 << 31);
+
+	r.f = ac + (ad >> 32) + (bc >> 32) + (mid >> 32);
+	r.e = x.e + y.e + 64;
+	return r;
+}
+
+
+static struct dtoa_fp _normalize(struct dtoa_fp x)
+{
+	int shift = __builtin_clzll(x.f);
+
+	x.f <<= shift;
+	x.e -= shift;
+	return x;
+}
+
+
+/**
+ * Splits a positive finite double into its normalized value and the
+ * boundaries halfway to its neighbours, all with the same exponent
+ */
+
+static void _boundaries(double val, struct dtoa_fp *w, struct dtoa_fp *minus, struct dtoa_fp *plus)
+{
+	uint64_t bits;
+	uint64_t fraction;
+	int biased;
+	struct dtoa_fp v;
+
+	memcpy(&bits, &val, sizeof(bits));
+	fraction = bits & (((uint64_t) 1 << 52) - 1);
+	biased = (bits >> 52) & 0x7ff;
+
+	if (biased) {
+		v.f = fraction | ((uint64_t) 1 << 52);
+		v.e = biased - 1075;
+	} else {
+		v.f = fraction;
+		v.e = -1074;
+	}
+
+	plus->f = (v.f << 1) + 1;
+	plus->e = v.e - 1;
+	*plus = _normalize(*plus);
+
+	/* at a power of two the next double down is half as far away */
+	if (fraction == 0 && biased > 1) {
+		minus->f = (v.f << 2) - 1;
+		minus->e = v.e - 2;
+	} else {
+		minus->f = (v.f << 1) - 1;
+		minus->e = v.e - 1;
+	}
+
+	minus->f <<= minus->e - plus->e;
+	minus->e = plus->e;
+
+	*w = _normalize(v);
+}
+
+
+/**
+ * Picks the cached power of ten that brings a number with binary exponent
+ * e into DTOA_MINEXP..DTOA_MAXEXP once multiplied in
+ */
+
+static const struct dtoa_power *_cached_power(int e)
+{
+	int min = DTOA_MINEXP - (e + 64);
+	int k = (int) ceil((min + 63) * DTOA_1_LOG2_10);
+
+	return &dtoa_powers[(k - DTOA_POWERS_MIN - 1) / DTOA_POWERS_STEP + 1];
+}
+
+
+/**
+ * Moves the last digit down while that brings it closer to the value, then
+ * checks that the result is certainly the closest of the shortest
+ *
+ * All distances are in the scaled unit; unit is how uncertain they are.
+ *
+ * @return 0 if Grisu3 can't be sure
+ */
+
+static int _round_weed(char *digits, int len, uint64_t too_high_w, uint64_t unsafe, uint64_t rest,
+	uint64_t ten_kappa, uint64_t unit)
+{
+	uint64_t small = too_high_w - unit;
+	uint64_t big = too_high_w + unit;
+
+	while (rest < small && unsafe - rest >= ten_kappa &&
+		(rest + ten_kappa < small || small - rest >= rest + ten_kappa - small)) {
+		digits[len - 1]--;
+		rest += ten_kappa;
+	}
+
+	if (rest < big && unsafe - rest >= ten_kappa &&
+		(rest + ten_kappa < big || big - rest > rest + ten_kappa - big))
+		return 0;
+
+	return 2 * unit <= rest && rest <= unsafe - 4 * unit;
+}
+
+
+/**
+ * Generates the shortest digits that land between the scaled boundaries
+ *
+ * @param kappa Receives the power of ten of the digits after the last one
+ * @return The number of digits, or 0 if Grisu3 can't be sure of them
+ */
+
+static int _digit_gen(struct dtoa_fp low, struct dtoa_fp w, struct dtoa_fp high, char *digits, int *kappa)
+{
+	uint64_t unit = 1;
+	uint64_t too_low = low.f - unit;
+	uint64_t too_high = high.f + unit;
+	uint64_t unsafe = too_high - too_low;
+	uint64_t one = (uint64_t) 1 << -w.e;
+	uint32_t integrals = too_high >> -w.e;
+	uint64_t fractionals = too_high & (one - 1);
+	uint64_t rest;
+	uint32_t divisor;
+	int len = 0;
+
+	for (*kappa = 0; *kappa < 10 && integrals >= dtoa_pow10[*kappa]; (*kappa)++)
+		;
+
+	divisor = *kappa ? dtoa_pow10[*kappa - 1] : 0;
+
+	while (*kappa > 0) {
+		digits[len++] = '0' + integrals / divisor;
+		integrals %= divisor;
+		(*kappa)--;
+
+		rest = ((uint64_t) integrals << -w.e) + fractionals;
+		if (rest < unsafe)
+			return _round_weed(digits, len, too_high - w.f, unsafe, rest, (uint64_t) divisor << -w.e, unit) ? len : 0;
+
+		divisor /= 10;
+	}
+
+	for (;;) {
+		fractionals *= 10;
+		unit *= 10;
+		unsafe *= 10;
+
+		digits[len++] = '0' + (fractionals >> -w.e);
+		fractionals &= one - 1;
+		(*kappa)--;
+
+		if (fractionals < unsafe)
+			return _round_weed(digits, len, (too_high - w.f) * unit, unsafe, fractionals, one, unit) ? len : 0;
+
+		if (len == DTOA_MAXDIGITS + 1)
+			return 0;
+	}
+}
+
+
+/**
+ * Finds the shortest digits through snprintf() and strtod(), for the
+ * doubles Grisu3 gives up on
+ */
+
+static int _fallback(double val, char *digits, int *exponent)
+{
+	char buf[32];
+	char *end;
+	int precision;
+	int len = 0;
+	int i;
+
+	for (precision = 0; precision < DTOA_MAXDIGITS; precision++) {
+		snprintf(buf, sizeof(buf), "%.*e", precision, val);
+		if (strtod(buf, NULL) == val)
+			break;
+	}
+
+	for (i = 0; buf[i] != 'e'; i++) {
+		if (buf[i] != '.')
+			digits[len++] = buf[i];
+	}
+
+	/* d.ddd e x has len digits, so the last one is worth 10^(x - len + 1) */
+	*exponent = (int) strtol(buf + i + 1, &end, 10) - len + 1;
+
+	while (len > 1 && digits[len - 1] == '0') {
+		len--;
+		(*exponent)++;
+	}
+
+	return len;
+}
+
+
+/**
+ * Finds the shortest digits that read back as a double
+ *
+ * @param val A positive finite double
+ * @param digits Receives at least one and at most DTOA_MAXDIGITS digits, not
+ * null terminated; room for DTOA_MAXDIGITS + 1
+ * @param exponent Receives the power of ten of the last digit
+ * @return The number of digits, or negative if val isn't positive and finite
+ */
+
+int dtoa_shortest(double val, char *digits, int *exponent)
+{
+	struct dtoa_fp w, minus, plus;
+	struct dtoa_fp ten_mk;
+	const struct dtoa_power *power;
+	int kappa;
+	int len;
+
+	if (!(val > 0) || isinf(val))
+		return -1;
+
+	_boundaries(val, &w, &minus, &plus);
+
+	power = _cached_power(w.e);
+	ten_mk.f = power->f;
+	ten_mk.e = power->e;
+
+	len = _digit_gen(_multiply(minus, ten_mk), _multiply(w, ten_mk), _multiply(plus, ten_mk), digits, &kappa);
+	if (len == 0)
+		return _fallback(val, digits, exponent);
+
+	*exponent = kappa - power->k;
+	return len;
+}
+
+
+/**
+ * Writes an integer's digits; returns how many
+ */
+
+static int _utoa(uint64_t val, char *buf)
+{
+	char tmp[20];
+	int len = 0;
+	int i;
+
+	do {
+		tmp[len++] = '0' + val % 10;
+		val /= 10;
+	} while (val);
+
+	for (i = 0; i < len; i++)
+		buf[i] = tmp[len - 1 - i];
+
+	return len;
+}
+
+
+/**
+ * Writes a double in plain decimal, never with an exponent, with the
+ * shortest digits that read back as the same double
+ *
+ * @param buf Room for DTOA_BUFSIZE; receives the text, null terminated
+ * @return The length of the text, or negative for NaN or infinity
+ */
+
+int dtoa_fixed(double val, char *buf)
+{
+	char digits[DTOA_MAXDIGITS + 1];
+	char *pos = buf;
+	int exponent;
+	int point;
+	int len;
+
+	if (isnan(val) || isinf(val))
+		return -1;
+
+	if (signbit(val)) {
+		*pos++ = '-';
+		val = -val;
+	}
+
+	if (val < 9007199254740992.0 && val == (double) (uint64_t) val) {
+		pos += _utoa((uint64_t) val, pos);
+		*pos = '\0';
+		return pos - buf;
+	}
+
+	len = dtoa_shortest(val, digits, &exponent);
+	point = len + exponent;		/* digits before the decimal point */
+
+	if (point <= 0) {
+		memcpy(pos, "0.", 2);
+		memset(pos + 2, '0', -point);
+		memcpy(pos + 2 - point, digits, len);
+		pos += 2 - point + len;
+	} else if (point >= len) {
+		memcpy(pos, digits, len);
+		memset(pos + len, '0', point - len);
+		pos += point;
+	} else {
+		memcpy(pos, digits, point);
+		pos[point] = '.';
+		memcpy(pos + point + 1, digits + point, len - point);
+		pos += len + 1;
+	}
+
+	*pos = '\0';
+	return pos - buf;
+}
@@ -0,0 +1,687 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <ctype.h>
+
+#include <ncrunch/ncrunch.h>
+#include <ncrunch/expr.h>
+
+
+
+#define EXPR_LINEBUFSIZE 512
+#define EXPR_NAMESIZE    64
+
+
+
+/**
+ * State used while compiling an expression
+ *
+ * The parser is a plain recursive descent over the source string; it emits
+ * postfix code straight into the program as it goes.
+ */
+
+struct parser {
+	const struct ncrunch_ctx *ctx;
+	const char *pos;
+	struct expr_prog *prog;
+	size_t capacity;
+	size_t depth;
+	int err;
+};
+
+
+/**
+ * Columns that have already been gathered out of the team list
+ *
+ * Evaluating a file full of computed fields tends to reference the same
+ * handful of source fields over and over; each one is only pulled out of the
+ * team list once. The scratch area holds the working column stack.
+ */
+
+struct colcache {
+	const struct ncrunch_ctx *ctx;
+	double **cols;
+	size_t num_cols;
+	size_t num_teams;
+	double *scratch;
+	size_t scratch_cols;
+};
+
+
+static int _parse_sum(struct parser *p);
+
+
+
+/**
+ * Appends an instruction to the program being compiled
+ *
+ * Constant operands are folded as they are emitted, so "2 * 3" costs a single
+ * push rather than three column passes.
+ */
+
+static void _emit(struct parser *p, enum expr_op op, size_t field, double val)
+{
+	struct expr_prog *prog = p->prog;
+	struct expr_insn *code;
+	struct expr_insn *a, *b;
+
+	if (p->err)
+		return;
+
+	if (op == EXPR_OP_NEG && prog->len > 0 && prog->code[prog->len - 1].op == EXPR_OP_CONST) {
+		prog->code[prog->len - 1].val = -prog->code[prog->len - 1].val;
+		return;
+	}
+
+	if (op >= EXPR_OP_ADD && op <= EXPR_OP_DIV && prog->len > 1) {
+		a = &prog->code[prog->len - 2];
+		b = &prog->code[prog->len - 1];
+
+		if (a->op == EXPR_OP_CONST && b->op == EXPR_OP_CONST) {
+			switch (op) {
+			case EXPR_OP_ADD: a->val += b->val; break;
+			case EXPR_OP_SUB: a->val -= b->val; break;
+			case EXPR_OP_MUL: a->val *= b->val; break;
+			default:          a->val /= b->val; break;
+			}
+
+			prog->len--;
+			p->depth--;
+			return;
+		}
+	}
+
+	if (prog->len == p->capacity) {
+		p->capacity = p->capacity ? p->capacity * 2 : 16;
+		code = realloc(prog->code, p->capacity * sizeof(struct expr_insn));
+		if (!code) {
+			p->err = -1;
+			return;
+		}
+
+		prog->code = code;
+	}
+
+	prog->code[prog->len].op = op;
+	prog->code[prog->len].field = field;
+	prog->code[prog->len].val = val;
+	prog->len++;
+
+	if (op == EXPR_OP_FIELD || op == EXPR_OP_CONST) {
+		p->depth++;
+		if (p->depth > prog->max_depth)
+			prog->max_depth = p->depth;
+	}
+
+	else if (op != EXPR_OP_NEG) {
+		p->depth--;
+	}
+}
+
+
+/**
+ * Skips any whitespace in front of the parser
+ */
+
+static void _skip_space(struct parser *p)
+{
+	while (isspace((unsigned char) *p->pos))
+		p->pos++;
+}
+
+
+/**
+ * Parses a number, a field name or a parenthesized sub-expression
+ *
+ * @return Negative on error
+ */
+
+static int _parse_primary(struct parser *p)
+{
+	char name[EXPR_NAMESIZE];
+	const char *start;
+	char *end;
+	size_t len;
+	size_t id;
+	double val;
+
+	_skip_space(p);
+
+	if (*p->pos == '(') {
+		p->pos++;
+		if (_parse_sum(p) < 0)
+			return -1;
+
+		_skip_space(p);
+		if (*p->pos != ')') {
+			fprintf(stderr, "%s: expected ')' at '%s'\n", __func__, p->pos);
+			return -1;
+		}
+
+		p->pos++;
+		return 0;
+	}
+
+	if (isdigit((unsigned char) *p->pos) || *p->pos == '.') {
+		val = strtod(p->pos, &end);
+		if (end == p->pos) {
+			fprintf(stderr, "%s: bad number at '%s'\n", __func__, p->pos);
+			return -1;
+		}
+
+		p->pos = end;
+		_emit(p, EXPR_OP_CONST, 0, val);
+		return 0;
+	}
+
+	if (isalpha((unsigned char) *p->pos) || *p->pos == '_') {
+		start = p->pos;
+		while (isalnum((unsigned char) *p->pos) || *p->pos == '_')
+			p->pos++;
+
+		len = p->pos - start;
+		if (len >= EXPR_NAMESIZE) {
+			fprintf(stderr, "%s: field name too long\n", __func__);
+			return -1;
+		}
+
+		memcpy(name, start, len);
+		name[len] = '\0';
+
+		if (tfl_find(p->ctx, name, &id) < 0) {
+			fprintf(stderr, "%s: unknown field '%s'\n", __func__, name);
+			return -1;
+		}
+
+		if (!tfl_type_numeric(tfl_get_type(p->ctx, id))) {
+			fprintf(stderr, "%s: field '%s' is not numeric\n", __func__, name);
+			return -1;
+		}
+
+		_emit(p, EXPR_OP_FIELD, id, 0.0);
+		return 0;
+	}
+
+	fprintf(stderr, "%s: unexpected '%s'\n", __func__, p->pos);
+	return -1;
+}
+
+
+/**
+ * Parses an optionally negated primary
+ *
+ * @return Negative on error
+ */
+
+static int _parse_unary(struct parser *p)
+{
+	_skip_space(p);
+
+	if (*p->pos == '-') {
+		p->pos++;
+		if (_parse_unary(p) < 0)
+			return -1;
+
+		_emit(p, EXPR_OP_NEG, 0, 0.0);
+		return 0;
+	}
+
+	if (*p->pos == '+') {
+		p->pos++;
+		return _parse_unary(p);
+	}
+
+	return _parse_primary(p);
+}
+
+
+/**
+ * Parses a chain of multiplications and divisions
+ *
+ * @return Negative on error
+ */
+
+static int _parse_product(struct parser *p)
+{
+	char op;
+
+	if (_parse_unary(p) < 0)
+		return -1;
+
+	for (;;) {
+		_skip_space(p);
+		op = *p->pos;
+
+		if (op != '*' && op != '/')
+			return 0;
+
+		p->pos++;
+		if (_parse_unary(p) < 0)
+			return -1;
+
+		_emit(p, op == '*' ? EXPR_OP_MUL : EXPR_OP_DIV, 0, 0.0);
+	}
+}
+
+
+/**
+ * Parses a chain of additions and subtractions
+ *
+ * @return Negative on error
+ */
+
+static int _parse_sum(struct parser *p)
+{
+	char op;
+
+	if (_parse_product(p) < 0)
+		return -1;
+
+	for (;;) {
+		_skip_space(p);
+		op = *p->pos;
+
+		if (op != '+' && op != '-')
+			return 0;
+
+		p->pos++;
+		if (_parse_product(p) < 0)
+			return -1;
+
+		_emit(p, op == '+' ? EXPR_OP_ADD : EXPR_OP_SUB, 0, 0.0);
+	}
+}
+
+
+/**
+ * Compiles an arithmetic expression over the double team fields
+ *
+ * Supports + - * /, unary minus, parentheses, numeric constants and field
+ * names. Field names are resolved against the team field list at compile
+ * time, so they must already exist.
+ *
+ * @param ctx The dataset whose fields may be referenced
+ * @param src The expression text
+ * @param prog The program to fill in; call expr_free() when done with it
+ * @return Negative on error
+ */
+
+int expr_compile(const struct ncrunch_ctx *ctx, const char *src, struct expr_prog *prog)
+{
+	struct parser p;
+
+	memset(prog, 0, sizeof(struct expr_prog));
+	memset(&p, 0, sizeof(struct parser));
+	p.ctx = ctx;
+	p.pos = src;
+	p.prog = prog;
+
+	if (_parse_sum(&p) < 0 || p.err) {
+		expr_free(prog);
+		return -1;
+	}
+
+	_skip_space(&p);
+	if (*p.pos) {
+		fprintf(stderr, "%s: trailing characters '%s'\n", __func__, p.pos);
+		expr_free(prog);
+		return -2;
+	}
+
+	assert(p.depth == 1);
+	return 0;
+}
+
+
+/**
+ * Frees the code allocated for a program
+ */
+
+void expr_free(struct expr_prog *prog)
+{
+	free(prog->code);
+	memset(prog, 0, sizeof(struct expr_prog));
+}
+
+
+/**
+ * Makes sure the cache has a slot for the given field
+ *
+ * @return Negative on error
+ */
+
+static int _cache_grow(struct colcache *cache, size_t field)
+{
+	double **cols;
+
+	if (field < cache->num_cols)
+		return 0;
+
+	cols = realloc(cache->cols, (field + 1) * sizeof(double *));
+	if (!cols)
+		return -1;
+
+	memset(&cols[cache->num_cols], 0, (field + 1 - cache->num_cols) * sizeof(double *));
+	cache->cols = cols;
+	cache->num_cols = field + 1;
+
+	return 0;
+}
+
+
+/**
+ * Returns the cached column for a field, gathering it from the teams if needed
+ *
+ * @return NULL on error
+ */
+
+static const double *_cache_column(struct colcache *cache, size_t field)
+{
+	if (_cache_grow(cache, field) < 0)
+		return NULL;
+
+	if (!cache->cols[field]) {
+		cache->cols[field] = malloc(cache->num_teams * sizeof(double));
+		if (!cache->cols[field])
+			return NULL;
+
+		teams_get_column(cache->ctx, field, cache->cols[field]);
+	}
+
+	return cache->cols[field];
+}
+
+
+/**
+ * Releases every column held by the cache
+ */
+
+static void _cache_destroy(struct colcache *cache)
+{
+	size_t i;
+
+	for (i = 0; i < cache->num_cols; i++) {
+		free(cache->cols[i]);
+	}
+
+	free(cache->cols);
+	free(cache->scratch);
+	memset(cache, 0, sizeof(struct colcache));
+}
+
+
+/* column kernels; kept trivial so that the compiler can vectorize them. dst
+ * may be a or b, as _eval() writes a result over its left operand */
+
+static void _col_add(double *dst, const double *a, const double *b, size_t n)
+{
+	size_t i;
+	for (i = 0; i < n; i++) dst[i] = a[i] + b[i];
+}
+
+static void _col_sub(double *dst, const double *a, const double *b, size_t n)
+{
+	size_t i;
+	for (i = 0; i < n; i++) dst[i] = a[i] - b[i];
+}
+
+static void _col_mul(double *dst, const double *a, const double *b, size_t n)
+{
+	size_t i;
+	for (i = 0; i < n; i++) dst[i] = a[i] * b[i];
+}
+
+static void _col_div(double *dst, const double *a, const double *b, size_t n)
+{
+	size_t i;
+	for (i = 0; i < n; i++) dst[i] = a[i] / b[i];
+}
+
+
+/**
+ * Runs a program over every team, one column at a time
+ *
+ * Each stack slot is a pointer to a column: field pushes point straight at
+ * the cached column and only computed intermediates are written to scratch.
+ *
+ * @param out Receives one result per team
+ * @return Negative on error
+ */
+
+static int _eval(const struct expr_prog *prog, struct colcache *cache, double *out)
+{
+	const double *stack[prog->max_depth];
+	const struct expr_insn *insn;
+	size_t n = cache->num_teams;
+	size_t top = 0;
+	size_t pc, i;
+	double *slot;
+	double *scratch;
+
+	if (n == 0)
+		return 0;
+
+	if (prog->max_depth > cache->scratch_cols) {
+		scratch = realloc(cache->scratch, prog->max_depth * n * sizeof(double));
+		if (!scratch)
+			return -1;
+
+		cache->scratch = scratch;
+		cache->scratch_cols = prog->max_depth;
+	}
+
+	for (pc = 0; pc < prog->len; pc++) {
+		insn = &prog->code[pc];
+
+		switch (insn->op) {
+		case EXPR_OP_FIELD:
+			stack[top] = _cache_column(cache, insn->field);
+			if (!stack[top])
+				return -1;
+			top++;
+			break;
+
+		case EXPR_OP_CONST:
+			slot = &cache->scratch[top * n];
+			for (i = 0; i < n; i++)
+				slot[i] = insn->val;
+			stack[top++] = slot;
+			break;
+
+		case EXPR_OP_NEG:
+			slot = &cache->scratch[(top - 1) * n];
+			for (i = 0; i < n; i++)
+				slot[i] = -stack[top - 1][i];
+			stack[top - 1] = slot;
+			break;
+
+		default:
+			slot = &cache->scratch[(top - 2) * n];
+
+			switch (insn->op) {
+			case EXPR_OP_ADD: _col_add(slot, stack[top - 2], stack[top - 1], n); break;
+			case EXPR_OP_SUB: _col_sub(slot, stack[top - 2], stack[top - 1], n); break;
+			case EXPR_OP_MUL: _col_mul(slot, stack[top - 2], stack[top - 1], n); break;
+			default:          _col_div(slot, stack[top - 2], stack[top - 1], n); break;
+			}
+
+			stack[top - 2] = slot;
+			top--;
+			break;
+		}
+	}
+
+	memcpy(out, stack[0], n * sizeof(double));
+	return 0;
+}
+
+
+/**
+ * Evaluates a compiled program for every team
+ *
+ * @param ctx The dataset the program was compiled against
+ * @param prog A program from expr_compile()
+ * @param out Receives one result per team, in team id order
+ * @return Negative on error
+ */
+
+int expr_eval(const struct ncrunch_ctx *ctx, const struct expr_prog *prog, double *out)
+{
+	struct colcache cache;
+	int err;
+
+	memset(&cache, 0, sizeof(struct colcache));
+	cache.ctx = ctx;
+	cache.num_teams = teams_num_teams(ctx);
+
+	err = _eval(prog, &cache, out);
+	_cache_destroy(&cache);
+
+	return err;
+}
+
+
+/**
+ * Splits a "name = expression" line from the computed fields file
+ *
+ * Comments (#) are stripped; blank lines give a zero length name.
+ *
+ * @param line The line, will be modified
+ * @param name Set to the start of the field name
+ * @param src Set to the start of the expression
+ * @return Negative if the line is malformed
+ */
+
+static int _split_line(char *line, char **name, char **src)
+{
+	char *c;
+	char *end;
+
+	c = strchr(line, '#');
+	if (c)
+		*c = '\0';
+
+	while (isspace((unsigned char) *line))
+		line++;
+
+	*name = line;
+	*src = line;
+
+	if (!*line)
+		return 0;
+
+	c = strchr(line, '=');
+	if (!c)
+		return -1;
+
+	end = c;
+	while (end > line && isspace((unsigned char) end[-1]))
+		end--;
+
+	if (end == line)
+		return -1;
+
+	*end = '\0';
+	*src = c + 1;
+
+	return 0;
+}
+
+
+/**
+ * Reads a file of computed field definitions and adds each to the teams
+ *
+ * Each line has the form "name = expression". Definitions are compiled once,
+ * evaluated over all teams and registered as new double fields in the team
+ * field list, in file order; a definition may use any field above it.
+ *
+ * @param ctx The dataset to add the fields to
+ * @param filename The computed fields file
+ * @return Negative on error
+ */
+
+int expr_load(struct ncrunch_ctx *ctx, const char *filename)
+{
+	FILE *file;
+	char line[EXPR_LINEBUFSIZE];
+	struct colcache cache;
+	struct expr_prog prog;
+	size_t line_num = 0;
+	size_t id;
+	char *name, *src;
+	double *column;
+	int err = 0;
+
+	file = fopen(filename, "r");
+	if (!file) {
+		fprintf(stderr, "%s: could not open file '%s'\n", __func__, filename);
+		return -1;
+	}
+
+	memset(&cache, 0, sizeof(struct colcache));
+	cache.ctx = ctx;
+	cache.num_teams = teams_num_teams(ctx);
+
+	while (fgets(line, sizeof(line), file)) {
+		line_num++;
+
+		/* a line that didn't fit would come back as two definitions; only
+		 * the last line of the file may lack its newline */
+		if (!strchr(line, '\n') && getc(file) != EOF) {
+			fprintf(stderr, "%s: %s:%lu: line too long; at most %d characters\n", __func__, filename, line_num,
+				EXPR_LINEBUFSIZE - 2);
+			err = -2;
+			break;
+		}
+
+		if (_split_line(line, &name, &src) < 0) {
+			fprintf(stderr, "%s: %s:%lu: expected 'name = expression'\n", __func__, filename, line_num);
+			err = -2;
+			break;
+		}
+
+		if (!*name)
+			continue;
+
+		if (tfl_find(ctx, name, &id) == 0) {
+			fprintf(stderr, "%s: %s:%lu: field '%s' already exists\n", __func__, filename, line_num, name);
+			err = -3;
+			break;
+		}
+
+		if (expr_compile(ctx, src, &prog) < 0) {
+			fprintf(stderr, "%s: %s:%lu: could not compile '%s'\n", __func__, filename, line_num, name);
+			err = -4;
+			break;
+		}
+
+		column = malloc(cache.num_teams * sizeof(double));
+		err = (column || !cache.num_teams) ? _eval(&prog, &cache, column) : -1;
+		expr_free(&prog);
+
+		if (!err)
+			err = tfl_add(ctx, name, TEAM_FIELD_DOUBLE, &id);
+
+		if (!err)
+			err = _cache_grow(&cache, id);
+
+		if (err) {
+			fprintf(stderr, "%s: %s:%lu: could not evaluate '%s'\n", __func__, filename, line_num, name);
+			free(column);
+			err = -5;
+			break;
+		}
+
+		teams_set_column(ctx, id, column);
+
+		/* hand the result to the cache so later definitions can use it */
+		cache.cols[id] = column;
+	}
+
+	_cache_destroy(&cache);
+	fclose(file);
+
+	return err;
+}
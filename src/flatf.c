@@ -4,18 +4,30 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <ctype.h>
+#include <strings.h>
+#include <errno.h>
 
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <sys/mman.h>
 
 
 #include <ncrunch/ncrunch.h>
+#include <ncrunch/stats.h>
+#include <ncrunch/decomp.h>
+#include <ncrunch/dtoa.h>
 
+#include "ctx.h"
+#include "flatf_internal.h"
 
 
-#define FLATF_READBUFSIZE 256
+
+/* rows read ahead to pick each column's type */
+#define FLATF_SAMPLEROWS  1024
 
 
 
@@ -26,7 +38,7 @@
  * @return Negative if error
  */
 
-static int _open_file(const char* filename)
+int flatf_open_file(const char* filename)
 {
 	int fd;
 
@@ -72,7 +84,7 @@ static int _close_file(int fd)
  * @return The number of characters read into the buffer
  */
 
-static size_t _read_line(int fd, char* buffer)
+size_t flatf_read_line(int fd, char* buffer)
 {
 	size_t count = 0;
 	char c;
@@ -99,57 +111,78 @@ static size_t _read_line(int fd, char* buffer)
 
 
 /**
- * A token from the current line in the buffer
- *
- * The str pointer points into the buffer - DO NOT FREE IT
+ * Where rows come from: a file descriptor, or a flatf already in memory
  */
 
-struct token {
-	const char *str;	/* pointer into buffer */
-	struct token *next;
+struct flatf_src {
+	int fd;			/* used when data is NULL */
+	const char *data;
+	size_t len;
+	size_t pos;
 };
 
 
 /**
- * Contains a list of tokens from a line in the flatf
+ * flatf_read_line() for a flatf in memory; the same limits apply, but the last
+ * line doesn't need a newline
  *
- * Create by calling _tokenize_line()
- * Cleaned up by calling _deallocate_tokens()
+ * @return The number of characters copied into the buffer
  */
 
-struct tokenlist {
-	struct token *head;
-	size_t num_tokens;
-};
+static size_t _copy_line(struct flatf_src *src, char *buffer)
+{
+	const char *start = src->data + src->pos;
+	const char *eol;
+	size_t count;
+
+	if (src->pos >= src->len)
+		return 0;
+
+	eol = memchr(start, '\n', src->len - src->pos);
+	count = eol ? (size_t) (eol - start) : src->len - src->pos;
+
+	if (count >= FLATF_READBUFSIZE) {
+		fprintf(stderr, "%s: Line too long for buffer!\n", __func__);
+		src->pos = src->len;
+		return 0;
+	}
+
+	memcpy(buffer, start, count);
+	buffer[count] = '\0';
+	src->pos += count + (eol != NULL);
+
+	return count;
+}
 
 
 /**
  * Tokenizes the line contained in a buffer into a token list
  *
  * Each token in the list will be allocated inside the function
- * Be sure to call _deallocate_tokens() afterwords
+ * Be sure to call flatf_deallocate_tokens() afterwords
  *
  * @param buffer The buffer that contains a line to be tokenized, it will be modified
  * during the tokenization process
  *
  * @param list The container for the resulting tokens; the individual tokens
- * will be allocated as needed. Call _deallocate_tokens() when done to clean
+ * will be allocated as needed. Call flatf_deallocate_tokens() when done to clean
  * up the list.
  *
  * @return The number of characters read, not including the null terminator
  */
 
-static size_t _tokenize_line(char* buffer, struct tokenlist *list)
+size_t flatf_tokenize_line(char* buffer, struct tokenlist *list)
 {
 	struct token *token = NULL;
 	size_t count = 0;
 	char *str;
+	char *save;
 
 	/* go ahead and reset the list, they better have deallocated! */
 	memset(list, 0, sizeof(struct tokenlist));
 
 
-	str = strtok(buffer, "\t");
+	str = strtok_r(buffer, "\t", &save);
 
 	while (str) {
 		if (!list->head) {
@@ -164,7 +197,7 @@ static size_t _tokenize_line(char* buffer, struct tokenlist *list)
 		token->next = NULL;
 		count++;
 
-		str = strtok(NULL, "\t");
+		str = strtok_r(NULL, "\t", &save);
 	}
 
 	list->num_tokens = count;
@@ -176,7 +209,7 @@ static size_t _tokenize_line(char* buffer, struct tokenlist *list)
  * Deallocates the tokens in a token list
  */
 
-static void _deallocate_tokens(struct tokenlist *list)
+void flatf_deallocate_tokens(struct tokenlist *list)
 {
 	struct token *token = list->head;
 	struct token *next;
@@ -192,6 +225,66 @@ static void _deallocate_tokens(struct tokenlist *list)
 }
 
 
+/**
+ * Reads the next line from the source, plus the context's read statistics
+ */
+
+static size_t _read_row(struct ncrunch_ctx *ctx, struct flatf_src *src, char *buf)
+{
+	uint64_t start = stats_begin(ctx->stats);
+	size_t count;
+
+	if (src->data)
+		count = _copy_line(src, buf);
+	else
+		count = flatf_read_line(src->fd, buf);
+
+	stats_end(ctx->stats, STATS_READ, start);
+	if (count)
+		stats_add(ctx->stats, STATS_READ, count + 1, 1, 0, 0);
+
+	return count;
+}
+
+
+/**
+ * flatf_tokenize_line() plus the context's tokenize statistics
+ */
+
+static size_t _tokenize_row(struct ncrunch_ctx *ctx, char *buf, struct tokenlist *list)
+{
+	uint64_t start = stats_begin(ctx->stats);
+	size_t num_tokens;
+
+	num_tokens = flatf_tokenize_line(buf, list);
+
+	stats_end(ctx->stats, STATS_TOKENIZE, start);
+	stats_add(ctx->stats, STATS_TOKENIZE, 0, 1, num_tokens, num_tokens);
+
+	return num_tokens;
+}
+
+
+/**
+ * Whether a column is one flatf_set_fields() asked for; "name" always is
+ */
+
+static int _wanted(const struct ncrunch_ctx *ctx, const char *name)
+{
+	size_t i;
+
+	if (!ctx->load || strcmp(name, "name") == 0)
+		return 1;
+
+	for (i = 0; i < ctx->num_load; i++) {
+		if (strcmp(ctx->load[i], name) == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+
 /**
  * Reads the first line of the flat file and adds each heading as a field in the
  * team fields list.
@@ -200,7 +293,7 @@ static void _deallocate_tokens(struct tokenlist *list)
  * @return The number of fields added to the team field list
  */
 
-static size_t _read_fields_list(int fd, char *buf)
+static size_t _read_fields_list(struct ncrunch_ctx *ctx, struct flatf_src *src, char *buf)
 {
 	size_t count;
 	struct tokenlist list;
@@ -208,36 +301,41 @@ static size_t _read_fields_list(int fd, char *buf)
 	size_t num_tokens;
 	size_t i;
 
-	count = _read_line(fd, buf);
+	count = _read_row(ctx, src, buf);
 	if (!count) {
 		/* no data or too much data! */
 		fprintf(stderr, "%s: failed to read fields line\n", __func__);
 		return 0;
 	}
 
-	num_tokens = _tokenize_line(buf, &list);
+	num_tokens = _tokenize_row(ctx, buf, &list);
 	if (!num_tokens) {
 		/* not formatted correctly */
 		fprintf(stderr, "%s: fields line incorrectly formatted\n", __func__);
-		_deallocate_tokens(&list);
+		flatf_deallocate_tokens(&list);
+		return 0;
+	}
+
+	ctx->skip = calloc(num_tokens, 1);
+	if (!ctx->skip || tfl_create(ctx, num_tokens) < 0) {
+		flatf_deallocate_tokens(&list);
 		return 0;
 	}
 
-	
-	tfl_create(num_tokens);
 	token = list.head;
 
 	for (i = 0; i < num_tokens; i++) {
-		tfl_set_name(i, token->str);
+		tfl_set_name(ctx, i, token->str);
+		ctx->skip[i] = !_wanted(ctx, token->str);
+
 		token = token->next;
 	}
 
-	_deallocate_tokens(&list);
+	flatf_deallocate_tokens(&list);
 	return num_tokens;	
 }
 
 
-#if 0
 /**
  * Finds the string name associated with the team's name
  *
@@ -245,13 +343,13 @@ static size_t _read_fields_list(int fd, char *buf)
  * @return Returns the string name of the currently being read team
  */
 
-static const char *_get_team_name(struct _token *list)
+static const char *_get_team_name(const struct ncrunch_ctx *ctx, const struct token *list)
 {
 	size_t i;
 	size_t nameid;
 	int err;
 
-	err = tfl_find("name", &nameid);
+	err = tfl_find(ctx, "name", &nameid);
 	if (err) {
 		fprintf(stderr, "%s: could not find required 'name' field\n", __func__);
 		return NULL;
@@ -263,7 +361,6 @@ static const char *_get_team_name(struct _token *list)
 
 	return list->str;
 }
-#endif
 
 
 /**
@@ -273,7 +370,7 @@ static const char *_get_team_name(struct _token *list)
  * @return 1 if string contains only valid alpha chars; or 0 otherwise
  */
 
-static int _isAlpha(const char *str)
+int flatf_is_alpha(const char *str)
 {
 	while (*str) {
 		if (!isalpha(*str) && !ispunct(*str) && *str != ' ') {
@@ -288,14 +385,18 @@ static int _isAlpha(const char *str)
 
 
 /**
- * Returns whether a string consists only of numbers
+ * Returns whether a string consists only of numbers, after an optional
+ * leading minus
  *
  * @param str The string to be tested
  * @return 1 if string contains only valid number chars; or 0 otherwise
  */
 
-static int _isNumeric(const char *str)
+int flatf_is_numeric(const char *str)
 {
+	if (*str == '-')
+		str++;
+
 	while (*str) {
 		if (!isdigit(*str) && *str != '.') {
 			return 0;
@@ -311,25 +412,26 @@ static int _isNumeric(const char *str)
 /**
  * Sets a team's field to a string value
  *
+ * @param ctx The dataset being read into
  * @param teamid The team that contains the field
  * @param fieldid The field that is to be set
  * @param str The string value to set the field to (copy)
  * @return Negative on error
  */
 
-static int _set_alpha_field(size_t teamid, size_t fieldid, const char *str)
+static int _set_alpha_field(struct ncrunch_ctx *ctx, size_t teamid, size_t fieldid, const char *str)
 {
-	enum tfl_type type = tfl_get_type(fieldid);
+	enum tfl_type type = tfl_get_type(ctx, fieldid);
 
-	if (type == TEAM_FIELD_DOUBLE) {
+	if (tfl_type_numeric(type) && type != TEAM_FIELD_BOOL) {
 		fprintf(stderr, "%s: token '%s' is not numeric!\n", __func__, str);
 		return -1;
 
 	} else if (type == TEAM_FIELD_INVALID) {
-		tfl_set_type(fieldid, TEAM_FIELD_STRING);
+		tfl_set_type(ctx, fieldid, TEAM_FIELD_STRING);
 	}
 
-	team_set_string(teamid, fieldid, str);
+	team_set_string(ctx, teamid, fieldid, str);
 
 	return 0;
 }
@@ -338,27 +440,28 @@ static int _set_alpha_field(size_t teamid, size_t fieldid, const char *str)
 /**
  * Sets a team's field to a double value
  *
+ * @param ctx The dataset being read into
  * @param teamid The team that contains the field
  * @param fieldid The field that is to be set
  * @param str The string containing a numeric value
  * @return Negative on error
  */
 
-static int  _set_numeric_field(size_t teamid, size_t fieldid, const char *str)
+static int  _set_numeric_field(struct ncrunch_ctx *ctx, size_t teamid, size_t fieldid, const char *str)
 {
 	double conv;
-	enum tfl_type type = tfl_get_type(fieldid);
+	enum tfl_type type = tfl_get_type(ctx, fieldid);
 
-	if (type == TEAM_FIELD_STRING) {
+	if (type == TEAM_FIELD_STRING || type == TEAM_FIELD_TAGS || type == TEAM_FIELD_BOOL) {
 		fprintf(stderr, "%s: token '%s' is not alpha!\n", __func__, str);
 		return -2;
 
 	} else if (type == TEAM_FIELD_INVALID) {
-		tfl_set_type(fieldid, TEAM_FIELD_DOUBLE);
+		tfl_set_type(ctx, fieldid, TEAM_FIELD_DOUBLE);
 	}
 
 	conv = atof(str);
-	team_set_double(teamid, fieldid, conv);
+	team_set_double(ctx, teamid, fieldid, conv);
 
 	return 0;
 }
@@ -372,24 +475,44 @@ static int  _set_numeric_field(size_t teamid, size_t fieldid, const char *str)
  * @return Negative on error
  */
 
-static int _set_fields(const struct tokenlist *list, size_t teamid)
+static int _set_fields(struct ncrunch_ctx *ctx, const struct tokenlist *list, size_t teamid)
 {
 	size_t id = 0;
 	int err = 0;
 	struct token *token = list->head;
+	uint64_t start;
+	int alpha, numeric;
 
 	while (token) {
-		if (_isAlpha(token->str)) {
-			err = _set_alpha_field(teamid, id, token->str);
+		/* still counted by _parse_team(), but neither checked nor kept */
+		if (ctx->skip[id]) {
+			token = token->next;
+			id++;
+			continue;
+		}
+
+		start = stats_begin(ctx->stats);
+		alpha = flatf_is_alpha(token->str);
+		numeric = !alpha && flatf_is_numeric(token->str);
+		stats_end(ctx->stats, STATS_INFER, start);
+		stats_add(ctx->stats, STATS_INFER, 0, 0, 1, 0);
+
+		start = stats_begin(ctx->stats);
+
+		if (alpha) {
+			err = _set_alpha_field(ctx, teamid, id, token->str);
 		} 
-		else if (_isNumeric(token->str)) {
-			err = _set_numeric_field(teamid, id, token->str);
+		else if (numeric) {
+			err = _set_numeric_field(ctx, teamid, id, token->str);
 		}
 		else {
 			fprintf(stderr, "%s: illegal value '%s'\n", __func__, token->str);
 			err = -3;
 		}
 
+		stats_end(ctx->stats, STATS_SET, start);
+		stats_add(ctx->stats, STATS_SET, 0, 0, 1, 0);
+
 		if (err)
 			break;
 
@@ -408,104 +531,1384 @@ static int _set_fields(const struct tokenlist *list, size_t teamid)
  * @return Negative on error
  */
 
-static int _create_team(const struct tokenlist *list)
+static int _create_team(struct ncrunch_ctx *ctx, const struct tokenlist *list)
 {
 	int err;
 	size_t teamid;
+	const char *name;
+	uint64_t start;
 
 
-	teamid = team_create();
+	start = stats_begin(ctx->stats);
+	teamid = team_create(ctx);
+	stats_end(ctx->stats, STATS_CREATE, start);
+
 	if (teamid == TEAMS_INVALID) {
 		fprintf(stderr, "%s: unable to create team\n", __func__);
 		return -2;
 	}
 
-	err = _set_fields(list, teamid);
+	err = _set_fields(ctx, list, teamid);
 	if (err) {
 		fprintf(stderr, "%s: unable to read field for team\n", __func__);
 		return -3;
 	}
 
+	name = _get_team_name(ctx, list->head);
+	if (!name) {
+		return -4;
+	}
+
+	start = stats_begin(ctx->stats);
+	team_set_name(ctx, teamid, name);
+	stats_end(ctx->stats, STATS_SET, start);
+	stats_add(ctx->stats, STATS_SET, 0, 1, 0, 0);
+
 	return 0;
 }
 
 
 /**
- * Reads a line from the file and interprets it as team data.
+ * Interprets a line already in the buffer as team data
  *
- * @param buf The buffer to use for reading
+ * @param buf The line; it is modified by tokenizing
  * @return The difference between the number of fields read and the number of fields
  * in the team field list
  */
 
-static size_t _read_team(int fd, char *buf)
+static size_t _parse_team(struct ncrunch_ctx *ctx, char *buf)
 {
-	size_t count;
-	size_t toread = tfl_num_fields();
+	size_t toread = tfl_num_fields(ctx);
 	struct tokenlist list;
-	struct token *token;
 	size_t num_tokens;
-	size_t i;
-
-	count = _read_line(fd, buf);
-	if (!count) {
-		return toread;
-	}
 
-	num_tokens = _tokenize_line(buf, &list);
+	num_tokens = _tokenize_row(ctx, buf, &list);
 	if (num_tokens != toread) {
 		fprintf(stderr, "%s: team only has %lu/%lu fields\n", __func__, num_tokens, toread);
-		_deallocate_tokens(&list);
+		flatf_deallocate_tokens(&list);
 		return (num_tokens - toread);
 	}
 
-	token = list.head;
-	for (i = 0; i < num_tokens; i++) {
-		token = token->next;
+	_create_team(ctx, &list);
+	flatf_deallocate_tokens(&list);
+	return 0;
+}
+
+
+/**
+ * Reads a line from the file and interprets it as team data.
+ *
+ * @param buf The buffer to use for reading
+ * @return The difference between the number of fields read and the number of fields
+ * in the team field list
+ */
+
+static size_t _read_team(struct ncrunch_ctx *ctx, struct flatf_src *src, char *buf)
+{
+	size_t count;
+
+	count = _read_row(ctx, src, buf);
+	if (!count) {
+		return tfl_num_fields(ctx);
+	}
+
+	return _parse_team(ctx, buf);
+}
+
+
+/**
+ * What the sample has shown about one column
+ */
+
+struct flatf_infer {
+	size_t alpha;
+	size_t numeric;
+	size_t fraction;	/* numeric values with a decimal point */
+	size_t boolean;		/* alpha values spelling "true" or "false" */
+	double min;
+	double max;
+
+	char *words[TFL_MAXTAGS];	/* distinct space separated words */
+	size_t num_words;
+	int too_many_words;
+};
+
+
+/**
+ * The first rows of the flatf, read ahead to pick column types
+ */
+
+struct flatf_sample {
+	char *lines[FLATF_SAMPLEROWS];
+	size_t num_lines;
+	int done;		/* the flatf ended within the sample */
+};
+
+
+/**
+ * Reads up to FLATF_SAMPLEROWS lines into the sample
+ *
+ * @return Negative on error
+ */
+
+static int _read_sample(struct ncrunch_ctx *ctx, struct flatf_src *src, char *buf, struct flatf_sample *sample)
+{
+	memset(sample, 0, sizeof(struct flatf_sample));
+
+	while (sample->num_lines < FLATF_SAMPLEROWS) {
+		if (!_read_row(ctx, src, buf)) {
+			sample->done = 1;
+			break;
+		}
+
+		sample->lines[sample->num_lines] = strdup(buf);
+		if (!sample->lines[sample->num_lines])
+			return -1;
+
+		sample->num_lines++;
+		stats_add(ctx->stats, STATS_READ, 0, 0, 0, 1);
 	}
 
-	_create_team(&list);
-	_deallocate_tokens(&list);
 	return 0;
 }
 
 
+static void _free_sample(struct flatf_sample *sample)
+{
+	size_t i;
+
+	for (i = 0; i < sample->num_lines; i++)
+		free(sample->lines[i]);
+
+	sample->num_lines = 0;
+}
+
+
 /**
- * Reads the flat file; The first line of the file is interpreted as the field list
- * (since the headings of the columns correspond to the data below). The team field
- * list is populated from this line. The rest of the lines are used to fill out the
- * individual teams.
+ * Adds a value's words to a column's distinct words
+ */
+
+static void _infer_words(struct flatf_infer *inf, const char *str)
+{
+	char copy[FLATF_READBUFSIZE];
+	char *word;
+	char *save;
+	size_t i;
+
+	snprintf(copy, sizeof(copy), "%s", str);
+
+	for (word = strtok_r(copy, " ", &save); word; word = strtok_r(NULL, " ", &save)) {
+		for (i = 0; i < inf->num_words; i++) {
+			if (strcmp(inf->words[i], word) == 0)
+				break;
+		}
+
+		if (i < inf->num_words)
+			continue;
+
+		if (inf->num_words == TFL_MAXTAGS)
+			inf->too_many_words = 1;
+		else
+			inf->words[inf->num_words++] = strdup(word);
+	}
+}
+
+
+/**
+ * Adds one value to what is known about its column
+ */
+
+static void _infer_value(struct flatf_infer *inf, const char *str)
+{
+	double val;
+
+	if (flatf_is_alpha(str)) {
+		inf->alpha++;
+
+		if (strcasecmp(str, "true") == 0 || strcasecmp(str, "false") == 0)
+			inf->boolean++;
+
+		if (!inf->too_many_words)
+			_infer_words(inf, str);
+
+	} else if (flatf_is_numeric(str)) {
+		inf->numeric++;
+
+		if (strchr(str, '.'))
+			inf->fraction++;
+
+		val = atof(str);
+		if (val < inf->min)
+			inf->min = val;
+		if (val > inf->max)
+			inf->max = val;
+	}
+}
+
+
+/**
+ * Picks the narrowest type that holds every value the sample has shown
+ *
+ * Columns whose sample mixes alpha and numeric values are left untyped, so
+ * the first row decides and later rows are rejected as before. Only the
+ * "tags" field becomes a tag set, and only while it has at most TFL_MAXTAGS
+ * distinct words: a set keeps neither word order nor repeats, which would
+ * lose what any other text says.
+ */
+
+static enum tfl_type _infer_type(const struct flatf_infer *inf, const char *name)
+{
+	if (inf->alpha && inf->numeric)
+		return TEAM_FIELD_INVALID;
+
+	if (inf->numeric) {
+		if (inf->fraction)
+			return TEAM_FIELD_DOUBLE;
+		if (inf->min >= 0 && inf->max <= UINT8_MAX)
+			return TEAM_FIELD_UINT8;
+		if (inf->min >= 0 && inf->max <= UINT16_MAX)
+			return TEAM_FIELD_UINT16;
+		if (inf->min >= INT32_MIN && inf->max <= INT32_MAX)
+			return TEAM_FIELD_INT32;
+		return TEAM_FIELD_DOUBLE;
+	}
+
+	if (inf->alpha) {
+		if (inf->boolean == inf->alpha)
+			return TEAM_FIELD_BOOL;
+		if (strcmp(name, "tags") == 0 && !inf->too_many_words)
+			return TEAM_FIELD_TAGS;
+		return TEAM_FIELD_STRING;
+	}
+
+	return TEAM_FIELD_INVALID;
+}
+
+
+/**
+ * Sets each field's type from the values in the sample
+ *
+ * Rows with the wrong number of fields are skipped here; they are reported
+ * when the sample is parsed.
  *
  * @return Negative on error
  */
 
-int flatf_read(const char *filename)
+static int _infer_types(struct ncrunch_ctx *ctx, const struct flatf_sample *sample)
 {
-	int fd;
 	char buf[FLATF_READBUFSIZE];
-	size_t count;
-	size_t diff;
-
+	size_t num_fields = tfl_num_fields(ctx);
+	struct flatf_infer *infer;
+	struct tokenlist list;
+	struct token *token;
+	enum tfl_type type;
+	uint64_t start;
+	size_t i, j;
 
-	fd = _open_file(filename);
-	if (fd < 0) {
-		fprintf(stderr, "%s: could not open file '%s'\n", __func__, filename);
+	infer = calloc(num_fields, sizeof(struct flatf_infer));
+	if (!infer)
 		return -1;
+
+	start = stats_begin(ctx->stats);
+
+	for (i = 0; i < sample->num_lines; i++) {
+		strcpy(buf, sample->lines[i]);
+
+		if (flatf_tokenize_line(buf, &list) == num_fields) {
+			for (j = 0, token = list.head; token; j++, token = token->next) {
+				if (!ctx->skip[j])
+					_infer_value(&infer[j], token->str);
+			}
+
+			stats_add(ctx->stats, STATS_INFER, 0, 1, num_fields, 0);
+		}
+
+		flatf_deallocate_tokens(&list);
+	}
+
+	for (j = 0; j < num_fields; j++) {
+		type = ctx->skip[j] ? TEAM_FIELD_INVALID : _infer_type(&infer[j], tfl_get_name(ctx, j));
+		if (type != TEAM_FIELD_INVALID)
+			tfl_set_type(ctx, j, type);
+
+		for (i = 0; i < infer[j].num_words; i++)
+			free(infer[j].words[i]);
 	}
 
+	stats_end(ctx->stats, STATS_INFER, start);
+
+	free(infer);
+	return 0;
+}
+
+
+/**
+ * Reads the heading and then every team from a source
+ *
+ * @return Negative on error
+ */
+
+static int _read_teams(struct ncrunch_ctx *ctx, struct flatf_src *src)
+{
+	char buf[FLATF_READBUFSIZE];
+	struct flatf_sample sample;
+	size_t count;
+	size_t diff;
+	size_t i;
+	int done;
+
 	/* read heading line which contains the variable names */
-	count = _read_fields_list(fd, buf);
+	count = _read_fields_list(ctx, src, buf);
 	if (count == 0) {
 		return -2;
 	}
 
-	do {
-		diff = _read_team(fd, buf);
-	} while (!diff);
+	/* pick column types from the first rows, then load those rows */
+	if (_read_sample(ctx, src, buf, &sample) < 0 || _infer_types(ctx, &sample) < 0) {
+		_free_sample(&sample);
+		return -3;
+	}
+
+	diff = 0;
+	for (i = 0; !diff && i < sample.num_lines; i++) {
+		strcpy(buf, sample.lines[i]);
+		diff = _parse_team(ctx, buf);
+	}
 
+	done = sample.done;
+	_free_sample(&sample);
 
-	_close_file(fd);
+	while (!diff && !done) {
+		diff = _read_team(ctx, src, buf);
+	}
 
 	return 0;
 }
 
+
+/**
+ * Reads a flatf with _read_teams(); which columns it skips only matters
+ * while it reads
+ *
+ * @return Negative on error
+ */
+
+static int _read_flatf(struct ncrunch_ctx *ctx, struct flatf_src *src)
+{
+	int err;
+
+	err = _read_teams(ctx, src);
+
+	free(ctx->skip);
+	ctx->skip = NULL;
+	return err;
+}
+
+
+/**
+ * Closes the file flatf_read() was reading and, for compressed input, waits
+ * for the decoder
+ *
+ * @return Negative if the compressed input turned out to be bad
+ */
+
+static int _finish_read(struct ncrunch_ctx *ctx, int fd, enum decomp_format format, struct decomp *decomp)
+{
+	uint64_t start;
+	int err = 0;
+
+	start = stats_begin(ctx->stats);
+	_close_file(fd);
+
+	if (format != DECOMP_NONE)
+		err = decomp_finish(decomp);
+
+	stats_end(ctx->stats, STATS_OPEN, start);
+
+	return err;
+}
+
+
+/**
+ * Reads the flat file; The first line of the file is interpreted as the field list
+ * (since the headings of the columns correspond to the data below). The team field
+ * list is populated from this line. The rest of the lines are used to fill out the
+ * individual teams.
+ *
+ * gzip and zstd files are recognised by their magic number and decoded on
+ * a second thread while they are parsed.
+ *
+ * @param ctx An empty context to read the dataset into
+ * @param filename The flat file to read
+ * @return Negative on error
+ */
+
+int flatf_read(struct ncrunch_ctx *ctx, const char *filename)
+{
+	struct flatf_src src;
+	struct decomp decomp;
+	enum decomp_format format;
+	uint64_t start;
+	int err;
+	int fd;
+
+
+	start = stats_begin(ctx->stats);
+	fd = flatf_open_file(filename);
+
+	/* compressed input is decoded on another thread as it is parsed */
+	format = fd < 0 ? DECOMP_NONE : decomp_detect(fd);
+	if (format != DECOMP_NONE) {
+		if (decomp_start(&decomp, fd, format) < 0) {
+			close(fd);
+			return -1;
+		}
+
+		fd = decomp.fd;
+	}
+
+	stats_end(ctx->stats, STATS_OPEN, start);
+
+	if (fd < 0) {
+		fprintf(stderr, "%s: could not open file '%s'\n", __func__, filename);
+		return -1;
+	}
+
+	memset(&src, 0, sizeof(struct flatf_src));
+	src.fd = fd;
+
+	err = _read_flatf(ctx, &src);
+
+	if (_finish_read(ctx, fd, format, &decomp) < 0 && !err) {
+		return -4;
+	}
+
+	return err;
+}
+
+
+/**
+ * Reads a flatf that is already in memory, as flatf_read() does a file
+ *
+ * The data is not modified and need not be null terminated. Compressed data
+ * is not recognised here.
+ *
+ * @param ctx An empty context to read the dataset into
+ * @return Negative on error
+ */
+
+int flatf_read_mem(struct ncrunch_ctx *ctx, const char *data, size_t len)
+{
+	struct flatf_src src;
+
+	memset(&src, 0, sizeof(struct flatf_src));
+	src.fd = -1;
+	src.data = data;
+	src.len = len;
+
+	return _read_flatf(ctx, &src);
+}
+
+
+/**
+ * Limits the next reads into a context to some of the flatf's columns
+ *
+ * Every column is still counted, so a short or long row is still caught,
+ * but the rest are neither checked nor converted and stay TEAM_FIELD_INVALID,
+ * with no storage. "name" is always read. A name no column has is ignored.
+ *
+ * @param names The fields to read (Not copied; keep them until the reads are
+ * done), or NULL for every field
+ * @param num The number of names
+ */
+
+void flatf_set_fields(struct ncrunch_ctx *ctx, const char **names, size_t num)
+{
+	ctx->load = names;
+	ctx->num_load = names ? num : 0;
+}
+
+
+
+
+/*
+ * Validation (-c)
+ *
+ * The data rows are split into chunks at line boundaries and each chunk is
+ * checked on its own thread with the same tokenizer and value tests as the
+ * loader. Errors are kept per chunk with chunk-relative line numbers, then
+ * numbered and printed in file order once every chunk is done.
+ */
+
+
+/* bytes of data per validation thread, at least */
+#define FLATF_CHUNKSIZE   (4 * 1024 * 1024)
+#define FLATF_MAXTHREADS  64
+
+#define FLATF_CLASS_ILLEGAL 0
+#define FLATF_CLASS_ALPHA   1
+#define FLATF_CLASS_NUMERIC 2
+
+
+/**
+ * One problem found in the flatf
+ */
+
+struct flatf_error {
+	size_t line;		/* relative to the chunk until numbered */
+	size_t col;		/* 1-based byte column; 0 for the whole line */
+	const char *pos;	/* start of the line in the file */
+	int empty;		/* an empty line; only an error if data follows */
+	char reason[160];
+};
+
+
+/**
+ * What every chunk checks against, taken from the heading and first row
+ */
+
+struct flatf_check {
+	size_t num_fields;
+	char *names[TFL_MAXFIELDS];
+	int classes[TFL_MAXFIELDS];	/* from the first full row; 0 if unknown */
+};
+
+
+struct flatf_chunk {
+	const struct flatf_check *check;
+	const char *start;
+	const char *end;
+
+	size_t num_lines;
+	size_t num_rows;	/* lines that make a team */
+
+	struct flatf_error *errors;
+	size_t num_errors;
+	size_t max_errors;
+	int err;		/* out of memory */
+};
+
+
+/**
+ * Classifies a value the way _set_fields() does
+ */
+
+static int _classify(const char *str)
+{
+	if (flatf_is_alpha(str))
+		return FLATF_CLASS_ALPHA;
+
+	if (flatf_is_numeric(str))
+		return FLATF_CLASS_NUMERIC;
+
+	return FLATF_CLASS_ILLEGAL;
+}
+
+
+/**
+ * Records an error in a chunk
+ */
+
+static struct flatf_error *_add_error(struct flatf_chunk *chunk, size_t line, size_t col, const char *pos)
+{
+	struct flatf_error *errors;
+	size_t max_errors;
+
+	if (chunk->num_errors == chunk->max_errors) {
+		max_errors = chunk->max_errors ? chunk->max_errors * 2 : 64;
+		errors = realloc(chunk->errors, max_errors * sizeof(struct flatf_error));
+		if (!errors) {
+			chunk->err = 1;
+			return NULL;
+		}
+
+		chunk->errors = errors;
+		chunk->max_errors = max_errors;
+	}
+
+	errors = &chunk->errors[chunk->num_errors++];
+	memset(errors, 0, sizeof(struct flatf_error));
+	errors->line = line;
+	errors->col = col;
+	errors->pos = pos;
+
+	return errors;
+}
+
+
+/**
+ * Checks one data line
+ *
+ * @param line The line's number within the chunk
+ * @param pos The line in the file; len bytes, without the newline
+ */
+
+static void _check_line(struct flatf_chunk *chunk, size_t line, const char *pos, size_t len)
+{
+	const struct flatf_check *check = chunk->check;
+	char buf[FLATF_READBUFSIZE];
+	struct tokenlist list;
+	struct token *token;
+	struct flatf_error *e;
+	size_t num_tokens;
+	size_t i;
+	int cls;
+
+	if (len == 0) {
+		e = _add_error(chunk, line, 0, pos);
+		if (e) {
+			e->empty = 1;
+			snprintf(e->reason, sizeof(e->reason), "empty line; the rows after it are not loaded");
+		}
+		return;
+	}
+
+	if (len >= FLATF_READBUFSIZE) {
+		e = _add_error(chunk, line, 0, pos);
+		if (e)
+			snprintf(e->reason, sizeof(e->reason), "line is %lu bytes; at most %d fit", len, FLATF_READBUFSIZE - 1);
+		return;
+	}
+
+	memcpy(buf, pos, len);
+	buf[len] = '\0';
+
+	num_tokens = flatf_tokenize_line(buf, &list);
+	if (num_tokens != check->num_fields) {
+		e = _add_error(chunk, line, 0, pos);
+		if (e)
+			snprintf(e->reason, sizeof(e->reason), "has %lu fields; expected %lu", num_tokens, check->num_fields);
+
+		flatf_deallocate_tokens(&list);
+		return;
+	}
+
+	for (i = 0, token = list.head; token; i++, token = token->next) {
+		cls = _classify(token->str);
+
+		if (cls == FLATF_CLASS_ILLEGAL) {
+			e = _add_error(chunk, line, token->str - buf + 1, pos);
+			if (e)
+				snprintf(e->reason, sizeof(e->reason), "field '%s': illegal value '%.40s'", check->names[i], token->str);
+
+		} else if (check->classes[i] && cls != check->classes[i]) {
+			e = _add_error(chunk, line, token->str - buf + 1, pos);
+			if (e)
+				snprintf(e->reason, sizeof(e->reason), "field '%s': expected %s value, got '%.40s'", check->names[i],
+					check->classes[i] == FLATF_CLASS_ALPHA ? "an alpha" : "a numeric", token->str);
+		}
+	}
+
+	flatf_deallocate_tokens(&list);
+	chunk->num_rows++;
+}
+
+
+/**
+ * Thread entry point; checks every line in a chunk
+ */
+
+static void *_check_chunk(void *arg)
+{
+	struct flatf_chunk *chunk = arg;
+	const char *pos = chunk->start;
+	const char *eol;
+
+	while (pos < chunk->end && !chunk->err) {
+		eol = memchr(pos, '\n', chunk->end - pos);
+		if (!eol)
+			eol = chunk->end;
+
+		_check_line(chunk, chunk->num_lines, pos, eol - pos);
+		chunk->num_lines++;
+		pos = eol + 1;
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Checks the heading line and fills in the field names
+ *
+ * @return The number of errors found
+ */
+
+static size_t _check_heading(struct flatf_check *check, const char *filename, const char *pos, size_t len, FILE *out)
+{
+	char buf[FLATF_READBUFSIZE];
+	struct tokenlist list;
+	struct token *token;
+	size_t errors = 0;
+	size_t i, j;
+	int has_name = 0;
+
+	if (len == 0 || len >= FLATF_READBUFSIZE) {
+		fprintf(out, "%s:1: heading line is %lu bytes; expected 1 to %d\n", filename, len, FLATF_READBUFSIZE - 1);
+		return 1;
+	}
+
+	memcpy(buf, pos, len);
+	buf[len] = '\0';
+	flatf_tokenize_line(buf, &list);
+
+	if (list.num_tokens > TFL_MAXFIELDS) {
+		fprintf(out, "%s:1: %lu fields; at most %d are supported\n", filename, list.num_tokens, TFL_MAXFIELDS);
+		flatf_deallocate_tokens(&list);
+		return 1;
+	}
+
+	for (i = 0, token = list.head; token; i++, token = token->next) {
+		if (!flatf_is_alpha(token->str)) {
+			fprintf(out, "%s:1:%ld: field heading '%s' is not valid\n", filename, token->str - buf + 1, token->str);
+			errors++;
+		}
+
+		for (j = 0; j < i; j++) {
+			if (strcmp(check->names[j], token->str) == 0) {
+				fprintf(out, "%s:1:%ld: field heading '%s' is repeated\n", filename, token->str - buf + 1, token->str);
+				errors++;
+			}
+		}
+
+		if (strcmp(token->str, "name") == 0)
+			has_name = 1;
+
+		check->names[i] = strdup(token->str);
+	}
+
+	check->num_fields = list.num_tokens;
+	flatf_deallocate_tokens(&list);
+
+	if (!has_name) {
+		fprintf(out, "%s:1: required field 'name' missing\n", filename);
+		errors++;
+	}
+
+	return errors;
+}
+
+
+/**
+ * Takes the expected alpha/numeric class of each field from the first row
+ * with the right number of fields, as the loader does
+ */
+
+static void _check_classes(struct flatf_check *check, const char *pos, const char *end)
+{
+	char buf[FLATF_READBUFSIZE];
+	struct tokenlist list;
+	struct token *token;
+	const char *eol;
+	size_t i;
+
+	while (pos < end) {
+		eol = memchr(pos, '\n', end - pos);
+		if (!eol)
+			eol = end;
+
+		if (eol - pos > 0 && eol - pos < FLATF_READBUFSIZE) {
+			memcpy(buf, pos, eol - pos);
+			buf[eol - pos] = '\0';
+
+			if (flatf_tokenize_line(buf, &list) == check->num_fields) {
+				for (i = 0, token = list.head; token; i++, token = token->next)
+					check->classes[i] = _classify(token->str);
+
+				flatf_deallocate_tokens(&list);
+				return;
+			}
+
+			flatf_deallocate_tokens(&list);
+		}
+
+		pos = eol + 1;
+	}
+}
+
+
+/**
+ * Makes the whole of a flatf available in memory for checking
+ *
+ * Plain files are mapped; compressed ones are decoded into a buffer.
+ *
+ * @param mapped Set if the data must be unmapped rather than freed
+ * @return Negative on error
+ */
+
+static int _load_input(const char *filename, const char **data, size_t *len, int *mapped)
+{
+	struct decomp decomp;
+	enum decomp_format format;
+	struct stat st;
+	char *buf = NULL;
+	char *tmp;
+	size_t size = 0;
+	size_t grow;
+	ssize_t count = 0;
+	int fd;
+
+	*data = NULL;
+	*len = 0;
+	*mapped = 0;
+
+	fd = flatf_open_file(filename);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		fprintf(stderr, "%s: could not open file '%s'\n", __func__, filename);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	format = decomp_detect(fd);
+
+	if (format == DECOMP_NONE) {
+		if (st.st_size == 0) {
+			close(fd);
+			return 0;
+		}
+
+		*data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+
+		if (*data == MAP_FAILED) {
+			fprintf(stderr, "%s: could not map file '%s'\n", __func__, filename);
+			*data = NULL;
+			return -2;
+		}
+
+		madvise((void *) *data, st.st_size, MADV_SEQUENTIAL);
+		*len = st.st_size;
+		*mapped = 1;
+		return 0;
+	}
+
+	if (decomp_start(&decomp, fd, format) < 0) {
+		close(fd);
+		return -3;
+	}
+
+	for (;;) {
+		if (*len == size) {
+			grow = size ? size * 2 : 4 * (size_t) st.st_size + 4096;
+			tmp = realloc(buf, grow);
+			if (!tmp)
+				break;
+			buf = tmp;
+			size = grow;
+		}
+
+		count = read(decomp.fd, buf + *len, size - *len);
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count <= 0)
+			break;
+
+		*len += count;
+	}
+
+	close(decomp.fd);
+
+	if (decomp_finish(&decomp) < 0 || count < 0 || *len == size) {
+		free(buf);
+		*len = 0;
+		return -4;
+	}
+
+	*data = buf;
+	return 0;
+}
+
+
+static void _unload_input(const char *data, size_t len, int mapped)
+{
+	if (mapped)
+		munmap((void *) data, len);
+	else
+		free((void *) data);
+}
+
+
+/**
+ * Checks a flatf without loading it and reports every problem found
+ *
+ * Each problem is written as one line, "file:line[:column]: reason", in
+ * file order; the column is the byte column of the offending field. The
+ * checks are those the loader applies: a valid heading with a 'name' field,
+ * the same number of fields on every row, values that are alpha or numeric
+ * and agree with the first row, lines that fit the read buffer, no empty
+ * lines before the end of the data and no more than TEAMS_MAXTEAMS teams.
+ * Large files are checked in parallel; compressed files are decoded first.
+ *
+ * @param filename The flatf to check
+ * @param out Where to write the problems
+ * @return The number of problems, or negative if the file couldn't be read
+ */
+
+long flatf_validate(const char *filename, FILE *out)
+{
+	struct flatf_check check;
+	struct flatf_chunk *chunks;
+	pthread_t threads[FLATF_MAXTHREADS];
+	int started[FLATF_MAXTHREADS] = { 0 };
+	const char *data;
+	const char *end;
+	const char *body;
+	const char *last;
+	const char *eol;
+	size_t len;
+	size_t num_chunks;
+	size_t line = 2;	/* the first data line */
+	size_t rows = 0;
+	long errors = 0;
+	long ncpu;
+	size_t i, j;
+	int mapped;
+
+	if (_load_input(filename, &data, &len, &mapped) < 0)
+		return -1;
+
+	if (len == 0) {
+		_unload_input(data, len, mapped);
+		fprintf(out, "%s:1: file is empty\n", filename);
+		return 1;
+	}
+
+	end = data + len;
+
+	memset(&check, 0, sizeof(struct flatf_check));
+
+	eol = memchr(data, '\n', len);
+	if (!eol)
+		eol = end;
+
+	errors += _check_heading(&check, filename, data, eol - data, out);
+	body = eol < end ? eol + 1 : end;
+
+	/* the last byte of data; empty lines after it are harmless */
+	last = end - 1;
+	while (last >= body && *last == '\n')
+		last--;
+
+	_check_classes(&check, body, end);
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	num_chunks = (end - body) / FLATF_CHUNKSIZE + 1;
+	if (ncpu > 0 && num_chunks > (size_t) ncpu)
+		num_chunks = ncpu;
+	if (num_chunks > FLATF_MAXTHREADS)
+		num_chunks = FLATF_MAXTHREADS;
+
+	chunks = calloc(num_chunks, sizeof(struct flatf_chunk));
+	if (!chunks) {
+		_unload_input(data, len, mapped);
+		return -3;
+	}
+
+	/* split at line boundaries; a chunk may end up empty */
+	for (i = 0; i < num_chunks; i++) {
+		chunks[i].check = &check;
+		chunks[i].start = i ? chunks[i - 1].end : body;
+		chunks[i].end = body + (end - body) * (i + 1) / num_chunks;
+
+		if (chunks[i].end < chunks[i].start)
+			chunks[i].end = chunks[i].start;
+
+		if (i == num_chunks - 1) {
+			chunks[i].end = end;
+		} else {
+			eol = memchr(chunks[i].end, '\n', end - chunks[i].end);
+			chunks[i].end = eol ? eol + 1 : end;
+		}
+	}
+
+	for (i = 1; i < num_chunks; i++) {
+		started[i] = pthread_create(&threads[i], NULL, _check_chunk, &chunks[i]) == 0;
+		if (!started[i])
+			_check_chunk(&chunks[i]);
+	}
+
+	_check_chunk(&chunks[0]);
+
+	for (i = 1; i < num_chunks; i++) {
+		if (started[i])
+			pthread_join(threads[i], NULL);
+	}
+
+	for (i = 0; i < num_chunks; i++) {
+		if (chunks[i].err) {
+			fprintf(stderr, "%s: out of memory\n", __func__);
+			errors = -4;
+		}
+
+		for (j = 0; errors >= 0 && j < chunks[i].num_errors; j++) {
+			if (chunks[i].errors[j].empty && chunks[i].errors[j].pos > last)
+				continue;
+
+			if (chunks[i].errors[j].col)
+				fprintf(out, "%s:%lu:%lu: %s\n", filename, line + chunks[i].errors[j].line,
+					chunks[i].errors[j].col, chunks[i].errors[j].reason);
+			else
+				fprintf(out, "%s:%lu: %s\n", filename, line + chunks[i].errors[j].line,
+					chunks[i].errors[j].reason);
+
+			errors++;
+		}
+
+		line += chunks[i].num_lines;
+		rows += chunks[i].num_rows;
+		free(chunks[i].errors);
+	}
+
+	if (errors >= 0 && rows > TEAMS_MAXTEAMS) {
+		fprintf(out, "%s: %lu teams; at most %d are supported\n", filename, rows, TEAMS_MAXTEAMS);
+		errors++;
+	}
+
+	for (i = 0; i < check.num_fields; i++)
+		free(check.names[i]);
+
+	free(chunks);
+	_unload_input(data, len, mapped);
+
+	return errors;
+}
+
+
+
+#define FLATF_WRITEBUFSIZE (1024 * 1024)
+
+
+/**
+ * Output buffer for flatf_write()
+ *
+ * Rows are formatted straight into one large buffer that is handed to
+ * write() only when it fills up. The first error sticks and makes the
+ * remaining puts no-ops.
+ */
+
+struct flatf_out {
+	int fd;
+	char *data;
+	size_t len;
+	size_t flushed;		/* bytes written out before data */
+	int err;
+};
+
+
+/**
+ * A team and where it was in the flatf it came from
+ */
+
+struct flatf_row {
+	size_t row;
+	size_t id;
+};
+
+
+/**
+ * Writes out everything in the buffer
+ */
+
+static void _flush(struct flatf_out *out)
+{
+	size_t done = 0;
+	ssize_t count;
+
+	while (!out->err && done < out->len) {
+		count = write(out->fd, out->data + done, out->len - done);
+
+		if (count < 0 && errno == EINTR)
+			continue;
+
+		if (count <= 0)
+			out->err = -1;
+		else
+			done += count;
+	}
+
+	out->flushed += out->len;
+	out->len = 0;
+}
+
+
+static void _put(struct flatf_out *out, const char *data, size_t len)
+{
+	size_t chunk;
+
+	while (len && !out->err) {
+		if (out->len == FLATF_WRITEBUFSIZE)
+			_flush(out);
+
+		chunk = FLATF_WRITEBUFSIZE - out->len;
+		if (chunk > len)
+			chunk = len;
+
+		memcpy(out->data + out->len, data, chunk);
+		out->len += chunk;
+		data += chunk;
+		len -= chunk;
+	}
+}
+
+
+/**
+ * Makes room for len more bytes and returns where they go
+ */
+
+static char *_reserve(struct flatf_out *out, size_t len)
+{
+	if (FLATF_WRITEBUFSIZE - out->len < len)
+		_flush(out);
+
+	return out->data + out->len;
+}
+
+
+/**
+ * Ends a line begun at offset start, unless it is too long for
+ * flatf_read() to read back
+ *
+ * @param line The line's number in the file, for the error
+ * @return Negative if the line is too long
+ */
+
+static int _end_line(struct flatf_out *out, size_t start, size_t line)
+{
+	size_t len = out->flushed + out->len - start;
+
+	if (len >= FLATF_READBUFSIZE) {
+		fprintf(stderr, "%s: line %lu is %lu bytes; at most %d can be read back\n", __func__, line, len,
+			FLATF_READBUFSIZE - 1);
+		return -1;
+	}
+
+	_put(out, "\n", 1);
+	return 0;
+}
+
+
+/**
+ * qsort() callback; by flatf row
+ */
+
+static int _compare_rows(const void *a, const void *b)
+{
+	const struct flatf_row *x = a;
+	const struct flatf_row *y = b;
+
+	return (x->row > y->row) - (x->row < y->row);
+}
+
+
+/**
+ * Writes one value of a team
+ *
+ * Text has to be something _set_fields() reads back as the same text: not
+ * empty, and alpha throughout (which also keeps out tabs and newlines).
+ *
+ * @return Negative if the value can't be written
+ */
+
+static int _put_value(struct flatf_out *out, const struct ncrunch_ctx *ctx, size_t id, size_t field)
+{
+	char text[FLATF_READBUFSIZE];
+	const char *str = text;
+	enum tfl_type type = tfl_get_type(ctx, field);
+	double val;
+	char *pos;
+	int len;
+
+	if (tfl_type_numeric(type) && type != TEAM_FIELD_BOOL) {
+		team_get_double(ctx, id, field, &val);
+
+		pos = _reserve(out, DTOA_BUFSIZE);
+		len = dtoa_fixed(val, pos);
+		if (len < 0) {
+			fprintf(stderr, "%s: field '%s' of row %lu is not a number\n", __func__,
+				tfl_get_name(ctx, field), team_get_row(ctx, id));
+			return -1;
+		}
+
+		out->len += len;
+		return 0;
+	}
+
+	if (type == TEAM_FIELD_STRING) {
+		str = team_get_string(ctx, id, field);
+		len = str ? (int) strlen(str) : 0;
+	} else {
+		len = team_get_text(ctx, id, field, text, sizeof(text));
+	}
+
+	if (len <= 0 || len >= FLATF_READBUFSIZE || !flatf_is_alpha(str)) {
+		fprintf(stderr, "%s: field '%s' of row %lu can't be written to a flatf\n", __func__,
+			tfl_get_name(ctx, field), team_get_row(ctx, id));
+		return -2;
+	}
+
+	_put(out, str, len);
+	return 0;
+}
+
+
+/**
+ * Syncs the directory that holds filename, so that a rename into it
+ * survives a crash
+ *
+ * @return Negative on error
+ */
+
+static int _sync_dir(const char *filename)
+{
+	char path[FILENAME_MAX];
+	int fd;
+	int err = 0;
+
+	snprintf(path, FILENAME_MAX, "%s", filename);
+
+	fd = open(dirname(path), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	if (fsync(fd) < 0)
+		err = -2;
+
+	close(fd);
+	return err;
+}
+
+
+/**
+ * Writes every team to a flat file that flatf_read() reads back, computed
+ * fields included
+ *
+ * Teams are written in the order of the flatf they were read from (see
+ * team_get_row()), fields in field list order. Numbers are written in plain
+ * decimal with the fewest digits that read back as the same value
+ * (dtoa_fixed()). The file is written under a unique temporary name next
+ * to it, synced and then renamed over filename, so that readers see either
+ * the old file or the whole new one; the directory is synced after the
+ * rename. A file that is replaced keeps its permissions; a new one is 0644.
+ *
+ * A field left out by flatf_set_fields() has no values and can't be
+ * written, nor can empty text or text with digits, nor a line longer than
+ * flatf_read() takes (FLATF_READBUFSIZE - 1 bytes); the old file is then
+ * left as it was.
+ *
+ * @param ctx The dataset to write
+ * @param filename The flat file to create or replace
+ * @return Negative on error
+ */
+
+int flatf_write(const struct ncrunch_ctx *ctx, const char *filename)
+{
+	struct flatf_out out;
+	struct flatf_row *rows;
+	struct stat st;
+	char tmp[FILENAME_MAX];
+	size_t num_fields = tfl_num_fields(ctx);
+	size_t num_teams = teams_num_teams(ctx);
+	const char *name;
+	size_t i, j, start;
+	int err = 0;
+
+	for (j = 0; j < num_fields; j++) {
+		if (num_teams && tfl_get_type(ctx, j) == TEAM_FIELD_INVALID) {
+			fprintf(stderr, "%s: field '%s' was not loaded\n", __func__, tfl_get_name(ctx, j));
+			return -1;
+		}
+	}
+
+	rows = malloc((num_teams ? num_teams : 1) * sizeof(struct flatf_row));
+	if (!rows)
+		return -2;
+
+	for (i = 0; i < num_teams; i++) {
+		rows[i].row = team_get_row(ctx, i);
+		rows[i].id = i;
+	}
+
+	qsort(rows, num_teams, sizeof(struct flatf_row), _compare_rows);
+
+	memset(&out, 0, sizeof(struct flatf_out));
+
+	/* a name of its own, so that writers of the same file on other threads
+	 * or in other processes don't share it */
+	out.fd = -1;
+	if (snprintf(tmp, FILENAME_MAX, "%s.XXXXXX", filename) < FILENAME_MAX)
+		out.fd = mkostemp(tmp, O_CLOEXEC);
+
+	if (out.fd < 0) {
+		fprintf(stderr, "%s: could not create a temporary file for '%s'\n", __func__, filename);
+		free(rows);
+		return -3;
+	}
+
+	if (stat(filename, &st) < 0)
+		st.st_mode = 0644;
+
+	if (fchmod(out.fd, st.st_mode & 07777) < 0) {
+		fprintf(stderr, "%s: could not give '%s' the mode of '%s'\n", __func__, tmp, filename);
+		close(out.fd);
+		unlink(tmp);
+		free(rows);
+		return -3;
+	}
+
+	out.data = malloc(FLATF_WRITEBUFSIZE);
+	if (!out.data) {
+		close(out.fd);
+		unlink(tmp);
+		free(rows);
+		return -2;
+	}
+
+	for (j = 0; j < num_fields; j++) {
+		name = tfl_get_name(ctx, j);
+
+		if (j)
+			_put(&out, "\t", 1);
+		_put(&out, name, strlen(name));
+	}
+
+	err = _end_line(&out, 0, 1);
+
+	for (i = 0; !err && i < num_teams; i++) {
+		start = out.flushed + out.len;
+
+		for (j = 0; !err && j < num_fields; j++) {
+			if (j)
+				_put(&out, "\t", 1);
+			err = _put_value(&out, ctx, rows[i].id, j);
+		}
+
+		if (!err)
+			err = _end_line(&out, start, i + 2);
+	}
+
+	_flush(&out);
+	free(out.data);
+	free(rows);
+
+	if (!err && !out.err && fsync(out.fd) < 0)
+		out.err = -1;
+
+	if (close(out.fd) < 0)
+		out.err = -1;
+
+	if (err || out.err || rename(tmp, filename) < 0) {
+		if (!err)
+			fprintf(stderr, "%s: could not write '%s'\n", __func__, filename);
+
+		unlink(tmp);
+		return -4;
+	}
+
+	if (_sync_dir(filename) < 0) {
+		fprintf(stderr, "%s: could not sync the directory of '%s'\n", __func__, filename);
+		return -5;
+	}
+
+	return 0;
+}
@@ -0,0 +1,47 @@
+
+#pragma once
+
+#include <stddef.h>
+
+
+
+/*
+ * The flatf reader's line and token helpers, for the library's own sources
+ * and the microbenchmarks; not part of the installed interface
+ */
+
+
+#define FLATF_READBUFSIZE 4096
+
+
+/**
+ * A token from the current line in the buffer
+ *
+ * The str pointer points into the buffer - DO NOT FREE IT
+ */
+
+struct token {
+	const char *str;	/* pointer into buffer */
+	struct token *next;
+};
+
+
+/**
+ * Contains a list of tokens from a line in the flatf
+ *
+ * Create by calling flatf_tokenize_line()
+ * Cleaned up by calling flatf_deallocate_tokens()
+ */
+
+struct tokenlist {
+	struct token *head;
+	size_t num_tokens;
+};
+
+
+int flatf_open_file(const char *filename);
+size_t flatf_read_line(int fd, char *buffer);
+size_t flatf_tokenize_line(char *buffer, struct tokenlist *list);
+void flatf_deallocate_tokens(struct tokenlist *list);
+int flatf_is_alpha(const char *str);
+int flatf_is_numeric(const char *str);
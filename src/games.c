@@ -0,0 +1,245 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <ncrunch/ncrunch.h>
+#include <ncrunch/games.h>
+#include <ncrunch/alias.h>
+
+
+
+#define GAMES_COL_WEEK       0
+#define GAMES_COL_HOME       1
+#define GAMES_COL_AWAY       2
+#define GAMES_COL_HOMESCORE  3
+#define GAMES_COL_AWAYSCORE  4
+#define GAMES_NUMCOLS        5
+
+/* most columns a log line may have, including ones we don't use */
+#define GAMES_MAXCOLS        32
+
+
+static const char *games_columns[GAMES_NUMCOLS] = {
+	"week", "home", "away", "home_score", "away_score"
+};
+
+
+
+/**
+ * Splits a line on tabs in place, dropping the newline
+ *
+ * @return The number of columns
+ */
+
+static size_t _split(char *line, char **cols)
+{
+	size_t n = 0;
+	char *p;
+
+	line[strcspn(line, "\r\n")] = '\0';
+
+	for (p = line; n < GAMES_MAXCOLS; p++) {
+		cols[n++] = p;
+
+		p = strchr(p, '\t');
+		if (!p)
+			break;
+
+		*p = '\0';
+	}
+
+	return n;
+}
+
+
+/**
+ * Parses a score or week; the whole column must be a number
+ */
+
+static int _number(const char *str, long *val)
+{
+	char *end;
+
+	*val = strtol(str, &end, 10);
+	return (end == str || *end) ? -1 : 0;
+}
+
+
+/**
+ * Appends a game
+ *
+ * @return Negative on error
+ */
+
+int games_add(struct games *games, const struct game *game)
+{
+	struct game *list;
+	size_t max_games;
+
+	if (games->num_games == games->max_games) {
+		max_games = games->max_games ? games->max_games * 2 : 256;
+		list = realloc(games->list, max_games * sizeof(struct game));
+		if (!list)
+			return -1;
+
+		games->list = list;
+		games->max_games = max_games;
+	}
+
+	games->list[games->num_games++] = *game;
+	return 0;
+}
+
+
+/**
+ * Reads a game log, resolving teams through an alias dictionary
+ *
+ * Lines with bad scores are reported and skipped. Lines naming a team the
+ * dictionary can't resolve are skipped, and the names counted in its miss
+ * report rather than reported line by line.
+ *
+ * @param games Receives the games; free with games_free()
+ * @return The number of lines skipped, or negative on error
+ */
+
+int games_read_alias(const struct ncrunch_ctx *ctx, struct alias *alias, const char *filename, struct games *games)
+{
+	char line[GAMES_LINEBUFSIZE];
+	char *cols[GAMES_MAXCOLS];
+	size_t index[GAMES_NUMCOLS];
+	struct game game;
+	size_t lineno = 1;
+	size_t num_cols;
+	size_t num_teams = teams_num_teams(ctx);
+	size_t home, away;
+	long week, hs, as;
+	int skipped = 0;
+	size_t i, j;
+	FILE *in;
+
+	memset(games, 0, sizeof(struct games));
+
+	in = fopen(filename, "r");
+	if (!in) {
+		fprintf(stderr, "%s: could not open file '%s'\n", __func__, filename);
+		return -1;
+	}
+
+	if (!fgets(line, sizeof(line), in)) {
+		fprintf(stderr, "%s: '%s' has no heading line\n", __func__, filename);
+		fclose(in);
+		return -2;
+	}
+
+	num_cols = _split(line, cols);
+
+	for (i = 0; i < GAMES_NUMCOLS; i++) {
+		index[i] = GAMES_MAXCOLS;
+
+		for (j = 0; j < num_cols; j++) {
+			if (strcmp(cols[j], games_columns[i]) == 0)
+				index[i] = j;
+		}
+
+		if (index[i] == GAMES_MAXCOLS && i != GAMES_COL_WEEK) {
+			fprintf(stderr, "%s: '%s' has no '%s' column\n", __func__, filename, games_columns[i]);
+			fclose(in);
+			return -3;
+		}
+	}
+
+	while (fgets(line, sizeof(line), in)) {
+		lineno++;
+
+		if (line[0] == '\n' || line[0] == '\0')
+			continue;
+
+		if (_split(line, cols) != num_cols) {
+			fprintf(stderr, "%s: %s:%lu: expected %lu columns\n", __func__, filename, lineno, num_cols);
+			skipped++;
+			continue;
+		}
+
+		home = alias_resolve_report(alias, cols[index[GAMES_COL_HOME]]);
+		away = alias_resolve_report(alias, cols[index[GAMES_COL_AWAY]]);
+
+		if (home == TEAMS_INVALID || away == TEAMS_INVALID) {
+			skipped++;
+			continue;
+		}
+
+		if (home >= num_teams || away >= num_teams) {
+			fprintf(stderr, "%s: %s:%lu: the alias dictionary gave a team id out of range\n", __func__,
+				filename, lineno);
+			skipped++;
+			continue;
+		}
+
+		if (home == away) {
+			fprintf(stderr, "%s: %s:%lu: team plays itself\n", __func__, filename, lineno);
+			skipped++;
+			continue;
+		}
+
+		week = 0;
+		if ((index[GAMES_COL_WEEK] != GAMES_MAXCOLS && _number(cols[index[GAMES_COL_WEEK]], &week) < 0) ||
+		    _number(cols[index[GAMES_COL_HOMESCORE]], &hs) < 0 ||
+		    _number(cols[index[GAMES_COL_AWAYSCORE]], &as) < 0) {
+			fprintf(stderr, "%s: %s:%lu: bad week or score\n", __func__, filename, lineno);
+			skipped++;
+			continue;
+		}
+
+		game.home = home;
+		game.away = away;
+		game.home_score = hs;
+		game.away_score = as;
+		game.week = week;
+
+		if (games_add(games, &game) < 0) {
+			fclose(in);
+			games_free(games);
+			return -4;
+		}
+	}
+
+	fclose(in);
+	return skipped;
+}
+
+
+/**
+ * Reads a game log for the teams in a context
+ *
+ * Builds a dictionary of the context's names and aliases just for this log;
+ * names that don't resolve are listed on stderr, most frequent first.
+ *
+ * @param games Receives the games; free with games_free()
+ * @return The number of lines skipped, or negative on error
+ */
+
+int games_read(const struct ncrunch_ctx *ctx, const char *filename, struct games *games)
+{
+	struct alias alias;
+	int ret;
+
+	if (alias_build(&alias, ctx) < 0)
+		return -1;
+
+	ret = games_read_alias(ctx, &alias, filename, games);
+	if (alias.num_misses) {
+		fprintf(stderr, "%s: '%s' names teams that could not be resolved:\n", __func__, filename);
+		alias_write_misses(&alias, stderr);
+	}
+
+	alias_free(&alias);
+	return ret;
+}
+
+
+void games_free(struct games *games)
+{
+	free(games->list);
+	memset(games, 0, sizeof(struct games));
+}
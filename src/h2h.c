@@ -0,0 +1,161 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <ncrunch/ncrunch.h>
+#include <ncrunch/games.h>
+#include <ncrunch/h2h.h>
+
+
+
+static void _set_bit(uint64_t *row, size_t bit)
+{
+	row[bit / 64] |= (uint64_t) 1 << (bit % 64);
+}
+
+
+/**
+ * Fills in the counts for one block of rows against one block of columns
+ *
+ * Only the upper triangle is visited; each pair fills both (i, j) and
+ * (j, i). Always inlined so that each of the callers below gets its own
+ * copy, compiled for its own instruction set.
+ */
+
+static inline __attribute__((always_inline)) void _fill_block(struct h2h *h2h, size_t ib, size_t jb)
+{
+	const uint64_t *pi, *pj, *bi, *bj;
+	size_t n = h2h->num_teams;
+	size_t iend = ib + H2H_BLOCK < n ? ib + H2H_BLOCK : n;
+	size_t jend = jb + H2H_BLOCK < n ? jb + H2H_BLOCK : n;
+	size_t common, wi, wj;
+	size_t i, j, w;
+
+	for (i = ib; i < iend; i++) {
+		pi = &h2h->played[i * h2h->words];
+		bi = &h2h->beat[i * h2h->words];
+
+		for (j = jb > i ? jb : i; j < jend; j++) {
+			pj = &h2h->played[j * h2h->words];
+			bj = &h2h->beat[j * h2h->words];
+			common = wi = wj = 0;
+
+			/* beat[i] is a subset of played[i], so beat[i] & played[j]
+			 * is i's wins over common opponents */
+			for (w = 0; w < h2h->words; w++) {
+				common += __builtin_popcountll(pi[w] & pj[w]);
+				wi += __builtin_popcountll(bi[w] & pj[w]);
+				wj += __builtin_popcountll(bj[w] & pi[w]);
+			}
+
+			h2h->common[i * n + j] = common;
+			h2h->common[j * n + i] = common;
+			h2h->wins[i * n + j] = wi;
+			h2h->wins[j * n + i] = wj;
+		}
+	}
+}
+
+
+static void _fill(struct h2h *h2h)
+{
+	size_t ib, jb;
+
+	for (ib = 0; ib < h2h->num_teams; ib += H2H_BLOCK) {
+		for (jb = ib; jb < h2h->num_teams; jb += H2H_BLOCK)
+			_fill_block(h2h, ib, jb);
+	}
+}
+
+
+#if defined(__x86_64__)
+/**
+ * _fill() using the POPCNT instruction; without it the builtin is a library
+ * call per word, which is most of the build time
+ */
+
+__attribute__((target("popcnt")))
+static void _fill_popcnt(struct h2h *h2h)
+{
+	size_t ib, jb;
+
+	for (ib = 0; ib < h2h->num_teams; ib += H2H_BLOCK) {
+		for (jb = ib; jb < h2h->num_teams; jb += H2H_BLOCK)
+			_fill_block(h2h, ib, jb);
+	}
+}
+#endif
+
+
+/**
+ * Builds the matrix from a season's games
+ *
+ * @param num_teams The number of teams in the context the games refer to
+ * @return Negative on error
+ */
+
+int h2h_build(struct h2h *h2h, const struct games *games, size_t num_teams)
+{
+	const struct game *game;
+	size_t winner, loser;
+	size_t i;
+
+	memset(h2h, 0, sizeof(struct h2h));
+
+	if (num_teams == 0)
+		return 0;
+
+	h2h->num_teams = num_teams;
+	h2h->words = (num_teams + 63) / 64;
+
+	h2h->played = calloc(num_teams * h2h->words, sizeof(uint64_t));
+	h2h->beat = calloc(num_teams * h2h->words, sizeof(uint64_t));
+	h2h->common = malloc(num_teams * num_teams * sizeof(uint16_t));
+	h2h->wins = malloc(num_teams * num_teams * sizeof(uint16_t));
+
+	if (!h2h->played || !h2h->beat || !h2h->common || !h2h->wins) {
+		fprintf(stderr, "%s: not enough memory for %lu teams\n", __func__, num_teams);
+		h2h_free(h2h);
+		return -1;
+	}
+
+	for (i = 0; i < games->num_games; i++) {
+		game = &games->list[i];
+
+		if (game->home >= num_teams || game->away >= num_teams) {
+			fprintf(stderr, "%s: game %lu has a team id out of range\n", __func__, i);
+			h2h_free(h2h);
+			return -2;
+		}
+
+		_set_bit(&h2h->played[game->home * h2h->words], game->away);
+		_set_bit(&h2h->played[game->away * h2h->words], game->home);
+
+		winner = game_winner(game);
+		if (winner != TEAMS_INVALID) {
+			loser = winner == game->home ? game->away : game->home;
+			_set_bit(&h2h->beat[winner * h2h->words], loser);
+		}
+	}
+
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("popcnt")) {
+		_fill_popcnt(h2h);
+		return 0;
+	}
+#endif
+
+	_fill(h2h);
+	return 0;
+}
+
+
+void h2h_free(struct h2h *h2h)
+{
+	free(h2h->played);
+	free(h2h->beat);
+	free(h2h->common);
+	free(h2h->wins);
+	memset(h2h, 0, sizeof(struct h2h));
+}
@@ -4,10 +4,17 @@
 #include <assert.h>
 #include <ctype.h>
 
+#include <unistd.h>
+#include <fcntl.h>
+
 #include <ncrunch/hash.h>
 
 
 
+#define HASH_READBUFSIZE 65536
+
+
+
 /**
  * Hashes a string into the digest
  *
@@ -50,6 +57,66 @@ void hash_stringi(const char *str, struct mdigest *md)
 }
 
 
+/**
+ * Hashes the contents of a file
+ *
+ * @param filename The file to be hashed
+ * @param md The resulting message digest
+ * @return Negative on error
+ */
+
+int hash_file(const char *filename, struct mdigest *md)
+{
+	SHA256_CTX ctx;
+	unsigned char buf[HASH_READBUFSIZE];
+	ssize_t count;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "%s: could not open file '%s'\n", __func__, filename);
+		return -1;
+	}
+
+	SHA256_Init(&ctx);
+
+	while ((count = read(fd, buf, sizeof(buf))) > 0) {
+		SHA256_Update(&ctx, buf, count);
+	}
+
+	close(fd);
+
+	if (count < 0) {
+		fprintf(stderr, "%s: error reading '%s'\n", __func__, filename);
+		return -2;
+	}
+
+	SHA256_Final(md->md, &ctx);
+	return 0;
+}
+
+
+/**
+ * Writes the message digest in hex form [0-9][a-f] into a string
+ *
+ * @param md The message digest
+ * @param hex Receives the null-terminated hex string
+ */
+
+void hash_hex(const struct mdigest *md, char hex[HASH_HEXSIZE])
+{
+	static const char trans[] = "0123456789abcdef";
+	int i;
+
+	for (i = 0; i < SHA256_DIGEST_LENGTH; i++) {
+		hex[2 * i] = trans[(md->md[i] >> 4) & 0x0f];
+		hex[2 * i + 1] = trans[md->md[i] & 0x0f];
+	}
+
+	hex[2 * SHA256_DIGEST_LENGTH] = '\0';
+}
+
+
 /**
  * Prints the message digest to stdout in hex form [0-9][a-f]. No new line is added
  */
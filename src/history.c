@@ -0,0 +1,862 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <ncrunch/ncrunch.h>
+#include <ncrunch/hash.h>
+#include <ncrunch/history.h>
+
+
+
+#define HISTORY_TAG_TEAM 'T'
+#define HISTORY_TAG_WEEK 'W'
+
+/* a record's tag and length, or a week's label, flags and team count, fit
+ * in this */
+#define HISTORY_HEADERSIZE 32
+
+/* the most bytes a group's entries can take: two ten byte varints a team */
+#define HISTORY_MAXGROUPSIZE (HISTORY_GROUP * 2 * 10)
+
+
+/**
+ * A growing output buffer
+ */
+
+struct history_buf {
+	uint8_t *data;
+	size_t len;
+	size_t max;
+};
+
+
+static int _reserve(struct history_buf *buf, size_t extra)
+{
+	uint8_t *data;
+	size_t max;
+
+	if (buf->len + extra <= buf->max)
+		return 0;
+
+	max = buf->max ? buf->max : 4096;
+	while (max < buf->len + extra)
+		max *= 2;
+
+	data = realloc(buf->data, max);
+	if (!data)
+		return -1;
+
+	buf->data = data;
+	buf->max = max;
+	return 0;
+}
+
+
+static int _put_varint(struct history_buf *buf, uint64_t val)
+{
+	if (_reserve(buf, 10) < 0)
+		return -1;
+
+	while (val >= 0x80) {
+		buf->data[buf->len++] = (uint8_t) val | 0x80;
+		val >>= 7;
+	}
+
+	buf->data[buf->len++] = (uint8_t) val;
+	return 0;
+}
+
+
+static int _put_bytes(struct history_buf *buf, const void *data, size_t len)
+{
+	if (_reserve(buf, len) < 0)
+		return -1;
+
+	memcpy(&buf->data[buf->len], data, len);
+	buf->len += len;
+	return 0;
+}
+
+
+static void _set_u32(uint8_t *p, uint32_t val)
+{
+	p[0] = val;
+	p[1] = val >> 8;
+	p[2] = val >> 16;
+	p[3] = val >> 24;
+}
+
+
+static uint32_t _get_u32(const uint8_t *p)
+{
+	return p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+
+/**
+ * Reads a varint
+ *
+ * @return The bytes it took, or 0 if it runs past end
+ */
+
+static size_t _get_varint(const uint8_t *p, const uint8_t *end, uint64_t *val)
+{
+	const uint8_t *start = p;
+	int shift = 0;
+
+	*val = 0;
+
+	while (p < end && shift < 64) {
+		*val |= (uint64_t) (*p & 0x7f) << shift;
+		if (!(*p++ & 0x80))
+			return p - start;
+
+		shift += 7;
+	}
+
+	return 0;
+}
+
+
+static uint64_t _zigzag(int64_t val)
+{
+	return ((uint64_t) val << 1) ^ (uint64_t) (val >> 63);
+}
+
+
+static int64_t _unzigzag(uint64_t val)
+{
+	return (int64_t) (val >> 1) ^ -(int64_t) (val & 1);
+}
+
+
+/**
+ * Reads up to len bytes at off
+ *
+ * @return The bytes read, or negative on error
+ */
+
+static ssize_t _pread_full(int fd, void *buf, size_t len, off_t off)
+{
+	size_t got = 0;
+	ssize_t n;
+
+	while (got < len) {
+		n = pread(fd, (uint8_t *) buf + got, len - got, off + got);
+		if (n < 0)
+			return -1;
+		if (n == 0)
+			break;
+
+		got += n;
+	}
+
+	return got;
+}
+
+
+static int _compare_names(const void *a, const void *b)
+{
+	return memcmp(&((const struct history_name *) a)->digest,
+		&((const struct history_name *) b)->digest, sizeof(struct mdigest));
+}
+
+
+static size_t _find_name(const struct history *h, const char *name)
+{
+	struct history_name key;
+	const struct history_name *found;
+
+	hash_stringi(name, &key.digest);
+	found = bsearch(&key, h->index, h->num_names, sizeof(struct history_name), _compare_names);
+
+	return found ? found->id : TEAMS_INVALID;
+}
+
+
+/**
+ * Makes room for max_names teams
+ */
+
+static int _grow_names(struct history *h, size_t max_names)
+{
+	char **names;
+	struct history_name *index;
+	uint32_t *last_rank;
+	int64_t *last_rating;
+
+	if (max_names <= h->max_names)
+		return 0;
+
+	names = realloc(h->names, max_names * sizeof(char *));
+	if (!names)
+		return -1;
+	h->names = names;
+
+	index = realloc(h->index, max_names * sizeof(struct history_name));
+	if (!index)
+		return -1;
+	h->index = index;
+
+	last_rank = realloc(h->last_rank, max_names * sizeof(uint32_t));
+	if (!last_rank)
+		return -1;
+	h->last_rank = last_rank;
+
+	last_rating = realloc(h->last_rating, max_names * sizeof(int64_t));
+	if (!last_rating)
+		return -1;
+	h->last_rating = last_rating;
+
+	h->max_names = max_names;
+	return 0;
+}
+
+
+/**
+ * Adds the next team, keeping the index sorted
+ */
+
+static int _add_name(struct history *h, const char *name, size_t len)
+{
+	struct history_name entry;
+	size_t lo, hi, mid;
+
+	if (h->num_names == h->max_names &&
+	    _grow_names(h, h->max_names ? h->max_names * 2 : 256) < 0)
+		return -1;
+
+	h->names[h->num_names] = strndup(name, len);
+	if (!h->names[h->num_names])
+		return -1;
+
+	hash_stringi(h->names[h->num_names], &entry.digest);
+	entry.id = h->num_names;
+
+	lo = 0;
+	hi = h->num_names;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (_compare_names(&h->index[mid], &entry) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	memmove(&h->index[lo + 1], &h->index[lo], (h->num_names - lo) * sizeof(struct history_name));
+	h->index[lo] = entry;
+
+	h->last_rank[h->num_names] = 0;
+	h->last_rating[h->num_names] = 0;
+	h->num_names++;
+	return 0;
+}
+
+
+static int _add_week(struct history *h, const struct history_week *week)
+{
+	struct history_week *weeks;
+	size_t max;
+
+	if (h->num_weeks == h->max_weeks) {
+		max = h->max_weeks ? h->max_weeks * 2 : 64;
+		weeks = realloc(h->weeks, max * sizeof(struct history_week));
+		if (!weeks)
+			return -1;
+
+		h->weeks = weeks;
+		h->max_weeks = max;
+	}
+
+	h->weeks[h->num_weeks++] = *week;
+	return 0;
+}
+
+
+/**
+ * Parses a week record's header
+ *
+ * @return Negative if it is malformed
+ */
+
+static int _parse_week(const uint8_t *p, const uint8_t *end, off_t payload, off_t rec_end, struct history_week *week)
+{
+	const uint8_t *start = p;
+	uint64_t val;
+	size_t n;
+
+	n = _get_varint(p, end, &val);
+	if (!n)
+		return -1;
+	week->week = val;
+	p += n;
+
+	if (p == end)
+		return -1;
+	week->keyframe = *p++ & HISTORY_KEYFRAME_FLAG;
+
+	n = _get_varint(p, end, &val);
+	if (!n || val > UINT32_MAX)
+		return -1;
+	week->num_teams = val;
+	p += n;
+
+	week->table = payload + (p - start);
+	week->entries = week->table + 4 * ((week->num_teams + HISTORY_GROUP - 1) / HISTORY_GROUP);
+	week->end = rec_end;
+
+	return week->entries <= rec_end ? 0 : -1;
+}
+
+
+/**
+ * Checks a parsed week against the history before it: a week can't rank
+ * more teams than have been named, nor fewer than the week before, as the
+ * teams only ever grow
+ *
+ * @return Negative if it doesn't fit
+ */
+
+static int _check_week(const struct history *h, const struct history_week *week)
+{
+	if (week->num_teams > h->num_names) {
+		fprintf(stderr, "%s: week %u has %u teams, but only %lu are named\n", __func__, week->week,
+			week->num_teams, h->num_names);
+		return -1;
+	}
+
+	if (h->num_weeks && week->num_teams < h->weeks[h->num_weeks - 1].num_teams) {
+		fprintf(stderr, "%s: week %u has %u teams, fewer than the week before\n", __func__, week->week,
+			week->num_teams);
+		return -2;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Applies a whole week's entries to rank and rating, which hold the week
+ * before's
+ *
+ * @return Negative on error
+ */
+
+static int _apply_week(const struct history *h, const struct history_week *week, uint32_t *rank, int64_t *rating)
+{
+	uint8_t *data;
+	const uint8_t *p, *end;
+	uint64_t val;
+	size_t len = week->end - week->entries;
+	size_t n;
+	size_t t;
+
+	data = malloc(len ? len : 1);
+	if (!data)
+		return -1;
+
+	if (_pread_full(h->fd, data, len, week->entries) != (ssize_t) len) {
+		free(data);
+		return -2;
+	}
+
+	p = data;
+	end = data + len;
+
+	for (t = 0; t < week->num_teams; t++) {
+		if (week->keyframe) {
+			rank[t] = 0;
+			rating[t] = 0;
+		}
+
+		n = _get_varint(p, end, &val);
+		if (!n)
+			break;
+		rank[t] += _unzigzag(val);
+		p += n;
+
+		n = _get_varint(p, end, &val);
+		if (!n)
+			break;
+		rating[t] += _unzigzag(val);
+		p += n;
+	}
+
+	free(data);
+	return t == week->num_teams ? 0 : -3;
+}
+
+
+/**
+ * Reads every record header, building the name table and week index, and
+ * works out the last week's values for the next week's deltas
+ *
+ * @return Negative on error
+ */
+
+static int _scan(struct history *h, off_t size)
+{
+	uint8_t hdr[HISTORY_HEADERSIZE];
+	char *name;
+	struct history_week week;
+	off_t off = sizeof(HISTORY_MAGIC);
+	off_t payload, rec_end;
+	uint64_t len;
+	ssize_t got;
+	size_t n, i, start;
+
+	while (off < size) {
+		got = _pread_full(h->fd, hdr, sizeof(hdr), off);
+		if (got <= 0)
+			return -1;
+
+		n = _get_varint(&hdr[1], &hdr[got], &len);
+		payload = off + 1 + n;
+		rec_end = payload + len;
+
+		if (!n || rec_end > size)
+			break;
+
+		if (hdr[0] == HISTORY_TAG_TEAM) {
+			name = malloc(len ? len : 1);
+			if (!name)
+				return -2;
+
+			if (_pread_full(h->fd, name, len, payload) != (ssize_t) len || _add_name(h, name, len) < 0) {
+				free(name);
+				return -3;
+			}
+
+			free(name);
+		} else if (hdr[0] == HISTORY_TAG_WEEK) {
+			got = _pread_full(h->fd, hdr, sizeof(hdr), payload);
+			if (got < 0 || _parse_week(hdr, &hdr[got], payload, rec_end, &week) < 0 || _check_week(h, &week) < 0 ||
+			    _add_week(h, &week) < 0)
+				return -4;
+		} else {
+			fprintf(stderr, "%s: unknown record at offset %ld\n", __func__, (long) off);
+			return -5;
+		}
+
+		off = rec_end;
+	}
+
+	if (off < size && h->readonly) {
+		fprintf(stderr, "%s: ignoring a partly written record at offset %ld\n", __func__, (long) off);
+	} else if (off < size) {
+		fprintf(stderr, "%s: dropping a partly written record at offset %ld\n", __func__, (long) off);
+		if (ftruncate(h->fd, off) < 0)
+			return -6;
+	}
+
+	h->end = off;
+
+	if (!h->num_weeks)
+		return 0;
+
+	start = h->num_weeks - 1;
+	while (start > 0 && !h->weeks[start].keyframe)
+		start--;
+
+	for (i = start; i < h->num_weeks; i++) {
+		if (_apply_week(h, &h->weeks[i], h->last_rank, h->last_rating) < 0)
+			return -7;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Opens a history file, creating it if it doesn't exist
+ *
+ * @param readonly Set to only query the file: it must exist already, and
+ * nothing is written to it, not even to drop a partly written record
+ * @return Negative on error
+ */
+
+int history_open(struct history *h, const char *path, int readonly)
+{
+	char magic[sizeof(HISTORY_MAGIC)];
+	struct stat st;
+
+	memset(h, 0, sizeof(struct history));
+	h->readonly = readonly;
+
+	if (readonly)
+		h->fd = open(path, O_RDONLY);
+	else
+		h->fd = open(path, O_RDWR | O_CREAT, 0644);
+
+	if (h->fd < 0) {
+		fprintf(stderr, "%s: could not open '%s'\n", __func__, path);
+		return -1;
+	}
+
+	if (fstat(h->fd, &st) < 0) {
+		history_close(h);
+		return -2;
+	}
+
+	if (st.st_size == 0 && !readonly) {
+		if (pwrite(h->fd, HISTORY_MAGIC, sizeof(HISTORY_MAGIC), 0) != sizeof(HISTORY_MAGIC)) {
+			history_close(h);
+			return -3;
+		}
+
+		h->end = sizeof(HISTORY_MAGIC);
+		return 0;
+	}
+
+	if (_pread_full(h->fd, magic, sizeof(magic), 0) != sizeof(magic) ||
+	    memcmp(magic, HISTORY_MAGIC, sizeof(magic)) != 0) {
+		fprintf(stderr, "%s: '%s' is not a history file\n", __func__, path);
+		history_close(h);
+		return -4;
+	}
+
+	if (_scan(h, st.st_size) < 0) {
+		fprintf(stderr, "%s: could not read '%s'\n", __func__, path);
+		history_close(h);
+		return -5;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Appends a record to buf
+ */
+
+static int _put_record(struct history_buf *buf, uint8_t tag, const void *payload, size_t len)
+{
+	if (_put_bytes(buf, &tag, 1) < 0 || _put_varint(buf, len) < 0 || _put_bytes(buf, payload, len) < 0)
+		return -1;
+
+	return 0;
+}
+
+
+/**
+ * Brings the in-memory state up to date with records just written: adds
+ * the names and the week, and keeps the week's values for the next deltas
+ *
+ * @param out The records as written at h->end; names, then the week
+ * @param payload The week record's payload
+ * @return Negative on error
+ */
+
+static int _commit(struct history *h, const struct history_buf *out, const struct history_buf *payload,
+	size_t num_names, const uint32_t *rank, const int64_t *rating)
+{
+	struct history_week week;
+	const uint8_t *p = out->data;
+	const uint8_t *end = out->data + out->len;
+	uint64_t len;
+	size_t n;
+
+	while (*p == HISTORY_TAG_TEAM) {
+		n = _get_varint(p + 1, end, &len);
+		if (_add_name(h, (const char *) p + 1 + n, len) < 0)
+			return -1;
+
+		p += 1 + n + len;
+	}
+
+	n = _get_varint(p + 1, end, &len);
+	if (_parse_week(payload->data, payload->data + payload->len, h->end + (p - out->data) + 1 + n,
+	    h->end + out->len, &week) < 0 || _check_week(h, &week) < 0 || _add_week(h, &week) < 0)
+		return -2;
+
+	memcpy(h->last_rank, rank, num_names * sizeof(uint32_t));
+	memcpy(h->last_rating, rating, num_names * sizeof(int64_t));
+	h->end += out->len;
+	return 0;
+}
+
+
+/**
+ * Appends a week's ranking by a numeric field
+ *
+ * Teams are matched to earlier weeks by name. Teams seen before but not in
+ * this context are unranked for the week. A NaN rating is stored as 0.
+ *
+ * @param week Its label, such as season * 100 + week; must be greater
+ * than the last week's
+ * @return Negative on error
+ */
+
+int history_append(struct history *h, const struct ncrunch_ctx *ctx, uint32_t week, size_t field)
+{
+	struct history_buf out, payload, entries;
+	const char *name;
+	uint8_t *table;
+	size_t num_teams = teams_num_teams(ctx);
+	size_t *order = NULL;
+	size_t *ids = NULL;
+	uint32_t *rank = NULL;
+	int64_t *rating = NULL;
+	uint32_t prev_rank;
+	int64_t prev_rating;
+	size_t num_names = h->num_names;
+	size_t nameid;
+	size_t num_groups;
+	size_t t, i;
+	uint8_t flags;
+	double val;
+	int keyframe = h->num_weeks % HISTORY_KEYFRAME == 0;
+	int err = 0;
+
+	if (h->readonly) {
+		fprintf(stderr, "%s: the history file was opened read only\n", __func__);
+		return -1;
+	}
+
+	if (h->num_weeks && week <= h->weeks[h->num_weeks - 1].week) {
+		fprintf(stderr, "%s: week %u is not after week %u\n", __func__, week, h->weeks[h->num_weeks - 1].week);
+		return -1;
+	}
+
+	if (tfl_find(ctx, "name", &nameid) < 0) {
+		fprintf(stderr, "%s: could not find required 'name' field\n", __func__);
+		return -2;
+	}
+
+	memset(&out, 0, sizeof(out));
+	memset(&payload, 0, sizeof(payload));
+	memset(&entries, 0, sizeof(entries));
+
+	order = malloc((num_teams ? num_teams : 1) * sizeof(size_t));
+	ids = malloc((num_teams ? num_teams : 1) * sizeof(size_t));
+	rank = calloc(h->num_names + num_teams + 1, sizeof(uint32_t));
+	rating = calloc(h->num_names + num_teams + 1, sizeof(int64_t));
+
+	if (!order || !ids || !rank || !rating || (num_teams && rank_by_field(ctx, field, order) < 0))
+		err = -3;
+
+	/* unranked teams keep last week's rating */
+	if (!err)
+		memcpy(rating, h->last_rating, h->num_names * sizeof(int64_t));
+
+	/* new names go out ahead of the week that first ranks them */
+	for (t = 0; !err && t < num_teams; t++) {
+		name = team_get_string(ctx, t, nameid);
+		ids[t] = _find_name(h, name);
+		if (ids[t] == TEAMS_INVALID) {
+			ids[t] = num_names++;
+			if (_put_record(&out, HISTORY_TAG_TEAM, name, strlen(name)) < 0)
+				err = -4;
+		}
+	}
+
+	for (i = 0; !err && i < num_teams; i++) {
+		t = order[i];
+		team_get_double(ctx, t, field, &val);
+		rank[ids[t]] = i + 1;
+		rating[ids[t]] = isnan(val) ? 0 : llround(val * HISTORY_SCALE);
+	}
+
+	num_groups = (num_names + HISTORY_GROUP - 1) / HISTORY_GROUP;
+	table = calloc(num_groups ? num_groups : 1, 4);
+	if (!table)
+		err = -4;
+
+	for (t = 0; !err && t < num_names; t++) {
+		prev_rank = keyframe || t >= h->num_names ? 0 : h->last_rank[t];
+		prev_rating = keyframe || t >= h->num_names ? 0 : h->last_rating[t];
+
+		if (t % HISTORY_GROUP == 0)
+			_set_u32(&table[4 * (t / HISTORY_GROUP)], entries.len);
+
+		if (_put_varint(&entries, _zigzag((int64_t) rank[t] - prev_rank)) < 0 ||
+		    _put_varint(&entries, _zigzag(rating[t] - prev_rating)) < 0)
+			err = -4;
+	}
+
+	flags = keyframe ? HISTORY_KEYFRAME_FLAG : 0;
+
+	if (!err && (_put_varint(&payload, week) < 0 || _put_bytes(&payload, &flags, 1) < 0 ||
+	    _put_varint(&payload, num_names) < 0 || _put_bytes(&payload, table, 4 * num_groups) < 0 ||
+	    _put_bytes(&payload, entries.data, entries.len) < 0 ||
+	    _put_record(&out, HISTORY_TAG_WEEK, payload.data, payload.len) < 0))
+		err = -4;
+
+	/* one write for the names and the week; if it fails part way the next
+	 * append writes over whatever got out */
+	if (!err && (pwrite(h->fd, out.data, out.len, h->end) != (ssize_t) out.len || fdatasync(h->fd) < 0)) {
+		fprintf(stderr, "%s: could not write week %u\n", __func__, week);
+		err = -5;
+	}
+
+	if (!err && _commit(h, &out, &payload, num_names, rank, rating) < 0)
+		err = -6;
+
+	free(out.data);
+	free(payload.data);
+	free(entries.data);
+	free(table);
+	free(order);
+	free(ids);
+	free(rank);
+	free(rating);
+	return err;
+}
+
+
+/**
+ * Decodes one team's entry for a week into rank and rating, which hold the
+ * team's values for the week before
+ *
+ * @return Negative on error
+ */
+
+static int _read_entry(const struct history *h, const struct history_week *week, size_t id,
+	uint32_t *rank, int64_t *rating)
+{
+	uint8_t buf[HISTORY_MAXGROUPSIZE];
+	uint8_t offsets[8];
+	const uint8_t *p, *end;
+	size_t group = id / HISTORY_GROUP;
+	size_t num_groups = (week->num_teams + HISTORY_GROUP - 1) / HISTORY_GROUP;
+	off_t from, to;
+	uint64_t val;
+	size_t n;
+	size_t i;
+
+	if (_pread_full(h->fd, offsets, group + 1 < num_groups ? 8 : 4, week->table + 4 * group) < 4)
+		return -1;
+
+	from = week->entries + _get_u32(offsets);
+	to = group + 1 < num_groups ? week->entries + _get_u32(&offsets[4]) : week->end;
+
+	if (to < from || to - from > (off_t) sizeof(buf) || to > week->end ||
+	    _pread_full(h->fd, buf, to - from, from) != to - from)
+		return -2;
+
+	if (week->keyframe) {
+		*rank = 0;
+		*rating = 0;
+	}
+
+	p = buf;
+	end = buf + (to - from);
+
+	/* skip the teams ahead of this one in the group */
+	for (i = 0; i < 2 * (id % HISTORY_GROUP); i++) {
+		n = _get_varint(p, end, &val);
+		if (!n)
+			return -3;
+		p += n;
+	}
+
+	n = _get_varint(p, end, &val);
+	if (!n)
+		return -3;
+	*rank += _unzigzag(val);
+	p += n;
+
+	if (!_get_varint(p, end, &val))
+		return -3;
+	*rating += _unzigzag(val);
+
+	return 0;
+}
+
+
+/**
+ * Reads one team's ranks and ratings for every week it was ranked
+ *
+ * Decoding starts at the last keyframe at or before since, and reads only
+ * the team's group of entries from each week.
+ *
+ * @param name The team; case doesn't matter
+ * @param since The first week label wanted; 0 for all of them
+ * @param entries Receives the weeks, oldest first; free() it
+ * @return The number of entries, or negative on error
+ */
+
+long history_team(const struct history *h, const char *name, uint32_t since, struct history_entry **entries)
+{
+	const struct history_week *week;
+	struct history_entry *list = NULL;
+	struct history_entry *grown;
+	size_t num = 0, max = 0;
+	size_t id;
+	size_t start = 0;
+	size_t i;
+	uint32_t rank = 0;
+	int64_t rating = 0;
+
+	*entries = NULL;
+
+	id = _find_name(h, name);
+	if (id == TEAMS_INVALID) {
+		fprintf(stderr, "%s: no team named '%s' in the history\n", __func__, name);
+		return -1;
+	}
+
+	for (i = 0; i < h->num_weeks && h->weeks[i].week <= since; i++) {
+		if (h->weeks[i].keyframe)
+			start = i;
+	}
+
+	for (i = start; i < h->num_weeks; i++) {
+		week = &h->weeks[i];
+		if (id >= week->num_teams)
+			continue;
+
+		if (_read_entry(h, week, id, &rank, &rating) < 0) {
+			fprintf(stderr, "%s: week %u is corrupt\n", __func__, week->week);
+			free(list);
+			return -2;
+		}
+
+		if (!rank || week->week < since)
+			continue;
+
+		if (num == max) {
+			max = max ? max * 2 : 64;
+			grown = realloc(list, max * sizeof(struct history_entry));
+			if (!grown) {
+				free(list);
+				return -3;
+			}
+
+			list = grown;
+		}
+
+		list[num].week = week->week;
+		list[num].rank = rank;
+		list[num].rating = rating / HISTORY_SCALE;
+		num++;
+	}
+
+	*entries = list;
+	return num;
+}
+
+
+void history_close(struct history *h)
+{
+	size_t i;
+
+	if (h->fd >= 0)
+		close(h->fd);
+
+	for (i = 0; i < h->num_names; i++)
+		free(h->names[i]);
+
+	free(h->names);
+	free(h->index);
+	free(h->weeks);
+	free(h->last_rank);
+	free(h->last_rating);
+	memset(h, 0, sizeof(struct history));
+	h->fd = -1;
+}
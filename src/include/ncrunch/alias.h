@@ -0,0 +1,91 @@
+
+#pragma once
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <ncrunch/ncrunch.h>
+#include <ncrunch/hash.h>
+
+
+
+/*
+ * Team name resolution
+ *
+ * Every team's name, and every word of its "tags" field, is a key that
+ * resolves to the team. Keys are folded before they are stored or looked
+ * up: ASCII case is ignored, '_' counts as a space (a tag is one word, so
+ * "texas_a&m" stands for "texas a&m"), and runs of spaces are one space
+ * with none at either end. A name always wins over another team's tag; a
+ * tag two teams share (a conference, say) resolves to neither.
+ *
+ * The keys go into a minimal perfect hash (hash and displace): keys are
+ * hashed into buckets of a few keys each, and each bucket, largest first,
+ * gets the first displacement that sends all of its keys to free slots. A
+ * lookup is then one hash, one displacement and one slot, whose key is
+ * compared to be sure, with no probing. There are exactly as many slots as
+ * keys.
+ *
+ * The dictionary is saved next to the flatf (its name plus ALIAS_SUFFIX)
+ * with the flatf's digest, and rebuilt only when the flatf changes. The
+ * file is in host byte order.
+ *
+ * Names that don't resolve through alias_resolve_report() are counted, to
+ * be written out with alias_write_misses().
+ */
+
+
+#define ALIAS_MAGIC   "NCALIAS1"
+#define ALIAS_SUFFIX  ".alias"
+
+/* longest key, folded, that can resolve */
+#define ALIAS_MAXKEY  256
+
+/* keys per bucket, on average */
+#define ALIAS_LOAD    4
+
+
+struct alias_slot {
+	uint32_t offset;	/* of the key in the blob */
+	uint32_t len;
+	uint32_t team;
+};
+
+
+/**
+ * A name that didn't resolve and how often it came up
+ */
+
+struct alias_miss {
+	char *name;		/* as first seen */
+	char *key;		/* folded */
+	uint64_t hash;
+	size_t count;
+};
+
+
+struct alias {
+	uint64_t seed;
+	size_t num_keys;
+	size_t num_buckets;
+	uint32_t *disp;			/* per bucket */
+	struct alias_slot *slots;	/* num_keys */
+	char *blob;			/* the folded keys */
+	size_t blob_len;
+	void *mem;			/* what the above point into */
+
+	struct alias_miss *misses;	/* open addressed on hash */
+	size_t num_misses;
+	size_t max_misses;
+};
+
+
+int alias_build(struct alias *alias, const struct ncrunch_ctx *ctx);
+int alias_load(struct alias *alias, const char *path, const struct mdigest *source, size_t num_teams);
+int alias_save(const struct alias *alias, const char *path, const struct mdigest *source);
+int alias_open(struct alias *alias, const struct ncrunch_ctx *ctx, const char *flatf);
+size_t alias_resolve(const struct alias *alias, const char *name);
+size_t alias_resolve_report(struct alias *alias, const char *name);
+int alias_write_misses(const struct alias *alias, FILE *out);
+void alias_free(struct alias *alias);
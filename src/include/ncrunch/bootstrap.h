@@ -0,0 +1,60 @@
+
+#pragma once
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <ncrunch/ncrunch.h>
+#include <ncrunch/games.h>
+#include <ncrunch/rating.h>
+
+
+
+/*
+ * Bootstrap confidence intervals
+ *
+ * Draws the season's games with replacement, as many as there were, some
+ * number of times and rates each draw with the same mode. The spread of a
+ * team's ratings and ranks over the draws gives its intervals.
+ *
+ * Draws are independent, so they are shared out to a pool of threads, each
+ * with its own copy of the drawn games and the mode's scratch space,
+ * allocated once and reused for every draw it takes. Each solve starts from
+ * the ratings for the whole season, which a draw stays close to, so an
+ * iterative mode needs only a few iterations. Draw i is always seeded the
+ * same way, so the results don't depend on the number of threads.
+ */
+
+
+#define BOOTSTRAP_DEFAULT_LEVEL 0.95
+
+
+struct bootstrap {
+	size_t num_teams;
+	size_t num_draws;
+	double *base;		/* ratings for the actual season */
+	double *ratings;	/* num_draws rows of num_teams */
+	uint32_t *ranks;	/* the same, as ranks from 1 */
+	size_t iterations;	/* solver iterations over all draws */
+};
+
+
+/**
+ * One team's intervals, at some level: lo and hi leave (1 - level) / 2 of
+ * the draws on either side
+ */
+
+struct bootstrap_team {
+	double rating;		/* for the actual season */
+	double lo, hi;
+	uint32_t rank;		/* for the actual season */
+	uint32_t rank_best, rank_lo, rank_median, rank_hi, rank_worst;
+};
+
+
+int bootstrap_run(struct bootstrap *bs, const struct rating_mode *mode, const struct games *games,
+	size_t num_teams, size_t num_draws, uint64_t seed, size_t threads);
+int bootstrap_summary(const struct bootstrap *bs, double level, struct bootstrap_team *teams);
+int bootstrap_write(const struct ncrunch_ctx *ctx, const struct bootstrap *bs, double level, FILE *out);
+void bootstrap_free(struct bootstrap *bs);
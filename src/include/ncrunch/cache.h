@@ -0,0 +1,39 @@
+
+#pragma once
+
+#include <stddef.h>
+
+#include <ncrunch/hash.h>
+
+
+
+/*
+ * On-disk cache of ranking output
+ *
+ * Entries are files in a cache directory named after the hex digest of
+ * everything that went into the run (input file contents, algorithm and its
+ * parameters). Entries are written to a temp file and renamed into place, so
+ * readers in other processes only ever see complete entries. A hit refreshes
+ * the entry's mtime; when the directory grows past its size limit the least
+ * recently used entries are removed.
+ */
+
+
+#define CACHE_DEFAULT_MAXSIZE (64 * 1024 * 1024)
+
+
+
+/**
+ * A cached result mapped into memory; release with cache_release()
+ */
+
+struct cache_entry {
+	const void *data;
+	size_t len;
+};
+
+
+int cache_key(const char **files, size_t num_files, const char *params, struct mdigest *key);
+int cache_lookup(const char *dir, const struct mdigest *key, struct cache_entry *entry);
+void cache_release(struct cache_entry *entry);
+int cache_store(const char *dir, size_t max_size, const struct mdigest *key, const void *data, size_t len);
@@ -0,0 +1,58 @@
+
+#pragma once
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <ncrunch/ncrunch.h>
+#include <ncrunch/games.h>
+#include <ncrunch/rating.h>
+
+
+
+/*
+ * Consensus of several rating modes
+ *
+ * Every mode rates the same season on its own thread, reading the one
+ * shared game list and writing only its own row of ratings, so the whole
+ * run takes about as long as the slowest mode. The modes' rankings are
+ * then combined:
+ *
+ *	borda	a team gets n - rank points from each mode; most points first
+ *	mean	lowest mean rank first
+ *	kemeny	starts from borda and swaps neighbours while more modes
+ *		prefer the lower team to the higher, a local search towards
+ *		the order that disagrees least with the modes pairwise
+ *
+ * Ties are broken by flatf row (see team_get_row()).
+ */
+
+
+/* passes of neighbour swaps the kemeny search makes at most */
+#define CONSENSUS_MAXPASSES 1000
+
+
+enum consensus_method {
+	CONSENSUS_BORDA,
+	CONSENSUS_MEAN,
+	CONSENSUS_KEMENY
+};
+
+
+struct consensus {
+	size_t num_teams;
+	size_t num_modes;
+	const struct rating_mode **modes;
+	double *ratings;	/* num_modes rows of num_teams */
+	uint32_t *ranks;	/* the same, as ranks from 1 */
+	double *score;		/* per team; borda points or mean rank */
+	size_t *order;		/* team ids, consensus first to last */
+};
+
+
+int consensus_method_find(const char *name, enum consensus_method *method);
+int consensus_run(struct consensus *cons, const struct rating_mode **modes, size_t num_modes,
+	const struct games *games, const struct ncrunch_ctx *ctx, enum consensus_method method);
+int consensus_write(const struct ncrunch_ctx *ctx, const struct consensus *cons, FILE *out);
+void consensus_free(struct consensus *cons);
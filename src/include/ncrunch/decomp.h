@@ -0,0 +1,50 @@
+
+#pragma once
+
+#include <pthread.h>
+
+
+
+/*
+ * Streaming decompression of compressed inputs
+ *
+ * A compressed file is decoded on a producer thread into a pipe, and the
+ * reader takes plain text from the pipe's read end with read(), just as it
+ * would from the file. The pipe is the ring buffer between the two: the
+ * producer blocks when it is full and the reader when it is empty, so
+ * decoding and parsing overlap and nothing is written to disk.
+ *
+ * gzip needs zlib (NCRUNCH_ZLIB) and zstd needs libzstd (NCRUNCH_ZSTD); a
+ * format that was not built in is reported as an error.
+ */
+
+
+/* bytes the pipe is asked to hold; the kernel may cap it */
+#define DECOMP_RINGSIZE (1024 * 1024)
+
+
+enum decomp_format {
+	DECOMP_NONE = 0,	/* plain text */
+	DECOMP_GZIP,
+	DECOMP_ZSTD
+};
+
+
+/**
+ * A running decoder; the reader owns fd and closes it before decomp_finish()
+ */
+
+struct decomp {
+	enum decomp_format format;
+	int fd;		/* plain text comes out here */
+	int in;		/* the compressed file */
+	int out;	/* the producer's end of the pipe */
+	int err;	/* set by the producer */
+	pthread_t thread;
+};
+
+
+enum decomp_format decomp_detect(int fd);
+const char *decomp_format_name(enum decomp_format format);
+int decomp_start(struct decomp *d, int fd, enum decomp_format format);
+int decomp_finish(struct decomp *d);
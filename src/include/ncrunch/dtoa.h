@@ -0,0 +1,34 @@
+
+#pragma once
+
+#include <stddef.h>
+
+
+
+/*
+ * Shortest round trip formatting of doubles
+ *
+ * A double is written with the fewest significant digits that strtod()
+ * reads back as the same double; 0.3 comes out as "0.3" rather than the
+ * "0.29999999999999999" of %.17g, and without the digits %g drops. The
+ * digits come from Grisu3 (Loitsch, "Printing Floating-Point Numbers
+ * Quickly and Accurately with Integers"), which needs only 64 bit integer
+ * arithmetic and a table of cached powers of ten. Grisu3 knows when it
+ * can't be sure of the shortest digits, for about one double in two hundred;
+ * those go through snprintf() and strtod() instead.
+ *
+ * Integral values below 2^53 skip all of that.
+ */
+
+
+/* significant digits a double can need */
+#define DTOA_MAXDIGITS 17
+
+/* room for any dtoa_fixed() text, with its null terminator: a sign, "0.",
+ * 307 zeros and 17 digits for the smallest normal magnitudes, and a little
+ * over for the subnormals, which have fewer digits */
+#define DTOA_BUFSIZE   336
+
+
+int dtoa_shortest(double val, char *digits, int *exponent);
+int dtoa_fixed(double val, char *buf);
@@ -0,0 +1,56 @@
+
+#pragma once
+
+#include <stddef.h>
+
+#include <ncrunch/ncrunch.h>
+
+
+
+/**
+ * Operations understood by the computed field evaluator
+ *
+ * Programs are run on a stack of columns; every operation works on a whole
+ * column (one value per team) at a time.
+ */
+
+enum expr_op {
+	EXPR_OP_FIELD,	/* push a double field's column */
+	EXPR_OP_CONST,	/* push a constant column */
+	EXPR_OP_ADD,
+	EXPR_OP_SUB,
+	EXPR_OP_MUL,
+	EXPR_OP_DIV,
+	EXPR_OP_NEG
+};
+
+
+/**
+ * A single instruction; field is used by EXPR_OP_FIELD, val by EXPR_OP_CONST
+ */
+
+struct expr_insn {
+	enum expr_op op;
+	size_t field;
+	double val;
+};
+
+
+/**
+ * A compiled expression for one computed field
+ *
+ * Create with expr_compile(), clean up with expr_free()
+ */
+
+struct expr_prog {
+	struct expr_insn *code;
+	size_t len;
+	size_t max_depth;	/* deepest the column stack gets */
+};
+
+
+int expr_compile(const struct ncrunch_ctx *ctx, const char *src, struct expr_prog *prog);
+int expr_eval(const struct ncrunch_ctx *ctx, const struct expr_prog *prog, double *out);
+void expr_free(struct expr_prog *prog);
+
+int expr_load(struct ncrunch_ctx *ctx, const char *filename);
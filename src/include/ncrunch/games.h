@@ -0,0 +1,65 @@
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <ncrunch/ncrunch.h>
+#include <ncrunch/alias.h>
+
+
+
+/*
+ * Game results
+ *
+ * A game log is a tab separated file with a heading line naming its columns;
+ * "home", "away", "home_score" and "away_score" are required and "week" is
+ * optional. Teams are given by name, or by any word of their "tags" field,
+ * and resolved against a loaded context (see alias.h), so a log is always
+ * read after the flatf it goes with.
+ *
+ *	week	home	away	home_score	away_score
+ *	1	Team A	Team B	24	17
+ */
+
+
+#define GAMES_LINEBUFSIZE 512
+
+
+struct game {
+	uint32_t home;		/* team ids in the context the log was read for */
+	uint32_t away;
+	int32_t home_score;
+	int32_t away_score;
+	uint32_t week;		/* 0 if the log has no week column */
+};
+
+
+/**
+ * A season's games, in log order
+ */
+
+struct games {
+	struct game *list;
+	size_t num_games;
+	size_t max_games;
+};
+
+
+int games_read(const struct ncrunch_ctx *ctx, const char *filename, struct games *games);
+int games_read_alias(const struct ncrunch_ctx *ctx, struct alias *alias, const char *filename, struct games *games);
+int games_add(struct games *games, const struct game *game);
+void games_free(struct games *games);
+
+
+/**
+ * Returns the winner of a game, or TEAMS_INVALID for a tie
+ */
+
+static inline size_t game_winner(const struct game *game)
+{
+	if (game->home_score == game->away_score)
+		return TEAMS_INVALID;
+
+	return game->home_score > game->away_score ? game->home : game->away;
+}
@@ -0,0 +1,98 @@
+
+#pragma once
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <ncrunch/ncrunch.h>
+#include <ncrunch/games.h>
+
+
+
+/*
+ * Head-to-head and common opponent matrix
+ *
+ * For every team there are two bitsets over all teams: the opponents it has
+ * played and the opponents it has beaten (at least once). From those, two
+ * n x n count matrices are built with popcounts, a block of rows against a
+ * block of columns at a time so that the bitsets being compared stay in
+ * cache:
+ *
+ *	common[i][j]  opponents i and j have both played
+ *	wins[i][j]    of those, how many i has beaten
+ *
+ * after which every pairwise question is a bit test or a matrix lookup.
+ * Results are per pair of teams, not per game: a team that beat an opponent
+ * twice counts once.
+ */
+
+
+/* rows (and columns) of the count matrices filled in per block */
+#define H2H_BLOCK 64
+
+
+struct h2h {
+	size_t num_teams;
+	size_t words;		/* 64 bit words per bitset row */
+	uint64_t *played;	/* num_teams rows of words */
+	uint64_t *beat;
+	uint16_t *common;	/* num_teams x num_teams */
+	uint16_t *wins;
+};
+
+
+int h2h_build(struct h2h *h2h, const struct games *games, size_t num_teams);
+void h2h_free(struct h2h *h2h);
+
+int rank_by_field_h2h(const struct ncrunch_ctx *ctx, size_t field, const struct h2h *h2h, size_t *order);
+int rank_write_h2h(const struct ncrunch_ctx *ctx, size_t field, const struct h2h *h2h, size_t limit, FILE *out);
+
+
+static inline int h2h_played(const struct h2h *h2h, size_t i, size_t j)
+{
+	return (h2h->played[i * h2h->words + j / 64] >> (j % 64)) & 1;
+}
+
+
+static inline int h2h_beat(const struct h2h *h2h, size_t i, size_t j)
+{
+	return (h2h->beat[i * h2h->words + j / 64] >> (j % 64)) & 1;
+}
+
+
+static inline size_t h2h_common(const struct h2h *h2h, size_t i, size_t j)
+{
+	return h2h->common[i * h2h->num_teams + j];
+}
+
+
+/**
+ * How many of the opponents i and j have in common i has beaten
+ */
+
+static inline size_t h2h_common_wins(const struct h2h *h2h, size_t i, size_t j)
+{
+	return h2h->wins[i * h2h->num_teams + j];
+}
+
+
+/**
+ * Breaks a tie between two teams: head-to-head result first, then record
+ * against common opponents
+ *
+ * @return Negative if i goes ahead of j, positive if j goes ahead, 0 if
+ * neither tiebreaker separates them
+ */
+
+static inline int h2h_compare(const struct h2h *h2h, size_t i, size_t j)
+{
+	int d;
+
+	d = h2h_beat(h2h, j, i) - h2h_beat(h2h, i, j);
+	if (d)
+		return d;
+
+	/* same number of common opponents, so wins alone decide */
+	return (int) h2h_common_wins(h2h, j, i) - (int) h2h_common_wins(h2h, i, j);
+}
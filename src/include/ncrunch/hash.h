@@ -5,6 +5,11 @@
 
 
 
+/* length of a digest written out by hash_hex(), including the terminator */
+#define HASH_HEXSIZE (2 * SHA256_DIGEST_LENGTH + 1)
+
+
+
 /**
  * Stores the message digests for hashing calls
  */
@@ -16,6 +21,8 @@ struct mdigest {
 
 void hash_string(const char *str, size_t len, struct mdigest* digest);
 void hash_stringi(const char *str, struct mdigest* digest);
+int hash_file(const char *filename, struct mdigest *digest);
+void hash_hex(const struct mdigest *digest, char hex[HASH_HEXSIZE]);
 void hash_show(const struct mdigest* digest);
 
 
@@ -0,0 +1,98 @@
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <ncrunch/ncrunch.h>
+#include <ncrunch/hash.h>
+
+
+
+/*
+ * Weekly ranking history
+ *
+ * An append-only file of every published weekly ranking. It starts with an
+ * eight byte magic, then holds records of a tag byte, a varint payload
+ * length and the payload:
+ *
+ *	T	a team name; teams are numbered in the order they appear
+ *	W	a week: varint label, flags byte, varint team count, then one
+ *		little endian uint32 per group of HISTORY_GROUP teams giving
+ *		where its entries start, then the entries
+ *
+ * Each team's entry is two zigzag varints: its rank less its rank the week
+ * before (0 for unranked) and its rating, in millionths, less the week
+ * before's. Rankings move little from week to week, so most entries are two
+ * bytes. Every HISTORY_KEYFRAME weeks the entries are absolute instead, so
+ * that a query starting late in the file need not decode from the start.
+ *
+ * Opening the file reads only the record headers, giving an index of the
+ * weeks in memory. A team's history then costs two small reads per week:
+ * its group's offset and its group's entries.
+ *
+ * A write that was cut short leaves a partial record at the end, which is
+ * cut off the next time the file is opened.
+ */
+
+
+#define HISTORY_MAGIC    "NCHIST1"
+#define HISTORY_GROUP    64
+#define HISTORY_KEYFRAME 52
+#define HISTORY_SCALE    1e6
+
+#define HISTORY_KEYFRAME_FLAG 0x01
+
+
+struct history_week {
+	uint32_t week;
+	uint32_t num_teams;	/* teams known when it was written */
+	int keyframe;
+	off_t table;		/* the group offsets */
+	off_t entries;
+	off_t end;
+};
+
+
+struct history_name {
+	struct mdigest digest;
+	size_t id;
+};
+
+
+struct history {
+	int fd;
+	off_t end;
+	int readonly;			/* opened for queries; never written */
+
+	char **names;
+	struct history_name *index;	/* sorted by digest */
+	size_t num_names;
+	size_t max_names;
+
+	struct history_week *weeks;
+	size_t num_weeks;
+	size_t max_weeks;
+
+	/* the last week, for the next one's deltas; max_names long */
+	uint32_t *last_rank;
+	int64_t *last_rating;
+};
+
+
+/**
+ * One week of one team's history
+ */
+
+struct history_entry {
+	uint32_t week;
+	uint32_t rank;
+	double rating;
+};
+
+
+int history_open(struct history *h, const char *path, int readonly);
+int history_append(struct history *h, const struct ncrunch_ctx *ctx, uint32_t week, size_t field);
+long history_team(const struct history *h, const char *name, uint32_t since, struct history_entry **entries);
+void history_close(struct history *h);
@@ -0,0 +1,61 @@
+
+#pragma once
+
+#include <stddef.h>
+
+#include <ncrunch/ncrunch.h>
+
+
+
+/*
+ * Batch loading of many flatfs (one per season)
+ *
+ * A batch is built from a directory (every regular file in it) or a glob
+ * pattern and loaded into one context per file. The files are read with
+ * many requests in flight at once, through io_uring where the kernel allows
+ * it and otherwise through a pool of reader threads, and each file is parsed
+ * by a worker thread as soon as its contents have arrived. A batch may also
+ * have each file processed on that same thread as soon as it has been
+ * parsed, so that work on one season overlaps with reading the next.
+ */
+
+
+/* reads kept in flight, and whole files held in memory waiting to be parsed */
+#define INGEST_QUEUEDEPTH 32
+
+
+struct ingest_file {
+	char *path;
+	struct ncrunch_ctx *ctx;	/* the loaded dataset; NULL if it failed */
+	int err;			/* negative if it couldn't be read or parsed */
+
+	/* contents while in flight; internal */
+	int fd;
+	char *data;
+	size_t len;
+	size_t done;
+};
+
+
+struct ingest_batch {
+	struct ingest_file *files;	/* in path order, then in the order added */
+	size_t num_files;
+	size_t max_files;
+	int uring;			/* set if io_uring did the reads */
+
+	/* if set, the only fields loaded (flatf_set_fields()) */
+	const char **fields;
+	size_t num_fields;
+
+	/* called on the parser thread for each file once it has loaded (or
+	 * failed to); files are handed over in no particular order, and the
+	 * callback may take over the file's ctx */
+	void (*process)(struct ingest_batch *batch, size_t i);
+	void *arg;
+};
+
+
+int ingest_find(const char *pattern, struct ingest_batch *batch);
+int ingest_add(struct ingest_batch *batch, const char *path);
+int ingest_read(struct ingest_batch *batch, size_t threads);
+void ingest_free(struct ingest_batch *batch);
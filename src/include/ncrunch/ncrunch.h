@@ -1,7 +1,9 @@
 
 #pragma once
 
-#include <ncrunch/hash.h>
+#include <stdio.h>
+#include <stdint.h>
+
 
 
 
@@ -9,78 +11,104 @@
 #define NCRUNCH_VERSION_MINOR 0
 
 
+struct ncrunch_stats;
+
 
 /**
+ * The type of a team field, which decides how its column is stored
  *
+ * Every numeric type reads back as a double (team_get_double(),
+ * teams_get_column()). Storing a value that doesn't fit a column's type
+ * widens the column: BOOL -> UINT8 -> UINT16 -> INT32 -> DOUBLE for numbers,
+ * BOOL and TAGS -> STRING for text.
  */
 
 enum tfl_type {
 	TEAM_FIELD_INVALID = 0, /* this needs to be 0 (calloc initialized array) */
 	TEAM_FIELD_STRING,
-	TEAM_FIELD_DOUBLE
+	TEAM_FIELD_DOUBLE,
+	TEAM_FIELD_INT32,
+	TEAM_FIELD_UINT16,
+	TEAM_FIELD_UINT8,
+	TEAM_FIELD_BOOL,	/* "true"/"false" in a flatf, 0/1 as a number */
+	TEAM_FIELD_TAGS		/* a set of up to TFL_MAXTAGS space separated words */
 };
 
 
-/**
- *
- */
+#define TFL_MAXFIELDS 1024
+#define TFL_MAXTAGS   64
 
-struct tfl_entry {
-	char *name;
-	enum tfl_type type;
-};
 
+#define TEAMS_MAXTEAMS	65536
+#define TEAMS_INVALID	TEAMS_MAXTEAMS
 
-int tfl_create(size_t num_fields);
-size_t tfl_num_fields(void);
-int tfl_set_name(size_t id, const char *name);
-int tfl_set_type(size_t id, enum tfl_type type);
-const char *tfl_get_name(size_t id);
-enum tfl_type tfl_get_type(size_t id);
-int tfl_find(const char *name, size_t *id);
 
-int tfl_destroy(void);
 
+/**
+ * @struct ncrunch_ctx
+ * @brief A loaded dataset: the team field list plus the teams themselves
+ *
+ * Opaque; every tfl_, team_ and flatf_ call operates on a context. Contexts
+ * share no state, so separate contexts may be used from separate threads; a
+ * single context is not locked and must not be modified from two threads at
+ * once.
+ */
 
+struct ncrunch_ctx;
 
 
+struct ncrunch_ctx *ncrunch_ctx_create(void);
+void ncrunch_ctx_destroy(struct ncrunch_ctx *ctx);
+void ncrunch_ctx_set_stats(struct ncrunch_ctx *ctx, struct ncrunch_stats *stats);
 
 
-#define TEAMS_MAXTEAMS	64
-#define TEAMS_INVALID	TEAMS_MAXTEAMS
+int tfl_create(struct ncrunch_ctx *ctx, size_t num_fields);
+size_t tfl_num_fields(const struct ncrunch_ctx *ctx);
+int tfl_set_name(struct ncrunch_ctx *ctx, size_t id, const char *name);
+int tfl_set_type(struct ncrunch_ctx *ctx, size_t id, enum tfl_type type);
+const char *tfl_get_name(const struct ncrunch_ctx *ctx, size_t id);
+enum tfl_type tfl_get_type(const struct ncrunch_ctx *ctx, size_t id);
+int tfl_find(const struct ncrunch_ctx *ctx, const char *name, size_t *id);
+int tfl_add(struct ncrunch_ctx *ctx, const char *name, enum tfl_type type, size_t *id);
+const char *tfl_get_tag(const struct ncrunch_ctx *ctx, size_t id, size_t bit);
+int tfl_type_numeric(enum tfl_type type);
+const char *tfl_type_name(enum tfl_type type);
 
+int tfl_destroy(struct ncrunch_ctx *ctx);
 
 
-/**
- *
- */
-
-union team_field {
-	char* data_s;
-	double data_d;
-};
+size_t team_create(struct ncrunch_ctx *ctx);
+int team_destroy(struct ncrunch_ctx *ctx, size_t id);
+int team_set_string(struct ncrunch_ctx *ctx, size_t id, size_t field, const char *str);
+int team_set_double(struct ncrunch_ctx *ctx, size_t id, size_t field, double val);
+int team_set_name(struct ncrunch_ctx *ctx, size_t id, const char *name);
+size_t team_find(const struct ncrunch_ctx *ctx, const char *name);
+size_t team_get_row(const struct ncrunch_ctx *ctx, size_t id);
+const char *team_get_string(const struct ncrunch_ctx *ctx, size_t id, size_t field);
+int team_get_double(const struct ncrunch_ctx *ctx, size_t id, size_t field, double *val);
+int team_get_tags(const struct ncrunch_ctx *ctx, size_t id, size_t field, uint64_t *mask);
+int team_get_text(const struct ncrunch_ctx *ctx, size_t id, size_t field, char *buf, size_t len);
 
+int teams_destroy(struct ncrunch_ctx *ctx);
+size_t teams_num_teams(const struct ncrunch_ctx *ctx);
+int teams_get_column(const struct ncrunch_ctx *ctx, size_t field, double *column);
+int teams_set_column(struct ncrunch_ctx *ctx, size_t field, const double *column);
+int teams_permute(struct ncrunch_ctx *ctx, const size_t *order);
 
-/**
- *
- */
-
-struct team {
-	struct mdigest name;
-	union team_field *fields;
-};
+/* Functions for reading flat file that contains team data */
 
-size_t team_create(void);
-int team_destroy(size_t id);
-int team_set_string(size_t id, size_t field, const char *str);
-int team_set_double(size_t id, size_t field, double val);
 
-int teams_destroy(void);
-size_t teams_num_teams(void);
+int flatf_read(struct ncrunch_ctx *ctx, const char* filename);
+int flatf_read_mem(struct ncrunch_ctx *ctx, const char *data, size_t len);
+void flatf_set_fields(struct ncrunch_ctx *ctx, const char **names, size_t num);
+int flatf_write(const struct ncrunch_ctx *ctx, const char *filename);
+long flatf_validate(const char *filename, FILE *out);
 
-/* Functions for reading flat file that contains team data */
 
 
-int flatf_read(const char* filename);
+/* Functions for ranking teams */
 
 
+int rank_by_field(const struct ncrunch_ctx *ctx, size_t field, size_t *order);
+int rank_field_tied(const struct ncrunch_ctx *ctx, size_t field);
+int rank_write(const struct ncrunch_ctx *ctx, size_t field, size_t limit, FILE *out);
@@ -0,0 +1,61 @@
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+
+
+/*
+ * Hardware counter profiling (perf_event_open)
+ *
+ * A session opens one counter per event for the calling thread, user space
+ * only. Code to be measured is bracketed with perf_begin()/perf_end(); each
+ * bracket becomes a region with counter deltas and the number of items
+ * (rows, teams) it worked on, so that results can be given per item.
+ * Counters the kernel or hardware won't provide are reported as missing
+ * rather than failing the run.
+ */
+
+
+#define PERF_MAXREGIONS 32
+
+
+enum perf_event {
+	PERF_CYCLES = 0,
+	PERF_INSTRUCTIONS,
+	PERF_CACHE_MISSES,
+	PERF_BRANCH_MISSES,
+	PERF_NUM_EVENTS
+};
+
+
+/**
+ * Counter deltas for one measured region
+ */
+
+struct perf_region {
+	const char *name;
+	const char *unit;	/* what items counts, e.g. "row" or "team" */
+	uint64_t items;
+	uint64_t ns;
+	uint64_t count[PERF_NUM_EVENTS];
+};
+
+
+struct perf_session {
+	int fd[PERF_NUM_EVENTS];	/* negative if the counter is unavailable */
+	int have[PERF_NUM_EVENTS];	/* whether the counter was opened; kept after perf_close() */
+	uint64_t start[PERF_NUM_EVENTS];
+	uint64_t start_ns;
+
+	struct perf_region regions[PERF_MAXREGIONS];
+	size_t num_regions;
+};
+
+
+int perf_open(struct perf_session *session);
+void perf_close(struct perf_session *session);
+void perf_begin(struct perf_session *session);
+void perf_end(struct perf_session *session, const char *name, uint64_t items, const char *unit);
+void perf_write(const struct perf_session *session, FILE *out);
@@ -0,0 +1,19 @@
+
+#pragma once
+
+#include <ncrunch/ncrunch.h>
+
+
+
+/*
+ * PostgreSQL binary COPY export
+ *
+ * Writes one row per team with one column per team field, in field list
+ * order: numeric fields (of any width) as float8 and string and tag fields as
+ * text, tags space separated. The output can
+ * be bulk loaded with COPY <table> FROM ... WITH (FORMAT binary) into a
+ * table with matching column types.
+ */
+
+
+int pgcopy_write(const struct ncrunch_ctx *ctx, const char *filename);
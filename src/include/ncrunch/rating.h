@@ -0,0 +1,80 @@
+
+#pragma once
+
+#include <stddef.h>
+
+#include <ncrunch/ncrunch.h>
+#include <ncrunch/games.h>
+
+
+
+/*
+ * Ratings computed from a season's games
+ *
+ * Colley: solves C r = b, where for n_i games played by team i, n_ij games
+ * between i and j, and w_i and l_i wins and losses (a tie is neither),
+ *
+ *	C_ii = 2 + n_i		C_ij = -n_ij		b_i = 1 + (w_i - l_i) / 2
+ *
+ * C is symmetric positive definite, so it is factored once as L L^T and the
+ * factor kept; anything else that needs C^-1 (the what-if scenarios, for
+ * one) reuses it through rating_solve() at O(n^2) per right hand side
+ * instead of refactoring at O(n^3).
+ *
+ * Rating modes: each named way of rating teams from games has an entry in
+ * a table, giving a solver that starts from whatever is already in the
+ * ratings array (a warm start) and the scratch space it needs, so that
+ * callers solving many related seasons, such as the bootstrap, can keep
+ * one workspace per thread and start each solve from a nearby answer. The
+ * Colley mode there is iterative (preconditioned conjugate gradients on
+ * the sparse matrix) rather than the dense factorization above.
+ *
+ *	colley	as above
+ *	massey	least squares fit to score margins, centred on 0
+ *	elo	one pass over the games in order, from 1500
+ */
+
+
+/* conjugate gradients stop at this residual, relative to b */
+#define RATING_TOLERANCE 1e-10
+#define RATING_MAXITER   1000
+
+/* most modes one run can ask for */
+#define RATING_MAXMODES  16
+
+#define RATING_ELO_INITIAL 1500.0
+#define RATING_ELO_SCALE   400.0
+#define RATING_ELO_K       20.0
+
+
+struct rating {
+	size_t num_teams;
+	double *factor;		/* L, num_teams x num_teams, row major */
+	double *rhs;		/* b */
+	double *ratings;	/* r */
+};
+
+
+struct rating_mode {
+	const char *name;
+	double initial;		/* cold start value for every team */
+	size_t (*work_size)(size_t num_teams);	/* doubles of scratch */
+
+	/* improves on ratings in place; returns the iterations taken, or
+	 * negative on error */
+	int (*solve)(const struct games *games, size_t num_teams, double *ratings, double *work);
+};
+
+
+const struct rating_mode *rating_mode_find(const char *name);
+const struct rating_mode *rating_mode_get(size_t index);
+int rating_mode_solve(const struct rating_mode *mode, const struct games *games, size_t num_teams, double *ratings);
+int rating_write_field(struct ncrunch_ctx *ctx, const char *name, const double *ratings);
+
+int rating_colley(struct rating *rating, const struct games *games, size_t num_teams);
+void rating_solve(const struct rating *rating, double *x);
+void rating_free(struct rating *rating);
+
+int rating_cholesky(double *a, size_t n);
+void rating_cholesky_solve(const double *l, size_t n, double *x);
+void rating_cholesky_solve_many(const double *l, size_t n, double *x, size_t m);
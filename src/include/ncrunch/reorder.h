@@ -0,0 +1,44 @@
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <ncrunch/ncrunch.h>
+#include <ncrunch/games.h>
+
+
+
+/*
+ * Team id reordering
+ *
+ * Team ids come from flatf row order, which need have nothing to do with
+ * who plays whom, so a pass over a season's games jumps all over every per
+ * team array. Reordering gives teams that play each other nearby ids:
+ *
+ *	conference	teams grouped by conference, in flatf order within
+ *			one. A team's conference is its tag the most teams
+ *			share; when the tags field holds more than TFL_MAXTAGS
+ *			words, the first word of its tags.
+ *	rcm		reverse Cuthill-McKee on the game graph: a
+ *			breadth first walk from an outlying team of each
+ *			connected part, neighbours fewest games first, then
+ *			reversed. Needs a game log.
+ *
+ * Reordering is done once, after loading and before anything is built on
+ * the ids (h2h, sos, ratings). team_get_row() maps a team back to its flatf
+ * row, which is what rankings break ties by, so output is the same either
+ * way. An alias dictionary holds flatf row ids and must be used before.
+ */
+
+
+enum reorder_method {
+	REORDER_CONFERENCE,
+	REORDER_RCM
+};
+
+
+int reorder_method_find(const char *name, enum reorder_method *method);
+int reorder_order(const struct ncrunch_ctx *ctx, const struct games *games, enum reorder_method method, size_t *order);
+int reorder_apply(struct ncrunch_ctx *ctx, struct games *games, const size_t *order);
+size_t reorder_spread(const struct games *games);
@@ -0,0 +1,33 @@
+
+#pragma once
+
+#include <stddef.h>
+
+#include <ncrunch/ncrunch.h>
+
+
+
+/* Lua scripting hooks; only built when Lua is available (NCRUNCH_LUA) */
+
+
+struct lua_State;
+
+
+/**
+ * A column of doubles as seen from Lua (userdata)
+ *
+ * The values are stored inline after the header so that a whole column is a
+ * single allocation owned by the Lua garbage collector.
+ */
+
+struct script_column {
+	size_t n;
+	double data[];
+};
+
+
+int script_open(struct lua_State *L, const struct ncrunch_ctx *ctx);
+struct script_column *script_new_column(struct lua_State *L, size_t n);
+struct script_column *script_to_column(struct lua_State *L, int idx);
+
+int script_run(struct ncrunch_ctx *ctx, const char *filename);
@@ -0,0 +1,30 @@
+
+#pragma once
+
+#include <ncrunch/ncrunch.h>
+
+
+
+/*
+ * Resident server mode
+ *
+ * Answers queries against a loaded dataset over a Unix domain socket. The
+ * protocol is line based; each request is one line and each reply starts
+ * with either "OK <n>" followed by n lines, or "ERR <reason>".
+ *
+ *	PING			OK 0
+ *	FIELDS			one "name<TAB>type" line per field
+ *	RANK <field> [limit]	one "rank<TAB>name<TAB>value" line per team
+ *	TEAM <name>		one "field<TAB>value" line per field
+ *	GAME <week> <home> <away> <hs> <as>
+ *				OK 0; adds or corrects a final score
+ *				(tab separated; serve_run_live() only)
+ *	QUIT			closes the connection
+ */
+
+
+struct sos;
+
+
+int serve_run(const struct ncrunch_ctx *ctx, const char *path);
+int serve_run_live(struct ncrunch_ctx *ctx, struct sos *sos, const char *path);
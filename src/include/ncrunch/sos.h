@@ -0,0 +1,65 @@
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <ncrunch/ncrunch.h>
+#include <ncrunch/games.h>
+
+
+
+/*
+ * Strength of schedule
+ *
+ * Keeps two computed fields up to date in a context:
+ *
+ *	owp	opponents' win percentage: the mean, over a team's games, of
+ *		the opponent's win percentage
+ *	oowp	opponents' opponents' win percentage: the same mean of the
+ *		opponent's owp
+ *
+ * Win percentage counts a tie as half a win. A team that plays an opponent
+ * twice counts it twice.
+ *
+ * After sos_build(), adding a game or correcting a result only touches the
+ * teams it can affect: the two teams' win percentages move, which moves the
+ * owp of their opponents, which moves the oowp of those teams' opponents.
+ * Each layer is kept as a running sum and adjusted by the change in the
+ * layer below, so an update costs the sum of the degrees of the teams within
+ * two games of the result rather than a pass over every game.
+ */
+
+
+/* returned by sos_find_game() when there is no such game */
+#define SOS_NOGAME ((size_t) -1)
+
+
+struct sos {
+	size_t num_teams;
+	size_t owp_field;
+	size_t oowp_field;
+
+	struct games games;	/* every game so far, in the order added */
+
+	uint32_t **team_games;	/* per team, indices into games */
+	size_t *num_team_games;
+	size_t *max_team_games;
+
+	double *wins;		/* ties count half */
+	double *owp_sum;	/* sum of opponents' win pct, per game */
+	double *oowp_sum;	/* sum of opponents' owp, per game */
+
+	/* scratch for updates */
+	uint32_t *mark;		/* generation a team was last touched in */
+	uint32_t generation;
+	size_t *touched;
+	double *old_owp;
+};
+
+
+int sos_build(struct sos *sos, struct ncrunch_ctx *ctx, const struct games *games);
+int sos_add_game(struct sos *sos, struct ncrunch_ctx *ctx, const struct game *game);
+int sos_set_result(struct sos *sos, struct ncrunch_ctx *ctx, size_t index, int32_t home_score, int32_t away_score);
+size_t sos_find_game(const struct sos *sos, uint32_t week, size_t home, size_t away);
+void sos_free(struct sos *sos);
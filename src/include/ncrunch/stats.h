@@ -0,0 +1,105 @@
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+
+
+/*
+ * Per-phase load instrumentation
+ *
+ * A context only records timings and counts when it has been handed a
+ * struct ncrunch_stats with ncrunch_ctx_set_stats(); otherwise every hook
+ * below is a NULL check. The caller owns the stats, so they outlive the
+ * context and can be printed after its teardown has been measured.
+ */
+
+
+enum stats_phase {
+	STATS_OPEN = 0,		/* opening and closing the flatf */
+	STATS_READ,		/* reading lines */
+	STATS_TOKENIZE,		/* splitting lines into tokens */
+	STATS_INFER,		/* deciding whether tokens are alpha or numeric */
+	STATS_CREATE,		/* team_create() */
+	STATS_SET,		/* converting values, team_set_*() */
+	STATS_TEARDOWN,		/* ncrunch_ctx_destroy() */
+	STATS_NUM_PHASES
+};
+
+
+/**
+ * What happened during one phase
+ */
+
+struct stats_counter {
+	uint64_t ns;
+	uint64_t calls;
+	uint64_t bytes;
+	uint64_t rows;
+	uint64_t fields;
+	uint64_t allocs;
+};
+
+
+struct ncrunch_stats {
+	struct stats_counter phase[STATS_NUM_PHASES];
+};
+
+
+/**
+ * Reads the monotonic clock in nanoseconds
+ */
+
+static inline uint64_t stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/**
+ * Starts timing a phase; pass the result to stats_end()
+ */
+
+static inline uint64_t stats_begin(const struct ncrunch_stats *stats)
+{
+	return stats ? stats_now() : 0;
+}
+
+
+/**
+ * Stops timing a phase started with stats_begin()
+ */
+
+static inline void stats_end(struct ncrunch_stats *stats, enum stats_phase phase, uint64_t start)
+{
+	if (stats) {
+		stats->phase[phase].ns += stats_now() - start;
+		stats->phase[phase].calls++;
+	}
+}
+
+
+/**
+ * Adds to a phase's counts
+ */
+
+static inline void stats_add(struct ncrunch_stats *stats, enum stats_phase phase,
+	uint64_t bytes, uint64_t rows, uint64_t fields, uint64_t allocs)
+{
+	if (stats) {
+		stats->phase[phase].bytes += bytes;
+		stats->phase[phase].rows += rows;
+		stats->phase[phase].fields += fields;
+		stats->phase[phase].allocs += allocs;
+	}
+}
+
+
+const char *stats_phase_name(enum stats_phase phase);
+void stats_write(const struct ncrunch_stats *stats, FILE *out);
+void stats_write_json(const struct ncrunch_stats *stats, FILE *out);
@@ -0,0 +1,39 @@
+
+#pragma once
+
+#include <stddef.h>
+
+#include <ncrunch/games.h>
+#include <ncrunch/rating.h>
+
+
+
+/*
+ * What-if scenarios
+ *
+ * A scenario is a handful of hypothetical games, results included, added to
+ * the season a base rating was solved for. Adding a game between h and a
+ * adds u u^T to the Colley matrix, u = e_h - e_a, and s u to b, where s is
+ * 1/2 for a home win, -1/2 for an away win and 0 for a tie. For k games
+ * with U = [u_1 .. u_k], Sherman-Morrison-Woodbury gives the new ratings
+ * from the base factor alone:
+ *
+ *	Z  = C^-1 U			k solves with the base factor
+ *	r0 = r + Z s			C^-1 b', since b' = b + U s
+ *	r' = r0 - Z (I + U^T Z)^-1 U^T r0
+ *
+ * which is O(k n^2) per scenario rather than the O(n^3) of a fresh solve.
+ * U^T Z is just differences of rows of Z, and I + U^T Z is k x k and
+ * positive definite, so it is factored the same way as C.
+ */
+
+
+struct whatif {
+	const struct game *games;	/* the hypothetical games */
+	size_t num_games;
+	double *ratings;		/* the base rating's num_teams; filled in */
+	int err;			/* negative if the scenario was bad */
+};
+
+
+int whatif_run(const struct rating *base, struct whatif *scenarios, size_t num_scenarios, size_t threads);
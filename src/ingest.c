@@ -0,0 +1,737 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <glob.h>
+#include <dirent.h>
+#include <pthread.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include <ncrunch/ncrunch.h>
+#include <ncrunch/decomp.h>
+#include <ncrunch/ingest.h>
+
+
+
+/* io_uring with IORING_OP_READ (Linux 5.6) is used when the headers have it */
+#if defined(__NR_io_uring_setup) && defined(IORING_FEAT_RW_CUR_POS)
+#define INGEST_URING 1
+#endif
+
+/* largest single read; files bigger than this take several */
+#define INGEST_MAXREAD (1 << 30)
+
+
+
+/**
+ * What the readers and the parsers share
+ *
+ * Files go through the ready queue once their contents are in memory; held
+ * counts files that have been opened but not yet parsed and is kept at or
+ * below INGEST_QUEUEDEPTH so that a slow parse doesn't let the whole batch
+ * pile up in memory.
+ */
+
+struct ingest_state {
+	struct ingest_batch *batch;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	size_t *ready;
+	size_t ready_head;
+	size_t ready_tail;
+
+	size_t next;		/* next file for a reader thread */
+	size_t held;
+	int reading_done;
+};
+
+
+#ifdef INGEST_URING
+/**
+ * A submission and completion ring shared with the kernel
+ */
+
+struct ingest_ring {
+	int fd;
+
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_map;
+	void *cq_map;
+	size_t sq_size;
+	size_t cq_size;
+	size_t sqes_size;
+
+	unsigned pending;	/* queued since the last io_uring_enter() */
+};
+#endif
+
+
+
+static int _compare_files(const void *a, const void *b)
+{
+	return strcmp(((const struct ingest_file *) a)->path, ((const struct ingest_file *) b)->path);
+}
+
+
+/**
+ * Adds a file to a batch, after the ones already in it
+ *
+ * @return Negative on error
+ */
+
+int ingest_add(struct ingest_batch *batch, const char *path)
+{
+	struct ingest_file *files;
+	size_t max_files;
+
+	if (batch->num_files == batch->max_files) {
+		max_files = batch->max_files ? batch->max_files * 2 : 64;
+		files = realloc(batch->files, max_files * sizeof(struct ingest_file));
+		if (!files)
+			return -1;
+
+		batch->files = files;
+		batch->max_files = max_files;
+	}
+
+	memset(&batch->files[batch->num_files], 0, sizeof(struct ingest_file));
+	batch->files[batch->num_files].fd = -1;
+	batch->files[batch->num_files].path = strdup(path);
+	if (!batch->files[batch->num_files].path)
+		return -1;
+
+	batch->num_files++;
+	return 0;
+}
+
+
+/**
+ * Builds a batch from a directory or a glob pattern
+ *
+ * A directory contributes every regular file in it that doesn't start with
+ * a dot. Files are sorted by path.
+ *
+ * @return Negative on error or if nothing matched
+ */
+
+int ingest_find(const char *pattern, struct ingest_batch *batch)
+{
+	char path[FILENAME_MAX];
+	struct dirent *ent;
+	struct stat st;
+	glob_t g;
+	DIR *dir;
+	size_t i;
+	int err = 0;
+
+	memset(batch, 0, sizeof(struct ingest_batch));
+
+	if (stat(pattern, &st) == 0 && S_ISDIR(st.st_mode)) {
+		dir = opendir(pattern);
+		if (!dir) {
+			fprintf(stderr, "%s: could not open directory '%s'\n", __func__, pattern);
+			return -1;
+		}
+
+		while (!err && (ent = readdir(dir))) {
+			if (ent->d_name[0] == '.')
+				continue;
+
+			snprintf(path, FILENAME_MAX, "%s/%s", pattern, ent->d_name);
+			if (stat(path, &st) == 0 && S_ISREG(st.st_mode))
+				err = ingest_add(batch, path);
+		}
+
+		closedir(dir);
+
+	} else {
+		if (glob(pattern, 0, NULL, &g) != 0) {
+			fprintf(stderr, "%s: nothing matches '%s'\n", __func__, pattern);
+			return -2;
+		}
+
+		for (i = 0; !err && i < g.gl_pathc; i++) {
+			if (stat(g.gl_pathv[i], &st) == 0 && S_ISREG(st.st_mode))
+				err = ingest_add(batch, g.gl_pathv[i]);
+		}
+
+		globfree(&g);
+	}
+
+	if (err) {
+		ingest_free(batch);
+		return -3;
+	}
+
+	if (!batch->num_files) {
+		fprintf(stderr, "%s: no files in '%s'\n", __func__, pattern);
+		return -4;
+	}
+
+	qsort(batch->files, batch->num_files, sizeof(struct ingest_file), _compare_files);
+	return 0;
+}
+
+
+/**
+ * Opens a file and sets up the buffer its contents will be read into
+ *
+ * Compressed files are left closed, for flatf_read() to decode while it
+ * parses.
+ *
+ * @return Positive if the file needs reading, 0 if it is ready, negative
+ * on error
+ */
+
+static int _open_input(struct ingest_file *file)
+{
+	struct stat st;
+
+	file->fd = open(file->path, O_RDONLY | O_CLOEXEC);
+	if (file->fd < 0 || fstat(file->fd, &st) < 0) {
+		fprintf(stderr, "%s: could not open file '%s'\n", __func__, file->path);
+		file->err = -1;
+		return -1;
+	}
+
+	if (decomp_detect(file->fd) != DECOMP_NONE) {
+		close(file->fd);
+		file->fd = -1;
+		return 0;
+	}
+
+	file->len = st.st_size;
+	file->done = 0;
+	file->data = malloc(file->len ? file->len : 1);
+	if (!file->data) {
+		file->err = -2;
+		return -2;
+	}
+
+	return file->len ? 1 : 0;
+}
+
+
+static void _close_input(struct ingest_file *file)
+{
+	if (file->fd >= 0)
+		close(file->fd);
+
+	file->fd = -1;
+}
+
+
+/**
+ * Reads what is left of a file with blocking reads
+ */
+
+static void _read_rest(struct ingest_file *file)
+{
+	ssize_t count;
+
+	while (file->done < file->len) {
+		count = pread(file->fd, file->data + file->done, file->len - file->done, file->done);
+		if (count < 0 && errno == EINTR)
+			continue;
+
+		if (count < 0) {
+			fprintf(stderr, "%s: could not read file '%s'\n", __func__, file->path);
+			file->err = -3;
+			break;
+		}
+
+		if (count == 0) {
+			/* the file shrank */
+			file->len = file->done;
+			break;
+		}
+
+		file->done += count;
+	}
+}
+
+
+/**
+ * Loads a file whose contents are in memory, or reads a compressed one
+ */
+
+static void _load_input(const struct ingest_batch *batch, struct ingest_file *file)
+{
+	file->ctx = ncrunch_ctx_create();
+	if (!file->ctx) {
+		file->err = -4;
+		return;
+	}
+
+	if (batch->fields)
+		flatf_set_fields(file->ctx, batch->fields, batch->num_fields);
+
+	if (file->data)
+		file->err = flatf_read_mem(file->ctx, file->data, file->len);
+	else
+		file->err = flatf_read(file->ctx, file->path);
+
+	if (file->err < 0) {
+		fprintf(stderr, "%s: could not load '%s'\n", __func__, file->path);
+		ncrunch_ctx_destroy(file->ctx);
+		file->ctx = NULL;
+	}
+}
+
+
+/**
+ * Loads a file whose contents are in memory, or reads a compressed one, and
+ * hands it to the batch's process callback if it has one
+ */
+
+static void _parse_input(struct ingest_batch *batch, size_t i)
+{
+	struct ingest_file *file = &batch->files[i];
+
+	if (file->err >= 0)
+		_load_input(batch, file);
+
+	if (batch->process)
+		batch->process(batch, i);
+}
+
+
+/**
+ * Hands a file that has been read (or has failed) to the parsers
+ */
+
+static void _push_ready(struct ingest_state *state, size_t i)
+{
+	_close_input(&state->batch->files[i]);
+
+	pthread_mutex_lock(&state->lock);
+	state->ready[state->ready_tail++] = i;
+	pthread_cond_broadcast(&state->cond);
+	pthread_mutex_unlock(&state->lock);
+}
+
+
+/**
+ * Parser thread; takes files off the ready queue until reading is over
+ */
+
+static void *_parser(void *arg)
+{
+	struct ingest_state *state = arg;
+	struct ingest_file *file;
+	size_t i;
+
+	pthread_mutex_lock(&state->lock);
+
+	for (;;) {
+		while (state->ready_head == state->ready_tail && !state->reading_done)
+			pthread_cond_wait(&state->cond, &state->lock);
+
+		if (state->ready_head == state->ready_tail)
+			break;
+
+		i = state->ready[state->ready_head++];
+		file = &state->batch->files[i];
+		pthread_mutex_unlock(&state->lock);
+
+		_parse_input(state->batch, i);
+		free(file->data);
+		file->data = NULL;
+
+		pthread_mutex_lock(&state->lock);
+		state->held--;
+		pthread_cond_broadcast(&state->cond);
+	}
+
+	pthread_mutex_unlock(&state->lock);
+	return NULL;
+}
+
+
+/**
+ * Reader thread for when io_uring isn't available; each reader keeps one
+ * blocking read in flight
+ */
+
+static void *_reader(void *arg)
+{
+	struct ingest_state *state = arg;
+	size_t i;
+
+	pthread_mutex_lock(&state->lock);
+
+	for (;;) {
+		while (state->held >= INGEST_QUEUEDEPTH && state->next < state->batch->num_files)
+			pthread_cond_wait(&state->cond, &state->lock);
+
+		if (state->next >= state->batch->num_files)
+			break;
+
+		i = state->next++;
+		state->held++;
+		pthread_mutex_unlock(&state->lock);
+
+		if (_open_input(&state->batch->files[i]) > 0)
+			_read_rest(&state->batch->files[i]);
+
+		_push_ready(state, i);
+		pthread_mutex_lock(&state->lock);
+	}
+
+	pthread_mutex_unlock(&state->lock);
+	return NULL;
+}
+
+
+#ifdef INGEST_URING
+static int _ring_open(struct ingest_ring *ring, unsigned entries)
+{
+	struct io_uring_params p;
+
+	memset(ring, 0, sizeof(struct ingest_ring));
+	memset(&p, 0, sizeof(struct io_uring_params));
+
+	ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (ring->fd < 0)
+		return -1;
+
+	ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	ring->sq_map = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		ring->fd, IORING_OFF_SQ_RING);
+	ring->cq_map = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		ring->fd, IORING_OFF_CQ_RING);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		ring->fd, IORING_OFF_SQES);
+
+	if (ring->sq_map == MAP_FAILED || ring->cq_map == MAP_FAILED || ring->sqes == MAP_FAILED) {
+		if (ring->sq_map != MAP_FAILED)
+			munmap(ring->sq_map, ring->sq_size);
+		if (ring->cq_map != MAP_FAILED)
+			munmap(ring->cq_map, ring->cq_size);
+		if (ring->sqes != MAP_FAILED)
+			munmap(ring->sqes, ring->sqes_size);
+
+		close(ring->fd);
+		return -2;
+	}
+
+	ring->sq_tail = (unsigned *) ((char *) ring->sq_map + p.sq_off.tail);
+	ring->sq_mask = (unsigned *) ((char *) ring->sq_map + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned *) ((char *) ring->sq_map + p.sq_off.array);
+
+	ring->cq_head = (unsigned *) ((char *) ring->cq_map + p.cq_off.head);
+	ring->cq_tail = (unsigned *) ((char *) ring->cq_map + p.cq_off.tail);
+	ring->cq_mask = (unsigned *) ((char *) ring->cq_map + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) ((char *) ring->cq_map + p.cq_off.cqes);
+
+	return 0;
+}
+
+
+static void _ring_close(struct ingest_ring *ring)
+{
+	munmap(ring->sqes, ring->sqes_size);
+	munmap(ring->cq_map, ring->cq_size);
+	munmap(ring->sq_map, ring->sq_size);
+	close(ring->fd);
+}
+
+
+/**
+ * Queues a read of the rest of a file; the caller keeps the number in flight
+ * within the ring's size
+ */
+
+static void _ring_read(struct ingest_ring *ring, struct ingest_file *file, size_t i)
+{
+	struct io_uring_sqe *sqe;
+	unsigned tail;
+	size_t len;
+
+	tail = *ring->sq_tail;
+	sqe = &ring->sqes[tail & *ring->sq_mask];
+
+	len = file->len - file->done;
+	if (len > INGEST_MAXREAD)
+		len = INGEST_MAXREAD;
+
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = file->fd;
+	sqe->addr = (unsigned long) (file->data + file->done);
+	sqe->len = len;
+	sqe->off = file->done;
+	sqe->user_data = i;
+
+	ring->sq_array[tail & *ring->sq_mask] = tail & *ring->sq_mask;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring->pending++;
+}
+
+
+/**
+ * Submits what has been queued and waits for at least one completion
+ */
+
+static int _ring_enter(struct ingest_ring *ring)
+{
+	long ret;
+
+	do {
+		ret = syscall(__NR_io_uring_enter, ring->fd, ring->pending, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0)
+		return -1;
+
+	ring->pending -= ret;
+	return 0;
+}
+
+
+/**
+ * Reads the batch through io_uring, handing each file to the parsers as its
+ * last read completes
+ *
+ * @return Negative if the ring failed and the reader threads should take
+ * over the files that haven't been started
+ */
+
+static int _read_uring(struct ingest_state *state, struct ingest_ring *ring)
+{
+	struct ingest_batch *batch = state->batch;
+	struct ingest_file *file;
+	struct io_uring_cqe *cqe;
+	unsigned head, tail;
+	size_t inflight = 0;
+	size_t i;
+	int err = 0;
+
+	while (state->next < batch->num_files || inflight) {
+		/* open files and queue their reads while there is room */
+		pthread_mutex_lock(&state->lock);
+
+		while (!inflight && state->held >= INGEST_QUEUEDEPTH)
+			pthread_cond_wait(&state->cond, &state->lock);
+
+		while (!err && state->next < batch->num_files && state->held < INGEST_QUEUEDEPTH) {
+			i = state->next++;
+			state->held++;
+			pthread_mutex_unlock(&state->lock);
+
+			if (_open_input(&batch->files[i]) > 0) {
+				_ring_read(ring, &batch->files[i], i);
+				inflight++;
+			} else {
+				_push_ready(state, i);
+			}
+
+			pthread_mutex_lock(&state->lock);
+		}
+
+		pthread_mutex_unlock(&state->lock);
+
+		if (!inflight)
+			continue;
+
+		if (_ring_enter(ring) < 0) {
+			/* finish what was queued with blocking reads */
+			for (i = 0; i < batch->num_files; i++) {
+				file = &batch->files[i];
+				if (file->fd >= 0 && file->data && file->done < file->len) {
+					_read_rest(file);
+					_push_ready(state, i);
+				}
+			}
+
+			return -1;
+		}
+
+		head = *ring->cq_head;
+		tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+		for (; head != tail; head++) {
+			cqe = &ring->cqes[head & *ring->cq_mask];
+			i = cqe->user_data;
+			file = &batch->files[i];
+
+			if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP) {
+				/* the kernel doesn't know IORING_OP_READ */
+				_read_rest(file);
+				err = -1;
+
+			} else if (cqe->res < 0) {
+				fprintf(stderr, "%s: could not read file '%s': %s\n", __func__, file->path, strerror(-cqe->res));
+				file->err = -3;
+
+			} else if (cqe->res == 0) {
+				file->len = file->done;
+
+			} else {
+				file->done += cqe->res;
+				if (file->done < file->len) {
+					_ring_read(ring, file, i);
+					continue;
+				}
+			}
+
+			inflight--;
+			_push_ready(state, i);
+		}
+
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+		if (err && !inflight)
+			return err;
+	}
+
+	return 0;
+}
+#endif
+
+
+/**
+ * Loads every file in a batch, each into its own context
+ *
+ * Reads are issued through io_uring when it is available and otherwise by
+ * a pool of reader threads; either way up to INGEST_QUEUEDEPTH files are in
+ * flight. Parser threads load each file as soon as it has been read. After
+ * this returns each file has either a ctx or a negative err.
+ *
+ * @param threads Parser threads; 0 for one per CPU
+ * @return Negative if the batch couldn't be started
+ */
+
+int ingest_read(struct ingest_batch *batch, size_t threads)
+{
+	struct ingest_state state;
+	pthread_t *parsers;
+	pthread_t readers[INGEST_QUEUEDEPTH];
+	size_t num_parsers = 0;
+	size_t num_readers = 0;
+	long ncpu;
+	size_t i;
+#ifdef INGEST_URING
+	struct ingest_ring ring;
+#endif
+
+	if (!threads) {
+		ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = ncpu > 0 ? ncpu : 1;
+	}
+
+	if (threads > batch->num_files)
+		threads = batch->num_files;
+
+	memset(&state, 0, sizeof(struct ingest_state));
+	state.batch = batch;
+	state.ready = malloc(batch->num_files * sizeof(size_t));
+	parsers = malloc(threads * sizeof(pthread_t));
+
+	if (!state.ready || !parsers) {
+		free(state.ready);
+		free(parsers);
+		return -1;
+	}
+
+	pthread_mutex_init(&state.lock, NULL);
+	pthread_cond_init(&state.cond, NULL);
+
+	for (i = 0; i < threads; i++) {
+		if (pthread_create(&parsers[num_parsers], NULL, _parser, &state) == 0)
+			num_parsers++;
+	}
+
+	batch->uring = 0;
+
+#ifdef INGEST_URING
+	if (num_parsers && _ring_open(&ring, INGEST_QUEUEDEPTH) == 0) {
+		batch->uring = 1;
+		_read_uring(&state, &ring);
+		_ring_close(&ring);
+	}
+#endif
+
+	/* whatever io_uring didn't get to, if anything */
+	if (num_parsers && state.next < batch->num_files) {
+		for (i = 0; i < INGEST_QUEUEDEPTH && i < batch->num_files - state.next; i++) {
+			if (pthread_create(&readers[num_readers], NULL, _reader, &state) == 0)
+				num_readers++;
+		}
+	}
+
+	if (!num_parsers || (state.next < batch->num_files && !num_readers)) {
+		/* no threads at all; do it in order on this one */
+		while (state.next < batch->num_files) {
+			i = state.next++;
+			if (_open_input(&batch->files[i]) > 0)
+				_read_rest(&batch->files[i]);
+
+			_close_input(&batch->files[i]);
+			_parse_input(batch, i);
+			free(batch->files[i].data);
+			batch->files[i].data = NULL;
+		}
+	}
+
+	for (i = 0; i < num_readers; i++)
+		pthread_join(readers[i], NULL);
+
+	pthread_mutex_lock(&state.lock);
+	state.reading_done = 1;
+	pthread_cond_broadcast(&state.cond);
+	pthread_mutex_unlock(&state.lock);
+
+	for (i = 0; i < num_parsers; i++)
+		pthread_join(parsers[i], NULL);
+
+	pthread_cond_destroy(&state.cond);
+	pthread_mutex_destroy(&state.lock);
+	free(state.ready);
+	free(parsers);
+
+	return 0;
+}
+
+
+/**
+ * Destroys every loaded context and frees the batch
+ */
+
+void ingest_free(struct ingest_batch *batch)
+{
+	size_t i;
+
+	for (i = 0; i < batch->num_files; i++) {
+		if (batch->files[i].ctx)
+			ncrunch_ctx_destroy(batch->files[i].ctx);
+
+		_close_input(&batch->files[i]);
+		free(batch->files[i].data);
+		free(batch->files[i].path);
+	}
+
+	free(batch->files);
+	memset(batch, 0, sizeof(struct ingest_batch));
+}
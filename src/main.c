@@ -4,8 +4,29 @@
 #include <assert.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 #include <ncrunch/ncrunch.h>
+#include <ncrunch/expr.h>
+#include <ncrunch/serve.h>
+#include <ncrunch/cache.h>
+#include <ncrunch/pgcopy.h>
+#include <ncrunch/stats.h>
+#include <ncrunch/perf.h>
+#include <ncrunch/ingest.h>
+#include <ncrunch/games.h>
+#include <ncrunch/alias.h>
+#include <ncrunch/reorder.h>
+#include <ncrunch/h2h.h>
+#include <ncrunch/sos.h>
+#include <ncrunch/rating.h>
+#include <ncrunch/bootstrap.h>
+#include <ncrunch/consensus.h>
+#include <ncrunch/history.h>
+
+#ifdef NCRUNCH_LUA
+#include <ncrunch/script.h>
+#endif
 
 
 
@@ -113,13 +134,224 @@ static int _check_installed_version(void)
 
 
 
+/**
+ * The dataset loaded by this run
+ */
+
+static struct ncrunch_ctx *ctx = NULL;
+
+
+
 /**
  * The name of the flat file from the command line
  *
- * It can be set with either the -f flag or simply ncrunch [flatf]
+ * It can be set with either the -f flag or simply ncrunch [flatf]. Every
+ * name given is kept in flatf_names; more than one makes a batch run, as
+ * -B does.
  */
 
 static const char *flatf_name = NULL;
+static const char **flatf_names = NULL;
+static size_t num_flatfs = 0;
+
+
+/**
+ * The flatf columns the run uses, from _load_fields()
+ */
+
+static const char *load_fields[2];
+
+
+/**
+ * The name of the computed fields file from the command line (-e)
+ */
+
+static const char *expr_name = NULL;
+
+
+/**
+ * The name of the field to rank the teams by (-r)
+ */
+
+static const char *rank_name = NULL;
+
+
+/**
+ * The game log from the command line (-g); when given, ties in a ranking
+ * are broken head-to-head and then by record against common opponents, and
+ * the owp and oowp fields are added (and kept up to date by a server)
+ */
+
+static const char *games_name = NULL;
+static struct games games;
+static struct h2h h2h;
+static struct sos sos;
+
+
+/**
+ * Where to list the game log's team names that could not be resolved (-u),
+ * most frequent first; stderr if not given
+ */
+
+static const char *unresolved_name = NULL;
+
+
+/**
+ * How to reorder team ids after loading (-O): conference or rcm; NULL to
+ * keep flatf order
+ */
+
+static const char *reorder_name = NULL;
+
+
+/**
+ * The rating modes to rate teams with (-m), comma separated or "all"; needs
+ * a game log, and adds each mode's ratings as a field named after it
+ */
+
+static const char *method_name = NULL;
+
+
+/**
+ * Resamples of the game log to draw for confidence intervals (-b); 0 for
+ * none
+ */
+
+static size_t bootstrap_draws = 0;
+
+
+/**
+ * How to combine the rating modes into one ranking (-a): borda, mean or
+ * kemeny; NULL to not write one
+ */
+
+static const char *consensus_name = NULL;
+
+
+/**
+ * The weekly ranking history file (-H); with -w the ranking by the -r field
+ * is appended to it as that week, and with -q a team's history is written
+ * out instead of loading a flatf
+ */
+
+static const char *history_path = NULL;
+static unsigned long history_week = 0;
+static const char *history_team_name = NULL;
+static unsigned long history_since = 0;
+
+
+/**
+ * The socket to serve queries on, if running as a server (--serve)
+ */
+
+static const char *serve_path = NULL;
+
+
+/**
+ * The file to export the teams to in PostgreSQL COPY format (-p)
+ */
+
+static const char *pgcopy_name = NULL;
+
+
+/**
+ * The flatf to write the teams back out to, computed fields included (-o)
+ */
+
+static const char *output_name = NULL;
+
+
+/**
+ * The directory to cache ranking output in (-C), NULL to not cache
+ */
+
+static const char *cache_dir = NULL;
+
+
+/**
+ * The size limit for the cache directory, set with -M (in megabytes)
+ */
+
+static size_t cache_max = CACHE_DEFAULT_MAXSIZE;
+
+
+/**
+ * The cache key for this run's ranking; valid if cache_dir is set
+ */
+
+static struct mdigest cache_key_rank;
+
+
+/**
+ * Set by -t (summary) or -T (JSON) to time the phases of the run
+ */
+
+static int timings = 0;
+static int timings_json = 0;
+
+
+/**
+ * Where the load statistics go when timings are on
+ */
+
+static struct ncrunch_stats stats;
+
+
+/**
+ * Set by -P to count cycles, instructions and misses around each step
+ */
+
+static int profile = 0;
+static struct perf_session perf;
+
+
+/**
+ * Set by -c to check the flatf (or each flatf of a batch) and report its
+ * problems instead of loading it
+ */
+
+static int check = 0;
+
+
+/**
+ * The directory or glob of flatfs to load as a batch (-B)
+ */
+
+static const char *batch_pattern = NULL;
+
+
+/**
+ * One file's part of a batch run's output, held until every file before it
+ * has been written
+ */
+
+struct batch_output {
+	char *buf;
+	size_t len;
+	int done;
+	int failed;
+};
+
+
+/**
+ * What a batch run's parser threads share
+ */
+
+struct batch_state {
+	pthread_mutex_t lock;
+	struct batch_output *outputs;
+	size_t next;		/* the next file to write out */
+	size_t failed;
+};
+
+
+#ifdef NCRUNCH_LUA
+/**
+ * The name of the Lua ranking script from the command line (-s)
+ */
+
+static const char *script_name = NULL;
+#endif
 
 
 
@@ -130,6 +362,9 @@ static const char *flatf_name = NULL;
  * @var _switch
  * The character that is read from the command line ('a' for switch -a)
  *
+ * @var long_name
+ * Optional long form of the switch ("serve" for --serve)
+ *
  * @var takes_arg
  * True if the switch expects to receive the next argument as input
  * (-f file.txt)
@@ -142,6 +377,7 @@ static const char *flatf_name = NULL;
 
 struct switch_handler {
 	char _switch;
+	const char *long_name;
 	unsigned char takes_arg;
 	void (*handler)(const char *);
 };
@@ -154,6 +390,31 @@ struct switch_handler {
 
 static void _switch_version(const char *arg);
 static void _switch_flatf(const char *arg);
+static void _switch_expr(const char *arg);
+static void _switch_rank(const char *arg);
+static void _switch_games(const char *arg);
+static void _switch_unresolved(const char *arg);
+static void _switch_reorder(const char *arg);
+static void _switch_method(const char *arg);
+static void _switch_bootstrap(const char *arg);
+static void _switch_consensus(const char *arg);
+static void _switch_history(const char *arg);
+static void _switch_week(const char *arg);
+static void _switch_team(const char *arg);
+static void _switch_since(const char *arg);
+static void _switch_serve(const char *arg);
+static void _switch_cache(const char *arg);
+static void _switch_pgcopy(const char *arg);
+static void _switch_output(const char *arg);
+static void _switch_cache_max(const char *arg);
+static void _switch_timings(const char *arg);
+static void _switch_timings_json(const char *arg);
+static void _switch_profile(const char *arg);
+static void _switch_check(const char *arg);
+static void _switch_batch(const char *arg);
+#ifdef NCRUNCH_LUA
+static void _switch_script(const char *arg);
+#endif
 
 
 
@@ -166,6 +427,31 @@ static void _switch_flatf(const char *arg);
 static struct switch_handler handlers[] = {
 	{ ._switch = 'v', .takes_arg = 0, .handler = _switch_version },
 	{ ._switch = 'f', .takes_arg = 1, .handler = _switch_flatf },
+	{ ._switch = 'e', .takes_arg = 1, .handler = _switch_expr },
+	{ ._switch = 'r', .takes_arg = 1, .handler = _switch_rank },
+	{ ._switch = 'g', .long_name = "games", .takes_arg = 1, .handler = _switch_games },
+	{ ._switch = 'u', .long_name = "unresolved", .takes_arg = 1, .handler = _switch_unresolved },
+	{ ._switch = 'O', .long_name = "reorder", .takes_arg = 1, .handler = _switch_reorder },
+	{ ._switch = 'm', .long_name = "method", .takes_arg = 1, .handler = _switch_method },
+	{ ._switch = 'b', .long_name = "bootstrap", .takes_arg = 1, .handler = _switch_bootstrap },
+	{ ._switch = 'a', .long_name = "consensus", .takes_arg = 1, .handler = _switch_consensus },
+	{ ._switch = 'H', .long_name = "history", .takes_arg = 1, .handler = _switch_history },
+	{ ._switch = 'w', .long_name = "week", .takes_arg = 1, .handler = _switch_week },
+	{ ._switch = 'q', .long_name = "team", .takes_arg = 1, .handler = _switch_team },
+	{ ._switch = 'W', .long_name = "since", .takes_arg = 1, .handler = _switch_since },
+	{ ._switch = 'S', .long_name = "serve", .takes_arg = 1, .handler = _switch_serve },
+	{ ._switch = 'C', .long_name = "cache", .takes_arg = 1, .handler = _switch_cache },
+	{ ._switch = 'p', .long_name = "pgcopy", .takes_arg = 1, .handler = _switch_pgcopy },
+	{ ._switch = 'o', .long_name = "output", .takes_arg = 1, .handler = _switch_output },
+	{ ._switch = 'M', .long_name = "cache-max", .takes_arg = 1, .handler = _switch_cache_max },
+	{ ._switch = 't', .long_name = "timings", .takes_arg = 0, .handler = _switch_timings },
+	{ ._switch = 'T', .long_name = "timings-json", .takes_arg = 0, .handler = _switch_timings_json },
+	{ ._switch = 'P', .long_name = "perf", .takes_arg = 0, .handler = _switch_profile },
+	{ ._switch = 'c', .long_name = "check", .takes_arg = 0, .handler = _switch_check },
+	{ ._switch = 'B', .long_name = "batch", .takes_arg = 1, .handler = _switch_batch },
+#ifdef NCRUNCH_LUA
+	{ ._switch = 's', .takes_arg = 1, .handler = _switch_script },
+#endif
 	{ ._switch =  0,  .takes_arg = 1, .handler = _switch_flatf },
 	{ ._switch = 27,  .takes_arg = 0, .handler = NULL } };
 
@@ -218,173 +504,856 @@ static void _switch_version(const char *arg)
 
 static void _switch_flatf(const char *arg)
 {
+	const char **names;
+
+	names = realloc(flatf_names, (num_flatfs + 1) * sizeof(const char *));
+	if (!names) {
+		fprintf(stderr, "%s: out of memory\n", __func__);
+		exit(EXIT_FAILURE);
+	}
+
+	flatf_names = names;
+	flatf_names[num_flatfs++] = arg;
 	flatf_name = arg;
 }
 
 
 /**
- * Finds the handler that handles the switch given
+ * Handles the computed fields file switch
  */
 
-static struct switch_handler *_find_handler(char _switch)
+static void _switch_expr(const char *arg)
 {
-	size_t i = 0;
+	expr_name = arg;
+}
 
-	while (handlers[i]._switch != 27) {
-		if (handlers[i]._switch == _switch)
-			return &handlers[i];
-		i++;
-	}
 
-	fprintf(stderr, "%s: '%c' is not a valid switch\n", __func__, _switch);
-	exit(EXIT_FAILURE);
+/**
+ * Handles the rank by field switch
+ */
 
-	return NULL;
+static void _switch_rank(const char *arg)
+{
+	rank_name = arg;
 }
 
 
 /**
- * Handles a simple switch (-a)
- *
- * Sets this switch to the active_switch if it expects an argument to follow,
- * otherwise the handler for the switch is called
- *
- * @param _switch The single switch from the command line (-x)
+ * Handles the game log switch
  */
 
-static void _process_single_switch(const char *_switch)
+static void _switch_games(const char *arg)
 {
-	struct switch_handler *handler;
+	games_name = arg;
+}
 
-	handler = _find_handler(_switch[1]);
 
-	if (handler->takes_arg) {
-		active_switch = handler;
-	} else {
-		handler->handler(NULL);
-	}
+/**
+ * Handles the unresolved names switch
+ */
+
+static void _switch_unresolved(const char *arg)
+{
+	unresolved_name = arg;
 }
 
 
 /**
- * Handles a switch that has multiple flags (-abc)
- *
- * Each switch in the chain is checked to ensure that they do not take an
- * argument, then the handler for each is called
- *
- * @param _switch The switch chain from the command line
+ * Handles the reorder switch
  */
 
-static void _process_chained_switch(const char *_switch)
+static void _switch_reorder(const char *arg)
 {
-	struct switch_handler *handler;
-	const char *switchstr = &_switch[1];
+	reorder_name = arg;
+}
 
-	while (*switchstr) {
-		handler = _find_handler(*switchstr);
 
-		if (handler->takes_arg) {
-			fprintf(stderr, "%s: can't chain switches that require arguments\n", __func__);
-			exit(EXIT_FAILURE);
-		}
+/**
+ * Handles the rating mode switch
+ */
 
-		handler->handler(NULL);
-		switchstr++;
-	}
+static void _switch_method(const char *arg)
+{
+	method_name = arg;
 }
 
 
 /**
- * Handles a data argument
- *
- * If there is an active switch (one that is waiting for a data argument), the
- * handler for the active switch is called with str for its data. Otherwise,
- * the default data handler is called (_find_handler(0))
- *
- * @param str The data argument
+ * Handles the bootstrap switch; the argument is the number of resamples
  */
 
-static void _process_non_switch(const char *str)
+static void _switch_bootstrap(const char *arg)
 {
-	struct switch_handler *handler;
-
-	if (active_switch) {
-		/* if a switch is expecting an argument, give it to them */
-		active_switch->handler(str);
-		active_switch = NULL;
-	} else {
-		/* otherwise, call default handler */
-		handler = _find_handler(0);
-		handler->handler(str);
-	}
+	bootstrap_draws = strtoul(arg, NULL, 10);
 }
 
 
 /**
- * Handles the processing of a switch from the command line (e.g. -x)
- *
- * Determines whether the switch is chained (-abc) or single (-f), then calls
- * the functions that handle these types
- *
- * @arg _switch The enite argument from the command line ("-abc")
+ * Handles the consensus switch; the argument is the method
  */
 
-static void _process_switch(const char *_switch)
+static void _switch_consensus(const char *arg)
 {
-	size_t len;
-
-	if (active_switch) {
-		/* can't have another switch when expecting an argument */
-		fprintf(stderr, "%s: switch '%c' expected argument to follow\n", __func__, active_switch->_switch);
-		exit(EXIT_FAILURE);
-	}
+	consensus_name = arg;
+}
 
-	len = strlen(_switch);
 
-	if (len > 2) {
-		/* more than one flag grouped together */
-		_process_chained_switch(_switch);
-	}
- 
-	else if (len == 2) {
-		/* just one flag */
-		_process_single_switch(_switch);
-	}
+/**
+ * Handles the history file switch
+ */
 
-	else {
-		/* not valid */
-		fprintf(stderr, "WTF\n");
-		exit(EXIT_FAILURE);
-	}
+static void _switch_history(const char *arg)
+{
+	history_path = arg;
 }
 
 
 /**
- * Handles the processing of flags and file names passed to the program
- *
- * First determines if each arg is a switch or non-switch, then calls the 
- * appropriate processing functions
- *
- * @param argc Number of arguments, including called location (argv[0])
- * @param argv Vector of string arguments
+ * Handles the week switch; the argument is the week's label, such as
+ * season * 100 + week
  */
 
-static void _process_args(int argc, char **argv)
+static void _switch_week(const char *arg)
 {
-	int arg = 1;
+	history_week = strtoul(arg, NULL, 10);
+}
 
-	while (arg < argc) {
+
+/**
+ * Handles the team history switch; the argument is the team's name
+ */
+
+static void _switch_team(const char *arg)
+{
+	history_team_name = arg;
+}
+
+
+/**
+ * Handles the since switch; the argument is the first week label wanted
+ */
+
+static void _switch_since(const char *arg)
+{
+	history_since = strtoul(arg, NULL, 10);
+}
+
+
+/**
+ * Handles the server switch; the argument is the socket path
+ */
+
+static void _switch_serve(const char *arg)
+{
+	serve_path = arg;
+}
+
+
+/**
+ * Handles the PostgreSQL export switch; "-" writes to stdout
+ */
+
+static void _switch_pgcopy(const char *arg)
+{
+	pgcopy_name = arg;
+}
+
+
+/**
+ * Handles the flatf output switch
+ */
+
+static void _switch_output(const char *arg)
+{
+	output_name = arg;
+}
+
+
+/**
+ * Handles the cache directory switch
+ */
+
+static void _switch_cache(const char *arg)
+{
+	cache_dir = arg;
+}
+
+
+/**
+ * Handles the cache size switch; the argument is in megabytes
+ */
+
+static void _switch_cache_max(const char *arg)
+{
+	char *end;
+	unsigned long mb;
+
+	mb = strtoul(arg, &end, 10);
+	if (*end || end == arg) {
+		fprintf(stderr, "%s: '%s' is not a size in megabytes\n", __func__, arg);
+		exit(EXIT_FAILURE);
+	}
+
+	cache_max = mb * 1024 * 1024;
+}
+
+
+/**
+ * Handles the timings switch; a summary is printed to stderr at exit
+ */
+
+static void _switch_timings(const char *arg)
+{
+	timings = 1;
+}
+
+
+/**
+ * Handles the JSON timings switch; one line of JSON is printed to stderr
+ */
+
+static void _switch_timings_json(const char *arg)
+{
+	timings = 1;
+	timings_json = 1;
+}
+
+
+/**
+ * Handles the hardware counter profiling switch; results go to stderr
+ */
+
+static void _switch_profile(const char *arg)
+{
+	profile = 1;
+}
+
+
+/**
+ * Handles the check switch; problems go to stdout and the exit status is
+ * nonzero if there were any
+ */
+
+static void _switch_check(const char *arg)
+{
+	check = 1;
+}
+
+
+/**
+ * Handles the batch switch; the argument is a directory or a quoted glob
+ */
+
+static void _switch_batch(const char *arg)
+{
+	batch_pattern = arg;
+}
+
+
+/**
+ * Starts a profiled region if profiling
+ */
+
+static void _profile_begin(void)
+{
+	if (profile)
+		perf_begin(&perf);
+}
+
+
+/**
+ * Ends a profiled region; items are counted per team
+ */
+
+static void _profile_end(const char *name)
+{
+	if (profile)
+		perf_end(&perf, name, teams_num_teams(ctx), "team");
+}
+
+
+#ifdef NCRUNCH_LUA
+/**
+ * Handles the Lua ranking script switch
+ */
+
+static void _switch_script(const char *arg)
+{
+	script_name = arg;
+}
+#endif
+
+
+/**
+ * Finds the handler that handles the switch given
+ */
+
+static struct switch_handler *_find_handler(char _switch)
+{
+	size_t i = 0;
+
+	while (handlers[i]._switch != 27) {
+		if (handlers[i]._switch == _switch)
+			return &handlers[i];
+		i++;
+	}
+
+	fprintf(stderr, "%s: '%c' is not a valid switch\n", __func__, _switch);
+	exit(EXIT_FAILURE);
+
+	return NULL;
+}
+
+
+/**
+ * Finds the handler for a long switch (--name)
+ */
+
+static struct switch_handler *_find_long_handler(const char *name)
+{
+	size_t i = 0;
+
+	while (handlers[i]._switch != 27) {
+		if (handlers[i].long_name && strcmp(handlers[i].long_name, name) == 0)
+			return &handlers[i];
+		i++;
+	}
+
+	fprintf(stderr, "%s: '--%s' is not a valid switch\n", __func__, name);
+	exit(EXIT_FAILURE);
+
+	return NULL;
+}
+
+
+/**
+ * Handles a long switch (--name)
+ *
+ * Behaves exactly like the single character form of the same switch
+ *
+ * @param _switch The switch from the command line, including the dashes
+ */
+
+static void _process_long_switch(const char *_switch)
+{
+	struct switch_handler *handler;
+
+	handler = _find_long_handler(&_switch[2]);
+
+	if (handler->takes_arg) {
+		active_switch = handler;
+	} else {
+		handler->handler(NULL);
+	}
+}
+
+
+/**
+ * Handles a simple switch (-a)
+ *
+ * Sets this switch to the active_switch if it expects an argument to follow,
+ * otherwise the handler for the switch is called
+ *
+ * @param _switch The single switch from the command line (-x)
+ */
+
+static void _process_single_switch(const char *_switch)
+{
+	struct switch_handler *handler;
+
+	handler = _find_handler(_switch[1]);
+
+	if (handler->takes_arg) {
+		active_switch = handler;
+	} else {
+		handler->handler(NULL);
+	}
+}
+
+
+/**
+ * Handles a switch that has multiple flags (-abc)
+ *
+ * Each switch in the chain is checked to ensure that they do not take an
+ * argument, then the handler for each is called
+ *
+ * @param _switch The switch chain from the command line
+ */
+
+static void _process_chained_switch(const char *_switch)
+{
+	struct switch_handler *handler;
+	const char *switchstr = &_switch[1];
+
+	while (*switchstr) {
+		handler = _find_handler(*switchstr);
+
+		if (handler->takes_arg) {
+			fprintf(stderr, "%s: can't chain switches that require arguments\n", __func__);
+			exit(EXIT_FAILURE);
+		}
+
+		handler->handler(NULL);
+		switchstr++;
+	}
+}
+
+
+/**
+ * Handles a data argument
+ *
+ * If there is an active switch (one that is waiting for a data argument), the
+ * handler for the active switch is called with str for its data. Otherwise,
+ * the default data handler is called (_find_handler(0))
+ *
+ * @param str The data argument
+ */
+
+static void _process_non_switch(const char *str)
+{
+	struct switch_handler *handler;
+
+	if (active_switch) {
+		/* if a switch is expecting an argument, give it to them */
+		active_switch->handler(str);
+		active_switch = NULL;
+	} else {
+		/* otherwise, call default handler */
+		handler = _find_handler(0);
+		handler->handler(str);
+	}
+}
+
+
+/**
+ * Handles the processing of a switch from the command line (e.g. -x)
+ *
+ * Determines whether the switch is chained (-abc) or single (-f), then calls
+ * the functions that handle these types
+ *
+ * @arg _switch The enite argument from the command line ("-abc")
+ */
+
+static void _process_switch(const char *_switch)
+{
+	size_t len;
+
+	if (active_switch) {
+		/* can't have another switch when expecting an argument */
+		fprintf(stderr, "%s: switch '%c' expected argument to follow\n", __func__, active_switch->_switch);
+		exit(EXIT_FAILURE);
+	}
+
+	len = strlen(_switch);
+
+	if (len > 2 && _switch[1] == '-') {
+		/* long form (--name) */
+		_process_long_switch(_switch);
+	}
+
+	else if (len > 2) {
+		/* more than one flag grouped together */
+		_process_chained_switch(_switch);
+	}
+ 
+	else if (len == 2) {
+		/* just one flag */
+		_process_single_switch(_switch);
+	}
+
+	else {
+		/* not valid */
+		fprintf(stderr, "WTF\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+/**
+ * Handles the processing of flags and file names passed to the program
+ *
+ * First determines if each arg is a switch or non-switch, then calls the 
+ * appropriate processing functions
+ *
+ * @param argc Number of arguments, including called location (argv[0])
+ * @param argv Vector of string arguments
+ */
+
+static void _process_args(int argc, char **argv)
+{
+	int arg = 1;
+
+	while (arg < argc) {
 
 		if (argv[arg][0] == '-') {
 			_process_switch(argv[arg]);
 		}
 
-		else {
-			_process_non_switch(argv[arg]);
+		else {
+			_process_non_switch(argv[arg]);
+		}
+
+		arg++;
+	}
+}
+
+
+/**
+ * Looks for this run's ranking in the cache and prints it if found
+ *
+ * The key covers the flatf, computed fields file and script contents plus
+ * the field being ranked, so a hit means the dataset doesn't need loading.
+ *
+ * @param name The name of the field being ranked
+ * @return 1 if the ranking was printed from the cache, 0 if not
+ */
+
+static int _rank_cached(const char *name)
+{
+	const char *files[4];
+	char params[FILENAME_MAX];
+	struct cache_entry entry;
+	int err;
+
+	files[0] = flatf_name;
+	files[1] = expr_name;
+#ifdef NCRUNCH_LUA
+	files[2] = script_name;
+#else
+	files[2] = NULL;
+#endif
+	files[3] = games_name;
+
+	if (!flatf_name)
+		return 0;
+
+	snprintf(params, sizeof(params), "rank_by_field\t%s", name);
+
+	err = cache_key(files, 4, params, &cache_key_rank);
+	if (err < 0) {
+		/* let the normal load report the problem */
+		cache_dir = NULL;
+		return 0;
+	}
+
+	err = cache_lookup(cache_dir, &cache_key_rank, &entry);
+	if (err != 0)
+		return 0;
+
+	fwrite(entry.data, 1, entry.len, stdout);
+	cache_release(&entry);
+
+	return 1;
+}
+
+
+/**
+ * Prints the teams ranked by the named field
+ *
+ * If caching, the output is also stored under the key from _rank_cached()
+ *
+ * @param name The name of a double field
+ * @return Negative on error
+ */
+
+static int _rank(const char *name)
+{
+	size_t field;
+	FILE *out;
+	char *buf = NULL;
+	size_t len = 0;
+	int error;
+
+	if (tfl_find(ctx, name, &field) < 0) {
+		fprintf(stderr, "%s: no field named '%s'\n", __func__, name);
+		return -1;
+	}
+
+	/* the n x n matrix only when there are ties for it to break */
+	if (games_name) {
+		error = rank_field_tied(ctx, field);
+		if (error > 0) {
+			_profile_begin();
+			error = h2h_build(&h2h, &games, teams_num_teams(ctx));
+			_profile_end("h2h");
+		}
+
+		if (error < 0) {
+			return -1;
+		}
+	}
+
+	if (!cache_dir) {
+		return rank_write_h2h(ctx, field, h2h.num_teams ? &h2h : NULL, 0, stdout);
+	}
+
+	out = open_memstream(&buf, &len);
+	if (!out) {
+		return -2;
+	}
+
+	error = rank_write_h2h(ctx, field, h2h.num_teams ? &h2h : NULL, 0, out);
+	fclose(out);
+
+	if (!error) {
+		fwrite(buf, 1, len, stdout);
+		cache_store(cache_dir, cache_max, &cache_key_rank, buf, len);
+	}
+
+	free(buf);
+	return error;
+}
+
+
+/**
+ * Parses a comma separated list of rating modes; "all" names every mode
+ *
+ * @param modes Room for RATING_MAXMODES modes
+ * @return The number of modes, or negative on error
+ */
+
+static int _parse_modes(const char *list, const struct rating_mode **modes)
+{
+	char name[64];
+	const char *p = list;
+	size_t num_modes = 0;
+	size_t len;
+
+	if (strcmp(list, "all") == 0) {
+		while ((modes[num_modes] = rating_mode_get(num_modes)))
+			num_modes++;
+
+		return num_modes;
+	}
+
+	while (*p) {
+		len = strcspn(p, ",");
+		if (len >= sizeof(name) || num_modes == RATING_MAXMODES) {
+			fprintf(stderr, "%s: too many rating modes in '%s'\n", __func__, list);
+			return -1;
+		}
+
+		memcpy(name, p, len);
+		name[len] = '\0';
+
+		modes[num_modes] = rating_mode_find(name);
+		if (!modes[num_modes]) {
+			fprintf(stderr, "%s: no rating mode named '%s'\n", __func__, name);
+			return -2;
+		}
+
+		num_modes++;
+		p += len;
+		if (*p == ',')
+			p++;
+	}
+
+	return num_modes;
+}
+
+
+/**
+ * Reads the game log from the command line, resolving names through the
+ * alias dictionary saved next to the flatf, and lists the names that didn't
+ * resolve
+ *
+ * @return The number of lines skipped, or negative on error
+ */
+
+static int _games_read(void)
+{
+	struct alias alias;
+	FILE *out = stderr;
+	int ret;
+
+	if (alias_open(&alias, ctx, flatf_name) < 0)
+		return -1;
+
+	ret = games_read_alias(ctx, &alias, games_name, &games);
+
+	if (ret >= 0 && unresolved_name) {
+		out = fopen(unresolved_name, "w");
+		if (!out) {
+			fprintf(stderr, "%s: could not open '%s'\n", __func__, unresolved_name);
+			ret = -2;
+		}
+	}
+
+	if (ret >= 0 && (unresolved_name || alias.num_misses)) {
+		if (!unresolved_name)
+			fprintf(stderr, "%s: '%s' names teams that could not be resolved:\n", __func__, games_name);
+
+		alias_write_misses(&alias, out);
+		if (out != stderr)
+			fclose(out);
+	}
+
+	alias_free(&alias);
+	return ret;
+}
+
+
+/**
+ * Gives the teams new ids by the method from the command line, remapping
+ * the game log if there is one
+ *
+ * @return Negative on error
+ */
+
+static int _reorder(void)
+{
+	enum reorder_method method;
+	size_t *order;
+	int err;
+
+	if (reorder_method_find(reorder_name, &method) < 0) {
+		fprintf(stderr, "%s: no reordering method named '%s'\n", __func__, reorder_name);
+		return -1;
+	}
+
+	order = malloc((teams_num_teams(ctx) + 1) * sizeof(size_t));
+	if (!order)
+		return -2;
+
+	err = reorder_order(ctx, games_name ? &games : NULL, method, order);
+	if (err >= 0)
+		err = reorder_apply(ctx, games_name ? &games : NULL, order);
+
+	free(order);
+	return err;
+}
+
+
+/**
+ * Rates the teams with the modes from the command line and stores each
+ * mode's ratings as a field named after it
+ *
+ * With -b (one mode only), also writes each team's confidence intervals;
+ * with -a, runs the modes at once and writes their consensus ranking.
+ *
+ * @return Negative on error
+ */
+
+static int _rate(const char *list)
+{
+	const struct rating_mode *modes[RATING_MAXMODES];
+	enum consensus_method method = CONSENSUS_BORDA;
+	struct consensus cons;
+	struct bootstrap bs;
+	int num_modes;
+	int error = 0;
+	int i;
+
+	num_modes = _parse_modes(list, modes);
+	if (num_modes < 0) {
+		return -1;
+	}
+
+	if (!games_name) {
+		fprintf(stderr, "%s: rating needs a game log (-g)\n", __func__);
+		return -2;
+	}
+
+	if (consensus_name && consensus_method_find(consensus_name, &method) < 0) {
+		fprintf(stderr, "%s: no consensus method named '%s'\n", __func__, consensus_name);
+		return -3;
+	}
+
+	if (bootstrap_draws) {
+		if (num_modes != 1) {
+			fprintf(stderr, "%s: the bootstrap takes one rating mode\n", __func__);
+			return -4;
+		}
+
+		if (bootstrap_run(&bs, modes[0], &games, teams_num_teams(ctx), bootstrap_draws, 0, 0) < 0) {
+			return -5;
 		}
 
-		arg++;
+		error = rating_write_field(ctx, modes[0]->name, bs.base);
+		if (!error) {
+			error = bootstrap_write(ctx, &bs, BOOTSTRAP_DEFAULT_LEVEL, stdout);
+		}
+
+		bootstrap_free(&bs);
+		return error;
+	}
+
+	if (consensus_run(&cons, modes, num_modes, &games, ctx, method) < 0) {
+		return -6;
+	}
+
+	for (i = 0; !error && i < num_modes; i++) {
+		error = rating_write_field(ctx, modes[i]->name, &cons.ratings[i * cons.num_teams]);
+	}
+
+	if (!error && consensus_name) {
+		error = consensus_write(ctx, &cons, stdout);
+	}
+
+	consensus_free(&cons);
+	return error;
+}
+
+
+/**
+ * Writes one team's weekly history, one week per line: week label, rank,
+ * rating
+ *
+ * @return Negative on error
+ */
+
+static int _history_team(void)
+{
+	struct history h;
+	struct history_entry *entries;
+	long num;
+	long i;
+
+	if (history_open(&h, history_path, 1) < 0) {
+		return -1;
+	}
+
+	num = history_team(&h, history_team_name, history_since, &entries);
+	history_close(&h);
+
+	if (num < 0) {
+		return -2;
+	}
+
+	for (i = 0; i < num; i++) {
+		printf("%u\t%u\t%g\n", entries[i].week, entries[i].rank, entries[i].rating);
+	}
+
+	free(entries);
+	return 0;
+}
+
+
+/**
+ * Appends the ranking by the -r field to the history as the -w week
+ *
+ * @return Negative on error
+ */
+
+static int _history_append(void)
+{
+	struct history h;
+	size_t field;
+	int error;
+
+	if (!rank_name || tfl_find(ctx, rank_name, &field) < 0) {
+		fprintf(stderr, "%s: the history needs a field to rank by (-r)\n", __func__);
+		return -1;
+	}
+
+	if (history_open(&h, history_path, 0) < 0) {
+		return -2;
 	}
+
+	error = history_append(&h, ctx, history_week, field);
+	history_close(&h);
+
+	return error;
 }
 
 
@@ -397,13 +1366,271 @@ static void _process_args(int argc, char **argv)
 static void _exit_handler(void)
 {
 #ifdef NCRUNCH_DEBUG
-	teams_destroy();
-	tfl_destroy();
+	ncrunch_ctx_destroy(ctx);
+#endif
+}
+
+/**
+ * Works out which flatf columns the run uses, so the rest needn't be
+ * converted and stored (flatf_set_fields())
+ *
+ * Computed fields and scripts may use any field, and pgcopy, -o and a server
+ * give out every field, so any of those reads every column.
+ *
+ * @return The number of names put in load_fields, besides "name", or
+ * negative to read every column
+ */
+
+static long _load_fields(void)
+{
+	long num = 0;
+
+#ifdef NCRUNCH_LUA
+	if (script_name)
+		return -1;
+#endif
+
+	if (expr_name || pgcopy_name || output_name || serve_path)
+		return -1;
+
+	/* names in a game log resolve through tags too; conferences are tags */
+	if (games_name || reorder_name)
+		load_fields[num++] = "tags";
+
+	if (rank_name)
+		load_fields[num++] = rank_name;
+
+	return num;
+}
+
+
+/**
+ * Ranks one file of a batch, writing its ranking with each line starting
+ * with the file's path
+ *
+ * @return Negative on error
+ */
+
+static int _batch_rank(const struct ingest_file *file, FILE *out)
+{
+	size_t field;
+	FILE *tmp;
+	char *buf = NULL;
+	size_t len = 0;
+	char *line, *end;
+	int err;
+
+	if (expr_name && expr_load(file->ctx, expr_name) < 0)
+		return -1;
+
+	if (tfl_find(file->ctx, rank_name, &field) < 0) {
+		fprintf(stderr, "%s: '%s' has no field named '%s'\n", __func__, file->path, rank_name);
+		return -2;
+	}
+
+	tmp = open_memstream(&buf, &len);
+	if (!tmp)
+		return -3;
+
+	err = rank_write(file->ctx, field, 0, tmp);
+	fclose(tmp);
+
+	for (line = buf; !err && line < buf + len; line = end + 1) {
+		end = memchr(line, '\n', buf + len - line);
+		if (!end)
+			end = buf + len;
+
+		fprintf(out, "%s\t%.*s\n", file->path, (int) (end - line), line);
+	}
+
+	free(buf);
+	return err;
+}
+
+
+/**
+ * Handles one file of a batch on the parser thread that loaded it, then
+ * writes out every file's output that is next in line
+ */
+
+static void _batch_process(struct ingest_batch *batch, size_t i)
+{
+	struct batch_state *state = batch->arg;
+	struct ingest_file *file = &batch->files[i];
+	struct batch_output *output = &state->outputs[i];
+	FILE *out;
+
+	out = open_memstream(&output->buf, &output->len);
+	if (!out) {
+		output->failed = 1;
+	} else {
+		if (!file->ctx)
+			output->failed = 1;
+		else if (rank_name)
+			output->failed = _batch_rank(file, out) < 0;
+		else
+			fprintf(out, "%s\t%lu\t%lu\n", file->path, teams_num_teams(file->ctx), tfl_num_fields(file->ctx));
+
+		if (output->failed)
+			fprintf(out, "%s\tfailed\n", file->path);
+
+		fclose(out);
+	}
+
+	/* done with it; a batch needn't hold every season at once */
+	if (file->ctx) {
+		ncrunch_ctx_destroy(file->ctx);
+		file->ctx = NULL;
+	}
+
+	pthread_mutex_lock(&state->lock);
+	output->done = 1;
+
+	for (; state->next < batch->num_files && state->outputs[state->next].done; state->next++) {
+		output = &state->outputs[state->next];
+		fwrite(output->buf, 1, output->len, stdout);
+		state->failed += output->failed;
+
+		free(output->buf);
+		output->buf = NULL;
+	}
+
+	pthread_mutex_unlock(&state->lock);
+}
+
+
+/**
+ * Runs every flatf in the batch (-B, and every flatf named when there is more
+ * than one) as its own dataset on ingest's worker threads
+ *
+ * Output is in file order whichever file finishes first: with -r, each
+ * file's ranking (after -e) with every line starting with the file's path;
+ * otherwise one line per file with its team and field counts. A file that
+ * fails gets a line saying so.
+ *
+ * @return Negative if any file failed
+ */
+
+static int _batch(const char *pattern)
+{
+	struct ingest_batch batch;
+	struct batch_state state;
+	uint64_t start;
+	size_t i;
+	long num;
+	int err = 0;
+
+	if (games_name || unresolved_name || reorder_name || method_name || bootstrap_draws || consensus_name ||
+		history_path || serve_path || cache_dir || pgcopy_name || output_name || profile) {
+		fprintf(stderr, "%s: a batch takes -e and -r, not per season options\n", __func__);
+		return -1;
+	}
+
+#ifdef NCRUNCH_LUA
+	if (script_name) {
+		fprintf(stderr, "%s: a batch takes -e and -r, not per season options\n", __func__);
+		return -1;
+	}
 #endif
+
+	memset(&batch, 0, sizeof(struct ingest_batch));
+
+	if (pattern && ingest_find(pattern, &batch) < 0) {
+		return -1;
+	}
+
+	for (i = 0; i < num_flatfs; i++) {
+		if (ingest_add(&batch, flatf_names[i]) < 0) {
+			ingest_free(&batch);
+			return -2;
+		}
+	}
+
+	memset(&state, 0, sizeof(struct batch_state));
+	state.outputs = calloc(batch.num_files, sizeof(struct batch_output));
+	if (!state.outputs) {
+		ingest_free(&batch);
+		return -2;
+	}
+
+	pthread_mutex_init(&state.lock, NULL);
+	batch.process = _batch_process;
+	batch.arg = &state;
+
+	num = _load_fields();
+	if (num >= 0) {
+		batch.fields = load_fields;
+		batch.num_fields = num;
+	}
+
+	start = stats_now();
+
+	if (ingest_read(&batch, 0) < 0) {
+		err = -2;
+	}
+
+	if (timings) {
+		fprintf(stderr, "%lu file(s) run in %.3f ms using %s\n", batch.num_files,
+			(stats_now() - start) / 1e6, batch.uring ? "io_uring" : "reader threads");
+	}
+
+	if (!err && state.failed)
+		err = -3;
+
+	pthread_mutex_destroy(&state.lock);
+	free(state.outputs);
+	ingest_free(&batch);
+	return err;
+}
+
+
+/**
+ * Checks the flatf, or every flatf of a batch, without loading it (-c)
+ *
+ * @return The number of problems found, or negative if a file couldn't
+ * be read
+ */
+
+static long _check(void)
+{
+	struct ingest_batch batch;
+	size_t i;
+	long num, total = 0;
+
+	if (!batch_pattern && num_flatfs <= 1) {
+		return flatf_validate(flatf_name, stdout);
+	}
+
+	memset(&batch, 0, sizeof(struct ingest_batch));
+
+	if (batch_pattern && ingest_find(batch_pattern, &batch) < 0) {
+		return -1;
+	}
+
+	for (i = 0; i < num_flatfs; i++) {
+		if (ingest_add(&batch, flatf_names[i]) < 0) {
+			ingest_free(&batch);
+			return -2;
+		}
+	}
+
+	/* every file gets checked, even after one that couldn't be read */
+	for (i = 0; i < batch.num_files; i++) {
+		num = flatf_validate(batch.files[i].path, stdout);
+		if (num < 0 || total < 0)
+			total = -1;
+		else
+			total += num;
+	}
+
+	ingest_free(&batch);
+	return total;
 }
 
+
 int main(int argc, char** argv)
 {
+	long num;
 	int error;
 
 	_process_args(argc, argv);
@@ -413,9 +1640,188 @@ int main(int argc, char** argv)
 		return -1;
 	}
 
+	if (check) {
+		return _check() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (batch_pattern || num_flatfs > 1) {
+		return _batch(batch_pattern) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	if (history_path && history_team_name) {
+		return _history_team() < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	/* only a run that prints nothing but the ranking is cached; a hit would
+	 * lose anything else (a rating's intervals, a consensus, an export, the
+	 * unresolved names report) */
+	if (!rank_name || method_name || bootstrap_draws || consensus_name || serve_path || pgcopy_name ||
+	    output_name || unresolved_name || history_week) {
+		cache_dir = NULL;
+	}
+
+	/* a ranking already in the cache needs no dataset */
+	if (cache_dir && _rank_cached(rank_name)) {
+		return 0;
+	}
+
+	ctx = ncrunch_ctx_create();
+	if (!ctx) {
+		return -1;
+	}
+
 	/* install our exit callback function */
 	atexit(_exit_handler);
-	flatf_read(flatf_name);
+
+	if (timings) {
+		ncrunch_ctx_set_stats(ctx, &stats);
+	}
+
+	if (profile) {
+		/* carry on without counters; regions still get wall time */
+		perf_open(&perf);
+	}
+
+	num = _load_fields();
+	if (num >= 0) {
+		flatf_set_fields(ctx, load_fields, num);
+	}
+
+	_profile_begin();
+
+	error = flatf_read(ctx, flatf_name);
+	if (error < 0) {
+		return -1;
+	}
+
+	if (profile)
+		perf_end(&perf, "parse", teams_num_teams(ctx), "row");
+
+	if (games_name) {
+		_profile_begin();
+		error = _games_read();
+		_profile_end("games");
+
+		if (error < 0) {
+			return -1;
+		}
+	}
+
+	if (reorder_name) {
+		_profile_begin();
+		error = _reorder();
+		_profile_end("reorder");
+
+		if (error < 0) {
+			return -1;
+		}
+	}
+
+	if (games_name) {
+		_profile_begin();
+		error = sos_build(&sos, ctx, &games);
+		_profile_end("sos");
+
+		if (error < 0) {
+			return -1;
+		}
+	}
+
+	if (method_name) {
+		_profile_begin();
+		error = _rate(method_name);
+		_profile_end("rate");
+
+		if (error < 0) {
+			return -1;
+		}
+	}
+
+	if (expr_name) {
+		_profile_begin();
+		error = expr_load(ctx, expr_name);
+		_profile_end("expr");
+
+		if (error < 0) {
+			return -1;
+		}
+	}
+
+#ifdef NCRUNCH_LUA
+	if (script_name) {
+		_profile_begin();
+		error = script_run(ctx, script_name);
+		_profile_end("script");
+
+		if (error < 0) {
+			return -1;
+		}
+	}
+#endif
+
+	if (rank_name) {
+		_profile_begin();
+		error = _rank(rank_name);
+		_profile_end("rank");
+
+		if (error < 0) {
+			return -1;
+		}
+	}
+
+	if (history_path && history_week) {
+		_profile_begin();
+		error = _history_append();
+		_profile_end("history");
+
+		if (error < 0) {
+			return -1;
+		}
+	}
+
+	if (output_name) {
+		_profile_begin();
+		error = flatf_write(ctx, output_name);
+		_profile_end("write");
+
+		if (error < 0) {
+			return -1;
+		}
+	}
+
+	if (pgcopy_name) {
+		error = pgcopy_write(ctx, pgcopy_name);
+		if (error < 0) {
+			return -1;
+		}
+	}
+
+	if (serve_path) {
+		if (games_name)
+			error = serve_run_live(ctx, &sos, serve_path);
+		else
+			error = serve_run(ctx, serve_path);
+
+		if (error < 0) {
+			return -1;
+		}
+	}
+
+	if (profile) {
+		perf_close(&perf);
+		perf_write(&perf, stderr);
+	}
+
+	if (timings) {
+		/* tear down now so that it shows up in the timings */
+		ncrunch_ctx_destroy(ctx);
+		ctx = NULL;
+
+		if (timings_json)
+			stats_write_json(&stats, stderr);
+		else
+			stats_write(&stats, stderr);
+	}
 
 	return 0;
 }
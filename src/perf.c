@@ -0,0 +1,216 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include <ncrunch/perf.h>
+#include <ncrunch/stats.h>
+
+
+
+/**
+ * The hardware events behind enum perf_event
+ */
+
+static const struct {
+	const char *name;
+	uint64_t config;
+} perf_events[PERF_NUM_EVENTS] = {
+	{ "cycles",		PERF_COUNT_HW_CPU_CYCLES },
+	{ "instructions",	PERF_COUNT_HW_INSTRUCTIONS },
+	{ "cache-misses",	PERF_COUNT_HW_CACHE_MISSES },
+	{ "branch-misses",	PERF_COUNT_HW_BRANCH_MISSES }
+};
+
+
+/**
+ * What read() returns for a counter opened with our read_format
+ */
+
+struct perf_value {
+	uint64_t value;
+	uint64_t time_enabled;
+	uint64_t time_running;
+};
+
+
+static int _perf_event_open(struct perf_event_attr *attr)
+{
+	/* this thread, any cpu, no group */
+	return syscall(__NR_perf_event_open, attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+
+/**
+ * Reads a counter, scaled up if the kernel had to multiplex it
+ */
+
+static uint64_t _read_counter(int fd)
+{
+	struct perf_value val;
+
+	if (fd < 0 || read(fd, &val, sizeof(struct perf_value)) != sizeof(struct perf_value))
+		return 0;
+
+	if (val.time_running && val.time_running < val.time_enabled)
+		return (uint64_t) ((double) val.value * val.time_enabled / val.time_running);
+
+	return val.value;
+}
+
+
+/**
+ * Opens the counters; they run from here until perf_close()
+ *
+ * @return Negative if no counter at all could be opened
+ */
+
+int perf_open(struct perf_session *session)
+{
+	struct perf_event_attr attr;
+	size_t opened = 0;
+	size_t i;
+
+	memset(session, 0, sizeof(struct perf_session));
+
+	for (i = 0; i < PERF_NUM_EVENTS; i++) {
+		memset(&attr, 0, sizeof(struct perf_event_attr));
+		attr.size = sizeof(struct perf_event_attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = perf_events[i].config;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		session->fd[i] = _perf_event_open(&attr);
+		if (session->fd[i] < 0) {
+			fprintf(stderr, "%s: %s counter unavailable: %s\n", __func__, perf_events[i].name, strerror(errno));
+			continue;
+		}
+
+		session->have[i] = 1;
+		opened++;
+	}
+
+	if (!opened) {
+		fprintf(stderr, "%s: no hardware counters available; is perf_event_paranoid too high?\n", __func__);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Closes the counters; the regions stay readable
+ */
+
+void perf_close(struct perf_session *session)
+{
+	size_t i;
+
+	for (i = 0; i < PERF_NUM_EVENTS; i++) {
+		if (session->fd[i] >= 0)
+			close(session->fd[i]);
+
+		session->fd[i] = -1;
+	}
+}
+
+
+/**
+ * Starts a region
+ */
+
+void perf_begin(struct perf_session *session)
+{
+	size_t i;
+
+	for (i = 0; i < PERF_NUM_EVENTS; i++)
+		session->start[i] = _read_counter(session->fd[i]);
+
+	session->start_ns = stats_now();
+}
+
+
+/**
+ * Ends the region started by the last perf_begin() and records it
+ *
+ * @param name The region's name; must stay valid for the session
+ * @param items How many rows, teams, etc. the region processed
+ * @param unit What an item is; must stay valid for the session
+ */
+
+void perf_end(struct perf_session *session, const char *name, uint64_t items, const char *unit)
+{
+	struct perf_region *region;
+	uint64_t end_ns = stats_now();
+	size_t i;
+
+	if (session->num_regions == PERF_MAXREGIONS) {
+		fprintf(stderr, "%s: too many regions, dropping '%s'\n", __func__, name);
+		return;
+	}
+
+	region = &session->regions[session->num_regions++];
+	region->name = name;
+	region->unit = unit;
+	region->items = items;
+	region->ns = end_ns - session->start_ns;
+
+	for (i = 0; i < PERF_NUM_EVENTS; i++)
+		region->count[i] = _read_counter(session->fd[i]) - session->start[i];
+}
+
+
+/**
+ * Writes one line per region: raw counts, IPC and misses per item
+ *
+ * Counters that could not be opened are shown as "-".
+ */
+
+void perf_write(const struct perf_session *session, FILE *out)
+{
+	const struct perf_region *r;
+	double items;
+	size_t i, e;
+
+	fprintf(out, "%-12s %10s %-6s %10s", "region", "items", "unit", "ms");
+	for (e = 0; e < PERF_NUM_EVENTS; e++)
+		fprintf(out, " %14s", perf_events[e].name);
+	fprintf(out, " %6s %12s %12s\n", "ipc", "cmiss/item", "bmiss/item");
+
+	for (i = 0; i < session->num_regions; i++) {
+		r = &session->regions[i];
+		items = r->items ? r->items : 1;
+
+		fprintf(out, "%-12s %10lu %-6s %10.3f", r->name, r->items, r->unit, r->ns / 1e6);
+
+		for (e = 0; e < PERF_NUM_EVENTS; e++) {
+			if (!session->have[e])
+				fprintf(out, " %14s", "-");
+			else
+				fprintf(out, " %14lu", r->count[e]);
+		}
+
+		if (!session->have[PERF_CYCLES] || !session->have[PERF_INSTRUCTIONS] || !r->count[PERF_CYCLES])
+			fprintf(out, " %6s", "-");
+		else
+			fprintf(out, " %6.2f", (double) r->count[PERF_INSTRUCTIONS] / r->count[PERF_CYCLES]);
+
+		if (!session->have[PERF_CACHE_MISSES])
+			fprintf(out, " %12s", "-");
+		else
+			fprintf(out, " %12.3f", r->count[PERF_CACHE_MISSES] / items);
+
+		if (!session->have[PERF_BRANCH_MISSES])
+			fprintf(out, " %12s\n", "-");
+		else
+			fprintf(out, " %12.3f\n", r->count[PERF_BRANCH_MISSES] / items);
+	}
+}
@@ -0,0 +1,258 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <endian.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <ncrunch/ncrunch.h>
+#include <ncrunch/pgcopy.h>
+
+
+
+#define PGCOPY_BUFSIZE (1024 * 1024)
+
+
+
+/* fixed start of every binary COPY stream */
+static const char pgcopy_signature[11] = "PGCOPY\n\377\r\n";
+
+
+
+/**
+ * Output buffer for the COPY stream
+ *
+ * Everything is staged in one large buffer and handed to write() only when it
+ * fills up. The first error sticks and makes the remaining puts no-ops.
+ */
+
+struct pgbuf {
+	int fd;
+	char *data;
+	size_t len;
+	int err;
+};
+
+
+/**
+ * A team and where it was in the flatf it came from
+ */
+
+struct pgcopy_row {
+	size_t row;
+	size_t id;
+};
+
+
+/**
+ * Writes out everything in the buffer
+ */
+
+static void _flush(struct pgbuf *buf)
+{
+	size_t done = 0;
+	ssize_t count;
+
+	while (!buf->err && done < buf->len) {
+		count = write(buf->fd, buf->data + done, buf->len - done);
+
+		if (count < 0 && errno == EINTR)
+			continue;
+
+		if (count <= 0)
+			buf->err = -1;
+		else
+			done += count;
+	}
+
+	buf->len = 0;
+}
+
+
+static void _put(struct pgbuf *buf, const void *data, size_t len)
+{
+	size_t chunk;
+
+	while (len && !buf->err) {
+		if (buf->len == PGCOPY_BUFSIZE)
+			_flush(buf);
+
+		chunk = PGCOPY_BUFSIZE - buf->len;
+		if (chunk > len)
+			chunk = len;
+
+		memcpy(buf->data + buf->len, data, chunk);
+		buf->len += chunk;
+		data = (const char *) data + chunk;
+		len -= chunk;
+	}
+}
+
+
+/* integers go out in network byte order */
+
+static void _put_u16(struct pgbuf *buf, uint16_t val)
+{
+	val = htobe16(val);
+	_put(buf, &val, sizeof(val));
+}
+
+static void _put_u32(struct pgbuf *buf, uint32_t val)
+{
+	val = htobe32(val);
+	_put(buf, &val, sizeof(val));
+}
+
+
+/**
+ * Writes a float8 column value: length followed by the big-endian IEEE double
+ */
+
+static void _put_double(struct pgbuf *buf, double val)
+{
+	uint64_t bits;
+
+	memcpy(&bits, &val, sizeof(bits));
+	bits = htobe64(bits);
+
+	_put_u32(buf, sizeof(bits));
+	_put(buf, &bits, sizeof(bits));
+}
+
+
+/**
+ * Writes a text column value, or NULL if str is
+ */
+
+static void _put_text(struct pgbuf *buf, const char *str)
+{
+	size_t len;
+
+	if (!str) {
+		_put_u32(buf, (uint32_t) -1);
+		return;
+	}
+
+	len = strlen(str);
+	_put_u32(buf, len);
+	_put(buf, str, len);
+}
+
+
+/**
+ * qsort() callback; by flatf row
+ */
+
+static int _compare_rows(const void *a, const void *b)
+{
+	const struct pgcopy_row *x = a;
+	const struct pgcopy_row *y = b;
+
+	return (x->row > y->row) - (x->row < y->row);
+}
+
+
+/**
+ * Writes every team as a row of a PostgreSQL binary COPY stream
+ *
+ * Teams go out in the order of the flatf they came from (team_get_row()),
+ * whatever order -O left their ids in.
+ *
+ * @param ctx The dataset to export, including any computed fields
+ * @param filename The file to write to, or "-" for stdout
+ * @return Negative on error
+ */
+
+int pgcopy_write(const struct ncrunch_ctx *ctx, const char *filename)
+{
+	struct pgbuf buf;
+	struct pgcopy_row *rows;
+	size_t num_fields = tfl_num_fields(ctx);
+	size_t num_teams = teams_num_teams(ctx);
+	size_t i, team, field;
+	enum tfl_type type;
+	char text[1024];
+	double val;
+
+	if (num_fields > INT16_MAX) {
+		fprintf(stderr, "%s: too many fields for a COPY row\n", __func__);
+		return -1;
+	}
+
+	rows = malloc((num_teams ? num_teams : 1) * sizeof(struct pgcopy_row));
+	if (!rows)
+		return -3;
+
+	for (i = 0; i < num_teams; i++) {
+		rows[i].row = team_get_row(ctx, i);
+		rows[i].id = i;
+	}
+
+	qsort(rows, num_teams, sizeof(struct pgcopy_row), _compare_rows);
+
+	memset(&buf, 0, sizeof(struct pgbuf));
+
+	if (strcmp(filename, "-") == 0)
+		buf.fd = STDOUT_FILENO;
+	else
+		buf.fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+	if (buf.fd < 0) {
+		fprintf(stderr, "%s: could not open file '%s'\n", __func__, filename);
+		free(rows);
+		return -2;
+	}
+
+	buf.data = malloc(PGCOPY_BUFSIZE);
+	if (!buf.data) {
+		if (buf.fd != STDOUT_FILENO)
+			close(buf.fd);
+		free(rows);
+		return -3;
+	}
+
+	/* header: signature, flags, header extension length */
+	_put(&buf, pgcopy_signature, sizeof(pgcopy_signature));
+	_put_u32(&buf, 0);
+	_put_u32(&buf, 0);
+
+	for (i = 0; i < num_teams; i++) {
+		team = rows[i].id;
+		_put_u16(&buf, num_fields);
+
+		for (field = 0; field < num_fields; field++) {
+			type = tfl_get_type(ctx, field);
+
+			if (tfl_type_numeric(type)) {
+				team_get_double(ctx, team, field, &val);
+				_put_double(&buf, val);
+			} else if (type == TEAM_FIELD_STRING) {
+				_put_text(&buf, team_get_string(ctx, team, field));
+			} else {
+				team_get_text(ctx, team, field, text, sizeof(text));
+				_put_text(&buf, text);
+			}
+		}
+	}
+
+	/* trailer */
+	_put_u16(&buf, (uint16_t) -1);
+	_flush(&buf);
+
+	free(buf.data);
+	free(rows);
+
+	if (buf.fd != STDOUT_FILENO && close(buf.fd) < 0)
+		buf.err = -1;
+
+	if (buf.err) {
+		fprintf(stderr, "%s: error writing '%s'\n", __func__, filename);
+		return -4;
+	}
+
+	return 0;
+}
@@ -0,0 +1,259 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <ncrunch/ncrunch.h>
+#include <ncrunch/h2h.h>
+
+
+
+/**
+ * A team's rating paired with its id for sorting
+ */
+
+struct rank_entry {
+	double val;
+	size_t id;
+	size_t row;	/* flatf order, which ties go by */
+};
+
+
+/**
+ * qsort() callback; orders by value descending, NaNs last, ties by flatf
+ * row (the team id, unless the teams were reordered)
+ */
+
+static int _compare(const void *a, const void *b)
+{
+	const struct rank_entry *x = a;
+	const struct rank_entry *y = b;
+
+	if (isnan(x->val) != isnan(y->val))
+		return isnan(x->val) ? 1 : -1;
+
+	if (x->val > y->val)
+		return -1;
+
+	if (x->val < y->val)
+		return 1;
+
+	return (x->row > y->row) - (x->row < y->row);
+}
+
+
+/**
+ * qsort() callback; doubles ascending
+ */
+
+static int _compare_values(const void *a, const void *b)
+{
+	double x = *(const double *) a;
+	double y = *(const double *) b;
+
+	return (x > y) - (x < y);
+}
+
+
+/**
+ * Puts each run of teams with the same value in tiebreak order
+ *
+ * Runs are short, so a plain insertion sort does; head-to-head results need
+ * not be transitive, which rules out handing the comparison to qsort().
+ */
+
+static void _break_ties(struct rank_entry *entries, size_t num_teams, const struct h2h *h2h)
+{
+	struct rank_entry tmp;
+	size_t start, end;
+	size_t i, j;
+
+	for (start = 0; start < num_teams; start = end) {
+		for (end = start + 1; end < num_teams && entries[end].val == entries[start].val; end++)
+			;
+
+		for (i = start + 1; i < end; i++) {
+			tmp = entries[i];
+
+			for (j = i; j > start && h2h_compare(h2h, tmp.id, entries[j - 1].id) < 0; j--)
+				entries[j] = entries[j - 1];
+
+			entries[j] = tmp;
+		}
+	}
+}
+
+
+/**
+ * Orders the teams by a numeric field, best first, breaking ties with
+ * head-to-head and common opponent results
+ *
+ * @param h2h The season's matrix; NULL to break ties by flatf row only
+ * @param order Receives teams_num_teams() team ids, best first
+ * @return Negative on error
+ */
+
+int rank_by_field_h2h(const struct ncrunch_ctx *ctx, size_t field, const struct h2h *h2h, size_t *order)
+{
+	struct rank_entry *entries;
+	double *column;
+	size_t num_teams = teams_num_teams(ctx);
+	size_t i;
+
+	if (!tfl_type_numeric(tfl_get_type(ctx, field))) {
+		fprintf(stderr, "%s: field id %lu is not a numeric field\n", __func__, field);
+		return -1;
+	}
+
+	if (h2h && h2h->num_teams != num_teams) {
+		fprintf(stderr, "%s: matrix is for %lu teams, not %lu\n", __func__, h2h->num_teams, num_teams);
+		return -1;
+	}
+
+	if (num_teams == 0)
+		return 0;
+
+	entries = malloc(num_teams * sizeof(struct rank_entry));
+	column = malloc(num_teams * sizeof(double));
+	if (!entries || !column) {
+		free(entries);
+		free(column);
+		return -2;
+	}
+
+	teams_get_column(ctx, field, column);
+
+	for (i = 0; i < num_teams; i++) {
+		entries[i].val = column[i];
+		entries[i].id = i;
+		entries[i].row = team_get_row(ctx, i);
+	}
+
+	qsort(entries, num_teams, sizeof(struct rank_entry), _compare);
+
+	if (h2h)
+		_break_ties(entries, num_teams, h2h);
+
+	for (i = 0; i < num_teams; i++) {
+		order[i] = entries[i].id;
+	}
+
+	free(entries);
+	free(column);
+	return 0;
+}
+
+
+/**
+ * Whether any two teams have the same value in a numeric field, so that
+ * ranking by it has ties to break
+ *
+ * @return 1 if so, 0 if not, negative on error
+ */
+
+int rank_field_tied(const struct ncrunch_ctx *ctx, size_t field)
+{
+	size_t num_teams = teams_num_teams(ctx);
+	double *column;
+	size_t i;
+	int tied = 0;
+
+	if (!tfl_type_numeric(tfl_get_type(ctx, field))) {
+		fprintf(stderr, "%s: field id %lu is not a numeric field\n", __func__, field);
+		return -1;
+	}
+
+	column = malloc((num_teams ? num_teams : 1) * sizeof(double));
+	if (!column)
+		return -2;
+
+	teams_get_column(ctx, field, column);
+	qsort(column, num_teams, sizeof(double), _compare_values);
+
+	for (i = 1; !tied && i < num_teams; i++)
+		tied = column[i] == column[i - 1];
+
+	free(column);
+	return tied;
+}
+
+
+/**
+ * Orders the teams by a numeric field, best (highest) first
+ *
+ * @param field The id of the field to rank by
+ * @param order Receives teams_num_teams() team ids, best first
+ * @return Negative on error
+ */
+
+int rank_by_field(const struct ncrunch_ctx *ctx, size_t field, size_t *order)
+{
+	return rank_by_field_h2h(ctx, field, NULL, order);
+}
+
+
+/**
+ * Writes the teams ranked by a numeric field, one per line
+ *
+ * Each line is tab separated: rank, team name, value
+ *
+ * @param field The id of the field to rank by
+ * @param h2h Breaks ties when not NULL; see rank_by_field_h2h()
+ * @param limit The most teams to write; 0 for all of them
+ * @param out Where to write the ranking
+ * @return Negative on error
+ */
+
+int rank_write_h2h(const struct ncrunch_ctx *ctx, size_t field, const struct h2h *h2h, size_t limit, FILE *out)
+{
+	size_t *order;
+	size_t num_teams = teams_num_teams(ctx);
+	size_t nameid;
+	size_t i;
+	double val;
+	int err;
+
+	if (tfl_find(ctx, "name", &nameid) < 0) {
+		fprintf(stderr, "%s: could not find required 'name' field\n", __func__);
+		return -1;
+	}
+
+	if (num_teams == 0)
+		return 0;
+
+	order = malloc(num_teams * sizeof(size_t));
+	if (!order) {
+		return -2;
+	}
+
+	err = rank_by_field_h2h(ctx, field, h2h, order);
+
+	if (limit == 0 || limit > num_teams)
+		limit = num_teams;
+
+	for (i = 0; !err && i < limit; i++) {
+		team_get_double(ctx, order[i], field, &val);
+		fprintf(out, "%lu\t%s\t%g\n", i + 1, team_get_string(ctx, order[i], nameid), val);
+	}
+
+	free(order);
+	return err;
+}
+
+
+/**
+ * Writes the teams ranked by a numeric field, one per line
+ *
+ * Each line is tab separated: rank, team name, value
+ *
+ * @param field The id of the field to rank by
+ * @param limit The most teams to write; 0 for all of them
+ * @param out Where to write the ranking
+ * @return Negative on error
+ */
+
+int rank_write(const struct ncrunch_ctx *ctx, size_t field, size_t limit, FILE *out)
+{
+	return rank_write_h2h(ctx, field, NULL, limit, out);
+}
@@ -0,0 +1,577 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <ncrunch/ncrunch.h>
+#include <ncrunch/games.h>
+#include <ncrunch/rating.h>
+
+
+
+/**
+ * Factors a symmetric positive definite matrix in place as L L^T
+ *
+ * Only the lower triangle is read; L is left there and the upper triangle
+ * is zeroed. Each entry is a dot product of two rows of L, so the inner
+ * loop always runs along contiguous memory.
+ *
+ * @param a n x n, row major
+ * @return Negative if a is not positive definite
+ */
+
+int rating_cholesky(double *a, size_t n)
+{
+	double *ri, *rj;
+	double sum;
+	size_t i, j, k;
+
+	for (i = 0; i < n; i++) {
+		ri = &a[i * n];
+
+		for (j = 0; j <= i; j++) {
+			rj = &a[j * n];
+			sum = ri[j];
+
+			for (k = 0; k < j; k++)
+				sum -= ri[k] * rj[k];
+
+			if (j < i) {
+				ri[j] = sum / rj[j];
+			} else {
+				if (sum <= 0.0)
+					return -1;
+				ri[i] = sqrt(sum);
+			}
+		}
+
+		memset(&ri[i + 1], 0, (n - i - 1) * sizeof(double));
+	}
+
+	return 0;
+}
+
+
+/**
+ * Solves L L^T x = b in place, given L from rating_cholesky()
+ *
+ * The back substitution goes a row of L at a time, subtracting each solved
+ * x_i from the entries still to come, rather than down columns of L.
+ *
+ * @param x b on entry, x on return
+ */
+
+void rating_cholesky_solve(const double *l, size_t n, double *x)
+{
+	const double *ri;
+	double sum;
+	size_t i, k;
+
+	for (i = 0; i < n; i++) {
+		ri = &l[i * n];
+		sum = x[i];
+
+		for (k = 0; k < i; k++)
+			sum -= ri[k] * x[k];
+
+		x[i] = sum / ri[i];
+	}
+
+	for (i = n; i-- > 0; ) {
+		ri = &l[i * n];
+		x[i] /= ri[i];
+
+		for (k = 0; k < i; k++)
+			x[k] -= ri[k] * x[i];
+	}
+}
+
+
+/**
+ * rating_cholesky_solve() for m right hand sides at once
+ *
+ * Each pass over L is the expensive part once L is bigger than the cache,
+ * so every entry of L is applied to all m vectors while it is loaded. The
+ * vectors are interleaved, x[i * m + j] being entry i of vector j, which
+ * keeps the innermost loop contiguous.
+ *
+ * @param x n x m, row major; the b vectors on entry, the x vectors on return
+ */
+
+void rating_cholesky_solve_many(const double *l, size_t n, double *x, size_t m)
+{
+	const double *ri;
+	double *xi, *xk;
+	double lik;
+	size_t i, j, k;
+
+	for (i = 0; i < n; i++) {
+		ri = &l[i * n];
+		xi = &x[i * m];
+
+		for (k = 0; k < i; k++) {
+			lik = ri[k];
+			if (lik == 0.0)
+				continue;
+
+			xk = &x[k * m];
+			for (j = 0; j < m; j++)
+				xi[j] -= lik * xk[j];
+		}
+
+		for (j = 0; j < m; j++)
+			xi[j] /= ri[i];
+	}
+
+	for (i = n; i-- > 0; ) {
+		ri = &l[i * n];
+		xi = &x[i * m];
+
+		for (j = 0; j < m; j++)
+			xi[j] /= ri[i];
+
+		for (k = 0; k < i; k++) {
+			lik = ri[k];
+			if (lik == 0.0)
+				continue;
+
+			xk = &x[k * m];
+			for (j = 0; j < m; j++)
+				xk[j] -= lik * xi[j];
+		}
+	}
+}
+
+
+/**
+ * Computes Colley ratings for a season's games
+ *
+ * @param num_teams The number of teams in the context the games refer to
+ * @return Negative on error
+ */
+
+int rating_colley(struct rating *rating, const struct games *games, size_t num_teams)
+{
+	const struct game *game;
+	size_t n = num_teams;
+	size_t h, a, winner;
+	size_t i;
+
+	memset(rating, 0, sizeof(struct rating));
+
+	if (n == 0)
+		return 0;
+
+	rating->num_teams = n;
+	rating->factor = calloc(n * n, sizeof(double));
+	rating->rhs = malloc(n * sizeof(double));
+	rating->ratings = malloc(n * sizeof(double));
+
+	if (!rating->factor || !rating->rhs || !rating->ratings) {
+		fprintf(stderr, "%s: not enough memory for %lu teams\n", __func__, n);
+		rating_free(rating);
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		rating->factor[i * n + i] = 2.0;
+		rating->rhs[i] = 1.0;
+	}
+
+	for (i = 0; i < games->num_games; i++) {
+		game = &games->list[i];
+		h = game->home;
+		a = game->away;
+
+		if (h >= n || a >= n || h == a) {
+			fprintf(stderr, "%s: game %lu has a bad team id\n", __func__, i);
+			rating_free(rating);
+			return -2;
+		}
+
+		/* the lower triangle is all the factorization reads */
+		rating->factor[h * n + h] += 1.0;
+		rating->factor[a * n + a] += 1.0;
+		rating->factor[h > a ? h * n + a : a * n + h] -= 1.0;
+
+		winner = game_winner(game);
+		if (winner != TEAMS_INVALID) {
+			rating->rhs[winner] += 0.5;
+			rating->rhs[winner == h ? a : h] -= 0.5;
+		}
+	}
+
+	if (rating_cholesky(rating->factor, n) < 0) {
+		fprintf(stderr, "%s: matrix is not positive definite\n", __func__);
+		rating_free(rating);
+		return -3;
+	}
+
+	memcpy(rating->ratings, rating->rhs, n * sizeof(double));
+	rating_cholesky_solve(rating->factor, n, rating->ratings);
+
+	return 0;
+}
+
+
+/**
+ * Solves C x = b with the factor kept from the base solve
+ *
+ * @param x b on entry, x on return; num_teams long
+ */
+
+void rating_solve(const struct rating *rating, double *x)
+{
+	rating_cholesky_solve(rating->factor, rating->num_teams, x);
+}
+
+
+/**
+ * y = A x, where A is a diagonal less the game graph's adjacency: both the
+ * Colley and Massey matrices are of this form
+ */
+
+static void _apply(const struct games *games, size_t n, const double *diag, const double *x, double *y)
+{
+	const struct game *game;
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		y[i] = diag[i] * x[i];
+
+	for (i = 0; i < games->num_games; i++) {
+		game = &games->list[i];
+		y[game->home] -= x[game->away];
+		y[game->away] -= x[game->home];
+	}
+}
+
+
+static double _dot(const double *x, const double *y, size_t n)
+{
+	double sum = 0.0;
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		sum += x[i] * y[i];
+
+	return sum;
+}
+
+
+/**
+ * Solves A x = b by conjugate gradients preconditioned by the diagonal,
+ * starting from x
+ *
+ * A team with no games has a zero diagonal (Massey); it is left alone.
+ *
+ * @param work 4 * n doubles
+ * @return The iterations taken
+ */
+
+static int _cg(const struct games *games, size_t n, const double *diag, const double *b, double *x, double *work)
+{
+	double *r = work;
+	double *z = &work[n];
+	double *p = &work[2 * n];
+	double *q = &work[3 * n];
+	double rz, rz_next, alpha, beta, limit;
+	size_t i;
+	int iter;
+
+	limit = RATING_TOLERANCE * RATING_TOLERANCE * _dot(b, b, n);
+
+	_apply(games, n, diag, x, q);
+	for (i = 0; i < n; i++) {
+		r[i] = b[i] - q[i];
+		z[i] = diag[i] > 0.0 ? r[i] / diag[i] : 0.0;
+		p[i] = z[i];
+	}
+
+	rz = _dot(r, z, n);
+
+	for (iter = 0; iter < RATING_MAXITER; iter++) {
+		if (_dot(r, r, n) <= limit)
+			return iter;
+
+		_apply(games, n, diag, p, q);
+		alpha = rz / _dot(p, q, n);
+
+		for (i = 0; i < n; i++) {
+			x[i] += alpha * p[i];
+			r[i] -= alpha * q[i];
+			z[i] = diag[i] > 0.0 ? r[i] / diag[i] : 0.0;
+		}
+
+		rz_next = _dot(r, z, n);
+		beta = rz_next / rz;
+		rz = rz_next;
+
+		for (i = 0; i < n; i++)
+			p[i] = z[i] + beta * p[i];
+	}
+
+	return iter;
+}
+
+
+static int _check_games(const struct games *games, size_t n)
+{
+	const struct game *game;
+	size_t i;
+
+	for (i = 0; i < games->num_games; i++) {
+		game = &games->list[i];
+
+		if (game->home >= n || game->away >= n || game->home == game->away)
+			return -1;
+	}
+
+	return 0;
+}
+
+
+static size_t _cg_work_size(size_t num_teams)
+{
+	return 6 * num_teams;
+}
+
+
+/**
+ * Colley; see the top of rating.h
+ */
+
+static int _colley_solve(const struct games *games, size_t num_teams, double *x, double *work)
+{
+	const struct game *game;
+	size_t n = num_teams;
+	double *diag = work;
+	double *b = &work[n];
+	size_t winner;
+	size_t i;
+
+	if (_check_games(games, n) < 0)
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		diag[i] = 2.0;
+		b[i] = 1.0;
+	}
+
+	for (i = 0; i < games->num_games; i++) {
+		game = &games->list[i];
+		diag[game->home] += 1.0;
+		diag[game->away] += 1.0;
+
+		winner = game_winner(game);
+		if (winner != TEAMS_INVALID) {
+			b[winner] += 0.5;
+			b[winner == game->home ? game->away : game->home] -= 0.5;
+		}
+	}
+
+	return _cg(games, n, diag, b, x, &work[2 * n]);
+}
+
+
+/**
+ * Massey: least squares fit of rating differences to score margins, which
+ * gives M r = p with M_ii = n_i, M_ij = -n_ij and p_i the team's total
+ * margin
+ *
+ * M is singular (adding a constant to every rating changes nothing), but p
+ * always lies in its range, so conjugate gradients still converge; the
+ * ratings are centred on 0 afterwards to pin the constant down.
+ */
+
+static int _massey_solve(const struct games *games, size_t num_teams, double *x, double *work)
+{
+	const struct game *game;
+	size_t n = num_teams;
+	double *diag = work;
+	double *b = &work[n];
+	double margin, mean;
+	size_t i;
+	int iter;
+
+	if (_check_games(games, n) < 0)
+		return -1;
+
+	memset(diag, 0, 2 * n * sizeof(double));
+
+	for (i = 0; i < games->num_games; i++) {
+		game = &games->list[i];
+		margin = (double) game->home_score - game->away_score;
+
+		diag[game->home] += 1.0;
+		diag[game->away] += 1.0;
+		b[game->home] += margin;
+		b[game->away] -= margin;
+	}
+
+	iter = _cg(games, n, diag, b, x, &work[2 * n]);
+
+	mean = 0.0;
+	for (i = 0; i < n; i++)
+		mean += x[i];
+
+	mean /= n;
+	for (i = 0; i < n; i++)
+		x[i] -= mean;
+
+	return iter;
+}
+
+
+static size_t _elo_work_size(size_t num_teams)
+{
+	return 0;
+}
+
+
+/**
+ * Elo: one pass over the games in log order, each moving the two ratings
+ * by RATING_ELO_K times how far the result was from the expected one
+ *
+ * Elo has no fixed point to converge on, so it ignores the ratings it is
+ * given and always starts every team from the initial rating.
+ */
+
+static int _elo_solve(const struct games *games, size_t num_teams, double *x, double *work)
+{
+	const struct game *game;
+	double expected, result, delta;
+	size_t i;
+
+	if (_check_games(games, num_teams) < 0)
+		return -1;
+
+	for (i = 0; i < num_teams; i++)
+		x[i] = RATING_ELO_INITIAL;
+
+	for (i = 0; i < games->num_games; i++) {
+		game = &games->list[i];
+
+		expected = 1.0 / (1.0 + pow(10.0, (x[game->away] - x[game->home]) / RATING_ELO_SCALE));
+		result = game->home_score > game->away_score ? 1.0 :
+			game->home_score < game->away_score ? 0.0 : 0.5;
+
+		delta = RATING_ELO_K * (result - expected);
+		x[game->home] += delta;
+		x[game->away] -= delta;
+	}
+
+	return 1;
+}
+
+
+static const struct rating_mode rating_modes[] = {
+	{ "colley",	0.5,			_cg_work_size,		_colley_solve },
+	{ "massey",	0.0,			_cg_work_size,		_massey_solve },
+	{ "elo",	RATING_ELO_INITIAL,	_elo_work_size,		_elo_solve },
+	{ NULL,		0.0,			NULL,			NULL }
+};
+
+
+/**
+ * Looks up a rating mode by name
+ *
+ * @return The mode, or NULL if there is none by that name
+ */
+
+const struct rating_mode *rating_mode_find(const char *name)
+{
+	const struct rating_mode *mode;
+
+	for (mode = rating_modes; mode->name; mode++) {
+		if (strcmp(mode->name, name) == 0)
+			return mode;
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Returns the mode at an index in the table, for listing them all
+ *
+ * @return The mode, or NULL past the end of the table
+ */
+
+const struct rating_mode *rating_mode_get(size_t index)
+{
+	if (index >= sizeof(rating_modes) / sizeof(rating_modes[0]) - 1)
+		return NULL;
+
+	return &rating_modes[index];
+}
+
+
+/**
+ * Rates a season from a cold start, allocating the mode's scratch space
+ *
+ * @param ratings Receives num_teams ratings
+ * @return Negative on error
+ */
+
+int rating_mode_solve(const struct rating_mode *mode, const struct games *games, size_t num_teams, double *ratings)
+{
+	double *work;
+	size_t i;
+	int err;
+
+	work = malloc((mode->work_size(num_teams) + 1) * sizeof(double));
+	if (!work)
+		return -1;
+
+	for (i = 0; i < num_teams; i++)
+		ratings[i] = mode->initial;
+
+	err = mode->solve(games, num_teams, ratings, work);
+	free(work);
+
+	if (err < 0) {
+		fprintf(stderr, "%s: %s failed\n", __func__, mode->name);
+		return -2;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Stores ratings in a double field, creating it if need be
+ *
+ * @param ratings One per team in the context
+ * @return Negative on error
+ */
+
+int rating_write_field(struct ncrunch_ctx *ctx, const char *name, const double *ratings)
+{
+	size_t field;
+	size_t i;
+	int err;
+
+	if (tfl_find(ctx, name, &field) == 0)
+		err = tfl_set_type(ctx, field, TEAM_FIELD_DOUBLE);
+	else
+		err = tfl_add(ctx, name, TEAM_FIELD_DOUBLE, &field);
+
+	if (err < 0)
+		return -1;
+
+	for (i = 0; i < teams_num_teams(ctx); i++)
+		team_set_double(ctx, i, field, ratings[i]);
+
+	return 0;
+}
+
+
+void rating_free(struct rating *rating)
+{
+	free(rating->factor);
+	free(rating->rhs);
+	free(rating->ratings);
+	memset(rating, 0, sizeof(struct rating));
+}
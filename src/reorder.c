@@ -0,0 +1,470 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <ncrunch/ncrunch.h>
+#include <ncrunch/games.h>
+#include <ncrunch/reorder.h>
+
+
+
+static const char *reorder_methods[] = { "conference", "rcm" };
+
+
+/**
+ * A team and what it sorts by
+ */
+
+struct reorder_entry {
+	const char *key;
+	size_t len;
+	size_t degree;
+	size_t id;
+};
+
+
+/**
+ * The game graph, with each pair of teams that met once
+ */
+
+struct reorder_graph {
+	size_t *start;		/* num_teams + 1 */
+	uint32_t *adj;
+};
+
+
+/**
+ * qsort() callback; by conference, then by id
+ */
+
+static int _compare_keys(const void *a, const void *b)
+{
+	const struct reorder_entry *x = a;
+	const struct reorder_entry *y = b;
+	size_t len = x->len < y->len ? x->len : y->len;
+	int c;
+
+	c = memcmp(x->key, y->key, len);
+	if (c)
+		return c;
+
+	if (x->len != y->len)
+		return x->len < y->len ? -1 : 1;
+
+	return (x->id > y->id) - (x->id < y->id);
+}
+
+
+/**
+ * qsort() callback; fewest games first, then by id
+ */
+
+static int _compare_degrees(const void *a, const void *b)
+{
+	const struct reorder_entry *x = a;
+	const struct reorder_entry *y = b;
+
+	if (x->degree != y->degree)
+		return x->degree < y->degree ? -1 : 1;
+
+	return (x->id > y->id) - (x->id < y->id);
+}
+
+
+/**
+ * Looks up a reordering method by name
+ *
+ * @return Negative if there is none by that name
+ */
+
+int reorder_method_find(const char *name, enum reorder_method *method)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(reorder_methods) / sizeof(reorder_methods[0]); i++) {
+		if (strcmp(reorder_methods[i], name) == 0) {
+			*method = i;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+
+/**
+ * Orders teams by conference
+ *
+ * @return Negative on error
+ */
+
+static int _conference(const struct ncrunch_ctx *ctx, size_t *order)
+{
+	struct reorder_entry *entries;
+	size_t counts[TFL_MAXTAGS] = { 0 };
+	size_t n = teams_num_teams(ctx);
+	size_t field;
+	size_t bit, best;
+	size_t i;
+	uint64_t mask;
+	const char *str;
+	enum tfl_type type;
+
+	if (tfl_find(ctx, "tags", &field) < 0) {
+		fprintf(stderr, "%s: grouping by conference needs a 'tags' field\n", __func__);
+		return -1;
+	}
+
+	type = tfl_get_type(ctx, field);
+	if (type != TEAM_FIELD_TAGS && type != TEAM_FIELD_STRING) {
+		fprintf(stderr, "%s: the 'tags' field is not text\n", __func__);
+		return -1;
+	}
+
+	entries = malloc((n ? n : 1) * sizeof(struct reorder_entry));
+	if (!entries)
+		return -2;
+
+	if (type == TEAM_FIELD_TAGS) {
+		for (i = 0; i < n; i++) {
+			team_get_tags(ctx, i, field, &mask);
+			for (bit = 0; bit < TFL_MAXTAGS; bit++)
+				counts[bit] += (mask >> bit) & 1;
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		entries[i].id = i;
+		entries[i].key = "";
+		entries[i].len = 0;
+
+		if (type == TEAM_FIELD_TAGS) {
+			team_get_tags(ctx, i, field, &mask);
+
+			for (bit = 0, best = TFL_MAXTAGS; bit < TFL_MAXTAGS; bit++) {
+				if ((mask >> bit) & 1 && (best == TFL_MAXTAGS || counts[bit] > counts[best]))
+					best = bit;
+			}
+
+			if (best != TFL_MAXTAGS) {
+				entries[i].key = tfl_get_tag(ctx, field, best);
+				entries[i].len = strlen(entries[i].key);
+			}
+		} else {
+			str = team_get_string(ctx, i, field);
+			if (str) {
+				str += strspn(str, " ");
+				entries[i].key = str;
+				entries[i].len = strcspn(str, " ");
+			}
+		}
+	}
+
+	qsort(entries, n, sizeof(struct reorder_entry), _compare_keys);
+
+	for (i = 0; i < n; i++)
+		order[i] = entries[i].id;
+
+	free(entries);
+	return 0;
+}
+
+
+static void _free_graph(struct reorder_graph *graph)
+{
+	free(graph->start);
+	free(graph->adj);
+	memset(graph, 0, sizeof(struct reorder_graph));
+}
+
+
+/**
+ * Builds the game graph; teams that met more than once are neighbours once
+ *
+ * @return Negative on error
+ */
+
+static int _graph(struct reorder_graph *graph, const struct games *games, size_t n)
+{
+	const struct game *game;
+	size_t *fill;
+	size_t *seen;
+	size_t i, j, k;
+
+	graph->start = calloc(n + 1, sizeof(size_t));
+	graph->adj = malloc((2 * games->num_games + 1) * sizeof(uint32_t));
+	fill = malloc((n + 1) * sizeof(size_t));
+	seen = malloc((n + 1) * sizeof(size_t));
+
+	if (!graph->start || !graph->adj || !fill || !seen) {
+		free(fill);
+		free(seen);
+		_free_graph(graph);
+		return -1;
+	}
+
+	for (i = 0; i < games->num_games; i++) {
+		game = &games->list[i];
+		if (game->home >= n || game->away >= n) {
+			fprintf(stderr, "%s: game %lu has a team id out of range\n", __func__, i);
+			free(fill);
+			free(seen);
+			_free_graph(graph);
+			return -2;
+		}
+
+		graph->start[game->home + 1]++;
+		graph->start[game->away + 1]++;
+	}
+
+	for (i = 0; i < n; i++)
+		graph->start[i + 1] += graph->start[i];
+
+	memcpy(fill, graph->start, n * sizeof(size_t));
+
+	for (i = 0; i < games->num_games; i++) {
+		game = &games->list[i];
+		graph->adj[fill[game->home]++] = game->away;
+		graph->adj[fill[game->away]++] = game->home;
+	}
+
+	/* drop repeat opponents, packing the lists down as we go */
+	for (i = 0; i < n; i++)
+		seen[i] = n;
+
+	for (i = 0, k = 0; i < n; i++) {
+		j = graph->start[i];
+		graph->start[i] = k;
+
+		for (; j < fill[i]; j++) {
+			if (seen[graph->adj[j]] == i)
+				continue;
+
+			seen[graph->adj[j]] = i;
+			graph->adj[k++] = graph->adj[j];
+		}
+	}
+
+	graph->start[n] = k;
+
+	free(fill);
+	free(seen);
+	return 0;
+}
+
+
+static size_t _degree(const struct reorder_graph *graph, size_t t)
+{
+	return graph->start[t + 1] - graph->start[t];
+}
+
+
+/**
+ * Walks breadth first from a team, appending each team reached to order,
+ * each team's unvisited neighbours fewest games first
+ *
+ * @param visited Set for every team reached; teams already set are skipped
+ * @param scratch Room for as many entries as the most neighbours a team has
+ * @return The number of teams appended
+ */
+
+static size_t _walk(const struct reorder_graph *graph, size_t from, uint8_t *visited, size_t *order,
+	struct reorder_entry *scratch)
+{
+	size_t head = 0, tail = 0;
+	size_t num, t, u;
+	size_t i;
+
+	visited[from] = 1;
+	order[tail++] = from;
+
+	while (head < tail) {
+		t = order[head++];
+		num = 0;
+
+		for (i = graph->start[t]; i < graph->start[t + 1]; i++) {
+			u = graph->adj[i];
+			if (visited[u])
+				continue;
+
+			visited[u] = 1;
+			scratch[num].id = u;
+			scratch[num].degree = _degree(graph, u);
+			num++;
+		}
+
+		qsort(scratch, num, sizeof(struct reorder_entry), _compare_degrees);
+
+		for (i = 0; i < num; i++)
+			order[tail++] = scratch[i].id;
+	}
+
+	return tail;
+}
+
+
+/**
+ * Orders teams by reverse Cuthill-McKee
+ *
+ * Each connected part starts from the last team reached by a trial walk
+ * from the part's team with the fewest games, which puts it at one end of
+ * the part.
+ *
+ * @return Negative on error
+ */
+
+static int _rcm(const struct games *games, size_t n, size_t *order)
+{
+	struct reorder_graph graph;
+	struct reorder_entry *entries;
+	struct reorder_entry *scratch;
+	uint8_t *visited;
+	uint8_t *trial;
+	size_t max_degree = 0;
+	size_t done = 0;
+	size_t num, from, t;
+	size_t i;
+
+	if (!games) {
+		fprintf(stderr, "%s: reverse Cuthill-McKee needs a game log\n", __func__);
+		return -1;
+	}
+
+	if (_graph(&graph, games, n) < 0)
+		return -2;
+
+	for (i = 0; i < n; i++) {
+		if (_degree(&graph, i) > max_degree)
+			max_degree = _degree(&graph, i);
+	}
+
+	entries = malloc((n + 1) * sizeof(struct reorder_entry));
+	scratch = malloc((max_degree + 1) * sizeof(struct reorder_entry));
+	visited = calloc(n + 1, 1);
+	trial = calloc(n + 1, 1);
+
+	if (!entries || !scratch || !visited || !trial) {
+		free(entries);
+		free(scratch);
+		free(visited);
+		free(trial);
+		_free_graph(&graph);
+		return -3;
+	}
+
+	for (i = 0; i < n; i++) {
+		entries[i].id = i;
+		entries[i].degree = _degree(&graph, i);
+	}
+
+	qsort(entries, n, sizeof(struct reorder_entry), _compare_degrees);
+
+	for (i = 0; i < n; i++) {
+		from = entries[i].id;
+		if (visited[from])
+			continue;
+
+		memcpy(trial, visited, n);
+		num = _walk(&graph, from, trial, &order[done], scratch);
+		from = order[done + num - 1];
+
+		done += _walk(&graph, from, visited, &order[done], scratch);
+	}
+
+	for (i = 0; i < n / 2; i++) {
+		t = order[i];
+		order[i] = order[n - 1 - i];
+		order[n - 1 - i] = t;
+	}
+
+	free(entries);
+	free(scratch);
+	free(visited);
+	free(trial);
+	_free_graph(&graph);
+	return 0;
+}
+
+
+/**
+ * Works out a new order for the teams
+ *
+ * @param games The season's games; may be NULL for REORDER_CONFERENCE
+ * @param order Receives teams_num_teams() team ids in their new order; pass
+ * to reorder_apply()
+ * @return Negative on error
+ */
+
+int reorder_order(const struct ncrunch_ctx *ctx, const struct games *games, enum reorder_method method, size_t *order)
+{
+	if (method == REORDER_RCM)
+		return _rcm(games, teams_num_teams(ctx), order);
+
+	return _conference(ctx, order);
+}
+
+
+/**
+ * Gives the teams new ids, team order[i] becoming team i, and remaps the
+ * games to match
+ *
+ * @param games May be NULL
+ * @return Negative on error
+ */
+
+int reorder_apply(struct ncrunch_ctx *ctx, struct games *games, const size_t *order)
+{
+	size_t n = teams_num_teams(ctx);
+	uint32_t *id;
+	size_t i;
+
+	id = malloc((n ? n : 1) * sizeof(uint32_t));
+	if (!id)
+		return -1;
+
+	for (i = 0; games && i < games->num_games; i++) {
+		if (games->list[i].home >= n || games->list[i].away >= n) {
+			fprintf(stderr, "%s: game %lu has a team id out of range\n", __func__, i);
+			free(id);
+			return -2;
+		}
+	}
+
+	/* checks that order is a permutation, so only then is it inverted */
+	if (teams_permute(ctx, order) < 0) {
+		free(id);
+		return -3;
+	}
+
+	for (i = 0; i < n; i++)
+		id[order[i]] = i;
+
+	for (i = 0; games && i < games->num_games; i++) {
+		games->list[i].home = id[games->list[i].home];
+		games->list[i].away = id[games->list[i].away];
+	}
+
+	free(id);
+	return 0;
+}
+
+
+/**
+ * The mean distance between the ids of two teams that play each other, a
+ * rough measure of how local a pass over the games is
+ */
+
+size_t reorder_spread(const struct games *games)
+{
+	const struct game *game;
+	size_t sum = 0;
+	size_t i;
+
+	for (i = 0; i < games->num_games; i++) {
+		game = &games->list[i];
+		sum += game->home > game->away ? game->home - game->away : game->away - game->home;
+	}
+
+	return games->num_games ? sum / games->num_games : 0;
+}
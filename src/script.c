@@ -0,0 +1,459 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include <ncrunch/ncrunch.h>
+#include <ncrunch/script.h>
+
+
+
+#define SCRIPT_COLUMN_MT   "ncrunch.column"
+#define SCRIPT_RATING_FUNC "rating"
+#define SCRIPT_RATING_NAME "rating"
+
+
+
+/**
+ * Allocates a new zeroed column and leaves it on top of the Lua stack
+ *
+ * @param n The number of values in the column
+ * @return The new column
+ */
+
+struct script_column *script_new_column(lua_State *L, size_t n)
+{
+	struct script_column *col;
+
+	col = lua_newuserdata(L, sizeof(struct script_column) + n * sizeof(double));
+	col->n = n;
+	memset(col->data, 0, n * sizeof(double));
+
+	luaL_getmetatable(L, SCRIPT_COLUMN_MT);
+	lua_setmetatable(L, -2);
+
+	return col;
+}
+
+
+/**
+ * Checks that the value at idx is a column and returns it
+ *
+ * Raises a Lua error if it is not
+ */
+
+struct script_column *script_to_column(lua_State *L, int idx)
+{
+	return luaL_checkudata(L, idx, SCRIPT_COLUMN_MT);
+}
+
+
+/**
+ * Reads the operand at idx as either a column or a scalar
+ *
+ * @param len Set to the length of the column, untouched for scalars
+ * @param scalar Set to the scalar value when the operand is a number
+ * @return The column, or NULL if the operand is a number
+ */
+
+static const struct script_column *_operand(lua_State *L, int idx, size_t *len, double *scalar)
+{
+	struct script_column *col;
+
+	if (lua_type(L, idx) == LUA_TNUMBER) {
+		*scalar = lua_tonumber(L, idx);
+		return NULL;
+	}
+
+	col = script_to_column(L, idx);
+	*len = col->n;
+	return col;
+}
+
+
+/**
+ * Shared body of the arithmetic metamethods
+ *
+ * Either side may be a number; the result is always a new column. The loops
+ * run in C over the whole column so a formula costs one crossing per
+ * operator, not one per team.
+ */
+
+static int _arith(lua_State *L, char op)
+{
+	const struct script_column *a, *b;
+	struct script_column *out;
+	double sa = 0.0, sb = 0.0;
+	size_t n = 0;
+	size_t i;
+	double x, y;
+
+	a = _operand(L, 1, &n, &sa);
+	b = _operand(L, 2, &n, &sb);
+
+	if (a && b && a->n != b->n) {
+		return luaL_error(L, "column length mismatch (%d vs %d)", (int) a->n, (int) b->n);
+	}
+
+	out = script_new_column(L, n);
+
+	for (i = 0; i < n; i++) {
+		x = a ? a->data[i] : sa;
+		y = b ? b->data[i] : sb;
+
+		switch (op) {
+		case '+': out->data[i] = x + y; break;
+		case '-': out->data[i] = x - y; break;
+		case '*': out->data[i] = x * y; break;
+		default:  out->data[i] = x / y; break;
+		}
+	}
+
+	return 1;
+}
+
+static int _col_add(lua_State *L) { return _arith(L, '+'); }
+static int _col_sub(lua_State *L) { return _arith(L, '-'); }
+static int _col_mul(lua_State *L) { return _arith(L, '*'); }
+static int _col_div(lua_State *L) { return _arith(L, '/'); }
+
+
+/**
+ * Metamethod for unary minus
+ */
+
+static int _col_unm(lua_State *L)
+{
+	struct script_column *col = script_to_column(L, 1);
+	struct script_column *out;
+	size_t i;
+
+	out = script_new_column(L, col->n);
+
+	for (i = 0; i < col->n; i++)
+		out->data[i] = -col->data[i];
+
+	return 1;
+}
+
+
+/**
+ * Metamethod for #col
+ */
+
+static int _col_len(lua_State *L)
+{
+	struct script_column *col = script_to_column(L, 1);
+
+	lua_pushnumber(L, (lua_Number) col->n);
+	return 1;
+}
+
+
+/**
+ * col:sum()
+ */
+
+static int _col_sum(lua_State *L)
+{
+	struct script_column *col = script_to_column(L, 1);
+	double sum = 0.0;
+	size_t i;
+
+	for (i = 0; i < col->n; i++)
+		sum += col->data[i];
+
+	lua_pushnumber(L, sum);
+	return 1;
+}
+
+
+/**
+ * col:min() and col:max(); nil for an empty column
+ */
+
+static int _col_extreme(lua_State *L, int want_max)
+{
+	struct script_column *col = script_to_column(L, 1);
+	double best;
+	size_t i;
+
+	if (col->n == 0) {
+		lua_pushnil(L);
+		return 1;
+	}
+
+	best = col->data[0];
+	for (i = 1; i < col->n; i++) {
+		if (want_max ? col->data[i] > best : col->data[i] < best)
+			best = col->data[i];
+	}
+
+	lua_pushnumber(L, best);
+	return 1;
+}
+
+static int _col_min(lua_State *L) { return _col_extreme(L, 0); }
+static int _col_max(lua_State *L) { return _col_extreme(L, 1); }
+
+
+/**
+ * Metamethod for col[i] (1-based) and method lookup (col:sum())
+ */
+
+static int _col_index(lua_State *L)
+{
+	struct script_column *col = script_to_column(L, 1);
+	lua_Integer i;
+
+	if (lua_type(L, 2) == LUA_TSTRING) {
+		luaL_getmetatable(L, SCRIPT_COLUMN_MT);
+		lua_getfield(L, -1, lua_tostring(L, 2));
+		return 1;
+	}
+
+	i = luaL_checkinteger(L, 2);
+	if (i < 1 || (size_t) i > col->n) {
+		lua_pushnil(L);
+		return 1;
+	}
+
+	lua_pushnumber(L, col->data[i - 1]);
+	return 1;
+}
+
+
+/**
+ * Metamethod for col[i] = x (1-based)
+ */
+
+static int _col_newindex(lua_State *L)
+{
+	struct script_column *col = script_to_column(L, 1);
+	lua_Integer i = luaL_checkinteger(L, 2);
+
+	if (i < 1 || (size_t) i > col->n) {
+		return luaL_error(L, "column index %d out of range", (int) i);
+	}
+
+	col->data[i - 1] = luaL_checknumber(L, 3);
+	return 0;
+}
+
+
+/**
+ * ncrunch.column(n); creates a zeroed column of length n
+ */
+
+static int _lib_column(lua_State *L)
+{
+	lua_Integer n = luaL_checkinteger(L, 1);
+
+	if (n < 0) {
+		return luaL_error(L, "column length must not be negative");
+	}
+
+	script_new_column(L, (size_t) n);
+	return 1;
+}
+
+
+/**
+ * ncrunch.field(name); copies a double team field into a new column
+ *
+ * The dataset is the library's upvalue, set by script_open()
+ */
+
+static int _lib_field(lua_State *L)
+{
+	const char *name = luaL_checkstring(L, 1);
+	const struct ncrunch_ctx *ctx = lua_touserdata(L, lua_upvalueindex(1));
+	struct script_column *col;
+	size_t id;
+
+	if (!ctx) {
+		return luaL_error(L, "no dataset loaded");
+	}
+
+	if (tfl_find(ctx, name, &id) < 0 || !tfl_type_numeric(tfl_get_type(ctx, id))) {
+		return luaL_error(L, "no numeric field '%s'", name);
+	}
+
+	col = script_new_column(L, teams_num_teams(ctx));
+	teams_get_column(ctx, id, col->data);
+
+	return 1;
+}
+
+
+/**
+ * Adds a C function to the table on top of the stack
+ */
+
+static void _set_function(lua_State *L, const char *name, lua_CFunction func)
+{
+	lua_pushcfunction(L, func);
+	lua_setfield(L, -2, name);
+}
+
+
+/**
+ * Registers the column metatable and the global 'ncrunch' table
+ *
+ * @param ctx The dataset ncrunch.field() reads from; may be NULL
+ * @return Negative on error
+ */
+
+int script_open(lua_State *L, const struct ncrunch_ctx *ctx)
+{
+	luaL_newmetatable(L, SCRIPT_COLUMN_MT);
+	_set_function(L, "__index", _col_index);
+	_set_function(L, "__newindex", _col_newindex);
+	_set_function(L, "__len", _col_len);
+	_set_function(L, "__add", _col_add);
+	_set_function(L, "__sub", _col_sub);
+	_set_function(L, "__mul", _col_mul);
+	_set_function(L, "__div", _col_div);
+	_set_function(L, "__unm", _col_unm);
+	_set_function(L, "sum", _col_sum);
+	_set_function(L, "min", _col_min);
+	_set_function(L, "max", _col_max);
+	lua_pop(L, 1);
+
+	lua_newtable(L);
+	_set_function(L, "column", _lib_column);
+	lua_pushlightuserdata(L, (void *) ctx);
+	lua_pushcclosure(L, _lib_field, 1);
+	lua_setfield(L, -2, "field");
+	lua_setglobal(L, "ncrunch");
+
+	return 0;
+}
+
+
+/**
+ * Pushes a table holding every numeric team field as a column, keyed by name
+ */
+
+static void _push_teams(lua_State *L, const struct ncrunch_ctx *ctx)
+{
+	struct script_column *col;
+	size_t num_fields = tfl_num_fields(ctx);
+	size_t num_teams = teams_num_teams(ctx);
+	size_t i;
+
+	lua_newtable(L);
+
+	for (i = 0; i < num_fields; i++) {
+		if (!tfl_type_numeric(tfl_get_type(ctx, i)))
+			continue;
+
+		col = script_new_column(L, num_teams);
+		teams_get_column(ctx, i, col->data);
+		lua_setfield(L, -2, tfl_get_name(ctx, i));
+	}
+}
+
+
+/**
+ * Returns the column at idx, or NULL if the value is something else
+ */
+
+static struct script_column *_test_column(lua_State *L, int idx)
+{
+	struct script_column *col = NULL;
+
+	if (!lua_isuserdata(L, idx) || !lua_getmetatable(L, idx))
+		return NULL;
+
+	luaL_getmetatable(L, SCRIPT_COLUMN_MT);
+	if (lua_rawequal(L, -1, -2))
+		col = lua_touserdata(L, idx);
+
+	lua_pop(L, 2);
+	return col;
+}
+
+
+/**
+ * Loads the script into L, calls its rating() function and stores the result
+ *
+ * @return Negative on error
+ */
+
+static int _run_rating(lua_State *L, struct ncrunch_ctx *ctx, const char *filename)
+{
+	struct script_column *col;
+	size_t id;
+
+	if (luaL_loadfile(L, filename) || lua_pcall(L, 0, 0, 0)) {
+		fprintf(stderr, "%s: %s\n", __func__, lua_tostring(L, -1));
+		return -1;
+	}
+
+	lua_getglobal(L, SCRIPT_RATING_FUNC);
+	if (lua_type(L, -1) != LUA_TFUNCTION) {
+		fprintf(stderr, "%s: '%s' does not define %s(teams)\n", __func__, filename, SCRIPT_RATING_FUNC);
+		return -2;
+	}
+
+	_push_teams(L, ctx);
+
+	if (lua_pcall(L, 1, 1, 0)) {
+		fprintf(stderr, "%s: %s\n", __func__, lua_tostring(L, -1));
+		return -3;
+	}
+
+	col = _test_column(L, -1);
+	if (!col || col->n != teams_num_teams(ctx)) {
+		fprintf(stderr, "%s: %s() must return a column with one value per team\n", __func__, SCRIPT_RATING_FUNC);
+		return -4;
+	}
+
+	if (tfl_add(ctx, SCRIPT_RATING_NAME, TEAM_FIELD_DOUBLE, &id) < 0) {
+		return -5;
+	}
+
+	teams_set_column(ctx, id, col->data);
+	return 0;
+}
+
+
+/**
+ * Runs a ranking script and stores its result as the 'rating' team field
+ *
+ * The script must define a global function rating(teams); teams is a table
+ * of columns (one per numeric field, keyed by field name) and the function
+ * returns a column with one rating per team. Columns support arithmetic with
+ * other columns and numbers, so a formula runs whole columns through C
+ * rather than calling back into Lua once per team.
+ *
+ * @param ctx The dataset to rate
+ * @param filename The Lua script
+ * @return Negative on error
+ */
+
+int script_run(struct ncrunch_ctx *ctx, const char *filename)
+{
+	lua_State *L;
+	int err;
+
+	L = luaL_newstate();
+	if (!L) {
+		fprintf(stderr, "%s: could not create Lua state\n", __func__);
+		return -1;
+	}
+
+	luaL_openlibs(L);
+	script_open(L, ctx);
+
+	err = _run_rating(L, ctx, filename);
+
+	lua_close(L);
+	return err;
+}
@@ -0,0 +1,693 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <errno.h>
+#include <signal.h>
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+
+#include <ncrunch/ncrunch.h>
+#include <ncrunch/serve.h>
+#include <ncrunch/sos.h>
+
+
+
+#define SERVE_MAXEVENTS   64
+#define SERVE_LINEBUFSIZE 1024
+#define SERVE_BACKLOG     64
+
+
+
+/**
+ * A connected client
+ *
+ * Requests are read into in until a newline shows up; replies are queued in
+ * out and written as the socket allows.
+ */
+
+struct client {
+	int fd;
+	int closing;		/* close once out has been written */
+
+	char in[SERVE_LINEBUFSIZE];
+	size_t in_len;
+
+	char *out;
+	size_t out_len;
+	size_t out_sent;
+
+	struct client *prev;
+	struct client *next;
+};
+
+
+/**
+ * State for one run of the server
+ */
+
+struct server {
+	const struct ncrunch_ctx *ctx;
+	struct ncrunch_ctx *live;	/* ctx, when results may be posted */
+	struct sos *sos;
+	int epfd;
+	int listenfd;
+	dev_t sock_dev;		/* the socket file bound, so that only it is removed */
+	ino_t sock_ino;
+	struct client *clients;
+};
+
+
+/**
+ * Set by the signal handler to shut the event loop down
+ */
+
+static volatile sig_atomic_t serve_stop = 0;
+
+
+
+static void _on_signal(int sig)
+{
+	serve_stop = 1;
+}
+
+
+/**
+ * Whether a server is accepting connections on the socket at addr
+ *
+ * @return 1 if one is, 0 if the socket is stale (nothing listening),
+ * negative if it can't be told
+ */
+
+static int _in_use(const struct sockaddr_un *addr)
+{
+	int fd;
+	int err;
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	if (connect(fd, (const struct sockaddr *) addr, sizeof(struct sockaddr_un)) == 0)
+		err = 1;
+	else
+		err = errno == ECONNREFUSED ? 0 : -2;
+
+	close(fd);
+	return err;
+}
+
+
+/**
+ * Creates the listening socket, replacing a stale socket file if one exists;
+ * a live server's socket, or anything else already at path, is left alone
+ * and is an error
+ *
+ * @return The socket, or negative on error
+ */
+
+static int _listen(struct server *srv, const char *path)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	int fd;
+	int used;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "%s: socket path '%s' is too long\n", __func__, path);
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	if (lstat(path, &st) == 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			fprintf(stderr, "%s: '%s' exists and is not a socket\n", __func__, path);
+			return -1;
+		}
+
+		used = _in_use(&addr);
+		if (used) {
+			if (used > 0)
+				fprintf(stderr, "%s: a server is already serving on '%s'\n", __func__, path);
+			else
+				fprintf(stderr, "%s: could not tell whether '%s' is in use\n", __func__, path);
+			return -1;
+		}
+
+		if (unlink(path) < 0) {
+			fprintf(stderr, "%s: could not remove '%s': %s\n", __func__, path, strerror(errno));
+			return -1;
+		}
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		fprintf(stderr, "%s: socket: %s\n", __func__, strerror(errno));
+		return -1;
+	}
+
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(struct sockaddr_un)) < 0 ||
+	    lstat(path, &st) < 0 || listen(fd, SERVE_BACKLOG) < 0) {
+		fprintf(stderr, "%s: could not listen on '%s': %s\n", __func__, path, strerror(errno));
+		close(fd);
+		return -2;
+	}
+
+	srv->sock_dev = st.st_dev;
+	srv->sock_ino = st.st_ino;
+	return fd;
+}
+
+
+/**
+ * Removes the socket file, unless another server has since replaced it
+ */
+
+static void _unlink_socket(const struct server *srv, const char *path)
+{
+	struct stat st;
+
+	if (lstat(path, &st) == 0 && st.st_dev == srv->sock_dev && st.st_ino == srv->sock_ino)
+		unlink(path);
+}
+
+
+/**
+ * Points epoll at what the client is waiting for: always input, plus output
+ * while there is a reply still queued
+ */
+
+static void _update_events(struct server *srv, struct client *cl)
+{
+	struct epoll_event ev;
+
+	ev.events = EPOLLIN;
+	if (cl->out_sent < cl->out_len)
+		ev.events |= EPOLLOUT;
+
+	ev.data.ptr = cl;
+	epoll_ctl(srv->epfd, EPOLL_CTL_MOD, cl->fd, &ev);
+}
+
+
+static void _close_client(struct server *srv, struct client *cl)
+{
+	epoll_ctl(srv->epfd, EPOLL_CTL_DEL, cl->fd, NULL);
+	close(cl->fd);
+
+	if (cl->prev)
+		cl->prev->next = cl->next;
+	else
+		srv->clients = cl->next;
+
+	if (cl->next)
+		cl->next->prev = cl->prev;
+
+	free(cl->out);
+	free(cl);
+}
+
+
+/**
+ * Accepts every pending connection on the listening socket
+ */
+
+static void _accept(struct server *srv)
+{
+	struct epoll_event ev;
+	struct client *cl;
+	int fd;
+
+	for (;;) {
+		fd = accept4(srv->listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0)
+			return;
+
+		cl = calloc(1, sizeof(struct client));
+		if (!cl) {
+			close(fd);
+			continue;
+		}
+
+		cl->fd = fd;
+		ev.events = EPOLLIN;
+		ev.data.ptr = cl;
+
+		if (epoll_ctl(srv->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			close(fd);
+			free(cl);
+			continue;
+		}
+
+		cl->next = srv->clients;
+		if (srv->clients)
+			srv->clients->prev = cl;
+		srv->clients = cl;
+	}
+}
+
+
+/**
+ * Writes as much of the queued reply as the socket will take
+ *
+ * @return Negative if the client went away
+ */
+
+static int _flush(struct server *srv, struct client *cl)
+{
+	ssize_t sent;
+
+	while (cl->out_sent < cl->out_len) {
+		sent = send(cl->fd, cl->out + cl->out_sent, cl->out_len - cl->out_sent, MSG_NOSIGNAL);
+
+		if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+
+		if (sent < 0 && errno == EINTR)
+			continue;
+
+		if (sent <= 0)
+			return -1;
+
+		cl->out_sent += sent;
+	}
+
+	if (cl->out_sent == cl->out_len) {
+		cl->out_len = 0;
+		cl->out_sent = 0;
+
+		if (cl->closing)
+			return -1;
+	}
+
+	_update_events(srv, cl);
+	return 0;
+}
+
+
+/**
+ * Adds a reply to the client's output queue
+ */
+
+static int _queue(struct client *cl, const char *data, size_t len)
+{
+	char *out;
+
+	out = realloc(cl->out, cl->out_len + len);
+	if (!out && len)
+		return -1;
+
+	memcpy(out + cl->out_len, data, len);
+	cl->out = out;
+	cl->out_len += len;
+
+	return 0;
+}
+
+
+static void _cmd_fields(const struct ncrunch_ctx *ctx, FILE *out)
+{
+	size_t num_fields = tfl_num_fields(ctx);
+	size_t i;
+
+	fprintf(out, "OK %lu\n", num_fields);
+
+	for (i = 0; i < num_fields; i++) {
+		fprintf(out, "%s\t%s\n", tfl_get_name(ctx, i), tfl_type_name(tfl_get_type(ctx, i)));
+	}
+}
+
+
+static void _cmd_rank(const struct ncrunch_ctx *ctx, char *args, FILE *out)
+{
+	char *name;
+	char *limitstr;
+	char *save;
+	size_t field;
+	size_t limit = 0;
+	size_t num_teams = teams_num_teams(ctx);
+
+	name = strtok_r(args, " \t", &save);
+	limitstr = strtok_r(NULL, " \t", &save);
+
+	if (!name || tfl_find(ctx, name, &field) < 0 || !tfl_type_numeric(tfl_get_type(ctx, field))) {
+		fprintf(out, "ERR no numeric field '%s'\n", name ? name : "");
+		return;
+	}
+
+	if (limitstr)
+		limit = strtoul(limitstr, NULL, 10);
+
+	if (limit == 0 || limit > num_teams)
+		limit = num_teams;
+
+	fprintf(out, "OK %lu\n", limit);
+	rank_write(ctx, field, limit, out);
+}
+
+
+static void _cmd_team(const struct ncrunch_ctx *ctx, const char *name, FILE *out)
+{
+	size_t num_fields = tfl_num_fields(ctx);
+	char text[1024];
+	size_t id;
+	size_t i;
+
+	id = team_find(ctx, name);
+	if (id == TEAMS_INVALID) {
+		fprintf(out, "ERR no team '%s'\n", name);
+		return;
+	}
+
+	fprintf(out, "OK %lu\n", num_fields);
+
+	for (i = 0; i < num_fields; i++) {
+		team_get_text(ctx, id, i, text, sizeof(text));
+		fprintf(out, "%s\t%s\n", tfl_get_name(ctx, i), text);
+	}
+}
+
+
+/**
+ * Adds a final score, or corrects it if the game is already known, and
+ * updates strength of schedule
+ *
+ * The arguments are tab separated since team names have spaces in them:
+ * week, home, away, home score, away score.
+ */
+
+static void _cmd_game(struct server *srv, char *args, FILE *out)
+{
+	char *cols[5];
+	char *save;
+	struct game game;
+	size_t home, away;
+	size_t index;
+	size_t i;
+	int err;
+
+	if (!srv->sos) {
+		fprintf(out, "ERR no game log loaded\n");
+		return;
+	}
+
+	for (i = 0; i < 5; i++) {
+		cols[i] = strtok_r(i ? NULL : args, "\t", &save);
+		if (!cols[i]) {
+			fprintf(out, "ERR expected week, home, away, home score and away score\n");
+			return;
+		}
+	}
+
+	home = team_find(srv->ctx, cols[1]);
+	away = team_find(srv->ctx, cols[2]);
+	if (home == TEAMS_INVALID || away == TEAMS_INVALID) {
+		fprintf(out, "ERR no team '%s'\n", home == TEAMS_INVALID ? cols[1] : cols[2]);
+		return;
+	}
+
+	game.week = strtoul(cols[0], NULL, 10);
+	game.home = home;
+	game.away = away;
+	game.home_score = strtol(cols[3], NULL, 10);
+	game.away_score = strtol(cols[4], NULL, 10);
+
+	index = sos_find_game(srv->sos, game.week, home, away);
+	if (index == SOS_NOGAME)
+		err = sos_add_game(srv->sos, srv->live, &game);
+	else
+		err = sos_set_result(srv->sos, srv->live, index, game.home_score, game.away_score);
+
+	if (err < 0)
+		fprintf(out, "ERR could not record game\n");
+	else
+		fprintf(out, "OK 0\n");
+}
+
+
+/**
+ * Handles one request line and queues the reply
+ *
+ * @return Negative on error
+ */
+
+static int _handle_line(struct server *srv, struct client *cl, char *line)
+{
+	FILE *out;
+	char *reply = NULL;
+	size_t len = 0;
+	char *cmd;
+	char *args;
+	int err;
+
+	cmd = line;
+	args = line + strcspn(line, " \t");
+	if (*args)
+		*args++ = '\0';
+
+	args += strspn(args, " \t");
+
+	out = open_memstream(&reply, &len);
+	if (!out)
+		return -1;
+
+	if (strcasecmp(cmd, "PING") == 0) {
+		fprintf(out, "OK 0\n");
+	}
+
+	else if (strcasecmp(cmd, "FIELDS") == 0) {
+		_cmd_fields(srv->ctx, out);
+	}
+
+	else if (strcasecmp(cmd, "RANK") == 0) {
+		_cmd_rank(srv->ctx, args, out);
+	}
+
+	else if (strcasecmp(cmd, "TEAM") == 0) {
+		_cmd_team(srv->ctx, args, out);
+	}
+
+	else if (strcasecmp(cmd, "GAME") == 0) {
+		_cmd_game(srv, args, out);
+	}
+
+	else if (strcasecmp(cmd, "QUIT") == 0) {
+		fprintf(out, "OK 0\n");
+		cl->closing = 1;
+	}
+
+	else if (*cmd) {
+		fprintf(out, "ERR unknown command '%s'\n", cmd);
+	}
+
+	fclose(out);
+	err = _queue(cl, reply, len);
+	free(reply);
+
+	return err;
+}
+
+
+/**
+ * Reads whatever the client has sent and answers each complete line
+ *
+ * @return Negative if the client should be dropped
+ */
+
+static int _read(struct server *srv, struct client *cl)
+{
+	ssize_t count;
+	char *start;
+	char *newline;
+	size_t used;
+
+	for (;;) {
+		count = read(cl->fd, cl->in + cl->in_len, SERVE_LINEBUFSIZE - 1 - cl->in_len);
+
+		if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+
+		if (count < 0 && errno == EINTR)
+			continue;
+
+		if (count <= 0)
+			return -1;
+
+		cl->in_len += count;
+		cl->in[cl->in_len] = '\0';
+
+		start = cl->in;
+		while (!cl->closing && (newline = strchr(start, '\n'))) {
+			*newline = '\0';
+			if (newline > start && newline[-1] == '\r')
+				newline[-1] = '\0';
+
+			if (_handle_line(srv, cl, start) < 0)
+				return -1;
+
+			start = newline + 1;
+		}
+
+		used = start - cl->in;
+		memmove(cl->in, start, cl->in_len - used);
+		cl->in_len -= used;
+
+		if (cl->in_len == SERVE_LINEBUFSIZE - 1) {
+			_queue(cl, "ERR line too long\n", 18);
+			cl->closing = 1;
+		}
+
+		if (cl->closing)
+			break;
+	}
+
+	return _flush(srv, cl);
+}
+
+
+/**
+ * Runs the event loop until SIGINT or SIGTERM
+ */
+
+static void _loop(struct server *srv)
+{
+	struct epoll_event events[SERVE_MAXEVENTS];
+	struct client *cl;
+	int count;
+	int i;
+	int err;
+
+	while (!serve_stop) {
+		count = epoll_wait(srv->epfd, events, SERVE_MAXEVENTS, -1);
+
+		if (count < 0) {
+			if (errno == EINTR)
+				continue;
+
+			fprintf(stderr, "%s: epoll_wait: %s\n", __func__, strerror(errno));
+			return;
+		}
+
+		for (i = 0; i < count; i++) {
+			cl = events[i].data.ptr;
+
+			if (!cl) {
+				_accept(srv);
+				continue;
+			}
+
+			if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+				_close_client(srv, cl);
+				continue;
+			}
+
+			err = 0;
+			if (events[i].events & EPOLLIN)
+				err = _read(srv, cl);
+			else if (events[i].events & EPOLLOUT)
+				err = _flush(srv, cl);
+
+			if (err)
+				_close_client(srv, cl);
+		}
+	}
+}
+
+
+/**
+ * Listens on path and runs the event loop until signalled
+ *
+ * @return Negative on error
+ */
+
+static int _run(struct server *srv, const char *path)
+{
+	struct sigaction sa;
+	struct epoll_event ev;
+
+	srv->listenfd = _listen(srv, path);
+	if (srv->listenfd < 0)
+		return -1;
+
+	srv->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (srv->epfd < 0) {
+		fprintf(stderr, "%s: epoll_create1: %s\n", __func__, strerror(errno));
+		close(srv->listenfd);
+		_unlink_socket(srv, path);
+		return -2;
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	epoll_ctl(srv->epfd, EPOLL_CTL_ADD, srv->listenfd, &ev);
+
+	memset(&sa, 0, sizeof(struct sigaction));
+	sa.sa_handler = _on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	serve_stop = 0;
+	_loop(srv);
+
+	while (srv->clients)
+		_close_client(srv, srv->clients);
+
+	close(srv->epfd);
+	close(srv->listenfd);
+	_unlink_socket(srv, path);
+
+	return 0;
+}
+
+
+/**
+ * Serves queries on the dataset until the process is signalled to stop
+ *
+ * The dataset is only read, never modified, so it is loaded once and every
+ * query after that costs just the lookup and the reply.
+ *
+ * @param ctx The loaded dataset to answer queries from
+ * @param path Where to create the Unix domain socket
+ * @return Negative on error
+ */
+
+int serve_run(const struct ncrunch_ctx *ctx, const char *path)
+{
+	struct server srv;
+
+	memset(&srv, 0, sizeof(struct server));
+	srv.ctx = ctx;
+
+	return _run(&srv, path);
+}
+
+
+/**
+ * serve_run(), also taking final scores with GAME as they come in
+ *
+ * Each score updates the owp and oowp fields through sos, which must have
+ * been built for ctx.
+ *
+ * @return Negative on error
+ */
+
+int serve_run_live(struct ncrunch_ctx *ctx, struct sos *sos, const char *path)
+{
+	struct server srv;
+
+	memset(&srv, 0, sizeof(struct server));
+	srv.ctx = ctx;
+	srv.live = ctx;
+	srv.sos = sos;
+
+	return _run(&srv, path);
+}
@@ -0,0 +1,433 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <ncrunch/ncrunch.h>
+#include <ncrunch/games.h>
+#include <ncrunch/sos.h>
+
+
+
+/**
+ * How much of a win a game was for team t: 1, 0.5 or 0
+ */
+
+static double _result(const struct game *game, size_t t)
+{
+	size_t winner = game_winner(game);
+
+	if (winner == TEAMS_INVALID)
+		return 0.5;
+
+	return winner == t ? 1.0 : 0.0;
+}
+
+
+static size_t _opponent(const struct game *game, size_t t)
+{
+	return game->home == t ? game->away : game->home;
+}
+
+
+static double _wp(const struct sos *sos, size_t t)
+{
+	size_t n = sos->num_team_games[t];
+	return n ? sos->wins[t] / n : 0.0;
+}
+
+
+static double _owp(const struct sos *sos, size_t t)
+{
+	size_t n = sos->num_team_games[t];
+	return n ? sos->owp_sum[t] / n : 0.0;
+}
+
+
+static double _oowp(const struct sos *sos, size_t t)
+{
+	size_t n = sos->num_team_games[t];
+	return n ? sos->oowp_sum[t] / n : 0.0;
+}
+
+
+/**
+ * Starts a new set of touched teams
+ */
+
+static void _begin(struct sos *sos, size_t *num_touched)
+{
+	if (++sos->generation == 0) {
+		memset(sos->mark, 0, sos->num_teams * sizeof(uint32_t));
+		sos->generation = 1;
+	}
+
+	*num_touched = 0;
+}
+
+
+static void _touch(struct sos *sos, size_t t, size_t *num_touched)
+{
+	if (sos->mark[t] == sos->generation)
+		return;
+
+	sos->mark[t] = sos->generation;
+	sos->touched[(*num_touched)++] = t;
+}
+
+
+/**
+ * Touches a team and every team it has played
+ */
+
+static void _touch_around(struct sos *sos, size_t t, size_t *num_touched)
+{
+	size_t i;
+
+	_touch(sos, t, num_touched);
+
+	for (i = 0; i < sos->num_team_games[t]; i++)
+		_touch(sos, _opponent(&sos->games.list[sos->team_games[t][i]], t), num_touched);
+}
+
+
+/**
+ * Adds delta to sums[] of every opponent of t, once per game, leaving out
+ * game skip; touches each opponent
+ */
+
+static void _spread(struct sos *sos, size_t t, double delta, double *sums, size_t skip, size_t *num_touched)
+{
+	uint32_t gi;
+	size_t opp;
+	size_t i;
+
+	for (i = 0; i < sos->num_team_games[t]; i++) {
+		gi = sos->team_games[t][i];
+		if (gi == skip)
+			continue;
+
+		opp = _opponent(&sos->games.list[gi], t);
+		sums[opp] += delta;
+		_touch(sos, opp, num_touched);
+	}
+}
+
+
+/**
+ * Records game gi against team t's schedule
+ */
+
+static int _link(struct sos *sos, size_t t, uint32_t gi)
+{
+	uint32_t *list;
+	size_t max;
+
+	if (sos->num_team_games[t] == sos->max_team_games[t]) {
+		max = sos->max_team_games[t] ? sos->max_team_games[t] * 2 : 16;
+		list = realloc(sos->team_games[t], max * sizeof(uint32_t));
+		if (!list)
+			return -1;
+
+		sos->team_games[t] = list;
+		sos->max_team_games[t] = max;
+	}
+
+	sos->team_games[t][sos->num_team_games[t]++] = gi;
+	return 0;
+}
+
+
+/**
+ * Creates the field or makes an existing one a double field
+ */
+
+static int _field(struct ncrunch_ctx *ctx, const char *name, size_t *id)
+{
+	if (tfl_find(ctx, name, id) == 0)
+		return tfl_set_type(ctx, *id, TEAM_FIELD_DOUBLE);
+
+	return tfl_add(ctx, name, TEAM_FIELD_DOUBLE, id);
+}
+
+
+static void _write(const struct sos *sos, struct ncrunch_ctx *ctx, size_t t)
+{
+	team_set_double(ctx, t, sos->owp_field, _owp(sos, t));
+	team_set_double(ctx, t, sos->oowp_field, _oowp(sos, t));
+}
+
+
+/**
+ * Carries a change in the win percentages of teams a and b up through owp
+ * and oowp
+ *
+ * The first num_t1 touched teams are a, b and their opponents, with their
+ * owp from before the change in old_owp. If skip is a game, it is one just
+ * added between a and b: the sums hold nothing for it yet, so its terms are
+ * added whole instead of adjusted.
+ */
+
+static void _propagate(struct sos *sos, struct ncrunch_ctx *ctx, size_t a, size_t b,
+	double old_wp_a, double old_wp_b, size_t skip, size_t num_t1, size_t *num_touched)
+{
+	double delta;
+	size_t t;
+	size_t i;
+
+	_spread(sos, a, _wp(sos, a) - old_wp_a, sos->owp_sum, skip, num_touched);
+	_spread(sos, b, _wp(sos, b) - old_wp_b, sos->owp_sum, skip, num_touched);
+
+	if (skip != SOS_NOGAME) {
+		sos->owp_sum[a] += _wp(sos, b);
+		sos->owp_sum[b] += _wp(sos, a);
+	}
+
+	/* only a, b and their opponents have a different owp now */
+	for (i = 0; i < num_t1; i++) {
+		t = sos->touched[i];
+		delta = _owp(sos, t) - sos->old_owp[i];
+
+		if (delta != 0.0)
+			_spread(sos, t, delta, sos->oowp_sum, skip, num_touched);
+	}
+
+	if (skip != SOS_NOGAME) {
+		sos->oowp_sum[a] += _owp(sos, b);
+		sos->oowp_sum[b] += _owp(sos, a);
+	}
+
+	for (i = 0; i < *num_touched; i++)
+		_write(sos, ctx, sos->touched[i]);
+}
+
+
+/**
+ * Touches a, b and their opponents and saves their owp
+ *
+ * @return The number of teams touched
+ */
+
+static size_t _collect(struct sos *sos, size_t a, size_t b, size_t *num_touched)
+{
+	size_t i;
+
+	_begin(sos, num_touched);
+	_touch_around(sos, a, num_touched);
+	_touch_around(sos, b, num_touched);
+
+	for (i = 0; i < *num_touched; i++)
+		sos->old_owp[i] = _owp(sos, sos->touched[i]);
+
+	return *num_touched;
+}
+
+
+/**
+ * Computes owp and oowp for every team from a season's games and adds them
+ * to the context as the fields "owp" and "oowp"
+ *
+ * @param games The games so far; copied, so later changes go through
+ * sos_add_game() and sos_set_result()
+ * @return Negative on error
+ */
+
+int sos_build(struct sos *sos, struct ncrunch_ctx *ctx, const struct games *games)
+{
+	const struct game *game;
+	size_t n = teams_num_teams(ctx);
+	size_t i;
+
+	memset(sos, 0, sizeof(struct sos));
+	sos->num_teams = n;
+
+	if (_field(ctx, "owp", &sos->owp_field) < 0 || _field(ctx, "oowp", &sos->oowp_field) < 0)
+		return -1;
+
+	sos->team_games = calloc(n ? n : 1, sizeof(uint32_t *));
+	sos->num_team_games = calloc(n ? n : 1, sizeof(size_t));
+	sos->max_team_games = calloc(n ? n : 1, sizeof(size_t));
+	sos->wins = calloc(n ? n : 1, sizeof(double));
+	sos->owp_sum = calloc(n ? n : 1, sizeof(double));
+	sos->oowp_sum = calloc(n ? n : 1, sizeof(double));
+	sos->mark = calloc(n ? n : 1, sizeof(uint32_t));
+	sos->touched = calloc(n ? n : 1, sizeof(size_t));
+	sos->old_owp = calloc(n ? n : 1, sizeof(double));
+
+	if (!sos->team_games || !sos->num_team_games || !sos->max_team_games || !sos->wins ||
+	    !sos->owp_sum || !sos->oowp_sum || !sos->mark || !sos->touched || !sos->old_owp) {
+		sos_free(sos);
+		return -2;
+	}
+
+	for (i = 0; i < games->num_games; i++) {
+		game = &games->list[i];
+
+		if (game->home >= n || game->away >= n) {
+			fprintf(stderr, "%s: game %lu has a team id out of range\n", __func__, i);
+			sos_free(sos);
+			return -3;
+		}
+
+		if (games_add(&sos->games, game) < 0 || _link(sos, game->home, i) < 0 || _link(sos, game->away, i) < 0) {
+			sos_free(sos);
+			return -2;
+		}
+
+		sos->wins[game->home] += _result(game, game->home);
+		sos->wins[game->away] += _result(game, game->away);
+	}
+
+	for (i = 0; i < games->num_games; i++) {
+		game = &games->list[i];
+		sos->owp_sum[game->home] += _wp(sos, game->away);
+		sos->owp_sum[game->away] += _wp(sos, game->home);
+	}
+
+	for (i = 0; i < games->num_games; i++) {
+		game = &games->list[i];
+		sos->oowp_sum[game->home] += _owp(sos, game->away);
+		sos->oowp_sum[game->away] += _owp(sos, game->home);
+	}
+
+	for (i = 0; i < n; i++)
+		_write(sos, ctx, i);
+
+	return 0;
+}
+
+
+/**
+ * Adds a game and updates owp and oowp for the teams it affects
+ *
+ * @return Negative on error
+ */
+
+int sos_add_game(struct sos *sos, struct ncrunch_ctx *ctx, const struct game *game)
+{
+	size_t a = game->home;
+	size_t b = game->away;
+	size_t num_touched;
+	size_t num_t1;
+	double old_wp_a, old_wp_b;
+	size_t gi;
+
+	if (a >= sos->num_teams || b >= sos->num_teams || a == b) {
+		fprintf(stderr, "%s: bad teams %lu and %lu\n", __func__, a, b);
+		return -1;
+	}
+
+	num_t1 = _collect(sos, a, b, &num_touched);
+	old_wp_a = _wp(sos, a);
+	old_wp_b = _wp(sos, b);
+
+	gi = sos->games.num_games;
+	if (games_add(&sos->games, game) < 0)
+		return -2;
+
+	if (_link(sos, a, gi) < 0 || _link(sos, b, gi) < 0) {
+		/* leave things as they were */
+		if (sos->num_team_games[a] && sos->team_games[a][sos->num_team_games[a] - 1] == gi)
+			sos->num_team_games[a]--;
+
+		sos->games.num_games--;
+		return -2;
+	}
+
+	sos->wins[a] += _result(game, a);
+	sos->wins[b] += _result(game, b);
+
+	_propagate(sos, ctx, a, b, old_wp_a, old_wp_b, gi, num_t1, &num_touched);
+	return 0;
+}
+
+
+/**
+ * Corrects the score of a game and updates owp and oowp for the teams the
+ * change affects
+ *
+ * @param index The game's index, in the order the games were added
+ * @return Negative on error
+ */
+
+int sos_set_result(struct sos *sos, struct ncrunch_ctx *ctx, size_t index, int32_t home_score, int32_t away_score)
+{
+	struct game *game;
+	size_t a, b;
+	size_t num_touched;
+	size_t num_t1;
+	double old_wp_a, old_wp_b;
+
+	if (index >= sos->games.num_games) {
+		fprintf(stderr, "%s: no game %lu\n", __func__, index);
+		return -1;
+	}
+
+	game = &sos->games.list[index];
+	a = game->home;
+	b = game->away;
+
+	num_t1 = _collect(sos, a, b, &num_touched);
+	old_wp_a = _wp(sos, a);
+	old_wp_b = _wp(sos, b);
+
+	sos->wins[a] -= _result(game, a);
+	sos->wins[b] -= _result(game, b);
+
+	game->home_score = home_score;
+	game->away_score = away_score;
+
+	sos->wins[a] += _result(game, a);
+	sos->wins[b] += _result(game, b);
+
+	_propagate(sos, ctx, a, b, old_wp_a, old_wp_b, SOS_NOGAME, num_t1, &num_touched);
+	return 0;
+}
+
+
+/**
+ * Finds a game by week and teams
+ *
+ * @return The game's index, or SOS_NOGAME
+ */
+
+size_t sos_find_game(const struct sos *sos, uint32_t week, size_t home, size_t away)
+{
+	const struct game *game;
+	size_t i;
+
+	if (home >= sos->num_teams)
+		return SOS_NOGAME;
+
+	for (i = 0; i < sos->num_team_games[home]; i++) {
+		game = &sos->games.list[sos->team_games[home][i]];
+
+		if (game->week == week && game->home == home && game->away == away)
+			return sos->team_games[home][i];
+	}
+
+	return SOS_NOGAME;
+}
+
+
+void sos_free(struct sos *sos)
+{
+	size_t i;
+
+	if (sos->team_games) {
+		for (i = 0; i < sos->num_teams; i++)
+			free(sos->team_games[i]);
+	}
+
+	games_free(&sos->games);
+	free(sos->team_games);
+	free(sos->num_team_games);
+	free(sos->max_team_games);
+	free(sos->wins);
+	free(sos->owp_sum);
+	free(sos->oowp_sum);
+	free(sos->mark);
+	free(sos->touched);
+	free(sos->old_owp);
+	memset(sos, 0, sizeof(struct sos));
+}
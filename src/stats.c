@@ -0,0 +1,96 @@
+
+#include <stdio.h>
+#include <string.h>
+
+#include <ncrunch/stats.h>
+
+
+
+static const char *phase_names[STATS_NUM_PHASES] = {
+	"open",
+	"read",
+	"tokenize",
+	"infer",
+	"create",
+	"set",
+	"teardown"
+};
+
+
+/**
+ * Returns the short name of a phase, as used in the summary and JSON
+ */
+
+const char *stats_phase_name(enum stats_phase phase)
+{
+	if (phase >= STATS_NUM_PHASES)
+		return "invalid";
+
+	return phase_names[phase];
+}
+
+
+/**
+ * Writes a human readable summary, one line per phase plus a total
+ *
+ * Throughput is given in MB/s for phases that moved bytes and in rows/s for
+ * the rest.
+ */
+
+void stats_write(const struct ncrunch_stats *stats, FILE *out)
+{
+	const struct stats_counter *c;
+	uint64_t total = 0;
+	double secs;
+	size_t i;
+
+	fprintf(out, "%-10s %10s %12s %12s %10s %10s %10s %14s\n",
+		"phase", "calls", "ms", "bytes", "rows", "fields", "allocs", "throughput");
+
+	for (i = 0; i < STATS_NUM_PHASES; i++) {
+		c = &stats->phase[i];
+		total += c->ns;
+		secs = c->ns / 1e9;
+
+		fprintf(out, "%-10s %10lu %12.3f %12lu %10lu %10lu %10lu ",
+			phase_names[i], c->calls, c->ns / 1e6, c->bytes, c->rows, c->fields, c->allocs);
+
+		if (secs <= 0.0)
+			fprintf(out, "%14s\n", "-");
+		else if (c->bytes)
+			fprintf(out, "%9.1f MB/s\n", c->bytes / secs / 1e6);
+		else if (c->rows)
+			fprintf(out, "%7.0f rows/s\n", c->rows / secs);
+		else
+			fprintf(out, "%14s\n", "-");
+	}
+
+	fprintf(out, "%-10s %10s %12.3f\n", "total", "", total / 1e6);
+}
+
+
+/**
+ * Writes the stats as a single line of JSON
+ *
+ *	{"phases":{"open":{"ns":..,"calls":..,"bytes":..,"rows":..,
+ *	"fields":..,"allocs":..},...},"total_ns":..}
+ */
+
+void stats_write_json(const struct ncrunch_stats *stats, FILE *out)
+{
+	const struct stats_counter *c;
+	uint64_t total = 0;
+	size_t i;
+
+	fprintf(out, "{\"phases\":{");
+
+	for (i = 0; i < STATS_NUM_PHASES; i++) {
+		c = &stats->phase[i];
+		total += c->ns;
+
+		fprintf(out, "%s\"%s\":{\"ns\":%lu,\"calls\":%lu,\"bytes\":%lu,\"rows\":%lu,\"fields\":%lu,\"allocs\":%lu}",
+			i ? "," : "", phase_names[i], c->ns, c->calls, c->bytes, c->rows, c->fields, c->allocs);
+	}
+
+	fprintf(out, "},\"total_ns\":%lu}\n", total);
+}
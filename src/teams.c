@@ -2,21 +2,285 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <strings.h>
 #include <stdio.h>
+#include <math.h>
 
 #include <ncrunch/ncrunch.h>
+#include <ncrunch/stats.h>
 
+#include "ctx.h"
 
-#define TFL_MAXFIELDS  16
 
+#define TEAMS_INITSIZE 64
 
 
-static struct tfl_entry *tfl = NULL;
-static size_t num_fields = 0;
 
+/**
+ * Allocates an empty dataset context
+ *
+ * Each context owns its own field list and team store, so several datasets
+ * can be loaded and worked on side by side (one context per thread).
+ *
+ * @return NULL on error
+ */
+
+struct ncrunch_ctx *ncrunch_ctx_create(void)
+{
+	return calloc(1, sizeof(struct ncrunch_ctx));
+}
+
+
+/**
+ * Frees a context along with its teams and field list
+ */
+
+void ncrunch_ctx_destroy(struct ncrunch_ctx *ctx)
+{
+	struct ncrunch_stats *stats;
+	size_t num_teams;
+	uint64_t start;
+
+	if (!ctx)
+		return;
+
+	stats = ctx->stats;
+	num_teams = ctx->num_teams;
+	start = stats_begin(stats);
+
+	teams_destroy(ctx);
+	tfl_destroy(ctx);
+	free(ctx->teams);
+	free(ctx);
+
+	stats_end(stats, STATS_TEARDOWN, start);
+	stats_add(stats, STATS_TEARDOWN, 0, num_teams, 0, 0);
+}
+
+
+/**
+ * Starts (or with NULL, stops) recording load statistics into stats
+ *
+ * The stats are owned by the caller and are not freed with the context.
+ */
+
+void ncrunch_ctx_set_stats(struct ncrunch_ctx *ctx, struct ncrunch_stats *stats)
+{
+	ctx->stats = stats;
+}
+
+
+
+/**
+ * Returns the size of one value in a column of the given type
+ */
+
+static size_t _type_size(enum tfl_type type)
+{
+	switch (type) {
+	case TEAM_FIELD_STRING:	return sizeof(char *);
+	case TEAM_FIELD_DOUBLE:	return sizeof(double);
+	case TEAM_FIELD_INT32:	return sizeof(int32_t);
+	case TEAM_FIELD_UINT16:	return sizeof(uint16_t);
+	case TEAM_FIELD_UINT8:	return sizeof(uint8_t);
+	case TEAM_FIELD_BOOL:	return sizeof(uint8_t);
+	case TEAM_FIELD_TAGS:	return sizeof(uint64_t);
+	default:		return 0;
+	}
+}
+
+
+/**
+ * Whether a field of the given type reads back as a number
+ */
+
+int tfl_type_numeric(enum tfl_type type)
+{
+	return type == TEAM_FIELD_DOUBLE || type == TEAM_FIELD_INT32 || type == TEAM_FIELD_UINT16
+		|| type == TEAM_FIELD_UINT8 || type == TEAM_FIELD_BOOL;
+}
+
+
+/**
+ * Returns the name of a type, as shown to users
+ */
+
+const char *tfl_type_name(enum tfl_type type)
+{
+	switch (type) {
+	case TEAM_FIELD_STRING:	return "string";
+	case TEAM_FIELD_DOUBLE:	return "double";
+	case TEAM_FIELD_INT32:	return "int32";
+	case TEAM_FIELD_UINT16:	return "uint16";
+	case TEAM_FIELD_UINT8:	return "uint8";
+	case TEAM_FIELD_BOOL:	return "bool";
+	case TEAM_FIELD_TAGS:	return "tags";
+	default:		return "invalid";
+	}
+}
+
+
+/**
+ * Whether a value can be stored in a numeric column of the given type
+ */
+
+static int _fits(enum tfl_type type, double val)
+{
+	switch (type) {
+	case TEAM_FIELD_DOUBLE:	return 1;
+	case TEAM_FIELD_INT32:	return val == floor(val) && val >= INT32_MIN && val <= INT32_MAX;
+	case TEAM_FIELD_UINT16:	return val == floor(val) && val >= 0 && val <= UINT16_MAX;
+	case TEAM_FIELD_UINT8:	return val == floor(val) && val >= 0 && val <= UINT8_MAX;
+	case TEAM_FIELD_BOOL:	return val == 0 || val == 1;
+	default:		return 0;
+	}
+}
+
+
+/**
+ * Returns the narrowest numeric type at least as wide as type that holds val
+ */
 
-static struct team teams[TEAMS_MAXTEAMS];
-static size_t num_teams = 0; 
+static enum tfl_type _widen(enum tfl_type type, double val)
+{
+	static const enum tfl_type order[] = {
+		TEAM_FIELD_BOOL, TEAM_FIELD_UINT8, TEAM_FIELD_UINT16, TEAM_FIELD_INT32, TEAM_FIELD_DOUBLE
+	};
+	size_t i = 0;
+
+	while (order[i] != type)
+		i++;
+
+	while (!_fits(order[i], val))
+		i++;
+
+	return order[i];
+}
+
+
+/**
+ * Reads a value out of a numeric column
+ */
+
+static double _column_get(const struct tfl_entry *entry, size_t id)
+{
+	switch (entry->type) {
+	case TEAM_FIELD_DOUBLE:	return ((const double *) entry->data)[id];
+	case TEAM_FIELD_INT32:	return ((const int32_t *) entry->data)[id];
+	case TEAM_FIELD_UINT16:	return ((const uint16_t *) entry->data)[id];
+	case TEAM_FIELD_UINT8:
+	case TEAM_FIELD_BOOL:	return ((const uint8_t *) entry->data)[id];
+	default:		return 0.0;
+	}
+}
+
+
+/**
+ * Stores a value into a numeric column; the value must fit the type
+ */
+
+static void _column_put(struct tfl_entry *entry, size_t id, double val)
+{
+	switch (entry->type) {
+	case TEAM_FIELD_DOUBLE:	((double *) entry->data)[id] = val; break;
+	case TEAM_FIELD_INT32:	((int32_t *) entry->data)[id] = (int32_t) val; break;
+	case TEAM_FIELD_UINT16:	((uint16_t *) entry->data)[id] = (uint16_t) val; break;
+	case TEAM_FIELD_UINT8:
+	case TEAM_FIELD_BOOL:	((uint8_t *) entry->data)[id] = (uint8_t) val; break;
+	default:		break;
+	}
+}
+
+
+/**
+ * Joins the names of the tags set in a mask with spaces
+ *
+ * @return The length the text would have, like snprintf()
+ */
+
+static int _format_tags(const struct tfl_entry *entry, uint64_t mask, char *buf, size_t len)
+{
+	size_t used = 0;
+	size_t bit;
+	int n;
+
+	if (len)
+		buf[0] = '\0';
+
+	for (bit = 0; bit < entry->num_tags; bit++) {
+		if (!(mask & ((uint64_t) 1 << bit)))
+			continue;
+
+		n = snprintf(buf + (used < len ? used : len), used < len ? len - used : 0, "%s%s",
+			used ? " " : "", entry->tags[bit]);
+		used += n;
+	}
+
+	return used;
+}
+
+
+/**
+ * Changes the type of a column that already holds values, converting them
+ *
+ * Numbers convert to any other numeric type (values must fit; see
+ * _widen()). BOOL and TAGS convert to STRING, the latter as the set's tags
+ * in dictionary order.
+ *
+ * @return Negative on error
+ */
+
+static int _convert_column(struct ncrunch_ctx *ctx, size_t field, enum tfl_type type)
+{
+	struct tfl_entry *entry = &ctx->tfl[field];
+	struct tfl_entry next = *entry;
+	char **strs;
+	char buf[1024];
+	size_t i;
+
+	next.type = type;
+	next.data = calloc(ctx->max_teams ? ctx->max_teams : 1, _type_size(type));
+	if (!next.data)
+		return -1;
+
+	if (tfl_type_numeric(entry->type) && tfl_type_numeric(type)) {
+		for (i = 0; i < ctx->num_teams; i++)
+			_column_put(&next, i, _column_get(entry, i));
+
+	} else if (entry->type == TEAM_FIELD_BOOL && type == TEAM_FIELD_STRING) {
+		strs = next.data;
+		for (i = 0; i < ctx->num_teams; i++)
+			strs[i] = strdup(((uint8_t *) entry->data)[i] ? "true" : "false");
+
+	} else if (entry->type == TEAM_FIELD_TAGS && type == TEAM_FIELD_STRING) {
+		strs = next.data;
+		for (i = 0; i < ctx->num_teams; i++) {
+			if (((uint64_t *) entry->data)[i] == 0)
+				continue;
+
+			_format_tags(entry, ((uint64_t *) entry->data)[i], buf, sizeof(buf));
+			strs[i] = strdup(buf);
+		}
+
+	} else {
+		fprintf(stderr, "%s: can't convert field '%s' from %s to %s\n", __func__,
+			entry->name, tfl_type_name(entry->type), tfl_type_name(type));
+		free(next.data);
+		return -2;
+	}
+
+	for (i = 0; i < entry->num_tags; i++)
+		free(entry->tags[i]);
+
+	free(entry->tags);
+	free(entry->data);
+
+	next.tags = NULL;
+	next.num_tags = 0;
+	*entry = next;
+
+	return 0;
+}
 
 
 
@@ -26,13 +290,21 @@ static size_t num_teams = 0;
  * @return Negative on error
  */
 
-int tfl_create(size_t num_fields_)
+int tfl_create(struct ncrunch_ctx *ctx, size_t num_fields)
 {
-	assert(num_fields == 0);
-	assert(num_fields_ <= TFL_MAXFIELDS);
+	assert(ctx->num_fields == 0);
+
+	if (num_fields > TFL_MAXFIELDS) {
+		fprintf(stderr, "%s: Too many fields! Max: %d\n", __func__, TFL_MAXFIELDS);
+		return -1;
+	}
+
+	ctx->tfl = calloc(num_fields ? num_fields : 1, sizeof(struct tfl_entry));
+	if (!ctx->tfl)
+		return -2;
 
-	tfl = calloc(num_fields_, sizeof(struct tfl_entry));
-	num_fields = num_fields_;
+	ctx->num_fields = num_fields;
+	ctx->max_fields = num_fields;
 
 	return 0;
 }
@@ -42,9 +314,9 @@ int tfl_create(size_t num_fields_)
  * Get the number of fields in the team field list
  */
 
-size_t tfl_num_fields(void)
+size_t tfl_num_fields(const struct ncrunch_ctx *ctx)
 {
-	return num_fields;
+	return ctx->num_fields;
 }
 
 
@@ -56,12 +328,12 @@ size_t tfl_num_fields(void)
  * @return Negative on error
  */
 
-int tfl_set_name(size_t id, const char *name)
+int tfl_set_name(struct ncrunch_ctx *ctx, size_t id, const char *name)
 {
-	if (id >= num_fields)
+	if (id >= ctx->num_fields)
 		return -1;
 
-	tfl[id].name = strdup(name);
+	ctx->tfl[id].name = strdup(name);
 	return 0;
 }
 
@@ -69,17 +341,34 @@ int tfl_set_name(size_t id, const char *name)
 /**
  * Set the type of a field in the list
  *
+ * Setting the type of a field that has none yet allocates its column.
+ * Changing the type of a field converts the values already stored.
+ *
  * @param id The id of the field
  * @param type The type to set the field to
  * @return Negative on error
  */
 
-int tfl_set_type(size_t id, enum tfl_type type)
+int tfl_set_type(struct ncrunch_ctx *ctx, size_t id, enum tfl_type type)
 {
-	if (id >= num_fields)
+	struct tfl_entry *entry;
+
+	if (id >= ctx->num_fields || type == TEAM_FIELD_INVALID)
 		return -1;
 
-	tfl[id].type = type;
+	entry = &ctx->tfl[id];
+
+	if (entry->type == type)
+		return 0;
+
+	if (entry->type != TEAM_FIELD_INVALID)
+		return _convert_column(ctx, id, type);
+
+	entry->data = calloc(ctx->max_teams ? ctx->max_teams : 1, _type_size(type));
+	if (!entry->data)
+		return -2;
+
+	entry->type = type;
 	return 0;
 }
 
@@ -91,12 +380,12 @@ int tfl_set_type(size_t id, enum tfl_type type)
  * @return Returns a const* to the field's name. DO NOT MODIFY
  */
 
-const char *tfl_get_name(size_t id)
+const char *tfl_get_name(const struct ncrunch_ctx *ctx, size_t id)
 {
-	if (id >= num_fields)
+	if (id >= ctx->num_fields)
 		return NULL;
 
-	return tfl[id].name;
+	return ctx->tfl[id].name;
 }
 
 
@@ -107,12 +396,29 @@ const char *tfl_get_name(size_t id)
  * @return The type of the field
  */
 
-enum tfl_type tfl_get_type(size_t id)
+enum tfl_type tfl_get_type(const struct ncrunch_ctx *ctx, size_t id)
 {
-	if (id >= num_fields)
+	if (id >= ctx->num_fields)
 		return TEAM_FIELD_INVALID;
 
-	return tfl[id].type;
+	return ctx->tfl[id].type;
+}
+
+
+/**
+ * Get the name of one of a tag field's tags
+ *
+ * @param id The field's id
+ * @param bit The tag's bit in team_get_tags() masks
+ * @return The tag, or NULL if there is no such tag. DO NOT MODIFY
+ */
+
+const char *tfl_get_tag(const struct ncrunch_ctx *ctx, size_t id, size_t bit)
+{
+	if (tfl_get_type(ctx, id) != TEAM_FIELD_TAGS || bit >= ctx->tfl[id].num_tags)
+		return NULL;
+
+	return ctx->tfl[id].tags[bit];
 }
 
 
@@ -124,13 +430,13 @@ enum tfl_type tfl_get_type(size_t id)
  * @return Negative if field not found
  */
 
-int tfl_find(const char *name, size_t *id)
+int tfl_find(const struct ncrunch_ctx *ctx, const char *name, size_t *id)
 {
 	size_t i;
 
-	for (i = 0; i < num_fields; i++) {
+	for (i = 0; i < ctx->num_fields; i++) {
 		/* FIXME: make this strcmpi - have to implement */
-		if (strcmp(tfl[i].name, name) == 0) {
+		if (strcmp(ctx->tfl[i].name, name) == 0) {
 			*id = i;
 			return 0;
 		}
@@ -140,47 +446,141 @@ int tfl_find(const char *name, size_t *id)
 }
 
 
+/**
+ * Appends a field to the end of the team field list
+ *
+ * The new field gets a zeroed column for the teams that already exist. Used
+ * for fields that are not read from the flatf (computed fields, etc.).
+ *
+ * @param name The name for the field (Copied)
+ * @param type The type of the new field
+ * @param id Set to the id of the new field
+ * @return Negative on error
+ */
+
+int tfl_add(struct ncrunch_ctx *ctx, const char *name, enum tfl_type type, size_t *id)
+{
+	struct tfl_entry *entries;
+	size_t max_fields;
+
+	if (ctx->num_fields >= TFL_MAXFIELDS) {
+		fprintf(stderr, "%s: Too many fields! Max: %d\n", __func__, TFL_MAXFIELDS);
+		return -1;
+	}
+
+	if (ctx->num_fields == ctx->max_fields) {
+		max_fields = ctx->max_fields ? ctx->max_fields * 2 : 8;
+		if (max_fields > TFL_MAXFIELDS)
+			max_fields = TFL_MAXFIELDS;
+
+		entries = realloc(ctx->tfl, max_fields * sizeof(struct tfl_entry));
+		if (!entries) {
+			return -2;
+		}
+
+		ctx->tfl = entries;
+		ctx->max_fields = max_fields;
+	}
+
+	memset(&ctx->tfl[ctx->num_fields], 0, sizeof(struct tfl_entry));
+	ctx->tfl[ctx->num_fields].name = strdup(name);
+	ctx->num_fields++;
+
+	if (tfl_set_type(ctx, ctx->num_fields - 1, type) < 0) {
+		ctx->num_fields--;
+		free(ctx->tfl[ctx->num_fields].name);
+		return -3;
+	}
+
+	*id = ctx->num_fields - 1;
+	return 0;
+}
+
+
 /**
  * Cleans up the allocations made for the team field list
  *
  * DEBUG only
  */
 
-int tfl_destroy(void)
+int tfl_destroy(struct ncrunch_ctx *ctx)
 {
-	size_t i;
+	size_t i, j;
+
+	for (i = 0; i < ctx->num_fields; i++) {
+		for (j = 0; j < ctx->tfl[i].num_tags; j++)
+			free(ctx->tfl[i].tags[j]);
 
-	for (i = 0; i < num_fields; i++) {
-		free(tfl[i].name);
+		free(ctx->tfl[i].tags);
+		free(ctx->tfl[i].data);
+		free(ctx->tfl[i].name);
 	}
 
-	free(tfl);
-	tfl = NULL;
-	num_fields = 0;
+	free(ctx->tfl);
+	ctx->tfl = NULL;
+	ctx->num_fields = 0;
+	ctx->max_fields = 0;
 	return 0;
 }
 
 
 /**
  * Adds a team to the team list
- * 
+ *
+ * The team's value in every column starts zeroed (NULL for strings).
+ *
  * @return Returns the id of the created team or TEAMS_INVALID on error
  */
 
-size_t team_create(void)
+size_t team_create(struct ncrunch_ctx *ctx)
 {
-	struct team *team;
-	size_t id = num_teams;
+	struct team *teams;
+	size_t id = ctx->num_teams;
+	size_t max_teams;
+	size_t size;
+	size_t i;
+	void *data;
 
-	if (num_teams >= TEAMS_MAXTEAMS) {
+	if (ctx->num_teams >= TEAMS_MAXTEAMS) {
 		fprintf(stderr, "%s: Too many teams! Max: %d\n", __func__, TEAMS_MAXTEAMS);
 		return TEAMS_INVALID;
 	}
 
-	team = &teams[id];
-	team->fields = calloc(num_fields, sizeof(union team_field));
+	if (ctx->num_teams == ctx->max_teams) {
+		max_teams = ctx->max_teams ? ctx->max_teams * 2 : TEAMS_INITSIZE;
+		teams = realloc(ctx->teams, max_teams * sizeof(struct team));
+		if (!teams) {
+			fprintf(stderr, "%s: out of memory\n", __func__);
+			return TEAMS_INVALID;
+		}
+
+		ctx->teams = teams;
+		stats_add(ctx->stats, STATS_CREATE, 0, 0, 0, 1);
+
+		for (i = 0; i < ctx->num_fields; i++) {
+			if (!ctx->tfl[i].data)
+				continue;
+
+			size = _type_size(ctx->tfl[i].type);
+			data = realloc(ctx->tfl[i].data, max_teams * size);
+			if (!data) {
+				fprintf(stderr, "%s: out of memory\n", __func__);
+				return TEAMS_INVALID;
+			}
 
-	num_teams++;
+			memset((char *) data + ctx->max_teams * size, 0, (max_teams - ctx->max_teams) * size);
+			ctx->tfl[i].data = data;
+			stats_add(ctx->stats, STATS_CREATE, 0, 0, 0, 1);
+		}
+
+		ctx->max_teams = max_teams;
+	}
+
+	memset(&ctx->teams[id], 0, sizeof(struct team));
+	ctx->teams[id].row = id;
+	stats_add(ctx->stats, STATS_CREATE, 0, 1, 0, 0);
+
+	ctx->num_teams++;
 	return id;
 }
 
@@ -192,25 +592,26 @@ size_t team_create(void)
  * Does not remove the team from the teams list
  */
 
-int team_destroy(size_t id)
+int team_destroy(struct ncrunch_ctx *ctx, size_t id)
 {
-	struct team *team;
+	char **strs;
 	size_t i;
 
-	if (id >= num_teams) {
+	if (id >= ctx->num_teams) {
 		fprintf(stderr, "%s: id %lu out of range\n", __func__, id);
 		return -1;
 	}
 
-	team = &teams[id];
+	for (i = 0; i < ctx->num_fields; i++) {
+		if (ctx->tfl[i].type != TEAM_FIELD_STRING)
+			continue;
 
-	for (i = 0; i < num_fields; i++) {
-		if (tfl[i].type == TEAM_FIELD_STRING)
-			free(team->fields[i].data_s);
+		strs = ctx->tfl[i].data;
+		free(strs[id]);
+		strs[id] = NULL;
 	}
 
-	free(team->fields);
-	memset(team, 0, sizeof(struct team));
+	memset(&ctx->teams[id], 0, sizeof(struct team));
 
 	return 0;
 }
@@ -222,67 +623,179 @@ int team_destroy(size_t id)
  * DEBUG only
  */
 
-int teams_destroy(void)
+int teams_destroy(struct ncrunch_ctx *ctx)
 {
 	size_t id;
 	int err;
 
-	for (id = 0; id < num_teams; id++) {
-		err = team_destroy(id);
+	for (id = 0; id < ctx->num_teams; id++) {
+		err = team_destroy(ctx, id);
 
 		if (err)
 			return -1;
 	}
 
+#ifdef NCRUNCH_DEBUG
 	printf("Destroyed %lu team(s)\n", id);
+#endif
 	return 0;
 }
 
 
+/**
+ * Returns the flatf row a team was read from, which is its id unless the
+ * teams have been permuted
+ */
+
+size_t team_get_row(const struct ncrunch_ctx *ctx, size_t id)
+{
+	if (id >= ctx->num_teams) {
+		fprintf(stderr, "%s: id %lu out of range\n", __func__, id);
+		return TEAMS_INVALID;
+	}
+
+	return ctx->teams[id].row;
+}
+
+
 /**
  * Get the number of teams
  */
 
-size_t teams_num_teams(void)
+size_t teams_num_teams(const struct ncrunch_ctx *ctx)
+{
+	return ctx->num_teams;
+}
+
+
+/**
+ * Whether a word is one of the spellings of a boolean
+ *
+ * @param val Set to the word's value if it is
+ */
+
+static int _bool_word(const char *str, uint8_t *val)
+{
+	if (strcasecmp(str, "true") == 0) {
+		*val = 1;
+		return 1;
+	}
+
+	if (strcasecmp(str, "false") == 0) {
+		*val = 0;
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Sets a team's tags from a space separated list of words
+ *
+ * New words are added to the field's tags. If that would take the field past
+ * TFL_MAXTAGS, the field is converted to a string field first.
+ *
+ * @return Negative on error
+ */
+
+static int _set_tags(struct ncrunch_ctx *ctx, size_t id, size_t field, const char *str)
 {
-	return num_teams;
+	struct tfl_entry *entry = &ctx->tfl[field];
+	char copy[1024];
+	char *word;
+	char *save;
+	char **tags;
+	uint64_t mask = 0;
+	size_t bit;
+
+	snprintf(copy, sizeof(copy), "%s", str);
+
+	for (word = strtok_r(copy, " ", &save); word; word = strtok_r(NULL, " ", &save)) {
+		for (bit = 0; bit < entry->num_tags; bit++) {
+			if (strcmp(entry->tags[bit], word) == 0)
+				break;
+		}
+
+		if (bit == entry->num_tags) {
+			if (entry->num_tags == TFL_MAXTAGS) {
+				if (_convert_column(ctx, field, TEAM_FIELD_STRING) < 0)
+					return -1;
+
+				return team_set_string(ctx, id, field, str);
+			}
+
+			tags = realloc(entry->tags, (entry->num_tags + 1) * sizeof(char *));
+			if (!tags)
+				return -2;
+
+			entry->tags = tags;
+			entry->tags[entry->num_tags++] = strdup(word);
+			stats_add(ctx->stats, STATS_SET, 0, 0, 0, 1);
+		}
+
+		mask |= (uint64_t) 1 << bit;
+	}
+
+	((uint64_t *) entry->data)[id] = mask;
+	return 0;
 }
 
 
 /**
  * Sets a field in a team to a string value.
  *
- * The string is copied.
+ * The string is copied into string fields, parsed into a set of words for
+ * tag fields and read as "true"/"false" for boolean fields. A value a tag or
+ * boolean field can't hold converts the field to a string field.
+ *
  * @param id The team's id
  * @param field The field's id
  * @param str The string to be copied into the field
  * @return Returns negative on error
  */
 
-int team_set_string(size_t id, size_t field, const char *str)
+int team_set_string(struct ncrunch_ctx *ctx, size_t id, size_t field, const char *str)
 {
-	struct team *team;
 	enum tfl_type type;
+	char **strs;
+	uint8_t val;
 
-	if (id >= num_teams) {
+	if (id >= ctx->num_teams) {
 		fprintf(stderr, "%s: id %lu out of range\n", __func__, id);
 		return -1;
 	}
 
-	team = &teams[id];
-	type = tfl_get_type(field);
+	type = tfl_get_type(ctx, field);
 
 	if (type == TEAM_FIELD_INVALID) {
 		fprintf(stderr, "%s: invalid field id %lu\n", __func__, field);
 		return -2;
 	}
 
-	else if (type == TEAM_FIELD_DOUBLE) {
-		fprintf(stderr, "%s: trying to write string to double field\n", __func__);
+	else if (type == TEAM_FIELD_TAGS) {
+		return _set_tags(ctx, id, field, str);
+	}
+
+	else if (type == TEAM_FIELD_BOOL) {
+		if (_bool_word(str, &val)) {
+			((uint8_t *) ctx->tfl[field].data)[id] = val;
+			return 0;
+		}
+
+		if (_convert_column(ctx, field, TEAM_FIELD_STRING) < 0)
+			return -4;
+	}
+
+	else if (type != TEAM_FIELD_STRING) {
+		fprintf(stderr, "%s: trying to write string to %s field\n", __func__, tfl_type_name(type));
 		return -3;
 	}
 
-	team->fields[field].data_s = strdup(str);
+	strs = ctx->tfl[field].data;
+	free(strs[id]);
+	strs[id] = strdup(str);
+	stats_add(ctx->stats, STATS_SET, 0, 0, 0, 1);
 	return 0;
 }
 
@@ -290,36 +803,395 @@ int team_set_string(size_t id, size_t field, const char *str)
 /**
  * Sets a field in a team to a double value
  *
+ * Works on any numeric field; if the value doesn't fit the field's type the
+ * field is widened to one that does.
+ *
  * @param id The team's id
  * @param field The field's id
  * @param val The value to set the field to
  * @return Returns negative on error
  */
 
-int team_set_double(size_t id, size_t field, double val)
+int team_set_double(struct ncrunch_ctx *ctx, size_t id, size_t field, double val)
 {
-	struct team *team;
 	enum tfl_type type;
+	enum tfl_type wider;
 
-	if (id >= num_teams) {
+	if (id >= ctx->num_teams) {
 		fprintf(stderr, "%s: id %lu out of range\n", __func__, id);
 		return -1;
 	}
 
-	team = &teams[id];
-	type = tfl_get_type(field);
+	type = tfl_get_type(ctx, field);
 
 	if (type == TEAM_FIELD_INVALID) {
 		fprintf(stderr, "%s: invalid field id %lu\n", __func__, field);
 		return -2;
 	}
 
-	else if (type == TEAM_FIELD_STRING) {
-		fprintf(stderr, "%s: trying to write double to string field\n", __func__);
+	else if (!tfl_type_numeric(type)) {
+		fprintf(stderr, "%s: trying to write double to %s field\n", __func__, tfl_type_name(type));
 		return -3;
 	}
 
-	team->fields[field].data_d = val;
+	if (!_fits(type, val)) {
+		wider = _widen(type, val);
+		if (_convert_column(ctx, field, wider) < 0)
+			return -4;
+	}
+
+	_column_put(&ctx->tfl[field], id, val);
+	return 0;
+}
+
+
+/**
+ * Sets the digest used to look a team up by name
+ *
+ * The name is hashed case-insensitively, see team_find()
+ *
+ * @param id The team's id
+ * @param name The team's name
+ * @return Returns negative on error
+ */
+
+int team_set_name(struct ncrunch_ctx *ctx, size_t id, const char *name)
+{
+	if (id >= ctx->num_teams) {
+		fprintf(stderr, "%s: id %lu out of range\n", __func__, id);
+		return -1;
+	}
+
+	hash_stringi(name, &ctx->teams[id].name);
+	return 0;
+}
+
+
+/**
+ * Locates a team by name, ignoring case
+ *
+ * @param name The team's name
+ * @return The team's id, or TEAMS_INVALID if there is no such team
+ */
+
+size_t team_find(const struct ncrunch_ctx *ctx, const char *name)
+{
+	struct mdigest digest;
+	size_t i;
+
+	hash_stringi(name, &digest);
+
+	for (i = 0; i < ctx->num_teams; i++) {
+		if (memcmp(&digest, &ctx->teams[i].name, sizeof(struct mdigest)) == 0)
+			return i;
+	}
+
+	return TEAMS_INVALID;
+}
+
+
+/**
+ * Gets the value of a team's string field
+ *
+ * @param id The team's id
+ * @param field The field's id
+ * @return Returns a const* to the string, or NULL on error. DO NOT MODIFY
+ */
+
+const char *team_get_string(const struct ncrunch_ctx *ctx, size_t id, size_t field)
+{
+	if (id >= ctx->num_teams) {
+		fprintf(stderr, "%s: id %lu out of range\n", __func__, id);
+		return NULL;
+	}
+
+	if (tfl_get_type(ctx, field) != TEAM_FIELD_STRING) {
+		fprintf(stderr, "%s: field id %lu is not a string field\n", __func__, field);
+		return NULL;
+	}
+
+	return ((char **) ctx->tfl[field].data)[id];
+}
+
+
+/**
+ * Gets the value of a team's numeric field
+ *
+ * @param id The team's id
+ * @param field The field's id
+ * @param val Set to the field's value
+ * @return Returns negative on error
+ */
+
+int team_get_double(const struct ncrunch_ctx *ctx, size_t id, size_t field, double *val)
+{
+	if (id >= ctx->num_teams) {
+		fprintf(stderr, "%s: id %lu out of range\n", __func__, id);
+		return -1;
+	}
+
+	if (!tfl_type_numeric(tfl_get_type(ctx, field))) {
+		fprintf(stderr, "%s: field id %lu is not a numeric field\n", __func__, field);
+		return -2;
+	}
+
+	*val = _column_get(&ctx->tfl[field], id);
 	return 0;
 }
 
+
+/**
+ * Gets the tags set on a team
+ *
+ * @param id The team's id
+ * @param field The field's id
+ * @param mask Set to the team's tags; bit n is tfl_get_tag(ctx, field, n)
+ * @return Returns negative on error
+ */
+
+int team_get_tags(const struct ncrunch_ctx *ctx, size_t id, size_t field, uint64_t *mask)
+{
+	if (id >= ctx->num_teams) {
+		fprintf(stderr, "%s: id %lu out of range\n", __func__, id);
+		return -1;
+	}
+
+	if (tfl_get_type(ctx, field) != TEAM_FIELD_TAGS) {
+		fprintf(stderr, "%s: field id %lu is not a tag field\n", __func__, field);
+		return -2;
+	}
+
+	*mask = ((const uint64_t *) ctx->tfl[field].data)[id];
+	return 0;
+}
+
+
+/**
+ * Writes any field of a team as text
+ *
+ * Doubles are written with %g, integers exactly, booleans as "true" or
+ * "false" and tags space separated. Unset strings are written as "".
+ *
+ * @param id The team's id
+ * @param field The field's id
+ * @param buf Receives the text, truncated to fit
+ * @param len Size of buf
+ * @return The length of the whole text like snprintf(), or negative on error
+ */
+
+int team_get_text(const struct ncrunch_ctx *ctx, size_t id, size_t field, char *buf, size_t len)
+{
+	const struct tfl_entry *entry;
+	const char *str;
+
+	if (id >= ctx->num_teams || field >= ctx->num_fields) {
+		fprintf(stderr, "%s: team %lu field %lu out of range\n", __func__, id, field);
+		return -1;
+	}
+
+	entry = &ctx->tfl[field];
+
+	switch (entry->type) {
+	case TEAM_FIELD_STRING:
+		str = ((char **) entry->data)[id];
+		return snprintf(buf, len, "%s", str ? str : "");
+
+	case TEAM_FIELD_DOUBLE:
+		return snprintf(buf, len, "%g", _column_get(entry, id));
+
+	case TEAM_FIELD_INT32:
+	case TEAM_FIELD_UINT16:
+	case TEAM_FIELD_UINT8:
+		return snprintf(buf, len, "%ld", (long) _column_get(entry, id));
+
+	case TEAM_FIELD_BOOL:
+		return snprintf(buf, len, "%s", _column_get(entry, id) ? "true" : "false");
+
+	case TEAM_FIELD_TAGS:
+		return _format_tags(entry, ((const uint64_t *) entry->data)[id], buf, len);
+
+	default:
+		return -2;
+	}
+}
+
+
+
+/**
+ * Copies a numeric field out of every team into a contiguous column
+ *
+ * @param field The field's id
+ * @param column Receives one value per team, in team id order
+ * @return Negative on error
+ */
+
+int teams_get_column(const struct ncrunch_ctx *ctx, size_t field, double *column)
+{
+	const struct tfl_entry *entry;
+	size_t n = ctx->num_teams;
+	size_t i;
+
+	if (!tfl_type_numeric(tfl_get_type(ctx, field))) {
+		fprintf(stderr, "%s: field id %lu is not a numeric field\n", __func__, field);
+		return -1;
+	}
+
+	entry = &ctx->tfl[field];
+
+	/* one loop per type so that each one is a straight conversion */
+	switch (entry->type) {
+	case TEAM_FIELD_DOUBLE:
+		memcpy(column, entry->data, n * sizeof(double));
+		break;
+
+	case TEAM_FIELD_INT32:
+		for (i = 0; i < n; i++)
+			column[i] = ((const int32_t *) entry->data)[i];
+		break;
+
+	case TEAM_FIELD_UINT16:
+		for (i = 0; i < n; i++)
+			column[i] = ((const uint16_t *) entry->data)[i];
+		break;
+
+	default:
+		for (i = 0; i < n; i++)
+			column[i] = ((const uint8_t *) entry->data)[i];
+		break;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Copies a contiguous column into a numeric field of every team
+ *
+ * The field is widened first if any of the values don't fit its type.
+ *
+ * @param field The field's id
+ * @param column One value per team, in team id order
+ * @return Negative on error
+ */
+
+int teams_set_column(struct ncrunch_ctx *ctx, size_t field, const double *column)
+{
+	enum tfl_type type = tfl_get_type(ctx, field);
+	size_t i;
+
+	if (!tfl_type_numeric(type)) {
+		fprintf(stderr, "%s: field id %lu is not a numeric field\n", __func__, field);
+		return -1;
+	}
+
+	if (type == TEAM_FIELD_DOUBLE) {
+		memcpy(ctx->tfl[field].data, column, ctx->num_teams * sizeof(double));
+		return 0;
+	}
+
+	for (i = 0; i < ctx->num_teams; i++) {
+		if (!_fits(type, column[i]))
+			type = _widen(type, column[i]);
+	}
+
+	if (type != ctx->tfl[field].type && _convert_column(ctx, field, type) < 0)
+		return -2;
+
+	for (i = 0; i < ctx->num_teams; i++)
+		_column_put(&ctx->tfl[field], i, column[i]);
+
+	return 0;
+}
+
+
+/**
+ * Gives every team a new id: the team that had id order[i] gets id i
+ *
+ * Every column is moved along with the teams, so that teams which are
+ * looked at together can be put next to each other in memory. Anything
+ * else holding team ids (a game log, say) has to be remapped by the
+ * caller; team_get_row() still gives each team's place in the flatf.
+ *
+ * @param order A permutation of the team ids; anything else (an id out of
+ * range or given twice) is refused, and the context is left unchanged on
+ * any error
+ * @return Negative on error
+ */
+
+int teams_permute(struct ncrunch_ctx *ctx, const size_t *order)
+{
+	struct team *teams;
+	char **cols;
+	uint8_t *seen;
+	size_t n = ctx->num_teams;
+	size_t max = ctx->max_teams ? ctx->max_teams : 1;
+	size_t size;
+	size_t i, f;
+	int err = 0;
+
+	/* a repeated id would leave two teams sharing one string */
+	seen = calloc(n ? n : 1, 1);
+	if (!seen) {
+		fprintf(stderr, "%s: out of memory\n", __func__);
+		return -1;
+	}
+
+	for (i = 0; !err && i < n; i++) {
+		if (order[i] >= n) {
+			fprintf(stderr, "%s: id %lu out of range\n", __func__, order[i]);
+			err = -2;
+		} else if (seen[order[i]]) {
+			fprintf(stderr, "%s: id %lu given twice\n", __func__, order[i]);
+			err = -2;
+		} else {
+			seen[order[i]] = 1;
+		}
+	}
+
+	free(seen);
+	if (err)
+		return err;
+
+	/* every new column before any old one goes, so that running out of
+	 * memory leaves the context as it was */
+	teams = malloc(max * sizeof(struct team));
+	cols = calloc(ctx->num_fields ? ctx->num_fields : 1, sizeof(char *));
+
+	for (f = 0; teams && cols && !err && f < ctx->num_fields; f++) {
+		if (!ctx->tfl[f].data)
+			continue;
+
+		cols[f] = calloc(max, _type_size(ctx->tfl[f].type));
+		if (!cols[f])
+			err = -3;
+	}
+
+	if (!teams || !cols || err) {
+		fprintf(stderr, "%s: out of memory\n", __func__);
+		for (f = 0; cols && f < ctx->num_fields; f++)
+			free(cols[f]);
+		free(cols);
+		free(teams);
+		return -3;
+	}
+
+	for (i = 0; i < n; i++)
+		teams[i] = ctx->teams[order[i]];
+
+	for (f = 0; f < ctx->num_fields; f++) {
+		if (!cols[f])
+			continue;
+
+		size = _type_size(ctx->tfl[f].type);
+		for (i = 0; i < n; i++)
+			memcpy(cols[f] + i * size, (const char *) ctx->tfl[f].data + order[i] * size, size);
+
+		free(ctx->tfl[f].data);
+		ctx->tfl[f].data = cols[f];
+	}
+
+	free(cols);
+	free(ctx->teams);
+	ctx->teams = teams;
+	return 0;
+}
@@ -0,0 +1,305 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <ncrunch/games.h>
+#include <ncrunch/rating.h>
+#include <ncrunch/whatif.h>
+
+
+
+/* scenarios a worker takes at a time; their solves share each pass over
+ * the base factor */
+#define WHATIF_BATCH 16
+
+
+/**
+ * Shared by the worker threads; each takes the next batch of scenarios in
+ * turn
+ */
+
+struct whatif_state {
+	const struct rating *base;
+	struct whatif *scenarios;
+	size_t num_scenarios;
+	size_t max_games;	/* the most games in any scenario */
+	size_t next;
+	pthread_mutex_t lock;
+};
+
+
+/**
+ * A worker's scratch space, sized once for a full batch of the largest
+ * scenario
+ */
+
+struct whatif_work {
+	double *z;		/* num_teams rows of one column per game */
+	double *m;		/* I + U^T Z, max_games x max_games */
+	double *y;		/* U^T r0, then the solve of m against it */
+};
+
+
+static void _free_work(struct whatif_work *work)
+{
+	free(work->z);
+	free(work->m);
+	free(work->y);
+}
+
+
+static int _alloc_work(struct whatif_work *work, size_t n, size_t k)
+{
+	k = k ? k : 1;
+
+	work->z = malloc(WHATIF_BATCH * k * n * sizeof(double));
+	work->m = malloc(k * k * sizeof(double));
+	work->y = malloc(k * sizeof(double));
+
+	if (!work->z || !work->m || !work->y) {
+		_free_work(work);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * How much of a game's result goes into b, as a multiple of u
+ */
+
+static double _share(const struct game *game)
+{
+	if (game->home_score == game->away_score)
+		return 0.0;
+
+	return game->home_score > game->away_score ? 0.5 : -0.5;
+}
+
+
+/**
+ * Finishes one scenario once its columns of Z are solved
+ *
+ * @param z The scenario's first column; the rest follow it
+ * @param stride Columns in each row of z
+ * @return Negative on error
+ */
+
+static int _evaluate(const struct rating *base, struct whatif *sc, const double *z, size_t stride, struct whatif_work *work)
+{
+	const struct game *g;
+	size_t n = base->num_teams;
+	size_t k = sc->num_games;
+	double *r = sc->ratings;
+	double s;
+	size_t i, j, t;
+
+	/* r0 = r + Z s */
+	memcpy(r, base->ratings, n * sizeof(double));
+	for (i = 0; i < k; i++) {
+		s = _share(&sc->games[i]);
+		if (s == 0.0)
+			continue;
+
+		for (t = 0; t < n; t++)
+			r[t] += s * z[t * stride + i];
+	}
+
+	/* m = I + U^T Z, whose (i, j) is z_j[home_i] - z_j[away_i];
+	 * y = U^T r0 */
+	for (i = 0; i < k; i++) {
+		g = &sc->games[i];
+
+		for (j = 0; j <= i; j++) {
+			work->m[i * k + j] = z[g->home * stride + j] - z[g->away * stride + j] +
+				(i == j ? 1.0 : 0.0);
+		}
+
+		work->y[i] = r[g->home] - r[g->away];
+	}
+
+	if (k && rating_cholesky(work->m, k) < 0)
+		return -2;
+
+	rating_cholesky_solve(work->m, k, work->y);
+
+	/* r' = r0 - Z y */
+	for (t = 0; t < n; t++) {
+		for (i = 0; i < k; i++)
+			r[t] -= work->y[i] * z[t * stride + i];
+	}
+
+	return 0;
+}
+
+
+/**
+ * Evaluates a batch of scenarios, solving for all of their columns of Z in
+ * one pass over the base factor
+ */
+
+static void _evaluate_batch(const struct rating *base, struct whatif *batch, size_t count, struct whatif_work *work)
+{
+	const struct game *g;
+	size_t n = base->num_teams;
+	size_t cols = 0;
+	size_t col;
+	size_t b, i;
+
+	for (b = 0; b < count; b++) {
+		batch[b].err = 0;
+
+		for (i = 0; i < batch[b].num_games; i++) {
+			g = &batch[b].games[i];
+			if (g->home >= n || g->away >= n || g->home == g->away)
+				batch[b].err = -1;
+		}
+
+		if (batch[b].err == 0)
+			cols += batch[b].num_games;
+	}
+
+	/* z_i = C^-1 u_i */
+	memset(work->z, 0, n * cols * sizeof(double));
+	for (b = 0, col = 0; b < count; b++) {
+		if (batch[b].err < 0)
+			continue;
+
+		for (i = 0; i < batch[b].num_games; i++, col++) {
+			g = &batch[b].games[i];
+			work->z[g->home * cols + col] = 1.0;
+			work->z[g->away * cols + col] = -1.0;
+		}
+	}
+
+	if (cols)
+		rating_cholesky_solve_many(base->factor, n, work->z, cols);
+
+	for (b = 0, col = 0; b < count; b++) {
+		if (batch[b].err < 0)
+			continue;
+
+		batch[b].err = _evaluate(base, &batch[b], &work->z[col], cols, work);
+		col += batch[b].num_games;
+	}
+}
+
+
+static void *_worker(void *arg)
+{
+	struct whatif_state *state = arg;
+	struct whatif_work work;
+	struct whatif *batch;
+	size_t count;
+	size_t i;
+	int err;
+
+	err = _alloc_work(&work, state->base->num_teams, state->max_games);
+
+	for (;;) {
+		pthread_mutex_lock(&state->lock);
+		batch = &state->scenarios[state->next];
+		count = state->num_scenarios - state->next;
+		if (count > WHATIF_BATCH)
+			count = WHATIF_BATCH;
+		state->next += count;
+		pthread_mutex_unlock(&state->lock);
+
+		if (!count)
+			break;
+
+		if (err < 0) {
+			for (i = 0; i < count; i++)
+				batch[i].err = -3;
+			continue;
+		}
+
+		_evaluate_batch(state->base, batch, count, &work);
+	}
+
+	if (err == 0)
+		_free_work(&work);
+
+	return NULL;
+}
+
+
+/**
+ * Computes the ratings for a batch of scenarios against a base Colley solve
+ *
+ * Scenarios are handed out to the workers WHATIF_BATCH at a time, and the
+ * C^-1 u solves for a whole batch are done together, so that the base
+ * factor is read once per batch rather than twice per game.
+ *
+ * A scenario that names a bad team, or whose games leave the update
+ * singular, gets a negative err and its ratings are left undefined; the
+ * others are unaffected.
+ *
+ * @param threads Worker threads; 0 for one per CPU
+ * @return The number of scenarios that failed, or negative on error
+ */
+
+int whatif_run(const struct rating *base, struct whatif *scenarios, size_t num_scenarios, size_t threads)
+{
+	struct whatif_state state;
+	pthread_t *workers;
+	size_t num_workers = 0;
+	int failed = 0;
+	long ncpu;
+	size_t i;
+
+	if (!num_scenarios)
+		return 0;
+
+	if (!threads) {
+		ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = ncpu > 0 ? ncpu : 1;
+	}
+
+	if (threads > num_scenarios)
+		threads = num_scenarios;
+
+	memset(&state, 0, sizeof(struct whatif_state));
+	state.base = base;
+	state.scenarios = scenarios;
+	state.num_scenarios = num_scenarios;
+
+	for (i = 0; i < num_scenarios; i++) {
+		if (scenarios[i].num_games > state.max_games)
+			state.max_games = scenarios[i].num_games;
+	}
+
+	workers = malloc(threads * sizeof(pthread_t));
+	if (!workers)
+		return -1;
+
+	pthread_mutex_init(&state.lock, NULL);
+
+	for (i = 0; i < threads; i++) {
+		if (pthread_create(&workers[num_workers], NULL, _worker, &state) == 0)
+			num_workers++;
+	}
+
+	/* no threads at all; do the work here */
+	if (!num_workers)
+		_worker(&state);
+
+	for (i = 0; i < num_workers; i++)
+		pthread_join(workers[i], NULL);
+
+	pthread_mutex_destroy(&state.lock);
+	free(workers);
+
+	for (i = 0; i < num_scenarios; i++) {
+		if (scenarios[i].err < 0) {
+			fprintf(stderr, "%s: scenario %lu failed (%d)\n", __func__, i, scenarios[i].err);
+			failed++;
+		}
+	}
+
+	return failed;
+}